@@ -51,6 +51,15 @@
 */
 /* #define FZ_ENABLE_JS 1 */
 
+/*
+	Choose whether to decode flate streams that are wholly in
+	memory with the built-in one-shot inflater rather than with
+	zlib. The two give identical results; zlib is still used for
+	streaming input, and whenever the one-shot inflater finds
+	something it does not like.
+*/
+/* #define FZ_ENABLE_FAST_INFLATE 1 */
+
 /*
 	Choose which fonts to include.
 	By default we include the base 14 PDF fonts,
@@ -160,6 +169,10 @@
 #define FZ_ENABLE_ICC 1
 #endif /* FZ_ENABLE_ICC */
 
+#ifndef FZ_ENABLE_FAST_INFLATE
+#define FZ_ENABLE_FAST_INFLATE 1
+#endif /* FZ_ENABLE_FAST_INFLATE */
+
 /* If Epub and HTML are both disabled, disable SIL fonts */
 #if FZ_ENABLE_HTML == 0 && FZ_ENABLE_EPUB == 0
 #undef TOFU_SIL
@@ -239,6 +239,49 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/*
+	A job is one independent piece of a larger operation, run with
+	a context of its own.
+
+	ctx: The context to use for running the job. This may be a clone
+	of the context that issued the job.
+
+	job: The job specific data.
+*/
+typedef void (fz_job_fn)(fz_context *ctx, void *job);
+
+/*
+	Some expensive operations (such as compressing streams when
+	saving PDF files) can be split into independent jobs. MuPDF does
+	not create threads itself, so callers who want such jobs to be
+	run in parallel supply a function to do so.
+
+	arg: The caller supplied opaque argument.
+
+	ctx: The context of the thread issuing the jobs.
+
+	count: The number of jobs.
+
+	fn: The function to call for each job. fn never throws.
+
+	jobs: The array of job specific data.
+
+	The function must call fn once for each of jobs[0..count-1] and
+	not return until all of the calls have completed. Calls may be
+	made on other threads, using contexts cloned from ctx, or on the
+	calling thread using ctx itself. The function may be called from
+	several threads at once, and from within jobs, so it must be
+	prepared to run jobs on the calling thread when its workers are
+	already busy.
+*/
+typedef void (fz_run_jobs_fn)(void *arg, fz_context *ctx, int count, fz_job_fn *fn, void **jobs);
+
+void fz_set_job_runner(fz_context *ctx, fz_run_jobs_fn *run_jobs, void *arg, int threads);
+
+int fz_job_threads(fz_context *ctx);
+
+void fz_run_jobs(fz_context *ctx, int count, fz_job_fn *fn, void **jobs);
+
 int fz_aa_level(fz_context *ctx);
 
 void fz_set_aa_level(fz_context *ctx, int bits);
@@ -283,6 +283,7 @@ struct fz_draw_options_s
 	int alpha;
 	int graphics;
 	int text;
+	int band_height;
 };
 
 extern const char *fz_draw_options_usage;
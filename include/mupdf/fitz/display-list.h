@@ -39,4 +39,8 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list);
+
+void fz_predecode_display_list_images(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area);
+
 #endif
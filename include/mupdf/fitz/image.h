@@ -132,6 +132,7 @@ struct fz_image_s
 
 fz_pixmap *fz_load_jpeg(fz_context *ctx, const unsigned char *data, size_t size);
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
+fz_pixmap *fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, fz_irect *subarea, int *l2factor);
 fz_pixmap *fz_load_png(fz_context *ctx, const unsigned char *data, size_t size);
 fz_pixmap *fz_load_tiff(fz_context *ctx, const unsigned char *data, size_t size);
 fz_pixmap *fz_load_jxr(fz_context *ctx, const unsigned char *data, size_t size);
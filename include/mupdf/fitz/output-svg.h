@@ -11,8 +11,13 @@ enum {
 	FZ_SVG_TEXT_AS_TEXT = 1,
 };
 
-fz_device *fz_new_svg_device(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse_images);
+enum {
+	FZ_SVG_REUSE_IMAGES = 1,
+	FZ_SVG_REUSE_PATHS = 2,
+};
+
+fz_device *fz_new_svg_device(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse);
 
-fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse_images, int *id);
+fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse, int *id);
 
 #endif
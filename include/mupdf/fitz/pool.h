@@ -10,6 +10,7 @@ fz_pool *fz_new_pool(fz_context *ctx);
 void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size);
 char *fz_pool_strdup(fz_context *ctx, fz_pool *pool, const char *s);
 size_t fz_pool_size(fz_context *ctx, fz_pool *pool);
+void fz_reset_pool(fz_context *ctx, fz_pool *pool);
 void fz_drop_pool(fz_context *ctx, fz_pool *pool);
 
 #endif
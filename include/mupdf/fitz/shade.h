@@ -29,7 +29,7 @@ enum
 */
 typedef struct fz_shade_s
 {
-	fz_storable storable;
+	fz_key_storable key_storable;
 
 	fz_rect bbox;		/* can be fz_infinite_rect */
 	fz_colorspace *colorspace;
@@ -81,6 +81,9 @@ typedef struct fz_shade_s
 fz_shade *fz_keep_shade(fz_context *ctx, fz_shade *shade);
 void fz_drop_shade(fz_context *ctx, fz_shade *shade);
 
+fz_shade *fz_keep_shade_store_key(fz_context *ctx, fz_shade *shade);
+void fz_drop_shade_store_key(fz_context *ctx, fz_shade *shade);
+
 void fz_drop_shade_imp(fz_context *ctx, fz_storable *shade);
 
 fz_rect fz_bound_shade(fz_context *ctx, fz_shade *shade, fz_matrix ctm);
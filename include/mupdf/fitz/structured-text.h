@@ -87,6 +87,9 @@ enum
 
 /*
 	A text page is a list of blocks, together with an overall bounding box.
+
+	The text device stores the chars of each line in one array, so
+	walking a line is sequential in memory.
 */
 struct fz_stext_page_s
 {
@@ -117,6 +120,13 @@ struct fz_stext_block_s
 
 /*
 	A text line is a list of characters that share a common baseline.
+
+	Once a line is complete, the text device also stores its len chars
+	as one array starting at first_char, with side tables of their
+	codepoints (text) and the middles of their quads (center), so
+	searching, copying and hit testing can scan the line without
+	touching the chars themselves. text and center are NULL for an
+	empty line.
 */
 struct fz_stext_line_s
 {
@@ -124,6 +134,9 @@ struct fz_stext_line_s
 	fz_point dir; /* normalized direction of baseline */
 	fz_rect bbox;
 	fz_stext_char *first_char, *last_char;
+	int len;
+	int *text;
+	fz_point *center;
 	fz_stext_line *prev, *next;
 };
 
@@ -161,6 +174,17 @@ void fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page
 
 int fz_search_stext_page(fz_context *ctx, fz_stext_page *text, const char *needle, fz_quad *quads, int max_quads);
 
+/*
+	fz_stext_search: A set of needles compiled for searching any number
+	of structured text pages in one linear pass each. Searching does
+	not modify it, so one search may be run from several threads.
+*/
+typedef struct fz_stext_search_s fz_stext_search;
+
+fz_stext_search *fz_new_stext_search(fz_context *ctx, const char **needles, int count);
+void fz_drop_stext_search(fz_context *ctx, fz_stext_search *search);
+int fz_run_stext_search(fz_context *ctx, fz_stext_search *search, fz_stext_page *page, fz_quad *quads, int *marks, int max_quads);
+
 int fz_highlight_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_point b, fz_quad *quads, int max_quads);
 
 enum
@@ -188,4 +212,8 @@ fz_stext_options *fz_parse_stext_options(fz_context *ctx, fz_stext_options *opts
 
 fz_device *fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options *options);
 
+typedef void (fz_stext_block_fn)(fz_context *ctx, void *arg, fz_stext_block *block);
+
+fz_device *fz_new_stext_stream_device(fz_context *ctx, const fz_stext_options *options, fz_stext_block_fn *fn, void *arg);
+
 #endif
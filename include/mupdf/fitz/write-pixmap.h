@@ -9,6 +9,8 @@
 #include "mupdf/fitz/bitmap.h"
 #include "mupdf/fitz/buffer.h"
 #include "mupdf/fitz/image.h"
+#include "mupdf/fitz/device.h"
+#include "mupdf/fitz/display-list.h"
 
 /*
 	PCL output
@@ -162,4 +164,6 @@ fz_band_writer *fz_new_pwg_band_writer(fz_context *ctx, fz_output *out, const fz
 
 void fz_write_pwg_file_header(fz_context *ctx, fz_output *out); /* for use by mudraw.c */
 
+void fz_write_display_list_as_bands(fz_context *ctx, fz_band_writer *writer, fz_display_list *list, const fz_draw_options *options, int pagenum);
+
 #endif
@@ -6,6 +6,7 @@
 #include "mupdf/fitz/output.h"
 #include "mupdf/fitz/document.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/band-writer.h"
 
 typedef struct fz_document_writer_s fz_document_writer;
 
@@ -105,6 +106,7 @@ fz_document_writer *fz_new_pgm_pixmap_writer(fz_context *ctx, const char *path,
 fz_document_writer *fz_new_ppm_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_pbm_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_pkm_pixmap_writer(fz_context *ctx, const char *path, const char *options);
+fz_document_writer *fz_new_psd_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 
 fz_device *fz_begin_page(fz_context *ctx, fz_document_writer *wri, fz_rect mediabox);
 
@@ -117,6 +119,16 @@ void fz_drop_document_writer(fz_context *ctx, fz_document_writer *wri);
 fz_document_writer *fz_new_pixmap_writer(fz_context *ctx, const char *path, const char *options, const char *default_path, int n,
 	void (*save)(fz_context *ctx, fz_pixmap *pix, const char *filename));
 
+/*
+	As fz_new_pixmap_writer, but when the "band-height" option is given
+	pages are recorded to a display list and rendered in bands of that
+	many rows into the band writer made by new_band_writer, instead of
+	rendering the whole page into one pixmap and calling save.
+*/
+fz_document_writer *fz_new_banded_pixmap_writer(fz_context *ctx, const char *path, const char *options, const char *default_path, int n,
+	void (*save)(fz_context *ctx, fz_pixmap *pix, const char *filename),
+	fz_band_writer *(*new_band_writer)(fz_context *ctx, fz_output *out));
+
 extern const char *fz_pdf_write_options_usage;
 extern const char *fz_svg_write_options_usage;
 
@@ -0,0 +1,39 @@
+#ifndef MUPDF_HELPERS_MU_JOBS_H
+#define MUPDF_HELPERS_MU_JOBS_H
+
+/*
+	Simple worker pool for running MuPDF jobs (see
+	fz_set_job_runner) on several threads, built on top of
+	the mu-threads helper library.
+
+	In builds without threading support the pool cannot be
+	created, and jobs will keep running on the calling thread.
+*/
+
+#include "mupdf/fitz.h"
+
+typedef struct mu_job_pool_s mu_job_pool;
+
+/*
+	Create a pool of worker threads and
+	install it as the job runner for ctx.
+
+	ctx: The context to run jobs for. It must have been created
+	with locks, as each worker runs jobs with a clone of it.
+
+	threads: The total number of threads to run jobs on, including
+	the thread that issues them. Values less than 2 create no
+	pool at all.
+
+	Returns NULL (and leaves ctx untouched) if no pool was created.
+*/
+mu_job_pool *mu_new_job_pool(fz_context *ctx, int threads);
+
+/*
+	Uninstall the pool as the job runner
+	for ctx, shut down its worker threads and free it. Must not be
+	called while jobs are running.
+*/
+void mu_drop_job_pool(fz_context *ctx, mu_job_pool *pool);
+
+#endif /* MUPDF_HELPERS_MU_JOBS_H */
@@ -50,6 +50,10 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+pdf_document *pdf_open_document_lazily(fz_context *ctx, const char *filename);
+
+void pdf_load_deferred_xref(fz_context *ctx, pdf_document *doc);
+
 void pdf_drop_document(fz_context *ctx, pdf_document *doc);
 
 pdf_document *pdf_keep_document(fz_context *ctx, pdf_document *doc);
@@ -220,6 +224,7 @@ struct pdf_document_s
 	pdf_xref *saved_xref_sections;
 	int *xref_index;
 	int save_in_progress;
+	int evicted_from, evicted_to; /* objects written out and dropped by a streaming save */
 	int has_xref_streams;
 	int has_old_style_xrefs;
 	int has_linearization_object;
@@ -242,6 +247,10 @@ struct pdf_document_s
 	int64_t linear_pos;
 	int linear_page_num;
 
+	/* Offset of the main xref section of a linearized file opened
+	 * with pdf_open_document_lazily, until it has been read. */
+	int64_t deferred_xref_ofs;
+
 	int hint_object_offset;
 	int hint_object_length;
 	int hints_loaded; /* Set to 1 after the hints loading has completed,
@@ -276,6 +285,9 @@ struct pdf_document_s
 	int dirty;
 	int redacted;
 
+	int cache_contents;
+	int edit_count; /* bumped on every change to the objects */
+
 	pdf_doc_event_cb *event_cb;
 	void *event_cb_data;
 
@@ -341,6 +353,7 @@ struct pdf_write_options_s
 	int do_clean; /* Clean content streams. */
 	int do_sanitize; /* Sanitize content streams. */
 	int do_appearance; /* (Re)create appearance streams. */
+	int do_stream; /* Write objects out as they are completed (see pdf_new_streaming_save). */
 	int do_encrypt; /* Encryption method to use: keep, none, rc4-40, etc. */
 	int permissions; /* Document encryption permissions. */
 	char opwd_utf8[128]; /* Owner password. */
@@ -357,6 +370,18 @@ void pdf_write_document(fz_context *ctx, pdf_document *doc, fz_output *out, pdf_
 
 void pdf_save_document(fz_context *ctx, pdf_document *doc, const char *filename, pdf_write_options *opts);
 
+typedef struct pdf_streaming_save_s pdf_streaming_save;
+
+pdf_streaming_save *pdf_new_streaming_save(fz_context *ctx, pdf_document *doc, fz_output *out, pdf_write_options *opts);
+
+void pdf_flush_streaming_save(fz_context *ctx, pdf_streaming_save *save);
+
+void pdf_add_streaming_page(fz_context *ctx, pdf_streaming_save *save, pdf_obj *page);
+
+void pdf_close_streaming_save(fz_context *ctx, pdf_streaming_save *save);
+
+void pdf_drop_streaming_save(fz_context *ctx, pdf_streaming_save *save);
+
 char *pdf_format_write_options(fz_context *ctx, char *buffer, size_t buffer_len, const pdf_write_options *opts);
 
 int pdf_can_be_saved_incrementally(fz_context *ctx, pdf_document *doc);
@@ -7,6 +7,7 @@
 typedef struct pdf_csi_s pdf_csi;
 typedef struct pdf_gstate_s pdf_gstate;
 typedef struct pdf_processor_s pdf_processor;
+typedef struct pdf_recording_s pdf_recording;
 
 void *pdf_new_processor(fz_context *ctx, int size);
 void pdf_close_processor(fz_context *ctx, pdf_processor *proc);
@@ -161,6 +162,10 @@ struct pdf_csi_s
 	size_t string_len;
 	int top;
 	float stack[32];
+
+	/* operators of a cacheable content stream */
+	pdf_recording *recording;
+	pdf_obj *resource;
 };
 
 /* Functions to set up pdf_process structures */
@@ -216,6 +221,15 @@ pdf_processor *pdf_new_filter_processor(fz_context *ctx, pdf_document *doc, pdf_
 pdf_obj *pdf_filter_xobject_instance(fz_context *ctx, pdf_obj *old_xobj, pdf_obj *page_res, fz_matrix ctm, pdf_filter_options *filter);
 
 void pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *obj, pdf_obj *res, fz_cookie *cookie);
+
+/*
+	pdf_enable_content_cache: Keep the lexed operators of page content
+	streams in the store, so that processing the same page again does
+	not need to decompress and lex its contents. Useful for viewers that
+	render pages repeatedly without keeping display lists. Form XObjects
+	and tiling patterns are always cached.
+*/
+void pdf_enable_content_cache(fz_context *ctx, pdf_document *doc, int enable);
 void pdf_process_annot(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_page *page, pdf_annot *annot, fz_cookie *cookie);
 void pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *resources, fz_buffer *contents);
 
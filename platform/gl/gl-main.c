@@ -1277,6 +1277,8 @@ static void load_document(void)
 	pdf = pdf_specifics(ctx, doc);
 	if (pdf)
 	{
+		/* pages are run again for every zoom and scroll change */
+		pdf_enable_content_cache(ctx, pdf, 1);
 		if (enable_js)
 		{
 			trace_action("doc.enableJS();\n");
@@ -400,6 +400,12 @@ static int make_fake_doc(pdfapp_t *app)
 	return 0;
 }
 
+static int has_pdf_extension(const char *filename)
+{
+	const char *ext = strrchr(filename, '.');
+	return ext && !fz_strcasecmp(ext, ".pdf");
+}
+
 void pdfapp_open_progressive(pdfapp_t *app, char *filename, int reload, int kbps)
 {
 	fz_context *ctx = app->ctx;
@@ -503,7 +509,12 @@ void pdfapp_open_progressive(pdfapp_t *app, char *filename, int reload, int kbps
 				}
 			}
 
-			app->doc = fz_open_accelerated_document(ctx, filename, accel);
+			/* Local linearized PDF files can show their first page
+			 * before the whole xref has been read. */
+			if (!accel && has_pdf_extension(filename))
+				app->doc = &pdf_open_document_lazily(ctx, filename)->super;
+			else
+				app->doc = fz_open_accelerated_document(ctx, filename, accel);
 		}
 	}
 	fz_catch(ctx)
@@ -2064,10 +2075,22 @@ void pdfapp_oncopy(pdfapp_t *app, unsigned short *ucsbuf, int ucslen)
 
 void pdfapp_postblit(pdfapp_t *app)
 {
+	pdf_document *idoc;
 	clock_t time;
 	float seconds;
 	int llama;
 
+	/* Now that a page is on screen, finish reading the xref of a
+	 * lazily opened file so that later page turns do not pause. */
+	idoc = pdf_specifics(app->ctx, app->doc);
+	if (idoc)
+	{
+		fz_try(app->ctx)
+			pdf_load_deferred_xref(app->ctx, idoc);
+		fz_catch(app->ctx)
+			pdfapp_warn(app, "cannot load cross reference table");
+	}
+
 	app->transitions_enabled = 1;
 	if (!app->in_transit)
 		return;
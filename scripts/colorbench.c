@@ -0,0 +1,148 @@
+/* colorbench.c -- time the fast pixmap color converters */
+
+/*
+	Converts a pixmap of random samples between each pair of the
+	device gray, rgb, bgr and cmyk colorspaces with
+	fz_convert_fast_pixmap_samples, with and without alpha, and
+	prints the best rate over a number of runs in MPixel/s.
+
+	Each line also has a checksum of the converted samples, so the
+	output of two builds can be compared: the rates should go up,
+	and the checksums must not change.
+
+	The -p option gives the pixmaps padded rows, to time (and check)
+	the row by row paths as well.
+
+	usage: colorbench [-p] [-w width] [-h height] [-r runs]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mupdf/fitz.h"
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned int checksum(fz_context *ctx, fz_pixmap *pix)
+{
+	unsigned int h = 2166136261u;
+	int x, y, n = fz_pixmap_width(ctx, pix) * fz_pixmap_components(ctx, pix);
+	unsigned char *s = fz_pixmap_samples(ctx, pix);
+	int stride = fz_pixmap_stride(ctx, pix);
+
+	for (y = 0; y < fz_pixmap_height(ctx, pix); y++, s += stride)
+		for (x = 0; x < n; x++)
+			h = (h ^ s[x]) * 16777619u;
+	return h;
+}
+
+static fz_pixmap *new_pixmap(fz_context *ctx, fz_colorspace *cs, int w, int h, int alpha, int pad)
+{
+	fz_pixmap *big, *pix;
+	fz_irect area = { 0, 0, w, h };
+
+	if (!pad)
+		return fz_new_pixmap(ctx, cs, w, h, NULL, alpha);
+	/* The left part of a wider pixmap has padded rows. */
+	big = fz_new_pixmap(ctx, cs, w + pad, h, NULL, alpha);
+	pix = fz_new_pixmap_from_pixmap(ctx, big, &area);
+	fz_drop_pixmap(ctx, big);
+	return pix;
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_colorspace *spaces[4];
+	const char *names[4] = { "gray", "rgb", "bgr", "cmyk" };
+	int w = 2001, h = 1000, runs = 10, pad = 0;
+	int i, j, a, r, c;
+	unsigned int seed = 1;
+
+	while ((c = fz_getopt(argc, argv, "pw:h:r:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p': pad = 3; break;
+		case 'w': w = atoi(fz_optarg); break;
+		case 'h': h = atoi(fz_optarg); break;
+		case 'r': runs = atoi(fz_optarg); break;
+		default:
+			fprintf(stderr, "usage: colorbench [-p] [-w width] [-h height] [-r runs]\n");
+			return 1;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create context\n");
+		return 1;
+	}
+
+	spaces[0] = fz_device_gray(ctx);
+	spaces[1] = fz_device_rgb(ctx);
+	spaces[2] = fz_device_bgr(ctx);
+	spaces[3] = fz_device_cmyk(ctx);
+
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 4; j++)
+		{
+			if (i == j)
+				continue;
+			for (a = 0; a < 2; a++)
+			{
+				fz_pixmap *src = new_pixmap(ctx, spaces[i], w, h, a, pad);
+				fz_pixmap *dst = new_pixmap(ctx, spaces[j], w, h, a, pad);
+				unsigned char *s = fz_pixmap_samples(ctx, src);
+				size_t k, len = (size_t)fz_pixmap_stride(ctx, src) * (h - 1) + (size_t)w * fz_pixmap_components(ctx, src);
+				double best = 0;
+
+				for (k = 0; k < len; k++)
+				{
+					seed = seed * 1103515245 + 12345;
+					s[k] = seed >> 16;
+				}
+				/* Keep premultiplied samples within their alpha. */
+				if (a)
+				{
+					int x, y, n = fz_pixmap_components(ctx, src);
+					for (y = 0; y < h; y++)
+					{
+						unsigned char *p = s + (size_t)y * fz_pixmap_stride(ctx, src);
+						for (x = 0; x < w; x++, p += n)
+							for (k = 0; k < (size_t)n - 1; k++)
+								p[k] = fz_mul255(p[k], p[n - 1]);
+					}
+				}
+
+				for (r = 0; r < runs; r++)
+				{
+					double t = now();
+					fz_convert_fast_pixmap_samples(ctx, src, dst, 1);
+					t = now() - t;
+					if (r == 0 || t < best)
+						best = t;
+				}
+
+				printf("%-4s to %-4s%s %8.1f MPixel/s  %08x\n", names[i], names[j], a ? " +alpha" : "       ",
+					(double)w * h / best / 1e6, checksum(ctx, dst));
+
+				fz_drop_pixmap(ctx, src);
+				fz_drop_pixmap(ctx, dst);
+			}
+		}
+	}
+
+	fz_drop_context(ctx);
+	return 0;
+}
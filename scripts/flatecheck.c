@@ -0,0 +1,330 @@
+/* flatecheck.c -- check that the one-shot inflater agrees with zlib */
+
+/*
+	Compresses random data (or the contents of the given files) with
+	zlib at assorted levels, strategies and window sizes, damages
+	some of the results by truncating them, flipping bits or
+	appending junk, and then decodes each one twice with
+	fz_open_flated: once from a memory stream, which lets the
+	one-shot inflater take it, and once from a stream that hands
+	zlib the same bytes in the same single chunk. The decoded data,
+	the warnings, whether an error was thrown and how much input was
+	consumed must all match.
+	Each given file is also decoded as it stands, so a corpus of
+	zlib streams extracted from PDF files can be checked directly.
+
+	usage: flatecheck [-s seed] [-n count] [file ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "mupdf/fitz.h"
+
+static unsigned int seed = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return n ? ((seed >> 8) & 0xffffff) % n : 0;
+}
+
+/*
+	Opaque stream: hands out the whole of the source data in one go,
+	just as a memory stream would, but is not recognisably one, so
+	the flate filter does not try its one-shot inflater on it.
+*/
+
+struct opaque
+{
+	const unsigned char *data;
+	size_t len;
+	int done;
+};
+
+static int next_opaque(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	struct opaque *o = stm->state;
+	if (o->done || o->len == 0)
+		return EOF;
+	o->done = 1;
+	stm->rp = (unsigned char *)o->data;
+	stm->wp = stm->rp + o->len;
+	stm->pos += o->len;
+	return *stm->rp++;
+}
+
+struct result
+{
+	fz_buffer *out;
+	fz_buffer *warnings;
+	int failed;
+	int64_t used;
+};
+
+static fz_buffer *warnings_sink;
+static fz_context *warnings_ctx;
+
+static void collect_warning(void *user, const char *message)
+{
+	fz_append_string(warnings_ctx, warnings_sink, message);
+	fz_append_byte(warnings_ctx, warnings_sink, '\n');
+}
+
+static void ignore_error(void *user, const char *message)
+{
+}
+
+static void decode(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, int opaque, struct result *r)
+{
+	struct opaque o;
+	fz_stream *chain = NULL;
+	fz_stream *stm = NULL;
+
+	r->out = NULL;
+	r->failed = 0;
+	r->used = 0;
+	r->warnings = fz_new_buffer(ctx, 64);
+	warnings_sink = r->warnings;
+	warnings_ctx = ctx;
+	fz_set_warning_callback(ctx, collect_warning, NULL);
+
+	fz_var(chain);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		if (opaque)
+		{
+			o.data = data;
+			o.len = len;
+			o.done = 0;
+			chain = fz_new_stream(ctx, &o, next_opaque, NULL);
+		}
+		else
+			chain = fz_open_memory(ctx, data, len);
+		stm = fz_open_flated(ctx, chain, window_bits);
+		r->out = fz_read_all(ctx, stm, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		if (chain)
+			r->used = fz_tell(ctx, chain);
+		fz_drop_stream(ctx, chain);
+	}
+	fz_catch(ctx)
+		r->failed = 1;
+
+	fz_flush_warnings(ctx);
+	fz_set_warning_callback(ctx, NULL, NULL);
+}
+
+static size_t length(fz_context *ctx, fz_buffer *buf)
+{
+	unsigned char *data;
+	return buf ? fz_buffer_storage(ctx, buf, &data) : 0;
+}
+
+static int same(fz_context *ctx, fz_buffer *a, fz_buffer *b)
+{
+	unsigned char *pa, *pb;
+	size_t na = a ? fz_buffer_storage(ctx, a, &pa) : 0;
+	size_t nb = b ? fz_buffer_storage(ctx, b, &pb) : 0;
+	return na == nb && (na == 0 || !memcmp(pa, pb, na));
+}
+
+static unsigned char *make_data(size_t *lenp)
+{
+	static const size_t sizes[] = { 0, 1, 2, 10, 100, 1000, 5000, 70000, 300000, 2000000 };
+	static const char *words[] = { "q ", "Q\n", "1 0 0 1 ", "cm ", "BT /F1 12 Tf ", "(Hello) Tj ", "ET\n", "0 0 m ", "re f\n" };
+	size_t len = sizes[rnd(nelem(sizes))];
+	unsigned char *data = malloc(len + 1);
+	int kind = rnd(5);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		switch (kind)
+		{
+		case 0: data[i] = rnd(256); break;
+		case 1: data[i] = rnd(4); break;
+		case 2: data[i] = (unsigned char)(i * 7 / 5); break;
+		case 3: data[i] = len & 255; break;
+		default:
+			{
+				const char *w = words[rnd(nelem(words))];
+				while (*w && i < len)
+					data[i++] = *w++;
+				i--;
+			}
+			break;
+		}
+	}
+	*lenp = len;
+	return data;
+}
+
+static unsigned char *compress_data(const unsigned char *data, size_t len, int window_bits, size_t *lenp)
+{
+	static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+	z_stream z;
+	size_t cap = deflateBound(NULL, len) + 1024 + len / 8;
+	unsigned char *out = malloc(cap);
+	size_t half = rnd(2) ? rnd(len + 1) : len;
+
+	memset(&z, 0, sizeof z);
+	if (deflateInit2(&z, rnd(10), Z_DEFLATED, window_bits, 1 + rnd(9), strategies[rnd(nelem(strategies))]) != Z_OK)
+	{
+		fprintf(stderr, "deflateInit2 failed\n");
+		exit(1);
+	}
+	z.next_out = out;
+	z.avail_out = cap;
+
+	/* Sometimes split the input with a full flush, to get stored and empty blocks mid-stream. */
+	z.next_in = (unsigned char *)data;
+	z.avail_in = half;
+	deflate(&z, half < len ? Z_FULL_FLUSH : Z_NO_FLUSH);
+	z.avail_in = len - half;
+	deflate(&z, Z_FINISH);
+	*lenp = z.total_out;
+	deflateEnd(&z);
+
+	switch (rnd(10))
+	{
+	case 0:
+		if (*lenp > 0)
+			*lenp = rnd(*lenp);
+		break;
+	case 1:
+		if (*lenp > 0)
+		{
+			int i, k = 1 + rnd(4);
+			for (i = 0; i < k; i++)
+				out[rnd(*lenp)] ^= 1 << rnd(8);
+		}
+		break;
+	case 2:
+		{
+			int i, k = 1 + rnd(20);
+			for (i = 0; i < k && *lenp < cap; i++)
+				out[(*lenp)++] = rnd(256);
+		}
+		break;
+	}
+
+	return out;
+}
+
+static int check(fz_context *ctx, const unsigned char *data, size_t len, int window_bits, const char *name)
+{
+	struct result a, b;
+	int ok;
+
+	decode(ctx, data, len, window_bits, 0, &a);
+	decode(ctx, data, len, window_bits, 1, &b);
+
+	ok = a.failed == b.failed && a.used == b.used && same(ctx, a.out, b.out) && same(ctx, a.warnings, b.warnings);
+	if (!ok)
+	{
+		fprintf(stderr, "mismatch: %s (window %d, %zu bytes): failed %d/%d, used %lld/%lld, output %zu/%zu\n",
+			name, window_bits, len, a.failed, b.failed, (long long)a.used, (long long)b.used,
+			length(ctx, a.out), length(ctx, b.out));
+	}
+
+	fz_drop_buffer(ctx, a.out);
+	fz_drop_buffer(ctx, a.warnings);
+	fz_drop_buffer(ctx, b.out);
+	fz_drop_buffer(ctx, b.warnings);
+	return ok;
+}
+
+static int check_data(fz_context *ctx, const unsigned char *data, size_t len, const char *name)
+{
+	static const int windows[] = { 15, 15, 15, 9, 12 };
+	int window_bits = windows[rnd(nelem(windows))];
+	int raw = rnd(10) < 3;
+	unsigned char *comp;
+	size_t comp_len;
+	int ok;
+
+	comp = compress_data(data, len, raw ? -window_bits : window_bits, &comp_len);
+	ok = check(ctx, comp, comp_len, raw ? -15 : 15, name);
+	free(comp);
+	return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int count = 300;
+	int failures = 0;
+	int total = 0;
+	int i, c;
+
+	while ((c = fz_getopt(argc, argv, "s:n:")) != -1)
+	{
+		switch (c)
+		{
+		case 's': seed = atoi(fz_optarg); break;
+		case 'n': count = atoi(fz_optarg); break;
+		default:
+			fprintf(stderr, "usage: flatecheck [-s seed] [-n count] [file ...]\n");
+			return 1;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create context\n");
+		return 1;
+	}
+	fz_set_error_callback(ctx, ignore_error, NULL);
+
+	if (fz_optind < argc)
+	{
+		for (i = fz_optind; i < argc; i++)
+		{
+			fz_buffer *buf = NULL;
+			unsigned char *data;
+			size_t len;
+			fz_try(ctx)
+				buf = fz_read_file(ctx, argv[i]);
+			fz_catch(ctx)
+			{
+				fprintf(stderr, "cannot read %s\n", argv[i]);
+				failures++;
+				continue;
+			}
+			len = fz_buffer_storage(ctx, buf, &data);
+			failures += !check(ctx, data, len, 15, argv[i]);
+			total++;
+			for (c = 0; c < count; c++, total++)
+				failures += !check_data(ctx, data, len, argv[i]);
+			fz_drop_buffer(ctx, buf);
+		}
+	}
+	else
+	{
+		for (i = 0; i < count; i++, total++)
+		{
+			size_t len;
+			unsigned char *data = make_data(&len);
+			char name[32];
+			fz_snprintf(name, sizeof name, "case %d", i);
+			failures += !check_data(ctx, data, len, name);
+			free(data);
+		}
+	}
+
+	printf("%d checked, %d mismatched\n", total, failures);
+
+	fz_drop_context(ctx);
+	return failures != 0;
+}
@@ -0,0 +1,514 @@
+/* lexcheck.c -- check that the lexer's fast paths agree with the byte at a time code */
+
+/*
+	Builds random runs of tokens of every class and lexes each run with
+	pdf_lex three times: from a memory stream, where the fast paths see
+	whole tokens; from a stream handing out random sized chunks, so that
+	tokens often straddle the end of the buffer; and from a stream
+	handing out one byte at a time, which always takes the old byte at
+	a time paths. The token types, values (bit for bit), scratch text
+	and length, and stream positions must all match. Each real number
+	is also checked against fz_atof of its text directly.
+
+	The runs mix:
+	- numbers: signs, leading zeros, decimal points in every position,
+	  too many digits, doubled signs and points, stray letters;
+	- runs of white space, including NUL bytes;
+	- comments ending in CR, LF, CRLF or at the end of the data;
+	- names with #xx escapes, bad escapes, bytes above 127, and lengths
+	  around the 127 byte limit;
+	- keywords, and words that are not keywords or not printable;
+	- literal strings with every escape, octal escapes of one to three
+	  digits, escaped line ends, nested parentheses, and lengths past
+	  the initial lexer buffer;
+	- hex strings with white space, odd digit counts and bad bytes;
+	- array, dictionary and brace delimiters, and stray closers.
+
+	usage: lexcheck [-s seed] [-n count]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+static unsigned int seed = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return n ? ((seed >> 8) & 0xffffff) % n : 0;
+}
+
+/*
+	Chunked stream: hands out the source data a few bytes at a time,
+	either one byte or a random number of bytes per call.
+*/
+
+struct chunked
+{
+	unsigned char *data;
+	size_t len, pos;
+	int one;
+};
+
+static int next_chunked(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	struct chunked *c = stm->state;
+	size_t n = c->one ? 1 : 1 + rnd(40);
+	if (c->pos >= c->len)
+		return EOF;
+	if (n > c->len - c->pos)
+		n = c->len - c->pos;
+	stm->rp = c->data + c->pos;
+	stm->wp = stm->rp + n;
+	c->pos += n;
+	stm->pos += n;
+	return *stm->rp++;
+}
+
+#define MAXTOK 256
+#define MAXLEN 640 /* longest generated token */
+
+struct result
+{
+	int n;
+	pdf_token tok[MAXTOK];
+	int64_t i[MAXTOK];
+	float f[MAXTOK];
+	char text[MAXTOK][32];
+	size_t len[MAXTOK];
+	unsigned int hash[MAXTOK];
+	int64_t pos[MAXTOK];
+};
+
+static unsigned int hash(const char *s, size_t n)
+{
+	unsigned int h = 2166136261u;
+	while (n--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+/* Tokens that leave text in the scratch buffer. */
+static int has_text(pdf_token tok)
+{
+	return tok >= PDF_TOK_NAME;
+}
+
+static void lex(fz_context *ctx, unsigned char *data, size_t len, int mode, struct result *r)
+{
+	struct chunked c;
+	fz_stream *stm;
+	pdf_lexbuf lb;
+	pdf_token tok;
+
+	if (mode == 0)
+		stm = fz_open_memory(ctx, data, len);
+	else
+	{
+		c.data = data;
+		c.len = len;
+		c.pos = 0;
+		c.one = (mode == 2);
+		stm = fz_new_stream(ctx, &c, next_chunked, NULL);
+	}
+	pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+
+	r->n = 0;
+	fz_try(ctx)
+	{
+		do
+		{
+			tok = pdf_lex(ctx, stm, &lb);
+			r->tok[r->n] = tok;
+			r->i[r->n] = tok == PDF_TOK_INT ? lb.i : 0;
+			r->f[r->n] = tok == PDF_TOK_REAL ? lb.f : 0;
+			r->text[r->n][0] = 0;
+			r->len[r->n] = 0;
+			r->hash[r->n] = 0;
+			if (tok == PDF_TOK_INT || tok == PDF_TOK_REAL)
+			{
+				/* The number lexer does not set the length. */
+				fz_strlcpy(r->text[r->n], lb.scratch, sizeof r->text[0]);
+				r->len[r->n] = strlen(lb.scratch);
+				r->hash[r->n] = hash(lb.scratch, r->len[r->n]);
+			}
+			else if (has_text(tok))
+			{
+				r->len[r->n] = lb.len;
+				r->hash[r->n] = hash(lb.scratch, lb.len);
+			}
+			r->pos[r->n] = fz_tell(ctx, stm);
+			r->n++;
+		}
+		while (tok != PDF_TOK_EOF && r->n < MAXTOK);
+	}
+	fz_always(ctx)
+	{
+		pdf_lexbuf_fin(ctx, &lb);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		r->tok[r->n++] = PDF_TOK_ERROR;
+}
+
+static const char *whites = " \n\r\t\f";
+
+/* Most tokens are short, a few are long enough to leave the fast paths. */
+static int token_length(int longest)
+{
+	return rnd(16) ? rnd(12) : rnd(longest + 1);
+}
+
+static size_t make_number(unsigned char *s)
+{
+	static const char *delims = "  \n\r\t\f/[]<>(){}%";
+	int ndigits = rnd(4) ? rnd(10) : rnd(14);
+	int dot = rnd(3) ? -1 : (int)rnd(ndigits + 1);
+	size_t n = 0;
+	int i;
+
+	switch (rnd(12))
+	{
+	case 0: case 1: case 2: s[n++] = '-'; break;
+	case 3: s[n++] = '-'; s[n++] = '-'; break;
+	case 4: s[n++] = '+'; break;
+	}
+	if (rnd(2))
+		dot = rnd(ndigits + 1);
+	for (i = 0; i <= ndigits; i++)
+	{
+		if (i == dot)
+			s[n++] = '.';
+		if (i == ndigits)
+			break;
+		s[n++] = (rnd(4) == 0 && i == 0) ? '0' : '0' + rnd(10);
+	}
+	switch (rnd(30))
+	{
+	case 0: s[n++] = '.'; break;
+	case 1: s[n++] = 'e'; break;
+	case 2: s[n++] = '-'; break;
+	case 3: s[n++] = 'a' + rnd(26); break;
+	}
+	s[n++] = delims[rnd(strlen(delims))];
+	return n;
+}
+
+static size_t make_white(unsigned char *s)
+{
+	int i, len = 1 + rnd(rnd(8) ? 4 : 40);
+	for (i = 0; i < len; i++)
+		s[i] = rnd(8) ? whites[rnd(5)] : 0;
+	return len;
+}
+
+static size_t make_comment(unsigned char *s)
+{
+	int i, len = token_length(MAXLEN - 3);
+	size_t n = 0;
+	s[n++] = '%';
+	for (i = 0; i < len; i++)
+	{
+		int c = rnd(4) ? 32 + rnd(95) : rnd(256);
+		s[n++] = (c == '\n' || c == '\r') ? '%' : c;
+	}
+	switch (rnd(4))
+	{
+	case 0: s[n++] = '\r'; break;
+	case 1: s[n++] = '\n'; break;
+	case 2: s[n++] = '\r'; s[n++] = '\n'; break;
+	case 3: break; /* runs into the next token */
+	}
+	return n;
+}
+
+static int name_byte(void)
+{
+	static const char *plain = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-+.*_!\"'";
+	int c;
+	if (rnd(8))
+		return plain[rnd(strlen(plain))];
+	do
+		c = rnd(256);
+	while (c == '#' || c == 0 || strchr(" \t\n\r\f()<>[]{}/%", c));
+	return c;
+}
+
+static size_t make_word(unsigned char *s, int longest)
+{
+	static const char *hex = "0123456789abcdefABCDEFg";
+	int i, len = token_length(longest);
+	int escapes = rnd(2);
+	size_t n = 0;
+
+	/* Sometimes straddle the 127 byte name limit. */
+	if (rnd(16) == 0)
+		len = 120 + rnd(16);
+	for (i = 0; i < len; i++)
+	{
+		if (escapes && rnd(12) == 0)
+		{
+			/* An escape, often a bad one. */
+			s[n++] = '#';
+			switch (rnd(5))
+			{
+			case 0: break;
+			case 1: s[n++] = hex[rnd(23)]; break;
+			case 2: s[n++] = '0'; s[n++] = '0'; break;
+			default: s[n++] = hex[rnd(22)]; s[n++] = hex[rnd(22)]; break;
+			}
+		}
+		else
+			s[n++] = name_byte();
+	}
+	return n;
+}
+
+static size_t make_name(unsigned char *s)
+{
+	size_t n = 0;
+	s[n++] = '/';
+	n += make_word(s + n, 200);
+	if (rnd(4))
+		s[n++] = whites[rnd(5)];
+	return n;
+}
+
+static size_t make_keyword(unsigned char *s)
+{
+	static const char *keywords[] = {
+		"R", "true", "false", "null", "obj", "endobj", "stream", "endstream",
+		"xref", "trailer", "startxref", "BT", "ET", "Tj", "re", "f*", "trues",
+	};
+	size_t n;
+	if (rnd(3))
+	{
+		const char *k = keywords[rnd(nelem(keywords))];
+		n = strlen(k);
+		memcpy(s, k, n);
+	}
+	else
+	{
+		/* A word that starts like a keyword, not a number or a delimiter. */
+		s[0] = 'a' + rnd(26);
+		n = 1 + make_word(s + 1, 40);
+		if (rnd(4) == 0)
+			s[rnd(n)] = 1 + rnd(31); /* not printable */
+	}
+	if (rnd(4))
+		s[n++] = whites[rnd(5)];
+	return n;
+}
+
+static size_t make_string(unsigned char *s)
+{
+	static const char *escapes = "nrtbf()\\xq";
+	int i, len = token_length(MAXLEN / 2 - 2);
+	int depth = 0;
+	size_t n = 0;
+
+	s[n++] = '(';
+	for (i = 0; i < len && n + depth < MAXLEN - 8; i++)
+	{
+		switch (rnd(10))
+		{
+		case 0:
+			s[n++] = '\\';
+			switch (rnd(4))
+			{
+			case 0: s[n++] = escapes[rnd(strlen(escapes))]; break;
+			case 1:
+				s[n++] = '0' + rnd(8);
+				if (rnd(2)) s[n++] = '0' + rnd(8);
+				if (rnd(2)) s[n++] = '0' + rnd(10);
+				break;
+			case 2:
+				switch (rnd(3))
+				{
+				case 0: s[n++] = '\n'; break;
+				case 1: s[n++] = '\r'; break;
+				case 2: s[n++] = '\r'; s[n++] = '\n'; break;
+				}
+				break;
+			case 3: s[n++] = rnd(256); break;
+			}
+			break;
+		case 1:
+			if (depth > 0 && rnd(2))
+			{
+				s[n++] = ')';
+				depth--;
+			}
+			else
+			{
+				s[n++] = '(';
+				depth++;
+			}
+			break;
+		default:
+			do
+				s[n] = rnd(4) ? 32 + rnd(95) : rnd(256);
+			while (s[n] == '(' || s[n] == ')' || s[n] == '\\');
+			n++;
+			break;
+		}
+	}
+	while (depth-- > 0)
+		s[n++] = ')';
+	s[n++] = ')';
+	return n;
+}
+
+static size_t make_hex_string(unsigned char *s)
+{
+	static const char *hex = "0123456789abcdefABCDEF";
+	int i, len = token_length(MAXLEN - 2);
+	size_t n = 0;
+
+	s[n++] = '<';
+	for (i = 0; i < len; i++)
+	{
+		if (rnd(8) == 0)
+			s[n++] = whites[rnd(5)];
+		else if (rnd(64) == 0)
+			s[n++] = "gz(/<"[rnd(5)]; /* invalid */
+		else
+			s[n++] = hex[rnd(22)];
+	}
+	/* Not a dictionary. */
+	if (n > 1 && s[1] == '<')
+		s[1] = '0';
+	s[n++] = '>';
+	return n;
+}
+
+static size_t make_delimiter(unsigned char *s)
+{
+	static const char *delims[] = { "[", "]", "{", "}", "<<", ">>", ")", ">" };
+	const char *d = delims[rnd(nelem(delims))];
+	memcpy(s, d, strlen(d));
+	return strlen(d);
+}
+
+static size_t make_token(unsigned char *s)
+{
+	switch (rnd(9))
+	{
+	default: return make_number(s);
+	case 1: return make_white(s);
+	case 2: return make_comment(s);
+	case 3: return make_name(s);
+	case 4: return make_keyword(s);
+	case 5: return make_string(s);
+	case 6: return make_hex_string(s);
+	case 7: return make_delimiter(s);
+	}
+}
+
+static int same(struct result *a, struct result *b)
+{
+	int k;
+	if (a->n != b->n)
+		return 0;
+	for (k = 0; k < a->n; k++)
+	{
+		if (a->tok[k] != b->tok[k] || a->i[k] != b->i[k] || a->pos[k] != b->pos[k])
+			return 0;
+		if (a->len[k] != b->len[k] || a->hash[k] != b->hash[k])
+			return 0;
+		if (memcmp(&a->f[k], &b->f[k], sizeof a->f[k]))
+			return 0;
+		if (strcmp(a->text[k], b->text[k]))
+			return 0;
+	}
+	return 1;
+}
+
+static int check_reals(struct result *r)
+{
+	int k;
+	for (k = 0; k < r->n; k++)
+	{
+		if (r->tok[k] == PDF_TOK_REAL && strncmp(r->text[k], "--", 2) && strlen(r->text[k]) < 10)
+		{
+			float f = fz_atof(r->text[k]);
+			if (memcmp(&f, &r->f[k], sizeof f))
+			{
+				fprintf(stderr, "real mismatch: '%s' lexed as %.9g, fz_atof gives %.9g\n", r->text[k], r->f[k], f);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static void print_data(unsigned char *data, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+		fputc(data[i] >= 32 && data[i] < 127 ? data[i] : '.', stderr);
+	fputc('\n', stderr);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct result a, b, c;
+	static unsigned char data[MAXTOK / 2 * (MAXLEN + 8)];
+	fz_context *ctx;
+	int count = 100000;
+	int failures = 0;
+	int i, k, n;
+	size_t len;
+
+	while ((k = fz_getopt(argc, argv, "s:n:")) != -1)
+	{
+		switch (k)
+		{
+		case 's': seed = atoi(fz_optarg); break;
+		case 'n': count = atoi(fz_optarg); break;
+		default:
+			fprintf(stderr, "usage: lexcheck [-s seed] [-n count]\n");
+			return 1;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create context\n");
+		return 1;
+	}
+	fz_set_warning_callback(ctx, NULL, NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		len = 0;
+		n = 1 + rnd(MAXTOK / 2);
+		for (k = 0; k < n; k++)
+			len += make_token(data + len);
+		/* Sometimes end inside a token, or with no delimiter after it. */
+		if (rnd(4) == 0)
+			len--;
+
+		lex(ctx, data, len, 0, &a);
+		lex(ctx, data, len, 1, &b);
+		lex(ctx, data, len, 2, &c);
+
+		if (!same(&a, &c) || !same(&b, &c) || !check_reals(&c))
+		{
+			fprintf(stderr, "mismatch: case %d: ", i);
+			print_data(data, len);
+			failures++;
+		}
+	}
+
+	printf("%d checked, %d mismatched\n", count, failures);
+
+	fz_drop_context(ctx);
+	return failures != 0;
+}
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+
+# Time SVG output of a synthetic drawing with and without sharing of repeated
+# paths, glyphs and images (the reuse-paths option of mutool convert).
+#
+# The drawing is a set of pages covered in small repeated symbols (circles,
+# crosses and stars, much like a plot or a schematic), short text labels, and
+# a logo image that is embedded twice per page as two separate image objects.
+#
+# usage: scripts/svgbench.py [path/to/mutool] [pages] [runs]
+
+import os, random, shutil, subprocess, sys, tempfile, time
+
+mutool = sys.argv[1] if len(sys.argv) > 1 else "build/release/mutool"
+pages = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+runs = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+
+circle = "4 0 m 4 2.2092 2.2092 4 0 4 c -2.2092 4 -4 2.2092 -4 0 c -4 -2.2092 -2.2092 -4 0 -4 c 2.2092 -4 4 -2.2092 4 0 c h"
+cross = "-3 -3 m 3 3 l -3 3 m 3 -3 l"
+star = "0 6 m 1.4 1.9 l 5.7 1.9 l 2.3 -0.7 l 3.5 -4.9 l 0 -2.4 l -3.5 -4.9 l -2.3 -0.7 l -5.7 1.9 l -1.4 1.9 l h"
+symbols = [
+	circle + " " + cross + " S",
+	"0.2 g " + star + " f",
+	"0 0 1 RG " + circle + " S",
+	"1 0 0 rg -3 -3 6 6 re f",
+]
+
+def page_contents(rnd):
+	out = ["0.2 w"]
+	for i in range(20000):
+		x, y = rnd.uniform(20, 1170), rnd.uniform(20, 822)
+		out.append("q 1 0 0 1 %.2f %.2f cm %s Q" % (x, y, rnd.choice(symbols)))
+	for i in range(500):
+		x, y = rnd.uniform(20, 1100), rnd.uniform(20, 822)
+		out.append("BT /F1 6 Tf %.2f %.2f Td (P%d) Tj ET" % (x, y, rnd.randrange(1000)))
+	out.append("q 80 0 0 40 1090 20 cm /I1 Do Q")
+	out.append("q 80 0 0 40 20 782 cm /I2 Do Q")
+	return "\n".join(out).encode()
+
+# Written by hand rather than with mutool create, which would merge the two
+# copies of the logo into one image object.
+def write_pdf(path, rnd):
+	w, h = 200, 100
+	logo = bytes(rnd.randrange(256) for i in range(w * h * 3))
+	image = b"<< /Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace /DeviceRGB /BitsPerComponent 8 /Length %d >>\nstream\n" % (w, h, len(logo)) + logo + b"\nendstream"
+	objs = [
+		b"<< /Type /Catalog /Pages 2 0 R >>",
+		b"<< /Type /Pages /Kids [%s] /Count %d >>" % (b" ".join(b"%d 0 R" % (6 + 2 * i) for i in range(pages)), pages),
+		b"<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>",
+		image,
+		image,
+	]
+	for i in range(pages):
+		contents = page_contents(rnd)
+		objs.append(b"<< /Type /Page /Parent 2 0 R /MediaBox [0 0 1190 842] /Contents %d 0 R /Resources << /Font << /F1 3 0 R >> /XObject << /I1 4 0 R /I2 5 0 R >> >> >>" % (7 + 2 * i))
+		objs.append(b"<< /Length %d >>\nstream\n" % len(contents) + contents + b"\nendstream")
+	data = b"%PDF-1.4\n"
+	offsets = []
+	for i, obj in enumerate(objs):
+		offsets.append(len(data))
+		data += b"%d 0 obj\n" % (i + 1) + obj + b"\nendobj\n"
+	xref = len(data)
+	data += b"xref\n0 %d\n0000000000 65535 f \n" % (len(objs) + 1)
+	for ofs in offsets:
+		data += b"%010d 00000 n \n" % ofs
+	data += b"trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%d\n%%%%EOF\n" % (len(objs) + 1, xref)
+	with open(path, "wb") as f:
+		f.write(data)
+
+def convert(tmp, options):
+	best = None
+	for k in range(runs):
+		for name in os.listdir(tmp):
+			if name.endswith(".svg"):
+				os.remove(os.path.join(tmp, name))
+		t = time.time()
+		subprocess.run([mutool, "convert", "-O", options, "-o", os.path.join(tmp, "out-%d.svg"), os.path.join(tmp, "in.pdf")],
+			check=True, stderr=subprocess.DEVNULL)
+		t = time.time() - t
+		best = t if best is None else min(best, t)
+	size = sum(os.path.getsize(os.path.join(tmp, name)) for name in os.listdir(tmp) if name.endswith(".svg"))
+	print("%-28s %8.3fs %12d bytes" % (options, best, size))
+
+tmp = tempfile.mkdtemp()
+try:
+	write_pdf(os.path.join(tmp, "in.pdf"), random.Random(1))
+	convert(tmp, "text=path")
+	convert(tmp, "text=path,reuse-paths")
+finally:
+	shutil.rmtree(tmp)
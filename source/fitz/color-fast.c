@@ -202,6 +202,117 @@ fz_lookup_fast_color_converter(fz_context *ctx, fz_colorspace *ss, fz_colorspace
 
 /* Fast pixmap color conversions */
 
+/*
+ * Span converters for the common case of a source without spots or
+ * alpha. They work on a whole row (or the whole pixmap when rows are
+ * contiguous) with the component layout fixed at each call site, so
+ * the inner loops have no per-pixel branches and can be vectorised
+ * by the compiler.
+ */
+
+static inline void
+gray_to_rgb_span(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int dn)
+{
+	size_t i;
+	for (i = 0; i < w; i++)
+	{
+		d[0] = s[0];
+		d[1] = s[0];
+		d[2] = s[0];
+		if (dn == 4)
+			d[3] = 255;
+		s += 1;
+		d += dn;
+	}
+}
+
+static inline void
+rgb_to_gray_span(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int dn, int bgr)
+{
+	size_t i;
+	for (i = 0; i < w; i++)
+	{
+		int r = bgr ? s[2] : s[0];
+		int b = bgr ? s[0] : s[2];
+		d[0] = ((r+1) * 77 + (s[1]+1) * 150 + (b+1) * 28) >> 8;
+		if (dn == 2)
+			d[1] = 255;
+		s += 3;
+		d += dn;
+	}
+}
+
+static inline void
+cmyk_to_rgb_span(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int dn, int bgr)
+{
+	size_t i;
+	for (i = 0; i < w; i++)
+	{
+		int k = s[3];
+		int r = 255 - fz_mini(s[0] + k, 255);
+		int g = 255 - fz_mini(s[1] + k, 255);
+		int b = 255 - fz_mini(s[2] + k, 255);
+		d[0] = bgr ? b : r;
+		d[1] = g;
+		d[2] = bgr ? r : b;
+		if (dn == 4)
+			d[3] = 255;
+		s += 4;
+		d += dn;
+	}
+}
+
+static inline void
+cmyk_to_gray_span(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int dn)
+{
+	size_t i;
+	for (i = 0; i < w; i++)
+	{
+		d[0] = 255 - fz_mini(s[0] + s[1] + s[2] + s[3], 255);
+		if (dn == 2)
+			d[1] = 255;
+		s += 4;
+		d += dn;
+	}
+}
+
+static inline void
+rgb_to_cmyk_span(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int dn, int bgr)
+{
+	size_t i;
+	for (i = 0; i < w; i++)
+	{
+		int c = 255 - (bgr ? s[2] : s[0]);
+		int m = 255 - s[1];
+		int y = 255 - (bgr ? s[0] : s[2]);
+		int k = fz_mini(c, fz_mini(m, y));
+		d[0] = c - k;
+		d[1] = m - k;
+		d[2] = y - k;
+		d[3] = k;
+		if (dn == 5)
+			d[4] = 255;
+		s += 3;
+		d += dn;
+	}
+}
+
+/* Convert all rows of an opaque source without spots with one of the span converters. */
+#define CONVERT_OPAQUE_SPANS(SPAN) \
+	do { \
+		if (d_line_inc == 0 && s_line_inc == 0) \
+		{ \
+			w *= h; \
+			h = 1; \
+		} \
+		while (h--) \
+		{ \
+			SPAN; \
+			d += w * dn + d_line_inc; \
+			s += w * sn + s_line_inc; \
+		} \
+	} while (0)
+
 static void fast_gray_to_rgb(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, int copy_spots)
 {
 	unsigned char *s = src->samples;
@@ -226,6 +337,15 @@ static void fast_gray_to_rgb(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		return;
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(gray_to_rgb_span(d, s, w, 4));
+		else
+			CONVERT_OPAQUE_SPANS(gray_to_rgb_span(d, s, w, 3));
+		return;
+	}
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -234,62 +354,21 @@ static void fast_gray_to_rgb(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 
 	if (ss == 0 && ds == 0)
 	{
-		/* Common, no spots case */
-		if (da)
-		{
-			if (sa)
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = s[0];
-						d[1] = s[0];
-						d[2] = s[0];
-						d[3] = s[1];
-						s += 2;
-						d += 4;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-			else
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = s[0];
-						d[1] = s[0];
-						d[2] = s[0];
-						d[3] = 255;
-						s++;
-						d += 4;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-		}
-		else
+		/* Common, no spots case; without alpha it is done above */
+		while (h--)
 		{
-			while (h--)
+			size_t ww = w;
+			while (ww--)
 			{
-				size_t ww = w;
-				while (ww--)
-				{
-					d[0] = s[0];
-					d[1] = s[0];
-					d[2] = s[0];
-					s++;
-					d += 3;
-				}
-				d += d_line_inc;
-				s += s_line_inc;
+				d[0] = s[0];
+				d[1] = s[0];
+				d[2] = s[0];
+				d[3] = s[1];
+				s += 2;
+				d += 4;
 			}
+			d += d_line_inc;
+			s += s_line_inc;
 		}
 	}
 	else if (copy_spots)
@@ -437,6 +516,15 @@ static void fast_rgb_to_gray(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		return;
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(rgb_to_gray_span(d, s, w, 2, 0));
+		else
+			CONVERT_OPAQUE_SPANS(rgb_to_gray_span(d, s, w, 1, 0));
+		return;
+	}
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -445,56 +533,19 @@ static void fast_rgb_to_gray(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 
 	if (ss == 0 && ds == 0)
 	{
-		/* Common, no spots case */
-		if (da)
-		{
-			if (sa)
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
-						d[1] = s[3];
-						s += 4;
-						d += 2;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-			else
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
-						d[1] = 255;
-						s += 3;
-						d += 2;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-		}
-		else
+		/* Common, no spots case; without alpha it is done above */
+		while (h--)
 		{
-			while (h--)
+			size_t ww = w;
+			while (ww--)
 			{
-				size_t ww = w;
-				while (ww--)
-				{
-					d[0] = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
-					s += 3;
-					d++;
-				}
-				d += d_line_inc;
-				s += s_line_inc;
+				d[0] = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
+				d[1] = s[3];
+				s += 4;
+				d += 2;
 			}
+			d += d_line_inc;
+			s += s_line_inc;
 		}
 	}
 	else if (copy_spots)
@@ -561,6 +612,15 @@ static void fast_bgr_to_gray(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		return;
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(rgb_to_gray_span(d, s, w, 2, 1));
+		else
+			CONVERT_OPAQUE_SPANS(rgb_to_gray_span(d, s, w, 1, 1));
+		return;
+	}
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -569,58 +629,19 @@ static void fast_bgr_to_gray(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 
 	if (ss == 0 && ds == 0)
 	{
-		/* Common, no spots case */
-		if (da)
-		{
-			if (sa)
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = ((s[0]+1) * 28 + (s[1]+1) * 150 + (s[2]+1) * 77) >> 8;
-						d[1] = s[3];
-						s += 4;
-						d += 2;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-			else
-			{
-				while (h--)
-				{
-					size_t ww = w;
-					while (ww--)
-					{
-						d[0] = ((s[0]+1) * 28 + (s[1]+1) * 150 + (s[2]+1) * 77) >> 8;
-						d[1] = 255;
-						s += 3;
-						d += 2;
-					}
-					d += d_line_inc;
-					s += s_line_inc;
-				}
-			}
-		}
-		else
+		/* Common, no spots case; without alpha it is done above */
+		while (h--)
 		{
-			int si = 3 + src->alpha;
-
-			while (h--)
+			size_t ww = w;
+			while (ww--)
 			{
-				size_t ww = w;
-				while (ww--)
-				{
-					d[0] = ((s[0]+1) * 28 + (s[1]+1) * 150 + (s[2]+1) * 77) >> 8;
-					s += si;
-					d++;
-				}
-				d += d_line_inc;
-				s += s_line_inc;
+				d[0] = ((s[0]+1) * 28 + (s[1]+1) * 150 + (s[2]+1) * 77) >> 8;
+				d[1] = s[3];
+				s += 4;
+				d += 2;
 			}
+			d += d_line_inc;
+			s += s_line_inc;
 		}
 	}
 	else if (copy_spots)
@@ -688,6 +709,15 @@ static void fast_rgb_to_cmyk(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(rgb_to_cmyk_span(d, s, w, 5, 0));
+		else
+			CONVERT_OPAQUE_SPANS(rgb_to_cmyk_span(d, s, w, 4, 0));
+		return;
+	}
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -775,6 +805,15 @@ static void fast_bgr_to_cmyk(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(rgb_to_cmyk_span(d, s, w, 5, 1));
+		else
+			CONVERT_OPAQUE_SPANS(rgb_to_cmyk_span(d, s, w, 4, 1));
+		return;
+	}
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -862,6 +901,15 @@ static void fast_cmyk_to_gray(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, i
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(cmyk_to_gray_span(d, s, w, 2));
+		else
+			CONVERT_OPAQUE_SPANS(cmyk_to_gray_span(d, s, w, 1));
+		return;
+	}
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -939,6 +987,15 @@ static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(cmyk_to_rgb_span(d, s, w, 4, 0));
+		else
+			CONVERT_OPAQUE_SPANS(cmyk_to_rgb_span(d, s, w, 3, 0));
+		return;
+	}
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -1022,6 +1079,15 @@ static void fast_cmyk_to_bgr(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, in
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		if (da)
+			CONVERT_OPAQUE_SPANS(cmyk_to_rgb_span(d, s, w, 4, 1));
+		else
+			CONVERT_OPAQUE_SPANS(cmyk_to_rgb_span(d, s, w, 3, 1));
+		return;
+	}
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -1130,6 +1196,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, int
 						s += 4;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 			else
@@ -1146,6 +1214,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, int
 						s += 3;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 		}
@@ -1162,6 +1232,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, int
 					s += 3;
 					d += 3;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
@@ -347,16 +347,57 @@ fz_icc_transform_color(fz_context *ctx, fz_color_converter *cc, const float *src
 #endif
 }
 
+typedef struct
+{
+	fz_icc_link *link;
+	unsigned char *inputpos;
+	unsigned char *outputpos;
+	int ss, ds, sw, dw, sn, dn, sc, dc, sa;
+	int h;
+} fz_icc_transform_band;
+
+static void
+fz_icc_transform_rows(fz_context *ctx, void *band_)
+{
+	GLOINIT
+	fz_icc_transform_band *band = band_;
+	unsigned char *inputpos = band->inputpos;
+	unsigned char *outputpos = band->outputpos;
+	unsigned char *buffer;
+	int h;
+
+	if (band->sa)
+	{
+		buffer = fz_malloc(ctx, band->ss);
+		for (h = band->h; h > 0; h--)
+		{
+			fz_unmultiply_row(ctx, band->sn, band->sc, band->sw, buffer, inputpos);
+			cmsDoTransform(GLO band->link->handle, buffer, outputpos, band->sw);
+			fz_premultiply_row(ctx, band->dn, band->dc, band->dw, outputpos);
+			inputpos += band->ss;
+			outputpos += band->ds;
+		}
+		fz_free(ctx, buffer);
+	}
+	else
+	{
+		for (h = band->h; h > 0; h--)
+		{
+			cmsDoTransform(GLO band->link->handle, inputpos, outputpos, band->sw);
+			inputpos += band->ss;
+			outputpos += band->ds;
+		}
+	}
+}
+
+/* Pixmaps smaller than this are not worth splitting into bands. */
+#define ICC_BAND_MIN_PIXELS (256 * 256)
+
 void
 fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, fz_pixmap *src, fz_pixmap *dst, int copy_spots)
 {
 	GLOINIT
 	int cmm_num_src, cmm_num_dst, cmm_extras;
-	unsigned char *inputpos, *outputpos, *buffer;
-	int ss = src->stride;
-	int ds = dst->stride;
-	int sw = src->w;
-	int dw = dst->w;
 	int sn = src->n;
 	int dn = dst->n;
 	int sa = src->alpha;
@@ -366,7 +407,11 @@ fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, fz_pixmap *src, fz_p
 	int sc = sn - ssp - sa;
 	int dc = dn - dsp - da;
 	int h = src->h;
+	int threads = fz_job_threads(ctx);
 	cmsUInt32Number src_format, dst_format;
+	fz_icc_transform_band *bands;
+	void **jobs;
+	int i, count, y;
 
 	/* check the channels. */
 	src_format = cmsGetTransformInputFormat(GLO link->handle);
@@ -377,30 +422,46 @@ fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, fz_pixmap *src, fz_p
 	if (cmm_num_src != sc || cmm_num_dst != dc || cmm_extras != ssp+sa || sa != da || (copy_spots && ssp != dsp))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "bad setup in ICC pixmap transform: src: %d vs %d+%d+%d, dst: %d vs %d+%d+%d", cmm_num_src, sc, ssp, sa, cmm_num_dst, dc, dsp, da);
 
-	inputpos = src->samples;
-	outputpos = dst->samples;
-	if (sa)
-	{
-		buffer = fz_malloc(ctx, ss);
-		for (; h > 0; h--)
-		{
-			fz_unmultiply_row(ctx, sn, sc, sw, buffer, inputpos);
-			cmsDoTransform(GLO link->handle, buffer, outputpos, sw);
-			fz_premultiply_row(ctx, dn, dc, dw, outputpos);
-			inputpos += ss;
-			outputpos += ds;
-		}
-		fz_free(ctx, buffer);
-	}
-	else
+	/* Transforms do not change once created, so bands of rows can
+	 * share the link and be transformed in parallel. */
+	count = 1;
+	if (threads > 1 && (int64_t)src->w * h >= ICC_BAND_MIN_PIXELS)
+		count = fz_mini(threads * 2, h);
+
+	bands = fz_malloc_array(ctx, count, fz_icc_transform_band);
+	fz_try(ctx)
 	{
-		for (; h > 0; h--)
+		jobs = fz_malloc_array(ctx, count, void *);
+		for (i = 0, y = 0; i < count; i++)
 		{
-			cmsDoTransform(GLO link->handle, inputpos, outputpos, sw);
-			inputpos += ss;
-			outputpos += ds;
+			int rows = (h - y) / (count - i);
+			bands[i].link = link;
+			bands[i].inputpos = src->samples + (size_t)y * src->stride;
+			bands[i].outputpos = dst->samples + (size_t)y * dst->stride;
+			bands[i].ss = src->stride;
+			bands[i].ds = dst->stride;
+			bands[i].sw = src->w;
+			bands[i].dw = dst->w;
+			bands[i].sn = sn;
+			bands[i].dn = dn;
+			bands[i].sc = sc;
+			bands[i].dc = dc;
+			bands[i].sa = sa;
+			bands[i].h = rows;
+			jobs[i] = &bands[i];
+			y += rows;
 		}
+		fz_try(ctx)
+			fz_run_jobs(ctx, count, fz_icc_transform_rows, jobs);
+		fz_always(ctx)
+			fz_free(ctx, jobs);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
 	}
+	fz_always(ctx)
+		fz_free(ctx, bands);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 #endif
@@ -82,6 +82,7 @@ static void fz_new_tuning_context(fz_context *ctx)
 		ctx->tuning->refs = 1;
 		ctx->tuning->image_decode = fz_default_image_decode;
 		ctx->tuning->image_scale = fz_default_image_scale;
+		ctx->tuning->job_threads = 1;
 	}
 }
 
@@ -130,6 +131,137 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+/*
+	Set the function to use for running
+	batches of independent jobs.
+
+	run_jobs: Function to use, or NULL to run all jobs one after
+	the other on the thread that issues them.
+
+	arg: Opaque argument to be passed to run_jobs.
+
+	threads: The number of jobs that run_jobs can usefully run
+	at the same time.
+*/
+void fz_set_job_runner(fz_context *ctx, fz_run_jobs_fn *run_jobs, void *arg, int threads)
+{
+	ctx->tuning->run_jobs = run_jobs;
+	ctx->tuning->run_jobs_arg = arg;
+	ctx->tuning->job_threads = run_jobs ? fz_maxi(threads, 1) : 1;
+}
+
+/*
+	Return the number of jobs that
+	can usefully be run at the same time. Operations that split
+	their work into jobs use this to decide whether doing so is
+	worthwhile, and how many jobs to issue at once.
+*/
+int fz_job_threads(fz_context *ctx)
+{
+	return ctx->tuning->job_threads;
+}
+
+typedef struct
+{
+	fz_job_fn *fn;
+	void *job;
+	int errcode;
+	char message[256];
+} fz_job_slot;
+
+static void
+fz_run_job_slot(fz_context *ctx, void *slot_)
+{
+	fz_job_slot *slot = slot_;
+
+	fz_try(ctx)
+		slot->fn(ctx, slot->job);
+	fz_catch(ctx)
+	{
+		slot->errcode = fz_caught(ctx);
+		fz_strlcpy(slot->message, fz_caught_message(ctx), sizeof slot->message);
+	}
+}
+
+/*
+	Run a batch of independent jobs, in
+	parallel if a job runner has been set (see fz_set_job_runner).
+
+	count: The number of jobs.
+
+	fn: The function to call for each job. It may be called on other
+	threads with cloned contexts, so it must only touch data that is
+	private to its job, or that is safe to share between threads.
+
+	jobs: The array of job specific data.
+
+	All jobs are run, even if some of them throw. Once they have all
+	completed, the first error thrown (if any) is rethrown.
+*/
+void fz_run_jobs(fz_context *ctx, int count, fz_job_fn *fn, void **jobs)
+{
+	fz_job_slot *slots;
+	void **args;
+	int errcode = FZ_ERROR_NONE;
+	char message[256];
+	int i;
+
+	if (count <= 0)
+		return;
+
+	if (count == 1 || ctx->tuning->run_jobs == NULL)
+	{
+		fz_job_slot slot;
+		for (i = 0; i < count; i++)
+		{
+			slot.fn = fn;
+			slot.job = jobs[i];
+			slot.errcode = FZ_ERROR_NONE;
+			fz_run_job_slot(ctx, &slot);
+			if (slot.errcode != FZ_ERROR_NONE && errcode == FZ_ERROR_NONE)
+			{
+				errcode = slot.errcode;
+				fz_strlcpy(message, slot.message, sizeof message);
+			}
+		}
+	}
+	else
+	{
+		slots = fz_calloc(ctx, count, sizeof *slots);
+		args = fz_malloc_no_throw(ctx, count * sizeof *args);
+		if (args == NULL)
+		{
+			fz_free(ctx, slots);
+			fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate job list");
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			slots[i].fn = fn;
+			slots[i].job = jobs[i];
+			args[i] = &slots[i];
+		}
+
+		ctx->tuning->run_jobs(ctx->tuning->run_jobs_arg, ctx, count, fz_run_job_slot, args);
+
+		for (i = 0; i < count; i++)
+		{
+			if (slots[i].errcode != FZ_ERROR_NONE)
+			{
+				errcode = slots[i].errcode;
+				fz_strlcpy(message, slots[i].message, sizeof message);
+				break;
+			}
+		}
+
+		fz_free(ctx, args);
+		fz_free(ctx, slots);
+	}
+
+	if (errcode != FZ_ERROR_NONE)
+		fz_throw(ctx, errcode, "%s", message);
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
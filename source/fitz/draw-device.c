@@ -3141,6 +3141,7 @@ const char *fz_draw_options_usage =
 	"\t\taaN=antialias with N bits (0 to 8)\n"
 	"\t\tcop=center of pixel\n"
 	"\t\tapp=any part of pixel\n"
+	"\tband-height=N: render and write pages N rows at a time (png, pnm, pam, psd and pwg)\n"
 	"\n";
 
 static int parse_aa_opts(const char *val)
@@ -3173,6 +3174,7 @@ fz_parse_draw_options(fz_context *ctx, fz_draw_options *opts, const char *args)
 	opts->alpha = 0;
 	opts->graphics = fz_aa_level(ctx);
 	opts->text = fz_text_aa_level(ctx);
+	opts->band_height = 0;
 
 	if (fz_has_option(ctx, args, "rotate", &val))
 		opts->rotate = fz_atoi(val);
@@ -3203,28 +3205,22 @@ fz_parse_draw_options(fz_context *ctx, fz_draw_options *opts, const char *args)
 		opts->text = opts->graphics = parse_aa_opts(val);
 	if (fz_has_option(ctx, args, "text", &val))
 		opts->text = parse_aa_opts(val);
+	if (fz_has_option(ctx, args, "band-height", &val))
+		opts->band_height = fz_atoi(val);
 
 	/* Sanity check values */
 	if (opts->x_resolution <= 0) opts->x_resolution = 96;
 	if (opts->y_resolution <= 0) opts->y_resolution = 96;
 	if (opts->width < 0) opts->width = 0;
 	if (opts->height < 0) opts->height = 0;
+	if (opts->band_height < 0) opts->band_height = 0;
 
 	return opts;
 }
 
-/*
-
-	Create a new pixmap and draw device, using the specified options.
-
-	options: Options to configure the draw device, and choose the resolution and colorspace.
-	mediabox: The bounds of the page in points.
-	pixmap: An out parameter containing the newly created pixmap.
-*/
-fz_device *
-fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz_rect mediabox, fz_pixmap **pixmap)
+static fz_matrix
+draw_options_transform(const fz_draw_options *opts, fz_rect mediabox)
 {
-	fz_aa_context aa = ctx->aa;
 	float x_zoom = opts->x_resolution / 72.0f;
 	float y_zoom = opts->y_resolution / 72.0f;
 	float page_w = mediabox.x1 - mediabox.x0;
@@ -3232,12 +3228,6 @@ fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz
 	float w = opts->width;
 	float h = opts->height;
 	float x_scale, y_scale;
-	fz_matrix transform;
-	fz_irect bbox;
-	fz_device *dev;
-
-	fz_set_rasterizer_graphics_aa_level(ctx, &aa, opts->graphics);
-	fz_set_rasterizer_text_aa_level(ctx, &aa, opts->text);
 
 	if (w > 0)
 	{
@@ -3258,7 +3248,29 @@ fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz
 		y_scale = floorf(page_h * y_zoom + 0.5f) / page_h;
 	}
 
-	transform = fz_pre_rotate(fz_scale(x_scale, y_scale), opts->rotate);
+	return fz_pre_rotate(fz_scale(x_scale, y_scale), opts->rotate);
+}
+
+/*
+
+	Create a new pixmap and draw device, using the specified options.
+
+	options: Options to configure the draw device, and choose the resolution and colorspace.
+	mediabox: The bounds of the page in points.
+	pixmap: An out parameter containing the newly created pixmap.
+*/
+fz_device *
+fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz_rect mediabox, fz_pixmap **pixmap)
+{
+	fz_aa_context aa = ctx->aa;
+	fz_matrix transform;
+	fz_irect bbox;
+	fz_device *dev;
+
+	fz_set_rasterizer_graphics_aa_level(ctx, &aa, opts->graphics);
+	fz_set_rasterizer_text_aa_level(ctx, &aa, opts->text);
+
+	transform = draw_options_transform(opts, mediabox);
 	bbox = fz_irect_from_rect(fz_transform_rect(mediabox, transform));
 
 	*pixmap = fz_new_pixmap_with_bbox(ctx, opts->colorspace, bbox, NULL, opts->alpha);
@@ -3280,3 +3292,74 @@ fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, fz
 	}
 	return dev;
 }
+
+/*
+	Render a display list as fz_new_draw_device_with_options would
+	render the page it was recorded from, band_height rows at a time
+	(from the options), passing each band on to a band writer.
+
+	Only a single band of pixels is held at a time, so pages can be
+	written at resolutions where the whole page would not fit in
+	memory. A band_height of zero renders the page in one band.
+
+	pagenum: The page number to pass to the band writer.
+*/
+void
+fz_write_display_list_as_bands(fz_context *ctx, fz_band_writer *writer, fz_display_list *list, const fz_draw_options *opts, int pagenum)
+{
+	fz_aa_context aa = ctx->aa;
+	fz_rect mediabox = fz_bound_display_list(ctx, list);
+	fz_matrix transform;
+	fz_irect bbox, band;
+	fz_pixmap *pix;
+	fz_device *dev = NULL;
+	int w, h, band_height, y;
+
+	fz_var(dev);
+
+	fz_set_rasterizer_graphics_aa_level(ctx, &aa, opts->graphics);
+	fz_set_rasterizer_text_aa_level(ctx, &aa, opts->text);
+
+	transform = draw_options_transform(opts, mediabox);
+	bbox = fz_irect_from_rect(fz_transform_rect(mediabox, transform));
+	w = bbox.x1 - bbox.x0;
+	h = bbox.y1 - bbox.y0;
+	band_height = opts->band_height > 0 ? fz_mini(opts->band_height, h) : h;
+
+	pix = fz_new_pixmap(ctx, opts->colorspace, w, fz_maxi(band_height, 1), NULL, opts->alpha);
+	fz_try(ctx)
+	{
+		fz_set_pixmap_resolution(ctx, pix, opts->x_resolution, opts->y_resolution);
+		fz_write_header(ctx, writer, w, h, pix->n, pix->alpha, opts->x_resolution, opts->y_resolution, pagenum, opts->colorspace, NULL);
+
+		for (y = 0; y < h; y += band_height)
+		{
+			band = bbox;
+			band.y0 = bbox.y0 + y;
+			band.y1 = fz_mini(band.y0 + band_height, bbox.y1);
+			pix->x = band.x0;
+			pix->y = band.y0;
+			pix->h = band.y1 - band.y0;
+
+			if (opts->alpha)
+				fz_clear_pixmap(ctx, pix);
+			else
+				fz_clear_pixmap_with_value(ctx, pix, 255);
+
+			dev = new_draw_device(ctx, fz_identity, pix, &aa, NULL, NULL);
+			fz_run_display_list(ctx, list, dev, transform, fz_rect_from_irect(band), NULL);
+			fz_close_device(ctx, dev);
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+
+			fz_write_band(ctx, writer, pix->stride, pix->h, pix->samples);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
@@ -1,8 +1,9 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
 #include "draw-imp.h"
 
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 enum { MAXN = 2 + FZ_MAX_COLORS };
 
@@ -98,8 +99,14 @@ static inline void step_edge(edge_data *edge, int n)
 	}
 }
 
+/*
+ * Only the rows from band_y0 up to band_y1 are painted, but the edges
+ * are always walked from the top of the scissor rect, exactly as when
+ * painting the whole triangle, so painting in bands gives the same
+ * pixels as painting serially.
+ */
 static void
-fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
+fz_paint_triangle_rows(fz_pixmap *pix, float *v[3], int n, fz_irect bbox, int band_y0, int band_y1)
 {
 	edge_data e0, e1;
 	int top, mid, bot;
@@ -116,6 +123,10 @@ fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
 	if (v[bot][1] < bbox.y0) return;
 	if (v[top][1] > bbox.y1) return;
 
+	/* Or outside the band */
+	if (v[bot][1] < band_y0) return;
+	if (v[top][1] > band_y1) return;
+
 	/* Magic! Ensure that mid/top/bot are all different */
 	mid = 3^top^bot;
 
@@ -135,7 +146,10 @@ fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
 
 		do
 		{
-			paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
+			if (y >= band_y1)
+				return;
+			if (y >= band_y0)
+				paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
 			step_edge(&e0, n);
 			step_edge(&e1, n);
 			y ++;
@@ -150,7 +164,10 @@ fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
 
 		do
 		{
-			paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
+			if (y >= band_y1)
+				return;
+			if (y >= band_y0)
+				paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
 			y ++;
 			if (y >= y1)
 				break;
@@ -161,14 +178,298 @@ fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
 	}
 }
 
+static void
+fz_paint_triangle(fz_pixmap *pix, float *v[3], int n, fz_irect bbox)
+{
+	fz_paint_triangle_rows(pix, v, n, bbox, bbox.y0, bbox.y1);
+}
+
+/*
+ * When a job runner is available, triangles are collected into a
+ * batch and then painted in horizontal bands of the destination,
+ * one job per band. Each band paints the whole batch in order, so
+ * overlapping triangles resolve the same way as when painting
+ * serially, and bands never touch each other's rows. The output is
+ * the same whatever the number of bands.
+ */
+
+enum
+{
+	MESH_BATCH_TRIANGLES = 16384,
+	MESH_BAND_MIN_ROWS = 16
+};
+
+typedef struct fz_shade_mesh_s fz_shade_mesh;
+
 struct paint_tri_data
 {
 	const fz_shade *shade;
 	fz_pixmap *dest;
 	fz_irect bbox;
 	fz_color_converter cc;
+	float *batch;
+	int batch_len;
+	int vn;
+	fz_shade_mesh *mesh;
+};
+
+typedef struct
+{
+	fz_pixmap *dest;
+	fz_irect bbox;
+	int y0, y1;
+	const float *batch;
+	int count;
+	int vn;
+} mesh_band;
+
+static void
+paint_mesh_band(fz_context *ctx, void *band_)
+{
+	mesh_band *band = band_;
+	float *v[3];
+	int i;
+
+	for (i = 0; i < band->count; i++)
+	{
+		v[0] = (float *)band->batch + (i * 3 + 0) * band->vn;
+		v[1] = (float *)band->batch + (i * 3 + 1) * band->vn;
+		v[2] = (float *)band->batch + (i * 3 + 2) * band->vn;
+		fz_paint_triangle_rows(band->dest, v, band->vn, band->bbox, band->y0, band->y1);
+	}
+}
+
+static void
+flush_triangle_batch(fz_context *ctx, struct paint_tri_data *ptd)
+{
+	fz_irect bbox = ptd->bbox;
+	int h = bbox.y1 - bbox.y0;
+	int count = fz_mini(fz_job_threads(ctx) * 2, fz_maxi(h / MESH_BAND_MIN_ROWS, 1));
+	mesh_band *bands;
+	void **jobs;
+	int i, y;
+
+	if (ptd->batch_len == 0)
+		return;
+
+	bands = fz_malloc_array(ctx, count, mesh_band);
+	fz_try(ctx)
+	{
+		jobs = fz_malloc_array(ctx, count, void *);
+		for (i = 0, y = bbox.y0; i < count; i++)
+		{
+			int rows = (bbox.y1 - y) / (count - i);
+			bands[i].dest = ptd->dest;
+			bands[i].bbox = bbox;
+			bands[i].y0 = y;
+			bands[i].y1 = y + rows;
+			bands[i].batch = ptd->batch;
+			bands[i].count = ptd->batch_len;
+			bands[i].vn = ptd->vn;
+			jobs[i] = &bands[i];
+			y += rows;
+		}
+		fz_try(ctx)
+			fz_run_jobs(ctx, count, paint_mesh_band, jobs);
+		fz_always(ctx)
+			fz_free(ctx, jobs);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, bands);
+		ptd->batch_len = 0;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/*
+ * Shadings other than axial ones tessellate the same way whatever the
+ * clip, and the tessellation only depends on the translation of the
+ * ctm by an offset. The device space triangles, with their colors
+ * already converted for the destination, are kept in the store keyed
+ * on the shade, the colorspaces, the color params and the linear part
+ * of the ctm, so that drawing the same shade again at the same zoom
+ * (another band, a panned or redrawn page) only has to rasterise them.
+ */
+
+enum { MAX_SHADE_MESH_TRIANGLES = 131072 };
+
+struct fz_shade_mesh_s
+{
+	fz_storable storable;
+	float e, f;
+	int vn;
+	int count;
+	int cap;
+	float *tris;
+};
+
+typedef struct fz_shade_mesh_key_s fz_shade_mesh_key;
+
+struct fz_shade_mesh_key_s
+{
+	int refs;
+	fz_shade *shade;
+	fz_colorspace *src;
+	fz_colorspace *dst;
+	fz_color_params color_params;
+	float a, b, c, d;
+	int vn;
+};
+
+static void
+fz_drop_shade_mesh_imp(fz_context *ctx, fz_storable *mesh_)
+{
+	fz_shade_mesh *mesh = (fz_shade_mesh *)mesh_;
+	fz_free(ctx, mesh->tris);
+	fz_free(ctx, mesh);
+}
+
+static int
+fz_make_hash_shade_mesh_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_shade_mesh_key *key = (fz_shade_mesh_key *)key_;
+	hash->u.pi.ptr = key->shade;
+	hash->u.pi.i = key->vn;
+	return 1;
+}
+
+static void *
+fz_keep_shade_mesh_key(fz_context *ctx, void *key_)
+{
+	fz_shade_mesh_key *key = (fz_shade_mesh_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_shade_mesh_key(fz_context *ctx, void *key_)
+{
+	fz_shade_mesh_key *key = (fz_shade_mesh_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_shade_store_key(ctx, key->shade);
+		fz_drop_colorspace_store_key(ctx, key->src);
+		fz_drop_colorspace_store_key(ctx, key->dst);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_shade_mesh_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_shade_mesh_key *k0 = (fz_shade_mesh_key *)k0_;
+	fz_shade_mesh_key *k1 = (fz_shade_mesh_key *)k1_;
+	return k0->shade == k1->shade &&
+		k0->src == k1->src &&
+		k0->dst == k1->dst &&
+		k0->color_params.ri == k1->color_params.ri &&
+		k0->color_params.bp == k1->color_params.bp &&
+		k0->color_params.op == k1->color_params.op &&
+		k0->color_params.opm == k1->color_params.opm &&
+		k0->a == k1->a && k0->b == k1->b &&
+		k0->c == k1->c && k0->d == k1->d &&
+		k0->vn == k1->vn;
+}
+
+static void
+fz_format_shade_mesh_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	fz_shade_mesh_key *key = (fz_shade_mesh_key *)key_;
+	fz_snprintf(s, n, "(shade mesh %p [%g %g %g %g])", key->shade, key->a, key->b, key->c, key->d);
+}
+
+static int
+fz_needs_reap_shade_mesh_key(fz_context *ctx, void *key_)
+{
+	fz_shade_mesh_key *key = (fz_shade_mesh_key *)key_;
+	return key->shade->key_storable.store_key_refs == key->shade->key_storable.storable.refs ||
+		(key->src && key->src->key_storable.store_key_refs == key->src->key_storable.storable.refs) ||
+		(key->dst && key->dst->key_storable.store_key_refs == key->dst->key_storable.storable.refs);
+}
+
+static const fz_store_type fz_shade_mesh_store_type =
+{
+	fz_make_hash_shade_mesh_key,
+	fz_keep_shade_mesh_key,
+	fz_drop_shade_mesh_key,
+	fz_cmp_shade_mesh_key,
+	fz_format_shade_mesh_key,
+	fz_needs_reap_shade_mesh_key
 };
 
+static void
+fz_init_shade_mesh_key(fz_shade_mesh_key *key, fz_shade *shade, fz_colorspace *src, fz_colorspace *dst, fz_color_params color_params, fz_matrix ctm, int vn)
+{
+	key->refs = 1;
+	key->shade = shade;
+	key->src = src;
+	key->dst = dst;
+	key->color_params = color_params;
+	key->a = ctm.a;
+	key->b = ctm.b;
+	key->c = ctm.c;
+	key->d = ctm.d;
+	key->vn = vn;
+}
+
+static void
+fz_store_shade_mesh(fz_context *ctx, fz_shade_mesh *mesh, fz_shade *shade, fz_colorspace *src, fz_colorspace *dst, fz_color_params color_params, fz_matrix ctm)
+{
+	fz_shade_mesh_key *key = NULL;
+	fz_shade_mesh *old_mesh;
+
+	fz_var(key);
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, fz_shade_mesh_key);
+		fz_init_shade_mesh_key(key, shade, src, dst, color_params, ctm, mesh->vn);
+		fz_keep_shade_store_key(ctx, shade);
+		fz_keep_colorspace_store_key(ctx, src);
+		fz_keep_colorspace_store_key(ctx, dst);
+		old_mesh = fz_store_item(ctx, key, mesh, sizeof *mesh + (size_t)mesh->count * 3 * mesh->vn * sizeof(float), &fz_shade_mesh_store_type);
+		if (old_mesh)
+			fz_drop_storable(ctx, &old_mesh->storable);
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			fz_drop_shade_mesh_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		/* Failing to cache the mesh is not fatal. */
+		fz_warn(ctx, "cannot store shade mesh");
+	}
+}
+
+/* Returns 0 (and gives up on recording) if the mesh gets too big. */
+static int
+record_mesh_triangle(fz_context *ctx, fz_shade_mesh *mesh, float *v[3])
+{
+	int tn = 3 * mesh->vn;
+
+	if (mesh->count == mesh->cap)
+	{
+		int cap = mesh->cap ? mesh->cap * 2 : 256;
+		if (cap > MAX_SHADE_MESH_TRIANGLES)
+			return 0;
+		fz_try(ctx)
+			mesh->tris = fz_realloc_array(ctx, mesh->tris, (size_t)cap * tn, float);
+		fz_catch(ctx)
+			return 0;
+		mesh->cap = cap;
+	}
+	memcpy(mesh->tris + mesh->count * tn, v[0], mesh->vn * sizeof(float));
+	memcpy(mesh->tris + mesh->count * tn + mesh->vn, v[1], mesh->vn * sizeof(float));
+	memcpy(mesh->tris + mesh->count * tn + 2 * mesh->vn, v[2], mesh->vn * sizeof(float));
+	mesh->count++;
+	return 1;
+}
+
 static void
 prepare_mesh_vertex(fz_context *ctx, void *arg, fz_vertex *v, const float *input)
 {
@@ -207,8 +508,46 @@ do_paint_tri(fz_context *ctx, void *arg, fz_vertex *av, fz_vertex *bv, fz_vertex
 	vertices[1] = (float *)bv;
 	vertices[2] = (float *)cv;
 
+	if (ptd->mesh && !record_mesh_triangle(ctx, ptd->mesh, vertices))
+	{
+		fz_drop_storable(ctx, &ptd->mesh->storable);
+		ptd->mesh = NULL;
+	}
+
 	dest = ptd->dest;
-	fz_paint_triangle(dest, vertices, 2 + dest->n - dest->alpha, ptd->bbox);
+	if (ptd->batch)
+	{
+		float *b = ptd->batch + ptd->batch_len * 3 * ptd->vn;
+		memcpy(b, vertices[0], ptd->vn * sizeof(float));
+		memcpy(b + ptd->vn, vertices[1], ptd->vn * sizeof(float));
+		memcpy(b + 2 * ptd->vn, vertices[2], ptd->vn * sizeof(float));
+		if (++ptd->batch_len == MESH_BATCH_TRIANGLES)
+			flush_triangle_batch(ctx, ptd);
+	}
+	else
+		fz_paint_triangle(dest, vertices, 2 + dest->n - dest->alpha, ptd->bbox);
+}
+
+static void
+replay_shade_mesh(fz_context *ctx, const fz_shade_mesh *mesh, fz_matrix ctm, struct paint_tri_data *ptd)
+{
+	float v[3][MAXN];
+	float dx = ctm.e - mesh->e;
+	float dy = ctm.f - mesh->f;
+	const float *t = mesh->tris;
+	int i, k;
+
+	for (i = 0; i < mesh->count; i++)
+	{
+		for (k = 0; k < 3; k++)
+		{
+			memcpy(v[k], t, mesh->vn * sizeof(float));
+			v[k][0] += dx;
+			v[k][1] += dy;
+			t += mesh->vn;
+		}
+		do_paint_tri(ctx, ptd, (fz_vertex *)v[0], (fz_vertex *)v[1], (fz_vertex *)v[2]);
+	}
 }
 
 /*
@@ -239,11 +578,14 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, fz_colorspace *colorspace, fz_m
 	fz_color_converter cc = { 0 };
 	float color[FZ_MAX_COLORS];
 	struct paint_tri_data ptd = { 0 };
+	fz_shade_mesh_key key;
+	fz_shade_mesh *mesh = NULL;
 	int i, k;
 	fz_matrix local_ctm;
 
 	fz_var(temp);
 	fz_var(conv);
+	fz_var(mesh);
 
 	if (colorspace == NULL)
 		colorspace = shade->colorspace;
@@ -270,7 +612,34 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, fz_colorspace *colorspace, fz_m
 		if (temp->colorspace)
 			fz_init_cached_color_converter(ctx, &ptd.cc, colorspace, temp->colorspace, NULL, color_params);
 
-		fz_process_shade(ctx, shade, local_ctm, fz_rect_from_irect(bbox), prepare_mesh_vertex, &do_paint_tri, &ptd);
+		ptd.vn = 2 + temp->n - temp->alpha;
+		if (fz_job_threads(ctx) > 1 && bbox.y1 - bbox.y0 >= 2 * MESH_BAND_MIN_ROWS)
+			ptd.batch = fz_malloc_array(ctx, MESH_BATCH_TRIANGLES * 3 * ptd.vn, float);
+
+		/* Axial shadings are tessellated to fit the clip, so can't be reused. */
+		if (shade->type != FZ_LINEAR)
+		{
+			fz_init_shade_mesh_key(&key, shade, colorspace, temp->colorspace, color_params, local_ctm, ptd.vn);
+			mesh = fz_find_item(ctx, fz_drop_shade_mesh_imp, &key, &fz_shade_mesh_store_type);
+			if (!mesh)
+			{
+				ptd.mesh = fz_malloc_struct(ctx, fz_shade_mesh);
+				FZ_INIT_STORABLE(ptd.mesh, 1, fz_drop_shade_mesh_imp);
+				ptd.mesh->e = local_ctm.e;
+				ptd.mesh->f = local_ctm.f;
+				ptd.mesh->vn = ptd.vn;
+			}
+		}
+
+		if (mesh)
+			replay_shade_mesh(ctx, mesh, local_ctm, &ptd);
+		else
+		{
+			fz_process_shade(ctx, shade, local_ctm, fz_rect_from_irect(bbox), prepare_mesh_vertex, &do_paint_tri, &ptd);
+			if (ptd.mesh)
+				fz_store_shade_mesh(ctx, ptd.mesh, shade, colorspace, temp->colorspace, color_params, local_ctm);
+		}
+		flush_triangle_batch(ctx, &ptd);
 
 		if (shade->use_function)
 		{
@@ -388,6 +757,11 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, fz_colorspace *colorspace, fz_m
 			fz_drop_pixmap(ctx, conv);
 		}
 		fz_fin_cached_color_converter(ctx, &ptd.cc);
+		fz_free(ctx, ptd.batch);
+		if (mesh)
+			fz_drop_storable(ctx, &mesh->storable);
+		if (ptd.mesh)
+			fz_drop_storable(ctx, &ptd.mesh->storable);
 	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
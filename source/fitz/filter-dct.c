@@ -20,6 +20,9 @@ struct fz_dctd_s
 	int init;
 	int stride;
 	int l2factor;
+	int crop;
+	fz_irect area;
+	int skip_x;
 	unsigned char *scanline;
 	unsigned char *rp, *wp;
 	struct jpeg_decompress_struct cinfo;
@@ -151,6 +154,38 @@ static void skip_input_data_dct(j_decompress_ptr cinfo, long num_bytes)
 	}
 }
 
+/*
+	Clamp the requested area to the output image, and when libjpeg
+	can do it, restrict decoding to the iMCU columns that cover it.
+	skip_x is left as the number of pixels to drop at the start of
+	each scanline that is read.
+*/
+static void
+start_dctd_area(fz_context *ctx, fz_dctd *state)
+{
+	j_decompress_ptr cinfo = &state->cinfo;
+
+	state->area = fz_intersect_irect(state->area, fz_make_irect(0, 0, cinfo->output_width, cinfo->output_height));
+	if (fz_is_empty_irect(state->area))
+	{
+		state->area = fz_make_irect(0, 0, 0, 0);
+		state->skip_x = 0;
+		return;
+	}
+
+#ifdef LIBJPEG_TURBO_VERSION
+	if (state->area.x0 > 0 || state->area.x1 < (int)cinfo->output_width)
+	{
+		JDIMENSION x = state->area.x0;
+		JDIMENSION w = state->area.x1 - state->area.x0;
+		jpeg_crop_scanline(cinfo, &x, &w);
+		state->skip_x = state->area.x0 - x;
+		return;
+	}
+#endif
+	state->skip_x = state->area.x0;
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 {
@@ -233,10 +268,24 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 
 			jpeg_start_decompress(cinfo);
 
+			if (state->crop)
+				start_dctd_area(ctx, state);
+
 			state->stride = cinfo->output_width * cinfo->output_components;
 			state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
 			state->rp = state->scanline;
 			state->wp = state->scanline;
+
+			if (state->crop)
+			{
+#ifdef LIBJPEG_TURBO_VERSION
+				jpeg_skip_scanlines(cinfo, state->area.y0);
+#else
+				while (cinfo->output_scanline < (JDIMENSION)state->area.y0)
+					jpeg_read_scanlines(cinfo, &state->scanline, 1);
+#endif
+				state->stride = (state->area.x1 - state->area.x0) * cinfo->output_components;
+			}
 		}
 
 		while (state->rp < state->wp && p < ep)
@@ -247,7 +296,15 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 			if (cinfo->output_scanline == cinfo->output_height)
 				break;
 
-			if (p + state->stride <= ep)
+			if (state->crop)
+			{
+				if (cinfo->output_scanline >= (JDIMENSION)state->area.y1)
+					break;
+				jpeg_read_scanlines(cinfo, &state->scanline, 1);
+				state->rp = state->scanline + state->skip_x * cinfo->output_components;
+				state->wp = state->rp + state->stride;
+			}
+			else if (p + state->stride <= ep)
 			{
 				jpeg_read_scanlines(cinfo, &p, 1);
 				p += state->stride;
@@ -312,9 +369,8 @@ close_dctd(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
-/* Default: color_transform = -1 (unset), l2factor = 0, jpegtables = NULL */
-fz_stream *
-fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables)
+static fz_stream *
+open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables, const fz_irect *area)
 {
 	fz_dctd *state = fz_malloc_struct(ctx, fz_dctd);
 	j_decompress_ptr cinfo = &state->cinfo;
@@ -332,6 +388,11 @@ fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2facto
 	state->color_transform = color_transform;
 	state->init = 0;
 	state->l2factor = l2factor;
+	if (area)
+	{
+		state->crop = 1;
+		state->area = *area;
+	}
 	state->chain = fz_keep_stream(ctx, chain);
 	state->jpegtables = fz_keep_stream(ctx, jpegtables);
 	state->curr_stm = state->chain;
@@ -343,3 +404,24 @@ fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2facto
 
 	return fz_new_stream(ctx, state, next_dctd, close_dctd);
 }
+
+/* Default: color_transform = -1 (unset), l2factor = 0, jpegtables = NULL */
+fz_stream *
+fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables)
+{
+	return open_dctd(ctx, chain, color_transform, l2factor, jpegtables, NULL);
+}
+
+/*
+	Open a DCT decode filter that only returns the pixels within
+	area, given in the (possibly reduced by l2factor) output
+	resolution. Rows above the area are skipped rather than
+	returned, and the stream ends after the last row of the area.
+	With libjpeg-turbo, the skipped rows and the columns outside
+	the area are not fully decoded either.
+*/
+fz_stream *
+fz_open_dctd_subarea(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables, fz_irect area)
+{
+	return open_dctd(ctx, chain, color_transform, l2factor, jpegtables, &area);
+}
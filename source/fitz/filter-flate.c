@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <zlib.h>
 
@@ -10,6 +11,9 @@ struct fz_inflate_state_s
 {
 	fz_stream *chain;
 	z_stream z;
+	int window_bits;
+	int tried_one_shot;
+	unsigned char *one_shot;
 	unsigned char buffer[4096];
 };
 
@@ -23,6 +27,658 @@ void fz_zlib_free(void *ctx, void *ptr)
 	fz_free(ctx, ptr);
 }
 
+#if FZ_ENABLE_FAST_INFLATE
+
+/*
+	One-shot inflater.
+
+	When all of the compressed data is already in memory (as it is
+	for images and other streams loaded into buffers, and for
+	small streams read from a file) we can decode it in one go into
+	a single output buffer. That avoids most of the bookkeeping
+	that zlib needs to be able to stop and resume anywhere: the
+	bit buffer is 64 bits wide and is refilled a word at a time,
+	codes are looked up in two-level tables, and matches are
+	copied 8 bytes at a time into the slack at the end of the
+	output buffer.
+
+	It is deliberately strict. On anything that is not a complete,
+	well formed stream it gives up, and the caller starts over with
+	zlib, which then produces exactly the output and warnings that
+	it always did.
+*/
+
+#define LITLEN_BITS 10
+#define DIST_BITS 8
+#define PRECODE_BITS 7
+
+/* Worst case table sizes for the above, as computed by zlib's 'enough'. */
+#define LITLEN_ENOUGH 1332
+#define DIST_ENOUGH 402
+#define PRECODE_ENOUGH 128
+
+/* Table entries are value << 16 | op << 8 | number of bits in the code. */
+#define OP_LITERAL 0x00
+#define OP_BASE 0x10 /* low bits are the number of extra bits */
+#define OP_END 0x20
+#define OP_LINK 0x40 /* low bits are the subtable index bits */
+#define OP_INVALID 0x80
+
+enum { KIND_PRECODE, KIND_LITLEN, KIND_DIST };
+
+/* Room for the longest match plus the overrun of the 8 byte copies. */
+#define ONE_SHOT_SLOP (258 + 16)
+
+/* Beyond this, fall back to streaming rather than hold it all at once. */
+#define ONE_SHOT_MAX (64 << 20)
+
+static const unsigned short len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const unsigned char dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const unsigned char precode_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef struct
+{
+	fz_context *ctx;
+	const unsigned char *in;
+	size_t inlen, pos;
+	uint64_t bitbuf;
+	unsigned int bitsleft;
+	unsigned char *out;
+	size_t outlen, outcap;
+	uint32_t litlen[LITLEN_ENOUGH];
+	uint32_t dist[DIST_ENOUGH];
+	uint32_t precode[PRECODE_ENOUGH];
+	unsigned char lens[286 + 30];
+} fz_inflater;
+
+static inline uint64_t
+load64le(const unsigned char *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/*
+	Top up the bit buffer to at least 56 bits. While there are 8
+	bytes of input left this is a single unaligned load; the bits
+	above bitsleft then hold the start of the next byte, which the
+	next load puts back in the same place. Near the end of the
+	input we go byte by byte and pad with zeros, giving up as soon
+	as we would need more than the padding.
+*/
+#define REFILL() \
+	do { \
+		if (pos + 8 <= inlen) \
+		{ \
+			bitbuf |= load64le(in + pos) << bitsleft; \
+			pos += (63 - bitsleft) >> 3; \
+			bitsleft |= 56; \
+		} \
+		else \
+		{ \
+			while (bitsleft <= 56) \
+			{ \
+				if (pos < inlen) \
+					bitbuf |= (uint64_t)in[pos] << bitsleft; \
+				pos++; \
+				bitsleft += 8; \
+			} \
+			if (pos > inlen + 8) \
+				goto fail; \
+		} \
+	} while (0)
+
+#define BITS(n) ((uint32_t)bitbuf & ((1U << (n)) - 1))
+#define DROP(n) do { bitbuf >>= (n); bitsleft -= (n); } while (0)
+
+/* Look up the next code in a two-level table, and consume its bits. */
+#define DECODE(e, table, tablebits) \
+	do { \
+		e = table[BITS(tablebits)]; \
+		if (e & (OP_LINK << 8)) \
+		{ \
+			DROP(tablebits); \
+			e = table[(e >> 16) + BITS((e >> 8) & 15)]; \
+		} \
+		DROP(e & 0xff); \
+	} while (0)
+
+static uint32_t
+symbol_entry(int kind, int sym)
+{
+	if (kind == KIND_LITLEN)
+	{
+		if (sym < 256)
+			return (uint32_t)sym << 16 | OP_LITERAL << 8;
+		if (sym == 256)
+			return OP_END << 8;
+		sym -= 257;
+		if (sym >= 29)
+			return OP_INVALID << 8;
+		return (uint32_t)len_base[sym] << 16 | (OP_BASE | len_extra[sym]) << 8;
+	}
+	if (kind == KIND_DIST)
+	{
+		if (sym >= 30)
+			return OP_INVALID << 8;
+		return (uint32_t)dist_base[sym] << 16 | (OP_BASE | dist_extra[sym]) << 8;
+	}
+	return (uint32_t)sym << 16;
+}
+
+/*
+	Build a lookup table for the canonical Huffman code with the
+	given code lengths. Codes longer than tablebits go in subtables
+	hanging off the main table. Accepts exactly the codes that zlib
+	does: no over-subscribed codes, and no incomplete ones except a
+	literal/length or distance code with a single one bit code.
+*/
+static int
+build_table(uint32_t *table, int tablebits, int enough, const unsigned char *lens, int n, int kind)
+{
+	unsigned short count[16], offs[16], sorted[288];
+	int sym, len, max, left, total, i, j;
+	int used, sub = 0, subbits = 0, low = -1;
+	unsigned int code, rev;
+
+	memset(count, 0, sizeof count);
+	for (sym = 0; sym < n; sym++)
+		count[lens[sym]]++;
+	count[0] = 0;
+
+	for (i = 0; i < (1 << tablebits); i++)
+		table[i] = OP_INVALID << 8;
+
+	for (max = 15; max > 0 && count[max] == 0; max--)
+		;
+	if (max == 0)
+		return 0;
+
+	left = 1;
+	for (len = 1; len <= 15; len++)
+	{
+		left <<= 1;
+		left -= count[len];
+		if (left < 0)
+			return -1;
+	}
+	if (left > 0 && (kind == KIND_PRECODE || max != 1))
+		return -1;
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + count[len];
+	total = offs[15] + count[15];
+	for (sym = 0; sym < n; sym++)
+		if (lens[sym] != 0)
+			sorted[offs[lens[sym]]++] = sym;
+
+	/* Assign the codes in canonical order, shortest first. */
+	used = 1 << tablebits;
+	code = 0;
+	len = 0;
+	for (i = 0; i < total; i++)
+	{
+		uint32_t entry;
+
+		sym = sorted[i];
+		code <<= lens[sym] - len;
+		len = lens[sym];
+
+		for (rev = 0, j = 0; j < len; j++)
+			rev |= ((code >> j) & 1) << (len - 1 - j);
+		code++;
+
+		entry = symbol_entry(kind, sym);
+		if (len <= tablebits)
+		{
+			for (j = rev; j < (1 << tablebits); j += 1 << len)
+				table[j] = entry | len;
+		}
+		else
+		{
+			int prefix = rev & ((1 << tablebits) - 1);
+			if (prefix != low)
+			{
+				/* Make the subtable just big enough for the codes that share this prefix. */
+				int curr = len - tablebits;
+				int room = 1 << curr;
+				while (curr + tablebits < max)
+				{
+					room -= count[curr + tablebits];
+					if (room <= 0)
+						break;
+					curr++;
+					room <<= 1;
+				}
+				if (used + (1 << curr) > enough)
+					return -1;
+				sub = used;
+				subbits = curr;
+				used += 1 << curr;
+				for (j = 0; j < (1 << curr); j++)
+					table[sub + j] = OP_INVALID << 8;
+				table[prefix] = (uint32_t)sub << 16 | (OP_LINK | subbits) << 8 | tablebits;
+				low = prefix;
+			}
+			for (j = rev >> tablebits; j < (1 << subbits); j += 1 << (len - tablebits))
+				table[sub + j] = entry | (len - tablebits);
+		}
+		count[len]--;
+	}
+
+	return 0;
+}
+
+static int
+grow_output(fz_inflater *z, size_t need)
+{
+	size_t cap = z->outcap;
+	unsigned char *out;
+
+	while (cap - z->outlen < need)
+		cap *= 2;
+	if (cap > ONE_SHOT_MAX)
+		return -1;
+	out = fz_realloc_no_throw(z->ctx, z->out, cap);
+	if (!out)
+		return -1;
+	z->out = out;
+	z->outcap = cap;
+	return 0;
+}
+
+/* Decode one block with the current tables. */
+static int
+inflate_block(fz_inflater *z)
+{
+	const unsigned char *in = z->in;
+	size_t inlen = z->inlen;
+	size_t pos = z->pos;
+	uint64_t bitbuf = z->bitbuf;
+	unsigned int bitsleft = z->bitsleft;
+	const uint32_t *litlen = z->litlen;
+	const uint32_t *dist = z->dist;
+	unsigned char *out = z->out;
+	size_t o = z->outlen;
+	size_t cap = z->outcap;
+	uint32_t e, op;
+	size_t len, d;
+
+	for (;;)
+	{
+		if (cap - o < ONE_SHOT_SLOP)
+		{
+			z->outlen = o;
+			if (grow_output(z, ONE_SHOT_SLOP))
+				goto fail;
+			out = z->out;
+			cap = z->outcap;
+		}
+
+		/* A length and distance pair takes at most 48 bits. */
+		REFILL();
+
+		DECODE(e, litlen, LITLEN_BITS);
+		op = (e >> 8) & 0xff;
+		if (op == OP_LITERAL)
+		{
+			/* Literals come in runs; take another without refilling if we can. */
+			out[o++] = e >> 16;
+			if (bitsleft < 15)
+				continue;
+			DECODE(e, litlen, LITLEN_BITS);
+			op = (e >> 8) & 0xff;
+			if (op == OP_LITERAL)
+			{
+				out[o++] = e >> 16;
+				continue;
+			}
+			REFILL();
+		}
+		if (!(op & OP_BASE))
+		{
+			if (op == OP_END)
+				break;
+			goto fail;
+		}
+		len = (e >> 16) + BITS(op & 15);
+		DROP(op & 15);
+
+		DECODE(e, dist, DIST_BITS);
+		op = (e >> 8) & 0xff;
+		if (!(op & OP_BASE))
+			goto fail;
+		d = (e >> 16) + BITS(op & 15);
+		DROP(op & 15);
+		if (d > o)
+			goto fail;
+
+		{
+			unsigned char *dst = out + o;
+			const unsigned char *src = dst - d;
+			unsigned char *end = dst + len;
+			o += len;
+			if (d >= 8)
+			{
+				do
+				{
+					memcpy(dst, src, 8);
+					dst += 8;
+					src += 8;
+				}
+				while (dst < end);
+			}
+			else if (d == 1)
+				memset(dst, *src, len);
+			else
+			{
+				do
+					*dst++ = *src++;
+				while (dst < end);
+			}
+		}
+	}
+
+	z->pos = pos;
+	z->bitbuf = bitbuf;
+	z->bitsleft = bitsleft;
+	z->outlen = o;
+	return 0;
+
+fail:
+	return -1;
+}
+
+static int
+refill_bits(fz_inflater *z)
+{
+	const unsigned char *in = z->in;
+	size_t inlen = z->inlen;
+	size_t pos = z->pos;
+	uint64_t bitbuf = z->bitbuf;
+	unsigned int bitsleft = z->bitsleft;
+
+	REFILL();
+
+	z->pos = pos;
+	z->bitbuf = bitbuf;
+	z->bitsleft = bitsleft;
+	return 0;
+
+fail:
+	return -1;
+}
+
+/* Read n (at most 16) bits outside the block decoding loop. */
+static int
+take_bits(fz_inflater *z, int n, unsigned int *v)
+{
+	if (z->bitsleft < (unsigned int)n && refill_bits(z))
+		return -1;
+	*v = z->bitbuf & ((1U << n) - 1);
+	z->bitbuf >>= n;
+	z->bitsleft -= n;
+	return 0;
+}
+
+/* Skip to the next byte boundary and hand back any whole bytes still in the bit buffer. */
+static int
+align_input(fz_inflater *z)
+{
+	z->pos -= z->bitsleft >> 3;
+	z->bitbuf = 0;
+	z->bitsleft = 0;
+	return z->pos > z->inlen ? -1 : 0;
+}
+
+static int
+inflate_stored(fz_inflater *z)
+{
+	const unsigned char *p;
+	size_t len;
+
+	if (align_input(z) || z->inlen - z->pos < 4)
+		return -1;
+	p = z->in + z->pos;
+	len = p[0] | p[1] << 8;
+	if ((p[2] | p[3] << 8) != (~len & 0xffff))
+		return -1;
+	z->pos += 4;
+	if (z->inlen - z->pos < len)
+		return -1;
+	if (z->outcap - z->outlen < len + ONE_SHOT_SLOP && grow_output(z, len + ONE_SHOT_SLOP))
+		return -1;
+	memcpy(z->out + z->outlen, z->in + z->pos, len);
+	z->outlen += len;
+	z->pos += len;
+	return 0;
+}
+
+static int
+build_fixed_tables(fz_inflater *z)
+{
+	unsigned char *lens = z->lens;
+	int i;
+
+	for (i = 0; i < 144; i++)
+		lens[i] = 8;
+	for (; i < 256; i++)
+		lens[i] = 9;
+	for (; i < 280; i++)
+		lens[i] = 7;
+	for (; i < 288; i++)
+		lens[i] = 8;
+	if (build_table(z->litlen, LITLEN_BITS, LITLEN_ENOUGH, lens, 288, KIND_LITLEN))
+		return -1;
+	for (i = 0; i < 32; i++)
+		lens[i] = 5;
+	return build_table(z->dist, DIST_BITS, DIST_ENOUGH, lens, 32, KIND_DIST);
+}
+
+static int
+build_dynamic_tables(fz_inflater *z)
+{
+	unsigned char prelens[19];
+	unsigned char *lens = z->lens;
+	unsigned int hlit, hdist, hclen, v, rep, i, k;
+	uint32_t e;
+
+	if (take_bits(z, 5, &hlit) || take_bits(z, 5, &hdist) || take_bits(z, 4, &hclen))
+		return -1;
+	hlit += 257;
+	hdist += 1;
+	hclen += 4;
+	if (hlit > 286 || hdist > 30)
+		return -1;
+
+	memset(prelens, 0, sizeof prelens);
+	for (i = 0; i < hclen; i++)
+	{
+		if (take_bits(z, 3, &v))
+			return -1;
+		prelens[precode_order[i]] = v;
+	}
+	if (build_table(z->precode, PRECODE_BITS, PRECODE_ENOUGH, prelens, 19, KIND_PRECODE))
+		return -1;
+
+	i = 0;
+	while (i < hlit + hdist)
+	{
+		if (z->bitsleft < PRECODE_BITS && refill_bits(z))
+			return -1;
+		e = z->precode[z->bitbuf & ((1 << PRECODE_BITS) - 1)];
+		if (e & (OP_INVALID << 8))
+			return -1;
+		z->bitbuf >>= e & 0xff;
+		z->bitsleft -= e & 0xff;
+		v = e >> 16;
+		if (v < 16)
+		{
+			lens[i++] = v;
+			continue;
+		}
+		if (v == 16)
+		{
+			if (i == 0 || take_bits(z, 2, &rep))
+				return -1;
+			v = lens[i - 1];
+			rep += 3;
+		}
+		else if (v == 17)
+		{
+			if (take_bits(z, 3, &rep))
+				return -1;
+			v = 0;
+			rep += 3;
+		}
+		else
+		{
+			if (take_bits(z, 7, &rep))
+				return -1;
+			v = 0;
+			rep += 11;
+		}
+		if (i + rep > hlit + hdist)
+			return -1;
+		for (k = 0; k < rep; k++)
+			lens[i++] = v;
+	}
+
+	if (lens[256] == 0)
+		return -1;
+	if (build_table(z->litlen, LITLEN_BITS, LITLEN_ENOUGH, lens, hlit, KIND_LITLEN))
+		return -1;
+	return build_table(z->dist, DIST_BITS, DIST_ENOUGH, lens + hlit, hdist, KIND_DIST);
+}
+
+static int
+inflate_one_shot_data(fz_inflater *z, int zlib_header)
+{
+	unsigned int final, type;
+
+	if (zlib_header)
+	{
+		/* Only 32K windows; zlib treats distances beyond a smaller window differently. */
+		if (z->inlen < 2)
+			return -1;
+		if (z->in[0] != 0x78 || (z->in[0] << 8 | z->in[1]) % 31 != 0 || (z->in[1] & 0x20))
+			return -1;
+		z->pos = 2;
+	}
+
+	do
+	{
+		if (take_bits(z, 1, &final) || take_bits(z, 2, &type))
+			return -1;
+		if (type == 0)
+		{
+			if (inflate_stored(z))
+				return -1;
+		}
+		else
+		{
+			if (type == 1 ? build_fixed_tables(z) : type == 2 ? build_dynamic_tables(z) : -1)
+				return -1;
+			if (inflate_block(z))
+				return -1;
+		}
+	}
+	while (!final);
+
+	if (align_input(z))
+		return -1;
+
+	if (zlib_header)
+	{
+		const unsigned char *p = z->in + z->pos;
+		uLong check;
+		if (z->inlen - z->pos < 4)
+			return -1;
+		check = adler32(adler32(0, NULL, 0), z->out, (uInt)z->outlen);
+		if (check != ((uLong)p[0] << 24 | (uLong)p[1] << 16 | (uLong)p[2] << 8 | p[3]))
+			return -1;
+		z->pos += 4;
+	}
+
+	return 0;
+}
+
+/*
+	Try to inflate the whole of a memory stream chain as a complete
+	stream. Input that is still arriving is left to zlib, since the
+	first chunk of it is not the whole stream. On success, the output
+	is left in state->one_shot, its length returned in *len, and the
+	input used is consumed from the chain.
+*/
+static int
+inflate_one_shot(fz_context *ctx, fz_inflate_state *state, size_t *len)
+{
+	fz_stream *chain = state->chain;
+	fz_inflater *z;
+	size_t n;
+	int code;
+
+	if (state->window_bits != 15 && state->window_bits != -15)
+		return 0;
+
+	if (!fz_is_memory_stream(chain))
+		return 0;
+	n = chain->wp - chain->rp;
+	if (n == 0)
+		return 0;
+
+	z = fz_malloc_no_throw(ctx, sizeof *z);
+	if (!z)
+		return 0;
+	z->ctx = ctx;
+	z->in = chain->rp;
+	z->inlen = n;
+	z->pos = 0;
+	z->bitbuf = 0;
+	z->bitsleft = 0;
+	z->outlen = 0;
+	z->outcap = n < 4096 ? 16384 : n * 4;
+	if (z->outcap > ONE_SHOT_MAX)
+		z->outcap = ONE_SHOT_MAX;
+	z->out = fz_malloc_no_throw(ctx, z->outcap);
+
+	code = z->out ? inflate_one_shot_data(z, state->window_bits > 0) : -1;
+	if (code == 0)
+	{
+		chain->rp += z->pos;
+		state->one_shot = z->out;
+		*len = z->outlen;
+	}
+	else
+		fz_free(ctx, z->out);
+	fz_free(ctx, z);
+
+	return code == 0;
+}
+
+#endif /* FZ_ENABLE_FAST_INFLATE */
+
 static int
 next_flated(fz_context *ctx, fz_stream *stm, size_t required)
 {
@@ -36,6 +692,31 @@ next_flated(fz_context *ctx, fz_stream *stm, size_t required)
 	if (stm->eof)
 		return EOF;
 
+#if FZ_ENABLE_FAST_INFLATE
+	if (!state->tried_one_shot)
+	{
+		size_t len;
+		state->tried_one_shot = 1;
+		if (inflate_one_shot(ctx, state, &len))
+		{
+			stm->rp = state->one_shot;
+			stm->wp = state->one_shot + len;
+			stm->pos += len;
+			if (len == 0)
+			{
+				stm->eof = 1;
+				return EOF;
+			}
+			return *stm->rp++;
+		}
+	}
+	else if (state->one_shot)
+	{
+		stm->eof = 1;
+		return EOF;
+	}
+#endif
+
 	zp->next_out = outbuf;
 	zp->avail_out = outlen;
 
@@ -96,6 +777,7 @@ close_flated(fz_context *ctx, void *state_)
 		fz_warn(ctx, "zlib error: inflateEnd: %s", state->z.msg);
 
 	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state->one_shot);
 	fz_free(ctx, state);
 }
 
@@ -111,6 +793,7 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 	state->z.opaque = ctx;
 	state->z.next_in = NULL;
 	state->z.avail_in = 0;
+	state->window_bits = window_bits;
 
 	code = inflateInit2(&state->z, window_bits);
 	if (code != Z_OK)
@@ -30,6 +30,9 @@ struct fz_tuning_context_s
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	fz_run_jobs_fn *run_jobs;
+	void *run_jobs_arg;
+	int job_threads;
 };
 
 void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *subarea);
@@ -48,6 +51,7 @@ void fz_drop_document_handler_context(fz_context *ctx);
 fz_document_handler_context *fz_keep_document_handler_context(fz_context *ctx);
 
 fz_stream *fz_open_file_ptr_no_close(fz_context *ctx, FILE *file);
+int fz_is_memory_stream(fz_stream *stm);
 
 #if defined(MEMENTO) || !defined(NDEBUG)
 #define FITZ_DEBUG_LOCKING
@@ -323,8 +323,12 @@ static void fz_compute_image_key(fz_context *ctx, fz_image *image, fz_matrix *ct
 		key->l2factor = 0;
 }
 
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor)
+/*
+	If cropped is set, stm only contains the samples within subarea
+	(at the l2factor reduced resolution) rather than the whole image.
+*/
+static fz_pixmap *
+decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int cropped)
 {
 	fz_image *image = &cimg->super;
 	fz_pixmap *tile = NULL;
@@ -373,7 +377,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			fz_throw(ctx, FZ_ERROR_MEMORY, "image too large");
 		samples = Memento_label(fz_malloc(ctx, h * stride), "pixmap_samples");
 
-		if (subarea)
+		if (subarea && !cropped)
 		{
 			int hh;
 			unsigned char *s = samples;
@@ -467,6 +471,12 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor)
+{
+	return decomp_image_from_stream(ctx, stm, cimg, subarea, indexed, l2factor, 0);
+}
+
 void
 fz_drop_image_base(fz_context *ctx, fz_image *image)
 {
@@ -501,6 +511,271 @@ drop_pixmap_image(fz_context *ctx, fz_image *image_)
 	fz_drop_pixmap(ctx, image->tile);
 }
 
+/*
+	JPX images are decoded in tiles of JPX_TILE_SIZE pixels at the
+	resolution level being decoded. Each tile is kept in the store
+	under the same kind of key as whole images (image, level, area),
+	so panning or zooming into a large image only decodes the tiles
+	that were not seen before.
+*/
+enum { JPX_TILE_SIZE = 512 };
+
+/*
+	rect is updated to the area actually decoded, which a decoder
+	that can not decode subareas leaves as the whole image. l2factor
+	is updated to the number of levels actually reduced by. Only
+	tiles decoded exactly as asked for are stored.
+*/
+static fz_pixmap *
+jpx_get_tile(fz_context *ctx, fz_compressed_image *image, fz_irect *rect, int *l2factor)
+{
+	unsigned char *data = image->buffer->buffer->data;
+	size_t len = image->buffer->buffer->len;
+	fz_image_key key;
+	fz_image_key *keyp = NULL;
+	fz_pixmap *tile, *existing_tile;
+	fz_irect area = *rect;
+	int remaining = *l2factor;
+
+	key.refs = 1;
+	key.image = &image->super;
+	key.l2factor = *l2factor;
+	key.rect = *rect;
+	tile = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_image_store_type);
+	if (tile)
+		return tile;
+
+	tile = fz_load_jpx_subarea(ctx, data, len, NULL, &area, &remaining);
+	*l2factor -= remaining;
+	if (remaining || area.x0 != rect->x0 || area.y0 != rect->y0 || area.x1 != rect->x1 || area.y1 != rect->y1)
+	{
+		*rect = area;
+		return tile;
+	}
+
+	fz_var(keyp);
+
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image_store_key(ctx, &image->super);
+		keyp->l2factor = key.l2factor;
+		keyp->rect = *rect;
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		if (existing_tile)
+		{
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_image_key(ctx, keyp);
+	fz_catch(ctx)
+	{
+		/* Not caching the tile is not fatal. */
+	}
+
+	return tile;
+}
+
+static int
+jpx_irect_equal(fz_irect a, fz_irect b)
+{
+	return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+static int
+jpx_irect_contains(fz_irect a, fz_irect b)
+{
+	return a.x0 <= b.x0 && a.y0 <= b.y0 && a.x1 >= b.x1 && a.y1 >= b.y1;
+}
+
+/*
+	Put together the tiles covering area (aligned to the tile grid) at
+	resolution level *l2factor. If the image cannot be reduced that far,
+	NULL is returned, with *l2factor set to the level it can go to.
+	If a single decode covers the whole area (because there is only one
+	tile, or because the decoder can not decode subareas and returned
+	the whole image), it is returned as is, with area and *l2factor
+	updated to what was actually decoded. A stored tile is only returned
+	as is if share is set, as the caller may otherwise subsample the
+	result in place.
+*/
+static fz_pixmap *
+jpx_get_tiles(fz_context *ctx, fz_compressed_image *image, fz_irect *area, int *l2factor, int share)
+{
+	int r = *l2factor;
+	int t = JPX_TILE_SIZE << r;
+	int f = 1 << r;
+	fz_pixmap *out = NULL;
+	fz_pixmap *tile = NULL;
+	int tx, ty, got, done = 0;
+
+	fz_var(out);
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		for (ty = area->y0; ty < area->y1 && !done; ty += t)
+		{
+			for (tx = area->x0; tx < area->x1; tx += t)
+			{
+				fz_irect rect, decoded;
+				unsigned char *s, *d;
+				int x, y, w, h, stored;
+
+				rect.x0 = tx;
+				rect.y0 = ty;
+				rect.x1 = fz_mini(tx + t, image->super.w);
+				rect.y1 = fz_mini(ty + t, image->super.h);
+				decoded = rect;
+				got = r;
+				tile = jpx_get_tile(ctx, image, &decoded, &got);
+				stored = (got == r && jpx_irect_equal(decoded, rect));
+
+				/* A decode that covers the whole area needs no copying. */
+				if (!out && jpx_irect_contains(decoded, *area) && (share || !stored))
+				{
+					*area = decoded;
+					*l2factor = got;
+					out = tile;
+					tile = NULL;
+					done = 1;
+					break;
+				}
+
+				if (got != r)
+				{
+					*l2factor = got;
+					fz_drop_pixmap(ctx, out);
+					out = NULL;
+					done = 1;
+					break;
+				}
+
+				if (!jpx_irect_contains(decoded, rect))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "JPX decoder returned the wrong area");
+
+				if (!out)
+				{
+					out = fz_new_pixmap(ctx, tile->colorspace,
+						(area->x1 - area->x0 + f - 1) >> r,
+						(area->y1 - area->y0 + f - 1) >> r,
+						NULL, tile->alpha);
+					fz_clear_pixmap(ctx, out);
+				}
+
+				/* Copy rect out of the decoded area, which may be larger. */
+				x = (rect.x0 - area->x0) >> r;
+				y = (rect.y0 - area->y0) >> r;
+				s = tile->samples + ((rect.y0 - decoded.y0) >> r) * tile->stride + ((rect.x0 - decoded.x0) >> r) * tile->n;
+				w = fz_mini(tile->w - ((rect.x0 - decoded.x0) >> r), out->w - x);
+				w = fz_mini(w, (rect.x1 - rect.x0 + f - 1) >> r);
+				h = fz_mini(tile->h - ((rect.y0 - decoded.y0) >> r), out->h - y);
+				h = fz_mini(h, (rect.y1 - rect.y0 + f - 1) >> r);
+				d = out->samples + y * out->stride + x * out->n;
+				for (; h > 0; h--)
+				{
+					memcpy(d, s, (size_t)w * out->n);
+					s += tile->stride;
+					d += out->stride;
+				}
+
+				fz_drop_pixmap(ctx, tile);
+				tile = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, tile);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, out);
+		fz_rethrow(ctx);
+	}
+
+	return out;
+}
+
+static fz_pixmap *
+jpx_get_pixmap(fz_context *ctx, fz_compressed_image *image, fz_irect *subarea, int *l2factor)
+{
+	fz_irect full = fz_make_irect(0, 0, image->super.w, image->super.h);
+	fz_pixmap *tile = NULL;
+	fz_irect area;
+	int r, t, want, prev;
+
+	want = r = l2factor ? *l2factor : 0;
+	while (subarea)
+	{
+		t = JPX_TILE_SIZE << r;
+		area.x0 = subarea->x0 / t * t;
+		area.y0 = subarea->y0 / t * t;
+		area.x1 = fz_mini((subarea->x1 + t - 1) / t * t, image->super.w);
+		area.y1 = fz_mini((subarea->y1 + t - 1) / t * t, image->super.h);
+
+		/* Requests that need every tile anyway are decoded in one go. */
+		if (fz_is_empty_irect(area) || jpx_irect_equal(area, full))
+			break;
+
+		prev = r;
+		tile = jpx_get_tiles(ctx, image, &area, &r, r == want);
+		if (tile)
+		{
+			*subarea = area;
+			if (l2factor)
+				*l2factor -= r;
+			return tile;
+		}
+
+		/* Each retry is at a lower resolution level than the last. */
+		if (r >= prev)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot decode JPX tiles");
+	}
+
+	if (subarea)
+		*subarea = full;
+	return fz_load_jpx_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL, NULL, l2factor);
+}
+
+/*
+	Open a JPEG image so that only the rows and columns of subarea
+	get decoded. subarea is adjusted the same way as in
+	fz_decomp_image_from_stream.
+*/
+static fz_stream *
+open_jpeg_subarea(fz_context *ctx, fz_compressed_image *image, fz_irect *subarea, int *l2factor)
+{
+	fz_stream *stm, *head = NULL;
+	int our_l2factor = 0;
+	int f;
+	fz_irect area;
+
+	if (l2factor)
+	{
+		our_l2factor = fz_mini(*l2factor, 3);
+		*l2factor -= our_l2factor;
+	}
+	f = 1<<our_l2factor;
+
+	fz_adjust_image_subarea(ctx, &image->super, subarea, our_l2factor);
+	area.x0 = subarea->x0 >> our_l2factor;
+	area.y0 = subarea->y0 >> our_l2factor;
+	area.x1 = (subarea->x1 + f - 1) >> our_l2factor;
+	area.y1 = (subarea->y1 + f - 1) >> our_l2factor;
+
+	stm = fz_open_buffer(ctx, image->buffer->buffer);
+	fz_try(ctx)
+		head = fz_open_dctd_subarea(ctx, stm, image->buffer->params.u.jpeg.color_transform, our_l2factor, NULL, area);
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return head;
+}
+
 static fz_pixmap *
 compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
 {
@@ -510,6 +785,7 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 	int indexed;
 	fz_pixmap *tile;
 	int can_sub = 0;
+	int cropped;
 	int local_l2factor;
 
 	/* If we are using matte, then the decode code requires both image and tile sizes
@@ -544,7 +820,8 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL);
+		tile = jpx_get_pixmap(ctx, image, subarea, l2factor);
+		can_sub = 1;
 		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
@@ -567,14 +844,18 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 
 	default:
 		native_l2factor = l2factor ? *l2factor : 0;
-		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
+		cropped = (subarea && image->buffer->params.type == FZ_IMAGE_JPEG);
+		if (cropped)
+			stm = open_jpeg_subarea(ctx, image, subarea, l2factor);
+		else
+			stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
 		fz_try(ctx)
 		{
 			if (l2factor)
 				native_l2factor -= *l2factor;
 			indexed = fz_colorspace_is_indexed(ctx, image->super.colorspace);
 			can_sub = 1;
-			tile = fz_decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor);
+			tile = decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, cropped);
 		}
 		fz_always(ctx)
 			fz_drop_stream(ctx, stm);
@@ -1509,6 +1509,19 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+/*
+	Return the number of bytes used by the nodes (and the packed
+	paths) of a display list.
+
+	Text, images and shadings referenced by the list are shared
+	objects and are not counted, so this is a lower bound on the
+	memory held by the list.
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list)
+{
+	return list ? list->max * sizeof(fz_display_node) : 0;
+}
+
 /*
 	(Re)-run a display list through a device.
 
@@ -1870,3 +1883,257 @@ visible:
 	if (cookie)
 		cookie->progress = progress;
 }
+
+/*
+ * Image pre-decoding.
+ *
+ * A pass over the display list records each image that a draw device
+ * would ask for, together with the area of the image it would need and
+ * the transform it would use. The images are then decoded in parallel
+ * by the job runner, leaving the results in the store where the draw
+ * device will find them.
+ */
+
+typedef struct
+{
+	fz_image *image;
+	fz_matrix ctm;
+	fz_irect area;
+	int whole;
+} fz_predecode_job;
+
+typedef struct
+{
+	fz_device super;
+	int top;
+	fz_irect stack[STACK_SIZE];
+	int ignore;
+	int len, max;
+	fz_predecode_job *jobs;
+} fz_predecode_device;
+
+static fz_irect
+fz_predecode_clip(fz_predecode_device *dev)
+{
+	return dev->stack[fz_mini(dev->top, STACK_SIZE - 1)];
+}
+
+static void
+fz_predecode_push(fz_context *ctx, fz_predecode_device *dev, fz_rect rect)
+{
+	fz_irect clip = fz_intersect_irect(fz_predecode_clip(dev), fz_irect_from_rect(rect));
+	if (++dev->top < STACK_SIZE)
+		dev->stack[dev->top] = clip;
+}
+
+static void
+fz_predecode_pop(fz_context *ctx, fz_device *dev_)
+{
+	fz_predecode_device *dev = (fz_predecode_device *)dev_;
+	if (dev->top > 0)
+		dev->top--;
+}
+
+static void
+fz_predecode_add(fz_context *ctx, fz_predecode_device *dev, fz_image *image, fz_matrix ctm, int whole)
+{
+	fz_predecode_job *job;
+	fz_irect area = { 0, 0, image->w, image->h };
+	fz_matrix inverse;
+	int i;
+
+	if (dev->ignore || image->w == 0 || image->h == 0)
+		return;
+
+	/* Work out the source area the same way the draw device does. */
+	if (!whole && !fz_try_invert_matrix(&inverse, ctm))
+	{
+		fz_rect rect;
+		float exp;
+		inverse = fz_post_scale(inverse, image->w, image->h);
+		exp = fz_matrix_max_expansion(inverse);
+		rect = fz_transform_rect(fz_rect_from_irect(fz_predecode_clip(dev)), inverse);
+		rect = fz_expand_rect(rect, fz_max(exp, 1) * 4);
+		area = fz_intersect_irect(fz_irect_from_rect(rect), area);
+		if (fz_is_empty_irect(area))
+			return;
+	}
+
+	/* Decode each image only once; it's also not safe to decode the same
+	 * image on two threads at once. */
+	for (i = 0; i < dev->len; i++)
+		if (dev->jobs[i].image == image)
+			return;
+
+	if (dev->len == dev->max)
+	{
+		int max = dev->max ? dev->max * 2 : 32;
+		dev->jobs = fz_realloc_array(ctx, dev->jobs, max, fz_predecode_job);
+		dev->max = max;
+	}
+	job = &dev->jobs[dev->len++];
+	job->image = fz_keep_image(ctx, image);
+	job->ctm = ctm;
+	job->area = area;
+	job->whole = whole;
+}
+
+static void
+fz_predecode_clip_path(fz_context *ctx, fz_device *dev, const fz_path *path, int even_odd, fz_matrix ctm, fz_rect scissor)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, fz_bound_path(ctx, path, NULL, ctm));
+}
+
+static void
+fz_predecode_clip_stroke_path(fz_context *ctx, fz_device *dev, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, fz_bound_path(ctx, path, stroke, ctm));
+}
+
+static void
+fz_predecode_clip_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_matrix ctm, fz_rect scissor)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, fz_bound_text(ctx, text, NULL, ctm));
+}
+
+static void
+fz_predecode_clip_stroke_text(fz_context *ctx, fz_device *dev, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, fz_bound_text(ctx, text, stroke, ctm));
+}
+
+static void
+fz_predecode_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, fz_matrix ctm, float alpha, fz_color_params color_params)
+{
+	if (alpha != 0)
+		fz_predecode_add(ctx, (fz_predecode_device *)dev, image, ctm, 0);
+}
+
+static void
+fz_predecode_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, fz_matrix ctm,
+	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
+{
+	if (alpha != 0)
+		fz_predecode_add(ctx, (fz_predecode_device *)dev, image, ctm, 0);
+}
+
+static void
+fz_predecode_clip_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, fz_matrix ctm, fz_rect scissor)
+{
+	fz_predecode_add(ctx, (fz_predecode_device *)dev, image, ctm, 1);
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, fz_transform_rect(fz_unit_rect, ctm));
+}
+
+static void
+fz_predecode_begin_mask(fz_context *ctx, fz_device *dev, fz_rect rect, int luminosity, fz_colorspace *colorspace, const float *color, fz_color_params color_params)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, rect);
+}
+
+static void
+fz_predecode_begin_group(fz_context *ctx, fz_device *dev, fz_rect rect, fz_colorspace *cs, int isolated, int knockout, int blendmode, float alpha)
+{
+	fz_predecode_push(ctx, (fz_predecode_device *)dev, rect);
+}
+
+static int
+fz_predecode_begin_tile(fz_context *ctx, fz_device *dev, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm, int id)
+{
+	/* Tiles are drawn into their own pixmaps; don't try to guess those. */
+	((fz_predecode_device *)dev)->ignore++;
+	return 0;
+}
+
+static void
+fz_predecode_end_tile(fz_context *ctx, fz_device *dev)
+{
+	((fz_predecode_device *)dev)->ignore--;
+}
+
+static void
+fz_predecode_drop_device(fz_context *ctx, fz_device *dev_)
+{
+	fz_predecode_device *dev = (fz_predecode_device *)dev_;
+	int i;
+	for (i = 0; i < dev->len; i++)
+		fz_drop_image(ctx, dev->jobs[i].image);
+	fz_free(ctx, dev->jobs);
+}
+
+static void
+fz_predecode_image(fz_context *ctx, void *job_)
+{
+	fz_predecode_job *job = job_;
+	fz_pixmap *pix = NULL;
+
+	fz_try(ctx)
+		pix = fz_get_pixmap_from_image(ctx, job->image, job->whole ? NULL : &job->area, &job->ctm, NULL, NULL);
+	fz_catch(ctx)
+	{
+		/* The draw device will report the error when it tries again. */
+	}
+	fz_drop_pixmap(ctx, pix);
+}
+
+/*
+	Decode the images used by a display list before drawing it.
+
+	When a job runner with more than one thread has been set (see
+	fz_set_job_runner), the images that a draw device would need to
+	draw list with ctm onto a pixmap covering area are decoded in
+	parallel, and the results left in the store. Drawing the list
+	afterwards with the same ctm then finds them there instead of
+	decoding them one at a time. Images inside tiling patterns are
+	not predecoded.
+
+	Otherwise this does nothing.
+*/
+void
+fz_predecode_display_list_images(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area)
+{
+	fz_predecode_device *dev;
+	void **jobs = NULL;
+	int i;
+
+	if (fz_job_threads(ctx) < 2)
+		return;
+
+	dev = fz_new_derived_device(ctx, fz_predecode_device);
+	dev->super.drop_device = fz_predecode_drop_device;
+	dev->super.clip_path = fz_predecode_clip_path;
+	dev->super.clip_stroke_path = fz_predecode_clip_stroke_path;
+	dev->super.clip_text = fz_predecode_clip_text;
+	dev->super.clip_stroke_text = fz_predecode_clip_stroke_text;
+	dev->super.fill_image = fz_predecode_fill_image;
+	dev->super.fill_image_mask = fz_predecode_fill_image_mask;
+	dev->super.clip_image_mask = fz_predecode_clip_image_mask;
+	dev->super.pop_clip = fz_predecode_pop;
+	dev->super.begin_mask = fz_predecode_begin_mask;
+	dev->super.begin_group = fz_predecode_begin_group;
+	dev->super.end_group = fz_predecode_pop;
+	dev->super.begin_tile = fz_predecode_begin_tile;
+	dev->super.end_tile = fz_predecode_end_tile;
+	dev->stack[0] = area;
+
+	fz_var(jobs);
+
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, &dev->super, ctm, fz_rect_from_irect(area), NULL);
+		fz_close_device(ctx, &dev->super);
+		if (dev->len > 1)
+		{
+			jobs = fz_malloc_array(ctx, dev->len, void *);
+			for (i = 0; i < dev->len; i++)
+				jobs[i] = &dev->jobs[i];
+			fz_run_jobs(ctx, dev->len, fz_predecode_image, jobs);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, jobs);
+		fz_drop_device(ctx, &dev->super);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
@@ -467,6 +467,18 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return jpx_read_image(ctx, &state, data, size, defcs, 0);
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_jpxd state = { 0 };
+	fz_pixmap *pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+
+	/* Luratech always decodes the whole image at full resolution. */
+	if (subarea)
+		*subarea = fz_make_irect(0, 0, pix->w, pix->h);
+	return pix;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -694,8 +706,42 @@ static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
 	return OPJ_TRUE;
 }
 
+/* The number of resolution levels available in all components. */
+static int
+jpx_resolution_levels(opj_codec_t *codec)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	int numres = 1;
+	OPJ_UINT32 i;
+
+	if (info)
+	{
+		if (info->m_default_tile_info.tccp_info)
+		{
+			numres = info->m_default_tile_info.tccp_info[0].numresolutions;
+			for (i = 1; i < info->nbcomps; i++)
+				numres = fz_mini(numres, info->m_default_tile_info.tccp_info[i].numresolutions);
+		}
+		opj_destroy_cstr_info(&info);
+	}
+	return numres;
+}
+
+static inline int
+jpx_ceildivpow2(int a, int b)
+{
+	return (a + (1 << b) - 1) >> b;
+}
+
+/*
+	subarea (in image pixels, optional) restricts decoding to that
+	area, and is updated to the area actually decoded. l2factor
+	(optional) asks for the image to be reduced by that many
+	resolution levels, and is updated to the amount of reduction
+	left for the caller to do.
+*/
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, fz_irect *subarea, int *l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -708,6 +754,9 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	OPJ_UINT32 x, y;
 	stream_block sb;
 	OPJ_UINT32 i;
+	fz_irect area = { 0 };
+	int reduce = 0;
+	int partial = 0;
 
 	fz_var(img);
 
@@ -753,6 +802,38 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	if (!onlymeta && (subarea || l2factor))
+	{
+		area = fz_make_irect(jpx->x0, jpx->y0, jpx->x1, jpx->y1);
+
+		if (l2factor && *l2factor > 0)
+		{
+			reduce = fz_mini(*l2factor, jpx_resolution_levels(codec) - 1);
+			if (reduce > 0 && !opj_set_decoded_resolution_factor(codec, reduce))
+				reduce = 0;
+			*l2factor -= reduce;
+		}
+
+		if (subarea)
+		{
+			fz_irect full = area;
+			area = fz_intersect_irect(fz_translate_irect(*subarea, full.x0, full.y0), full);
+			if (fz_is_empty_irect(area))
+				area = full;
+			if ((area.x0 != full.x0 || area.y0 != full.y0 || area.x1 != full.x1 || area.y1 != full.y1) &&
+				!opj_set_decode_area(codec, jpx, area.x0, area.y0, area.x1, area.y1))
+			{
+				opj_stream_destroy(stream);
+				opj_destroy_codec(codec);
+				opj_image_destroy(jpx);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to set JPX decode area");
+			}
+			*subarea = fz_translate_irect(area, -full.x0, -full.y0);
+		}
+
+		partial = 1;
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -787,8 +868,18 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	state->width = w = jpx->x1 - jpx->x0;
-	state->height = h = jpx->y1 - jpx->y0;
+	if (partial)
+	{
+		w = jpx_ceildivpow2(area.x1, reduce) - jpx_ceildivpow2(area.x0, reduce);
+		h = jpx_ceildivpow2(area.y1, reduce) - jpx_ceildivpow2(area.y0, reduce);
+	}
+	else
+	{
+		w = jpx->x1 - jpx->x0;
+		h = jpx->y1 - jpx->y0;
+	}
+	state->width = w;
+	state->height = h;
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -864,8 +955,9 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		for (k = 0; k < comps; k++)
 		{
 			opj_image_comp_t *comp = &(jpx->comps[k]);
-			int oy = comp->y0 * comp->dy - jpx->y0;
-			int ox = comp->x0 * comp->dx - jpx->x0;
+			/* Decoded areas start at the top left of the pixmap. */
+			int oy = partial ? 0 : comp->y0 * comp->dy - jpx->y0;
+			int ox = partial ? 0 : comp->x0 * comp->dx - jpx->x0;
 
 			if (comp->data == NULL)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "No data for JP2 image component %d", k);
@@ -929,7 +1021,26 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, NULL, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return pix;
+}
+
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_jpxd state = { 0 };
+	fz_pixmap *pix = NULL;
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, subarea, l2factor);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -947,7 +1058,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -971,6 +1082,12 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -111,6 +111,8 @@ struct fz_pixmap_writer_s
 	fz_draw_options options;
 	fz_pixmap *pixmap;
 	void (*save)(fz_context *ctx, fz_pixmap *pix, const char *filename);
+	fz_band_writer *(*new_band_writer)(fz_context *ctx, fz_output *out);
+	fz_display_list *list;
 	int count;
 	char *path;
 };
@@ -119,9 +121,37 @@ static fz_device *
 pixmap_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 {
 	fz_pixmap_writer *wri = (fz_pixmap_writer*)wri_;
+	if (wri->new_band_writer && wri->options.band_height > 0)
+	{
+		wri->list = fz_new_display_list(ctx, mediabox);
+		return fz_new_list_device(ctx, wri->list);
+	}
 	return fz_new_draw_device_with_options(ctx, &wri->options, mediabox, &wri->pixmap);
 }
 
+static void
+pixmap_write_bands(fz_context *ctx, fz_pixmap_writer *wri, const char *path)
+{
+	fz_output *out = fz_new_output_with_path(ctx, path, 0);
+	fz_band_writer *writer = NULL;
+
+	fz_var(writer);
+
+	fz_try(ctx)
+	{
+		writer = wri->new_band_writer(ctx, out);
+		fz_write_display_list_as_bands(ctx, writer, wri->list, &wri->options, 0);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_band_writer(ctx, writer);
+		fz_drop_output(ctx, out);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 static void
 pixmap_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 {
@@ -133,13 +163,18 @@ pixmap_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 		fz_close_device(ctx, dev);
 		wri->count += 1;
 		fz_format_output_path(ctx, path, sizeof path, wri->path, wri->count);
-		wri->save(ctx, wri->pixmap, path);
+		if (wri->list)
+			pixmap_write_bands(ctx, wri, path);
+		else
+			wri->save(ctx, wri->pixmap, path);
 	}
 	fz_always(ctx)
 	{
 		fz_drop_device(ctx, dev);
 		fz_drop_pixmap(ctx, wri->pixmap);
 		wri->pixmap = NULL;
+		fz_drop_display_list(ctx, wri->list);
+		wri->list = NULL;
 	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
@@ -150,6 +185,7 @@ pixmap_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_pixmap_writer *wri = (fz_pixmap_writer*)wri_;
 	fz_drop_pixmap(ctx, wri->pixmap);
+	fz_drop_display_list(ctx, wri->list);
 	fz_free(ctx, wri->path);
 }
 
@@ -157,6 +193,15 @@ fz_document_writer *
 fz_new_pixmap_writer(fz_context *ctx, const char *path, const char *options,
 	const char *default_path, int n,
 	void (*save)(fz_context *ctx, fz_pixmap *pix, const char *filename))
+{
+	return fz_new_banded_pixmap_writer(ctx, path, options, default_path, n, save, NULL);
+}
+
+fz_document_writer *
+fz_new_banded_pixmap_writer(fz_context *ctx, const char *path, const char *options,
+	const char *default_path, int n,
+	void (*save)(fz_context *ctx, fz_pixmap *pix, const char *filename),
+	fz_band_writer *(*new_band_writer)(fz_context *ctx, fz_output *out))
 {
 	fz_pixmap_writer *wri = fz_new_derived_document_writer(ctx, fz_pixmap_writer, pixmap_begin_page, pixmap_end_page, NULL, pixmap_drop_writer);
 
@@ -165,6 +210,7 @@ fz_new_pixmap_writer(fz_context *ctx, const char *path, const char *options,
 		fz_parse_draw_options(ctx, &wri->options, options);
 		wri->path = fz_strdup(ctx, path ? path : default_path);
 		wri->save = save;
+		wri->new_band_writer = new_band_writer;
 		switch (n)
 		{
 		case 1: wri->options.colorspace = fz_device_gray(ctx); break;
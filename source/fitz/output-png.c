@@ -79,15 +79,53 @@ fz_write_pixmap_as_png(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap)
 	}
 }
 
-typedef struct png_band_writer_s
+/*
+	Bands are filtered and deflated in blocks of rows that can be
+	processed in parallel (see fz_set_job_runner). Each block is
+	compressed as raw deflate data, primed with the data preceding
+	it as a dictionary and ended with a sync flush, so the blocks
+	concatenate into a single zlib stream.
+*/
+#define PNG_MIN_BLOCK_SIZE (128 << 10)
+#define PNG_WINDOW_SIZE (32 << 10)
+
+typedef struct png_band_writer_s png_band_writer;
+
+typedef struct
+{
+	png_band_writer *writer;
+	const unsigned char *sp;
+	const unsigned char *above;
+	int stride;
+	int rows;
+	unsigned char *scratch;
+	unsigned char *dp;
+	size_t len;
+	const unsigned char *dict;
+	size_t dict_len;
+	int last;
+	z_stream *stream;
+	unsigned char *cdata;
+	size_t csize;
+	size_t clen;
+	uLong adler;
+} png_block;
+
+struct png_band_writer_s
 {
 	fz_band_writer super;
 	unsigned char *udata;
-	unsigned char *cdata;
-	uLong usize, csize;
-	z_stream stream;
-	int stream_ended;
-} png_band_writer;
+	unsigned char *prev;
+	unsigned char *dict;
+	size_t dict_len;
+	unsigned char *scratch;
+	int nblocks;
+	png_block *blocks;
+	void **jobs;
+	z_stream **streams;
+	int started;
+	uLong adler;
+};
 
 static void
 png_write_icc(fz_context *ctx, png_band_writer *writer, fz_colorspace *cs)
@@ -174,14 +212,256 @@ png_write_header(fz_context *ctx, fz_band_writer *writer_, fz_colorspace *cs)
 	png_write_icc(ctx, writer, cs);
 }
 
+static void
+png_unpremultiply_row(unsigned char *dp, const unsigned char *sp, int w, int n)
+{
+	int x, k;
+
+	for (x = 0; x < w; x++)
+	{
+		int a = sp[n-1];
+		int inva = a ? 256*255/a : 0;
+		for (k = 0; k < n-1; k++)
+			dp[k] = (sp[k] * inva + 128)>>8;
+		dp[k] = a;
+		sp += n;
+		dp += n;
+	}
+}
+
+static inline int png_paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = fz_absi(p - a);
+	int pb = fz_absi(p - b);
+	int pc = fz_absi(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/* The magnitude of a filtered byte, taken as a signed value. */
+static inline int png_cost(int v)
+{
+	int s = (signed char)v;
+	return s < 0 ? -s : s;
+}
+
+/* Filter a row with whichever of the five filters gives the smallest
+ * sum of residuals; the usual heuristic for picking filters per row.
+ * The cheap filters are summed first, so that the others can give up
+ * as soon as they cannot win. */
+static void
+png_filter_row(unsigned char *dp, const unsigned char *row, const unsigned char *prev, int len, int bpp)
+{
+	unsigned int cost[5] = { 0 };
+	unsigned int best_cost;
+	int i, best;
+
+	for (i = 0; i < bpp; i++)
+	{
+		cost[0] += png_cost(row[i]);
+		cost[2] += png_cost(row[i] - prev[i]);
+		cost[3] += png_cost(row[i] - (prev[i] >> 1));
+	}
+	cost[1] = cost[0];
+	cost[4] = cost[2];
+	for (; i < len; i++)
+	{
+		cost[0] += png_cost(row[i]);
+		cost[1] += png_cost(row[i] - row[i-bpp]);
+		cost[2] += png_cost(row[i] - prev[i]);
+	}
+
+	best = 0;
+	for (i = 1; i < 3; i++)
+		if (cost[i] < cost[best])
+			best = i;
+	best_cost = cost[best];
+
+	if (cost[3] < best_cost)
+	{
+		for (i = bpp; i < len && cost[3] < best_cost; i++)
+			cost[3] += png_cost(row[i] - ((row[i-bpp] + prev[i]) >> 1));
+		if (cost[3] < best_cost)
+		{
+			best = 3;
+			best_cost = cost[3];
+		}
+	}
+
+	if (cost[4] < best_cost)
+	{
+		for (i = bpp; i < len && cost[4] < best_cost; i++)
+			cost[4] += png_cost(row[i] - png_paeth(row[i-bpp], prev[i], prev[i-bpp]));
+		if (cost[4] < best_cost)
+			best = 4;
+	}
+
+	*dp++ = best;
+	switch (best)
+	{
+	case 0:
+		memcpy(dp, row, len);
+		break;
+	case 1:
+		memcpy(dp, row, bpp);
+		for (i = bpp; i < len; i++)
+			dp[i] = row[i] - row[i-bpp];
+		break;
+	case 2:
+		for (i = 0; i < len; i++)
+			dp[i] = row[i] - prev[i];
+		break;
+	case 3:
+		for (i = 0; i < bpp; i++)
+			dp[i] = row[i] - (prev[i] >> 1);
+		for (; i < len; i++)
+			dp[i] = row[i] - ((row[i-bpp] + prev[i]) >> 1);
+		break;
+	case 4:
+		for (i = 0; i < bpp; i++)
+			dp[i] = row[i] - prev[i];
+		for (; i < len; i++)
+			dp[i] = row[i] - png_paeth(row[i-bpp], prev[i], prev[i-bpp]);
+		break;
+	}
+}
+
+static void
+png_filter_block(fz_context *ctx, void *block_)
+{
+	png_block *block = block_;
+	png_band_writer *writer = block->writer;
+	int w = writer->super.w;
+	int n = writer->super.n;
+	int len = w * n;
+	const unsigned char *sp = block->sp;
+	const unsigned char *prev;
+	unsigned char *dp = block->dp;
+	unsigned char *row[2];
+	int y;
+
+	if (writer->super.alpha)
+	{
+		/* Filter the unpremultiplied data, alternating between two
+		 * scratch rows for the current and the previous row. */
+		row[0] = block->scratch;
+		row[1] = block->scratch + len;
+		prev = writer->prev;
+		if (block->above)
+		{
+			png_unpremultiply_row(row[1], block->above, w, n);
+			prev = row[1];
+		}
+		for (y = 0; y < block->rows; y++)
+		{
+			png_unpremultiply_row(row[y & 1], sp, w, n);
+			png_filter_row(dp, row[y & 1], prev, len, n);
+			prev = row[y & 1];
+			sp += block->stride;
+			dp += len + 1;
+		}
+	}
+	else
+	{
+		prev = block->above ? block->above : writer->prev;
+		for (y = 0; y < block->rows; y++)
+		{
+			png_filter_row(dp, sp, prev, len, n);
+			prev = sp;
+			sp += block->stride;
+			dp += len + 1;
+		}
+	}
+}
+
+static void
+png_deflate_block(fz_context *ctx, void *block_)
+{
+	png_block *block = block_;
+	z_stream *stream = block->stream;
+	int err;
+
+	err = deflateReset(stream);
+	if (err == Z_OK && block->dict_len > 0)
+		err = deflateSetDictionary(stream, block->dict, (uInt)block->dict_len);
+	if (err != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+
+	/* Leave room for the zlib header before, and the checksum after. */
+	stream->next_in = (Bytef *)block->dp;
+	stream->avail_in = (uInt)block->len;
+	stream->next_out = block->cdata + 2;
+	stream->avail_out = (uInt)(block->csize - 6);
+	err = deflate(stream, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (err != (block->last ? Z_STREAM_END : Z_OK) || stream->avail_out == 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+
+	block->clen = stream->next_out - (block->cdata + 2);
+	block->adler = adler32(adler32(0, NULL, 0), block->dp, (uInt)block->len);
+}
+
+static void
+png_new_blocks(fz_context *ctx, png_band_writer *writer, int band_height)
+{
+	int w = writer->super.w;
+	int n = writer->super.n;
+	size_t rowbytes = (size_t)w * n + 1;
+	size_t usize = rowbytes * band_height;
+	int count, rows, i, err;
+
+	count = fz_mini(fz_job_threads(ctx), (int)(usize / PNG_MIN_BLOCK_SIZE));
+	count = fz_clampi(count, 1, fz_maxi(band_height, 1));
+	rows = (band_height + count - 1) / count;
+
+	writer->udata = Memento_label(fz_malloc(ctx, usize), "png_write_udata");
+	writer->prev = fz_calloc(ctx, w, n);
+	writer->dict = fz_malloc(ctx, PNG_WINDOW_SIZE);
+	if (writer->super.alpha)
+		writer->scratch = fz_malloc(ctx, (size_t)count * 2 * w * n);
+	writer->blocks = fz_calloc(ctx, count, sizeof *writer->blocks);
+	writer->jobs = fz_calloc(ctx, count, sizeof *writer->jobs);
+	writer->streams = fz_calloc(ctx, count, sizeof *writer->streams);
+	writer->adler = adler32(0, NULL, 0);
+
+	for (i = 0; i < count; i++)
+	{
+		png_block *block = &writer->blocks[i];
+		z_stream *stream;
+
+		stream = fz_malloc_struct(ctx, z_stream);
+		stream->opaque = ctx;
+		stream->zalloc = fz_zlib_alloc;
+		stream->zfree = fz_zlib_free;
+		err = deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		if (err != Z_OK)
+		{
+			fz_free(ctx, stream);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+		}
+		writer->streams[writer->nblocks++] = stream;
+
+		block->writer = writer;
+		block->stream = stream;
+		if (writer->scratch)
+			block->scratch = writer->scratch + (size_t)i * 2 * w * n;
+		/* Room for the header, the checksum and the sync flush. */
+		block->csize = deflateBound(stream, (uLong)(rowbytes * rows)) + 32;
+		block->cdata = Memento_label(fz_malloc(ctx, block->csize), "png_write_cdata");
+		writer->jobs[i] = block;
+	}
+}
+
 static void
 png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
 {
 	png_band_writer *writer = (png_band_writer *)(void *)writer_;
 	fz_output *out = writer->super.out;
-	unsigned char *dp;
-	int y, x, k, err, finalband;
-	int w, h, n;
+	size_t rowbytes, ulen, off;
+	int w, h, n, finalband, count, i, y;
 
 	if (!out)
 		return;
@@ -195,101 +475,89 @@ png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_st
 		band_height = h - band_start;
 
 	if (writer->udata == NULL)
-	{
-		writer->usize = (w * n + 1) * band_height;
-		/* Sadly the bound returned by compressBound is just for a
-		 * single usize chunk; if you compress a sequence of them
-		 * the buffering can result in you suddenly getting a block
-		 * larger than compressBound outputted in one go, even if you
-		 * take all the data out each time. */
-		writer->csize = compressBound(writer->usize);
-		writer->udata = Memento_label(fz_malloc(ctx, writer->usize), "png_write_udata");
-		writer->cdata = Memento_label(fz_malloc(ctx, writer->csize), "png_write_cdata");
-		writer->stream.opaque = ctx;
-		writer->stream.zalloc = fz_zlib_alloc;
-		writer->stream.zfree = fz_zlib_free;
-		err = deflateInit(&writer->stream, Z_DEFAULT_COMPRESSION);
-		if (err != Z_OK)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
-	}
+		png_new_blocks(ctx, writer, band_height);
 
-	dp = writer->udata;
-	stride -= w*n;
-	if (writer->super.alpha)
+	rowbytes = (size_t)w * n + 1;
+	ulen = rowbytes * band_height;
+	count = fz_clampi(band_height, 1, writer->nblocks);
+
+	for (i = 0, y = 0; i < count; i++)
 	{
-		/* Unpremultiply data */
-		for (y = 0; y < band_height; y++)
+		png_block *block = &writer->blocks[i];
+		int rows = (band_height - y) / (count - i);
+
+		block->sp = sp + (size_t)y * stride;
+		block->above = y > 0 ? block->sp - stride : NULL;
+		block->stride = stride;
+		block->rows = rows;
+		block->dp = writer->udata + rowbytes * y;
+		block->len = rowbytes * rows;
+		if (y > 0)
 		{
-			int prev[FZ_MAX_COLORS];
-			*dp++ = 1; /* sub prediction filter */
-			for (x = 0; x < w; x++)
-			{
-				int a = sp[n-1];
-				int inva = a ? 256*255/a : 0;
-				int p;
-				for (k = 0; k < n-1; k++)
-				{
-					int v = (sp[k] * inva + 128)>>8;
-					p = x ? prev[k] : 0;
-					prev[k] = v;
-					v -= p;
-					dp[k] = v;
-				}
-				p = x ? prev[k] : 0;
-				prev[k] = a;
-				a -= p;
-				dp[k] = a;
-				sp += n;
-				dp += n;
-			}
-			sp += stride;
+			off = fz_minz(rowbytes * y, PNG_WINDOW_SIZE);
+			block->dict = block->dp - off;
+			block->dict_len = off;
 		}
-	}
-	else
-	{
-		for (y = 0; y < band_height; y++)
+		else
 		{
-			*dp++ = 1; /* sub prediction filter */
-			for (x = 0; x < w; x++)
-			{
-				for (k = 0; k < n; k++)
-				{
-					if (x == 0)
-						dp[k] = sp[k];
-					else
-						dp[k] = sp[k] - sp[k-n];
-				}
-				sp += n;
-				dp += n;
-			}
-			sp += stride;
+			block->dict = writer->dict;
+			block->dict_len = writer->dict_len;
 		}
+		block->last = finalband && i == count - 1;
+		y += rows;
 	}
 
-	writer->stream.next_in = (Bytef*)writer->udata;
-	writer->stream.avail_in = (uInt)(dp - writer->udata);
-	do
+	fz_run_jobs(ctx, count, png_filter_block, writer->jobs);
+	fz_run_jobs(ctx, count, png_deflate_block, writer->jobs);
+
+	for (i = 0; i < count; i++)
 	{
-		writer->stream.next_out = writer->cdata;
-		writer->stream.avail_out = (uInt)writer->csize;
+		png_block *block = &writer->blocks[i];
+		unsigned char *data = block->cdata + 2;
+		size_t len = block->clen;
 
-		if (!finalband)
+		if (!writer->started)
 		{
-			err = deflate(&writer->stream, Z_NO_FLUSH);
-			if (err != Z_OK)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+			/* zlib header: deflate with a 32K window, default level. */
+			data -= 2;
+			data[0] = 0x78;
+			data[1] = 0x9c;
+			len += 2;
+			writer->started = 1;
 		}
-		else
+		writer->adler = adler32_combine(writer->adler, block->adler, (z_off_t)block->len);
+		if (block->last)
 		{
-			err = deflate(&writer->stream, Z_FINISH);
-			if (err != Z_STREAM_END)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+			big32(data + len, (unsigned int)writer->adler);
+			len += 4;
 		}
+		if (len > 0)
+			putchunk(ctx, out, "IDAT", data, len);
+	}
+
+	if (finalband || band_height == 0)
+		return;
+
+	/* Keep what the next band continues from: the last row, and the
+	 * end of the filtered data to use as the dictionary. */
+	sp += (size_t)(band_height - 1) * stride;
+	if (writer->super.alpha)
+		png_unpremultiply_row(writer->prev, sp, w, n);
+	else
+		memcpy(writer->prev, sp, (size_t)w * n);
 
-		if (writer->stream.next_out != writer->cdata)
-			putchunk(ctx, out, "IDAT", writer->cdata, writer->stream.next_out - writer->cdata);
+	if (ulen >= PNG_WINDOW_SIZE)
+	{
+		memcpy(writer->dict, writer->udata + ulen - PNG_WINDOW_SIZE, PNG_WINDOW_SIZE);
+		writer->dict_len = PNG_WINDOW_SIZE;
+	}
+	else
+	{
+		off = fz_minz(writer->dict_len, PNG_WINDOW_SIZE - ulen);
+		memmove(writer->dict, writer->dict + writer->dict_len - off, off);
+		memcpy(writer->dict + off, writer->udata, ulen);
+		writer->dict_len = off + ulen;
 	}
-	while (writer->stream.avail_out == 0);
 }
 
 static void
@@ -298,12 +566,6 @@ png_write_trailer(fz_context *ctx, fz_band_writer *writer_)
 	png_band_writer *writer = (png_band_writer *)(void *)writer_;
 	fz_output *out = writer->super.out;
 	unsigned char block[1];
-	int err;
-
-	writer->stream_ended = 1;
-	err = deflateEnd(&writer->stream);
-	if (err != Z_OK)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
 
 	putchunk(ctx, out, "IEND", block, 0);
 }
@@ -312,15 +574,25 @@ static void
 png_drop_band_writer(fz_context *ctx, fz_band_writer *writer_)
 {
 	png_band_writer *writer = (png_band_writer *)(void *)writer_;
+	int i;
 
-	if (!writer->stream_ended)
+	for (i = 0; i < writer->nblocks; i++)
 	{
-		int err = deflateEnd(&writer->stream);
-		if (err != Z_OK)
+		int err = deflateEnd(writer->streams[i]);
+		if (err != Z_OK && err != Z_DATA_ERROR)
 			fz_warn(ctx, "ignoring compression error %d", err);
+		fz_free(ctx, writer->streams[i]);
 	}
-
-	fz_free(ctx, writer->cdata);
+	if (writer->blocks)
+		for (i = 0; i < writer->nblocks; i++)
+			fz_free(ctx, writer->blocks[i].cdata);
+
+	fz_free(ctx, writer->streams);
+	fz_free(ctx, writer->jobs);
+	fz_free(ctx, writer->blocks);
+	fz_free(ctx, writer->scratch);
+	fz_free(ctx, writer->dict);
+	fz_free(ctx, writer->prev);
 	fz_free(ctx, writer->udata);
 }
 
@@ -219,7 +219,6 @@ pwg_write_mono_band(fz_context *ctx, fz_band_writer *writer_, int stride, int ba
 	pwg_band_writer *writer = (pwg_band_writer *)writer_;
 	fz_output *out = writer->super.out;
 	int w = writer->super.w;
-	int h = writer->super.h;
 	const unsigned char *sp;
 	int y, x;
 	int byte_width;
@@ -235,7 +234,7 @@ pwg_write_mono_band(fz_context *ctx, fz_band_writer *writer_, int stride, int ba
 		assert(sp == samples + y * stride);
 
 		/* Count the number of times this line is repeated */
-		for (yrep = 1; yrep < 256 && y+yrep < h; yrep++)
+		for (yrep = 1; yrep < 256 && y+yrep < band_height; yrep++)
 		{
 			if (memcmp(sp, sp + yrep * stride, byte_width) != 0)
 				break;
@@ -329,7 +328,6 @@ pwg_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_st
 	pwg_band_writer *writer = (pwg_band_writer *)writer_;
 	fz_output *out = writer->super.out;
 	int w = writer->super.w;
-	int h = writer->super.h;
 	const unsigned char *sp = samples;
 	int n = writer->super.n;
 	int ss = w * n;
@@ -337,14 +335,14 @@ pwg_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_st
 
 	/* Now output the actual bitmap, using a packbits like compression */
 	y = 0;
-	while (y < h)
+	while (y < band_height)
 	{
 		int yrep;
 
 		assert(sp == samples + y * stride);
 
 		/* Count the number of times this line is repeated */
-		for (yrep = 1; yrep < 256 && y+yrep < h; yrep++)
+		for (yrep = 1; yrep < 256 && y+yrep < band_height; yrep++)
 		{
 			if (memcmp(sp, sp + yrep * stride, ss) != 0)
 				break;
@@ -548,6 +546,7 @@ struct fz_pwg_writer_s
 	fz_pwg_options pwg;
 	int mono;
 	fz_pixmap *pixmap;
+	fz_display_list *list;
 	fz_output *out;
 };
 
@@ -555,6 +554,11 @@ static fz_device *
 pwg_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 {
 	fz_pwg_writer *wri = (fz_pwg_writer*)wri_;
+	if (!wri->mono && wri->draw.band_height > 0)
+	{
+		wri->list = fz_new_display_list(ctx, mediabox);
+		return fz_new_list_device(ctx, wri->list);
+	}
 	return fz_new_draw_device_with_options(ctx, &wri->draw, mediabox, &wri->pixmap);
 }
 
@@ -563,13 +567,20 @@ pwg_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 {
 	fz_pwg_writer *wri = (fz_pwg_writer*)wri_;
 	fz_bitmap *bitmap = NULL;
+	fz_band_writer *writer = NULL;
 
 	fz_var(bitmap);
+	fz_var(writer);
 
 	fz_try(ctx)
 	{
 		fz_close_device(ctx, dev);
-		if (wri->mono)
+		if (wri->list)
+		{
+			writer = fz_new_pwg_band_writer(ctx, wri->out, &wri->pwg);
+			fz_write_display_list_as_bands(ctx, writer, wri->list, &wri->draw, 0);
+		}
+		else if (wri->mono)
 		{
 			bitmap = fz_new_bitmap_from_pixmap(ctx, wri->pixmap, NULL);
 			fz_write_bitmap_as_pwg_page(ctx, wri->out, bitmap, &wri->pwg);
@@ -582,9 +593,12 @@ pwg_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 	fz_always(ctx)
 	{
 		fz_drop_device(ctx, dev);
+		fz_drop_band_writer(ctx, writer);
 		fz_drop_bitmap(ctx, bitmap);
 		fz_drop_pixmap(ctx, wri->pixmap);
 		wri->pixmap = NULL;
+		fz_drop_display_list(ctx, wri->list);
+		wri->list = NULL;
 	}
 	fz_catch(ctx)
 	{
@@ -604,6 +618,7 @@ pwg_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_pwg_writer *wri = (fz_pwg_writer*)wri_;
 	fz_drop_pixmap(ctx, wri->pixmap);
+	fz_drop_display_list(ctx, wri->list);
 	fz_drop_output(ctx, wri->out);
 }
 
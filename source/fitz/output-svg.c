@@ -16,6 +16,7 @@ struct fz_svg_writer_s
 	fz_output *out;
 	int text_format;
 	int reuse_images;
+	int reuse_paths;
 	int id;
 };
 
@@ -24,6 +25,7 @@ const char *fz_svg_write_options_usage =
 	"\ttext=text: Emit text as <text> elements (inaccurate fonts).\n"
 	"\ttext=path: Emit text as <path> elements (accurate fonts).\n"
 	"\tno-reuse-images: Do not reuse images using <symbol> definitions.\n"
+	"\treuse-paths: Reuse repeated paths, glyph outlines and image data using <defs> definitions.\n"
 	"\n"
 	;
 
@@ -40,7 +42,9 @@ svg_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 
 	fz_format_output_path(ctx, path, sizeof path, wri->path, wri->count);
 	wri->out = fz_new_output_with_path(ctx, path, 0);
-	return fz_new_svg_device_with_id(ctx, wri->out, w, h, wri->text_format, wri->reuse_images, &wri->id);
+	return fz_new_svg_device_with_id(ctx, wri->out, w, h, wri->text_format,
+		(wri->reuse_images ? FZ_SVG_REUSE_IMAGES : 0) | (wri->reuse_paths ? FZ_SVG_REUSE_PATHS : 0),
+		&wri->id);
 }
 
 static void
@@ -92,6 +96,9 @@ fz_new_svg_writer(fz_context *ctx, const char *path, const char *args)
 		if (fz_has_option(ctx, args, "no-reuse-images", &val))
 			if (fz_option_eq(val, "yes"))
 				wri->reuse_images = 0;
+		if (fz_has_option(ctx, args, "reuse-paths", &val))
+			if (fz_option_eq(val, "yes"))
+				wri->reuse_paths = 1;
 		wri->path = fz_strdup(ctx, path ? path : "out-%04d.svg");
 	}
 	fz_catch(ctx)
@@ -1,4 +1,4 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <assert.h>
 #include <limits.h>
@@ -1745,6 +1745,306 @@ fz_convert_indexed_pixmap_to_base(fz_context *ctx, const fz_pixmap *src)
 	return dst;
 }
 
+/*
+ * Tint transform lookup tables.
+ *
+ * Converting DeviceN/Separation samples to the base colorspace only
+ * depends on the colorspace, so the results are kept in the store keyed
+ * on it and shared by all images that use it. Separations get a full
+ * table of 256 entries. DeviceN samples are memoized in a hash table;
+ * the first conversion publishes its table, and later conversions look
+ * there before evaluating the tint transform.
+ */
+
+enum { MAX_TINT_HASH_ENTRIES = 65536 };
+
+typedef struct fz_tint_table_s fz_tint_table;
+
+struct fz_tint_table_s
+{
+	fz_storable storable;
+	unsigned char *lookup;
+	fz_hash_table *hash;
+};
+
+typedef struct fz_tint_table_key_s fz_tint_table_key;
+
+struct fz_tint_table_key_s
+{
+	int refs;
+	fz_colorspace *cs;
+};
+
+static void
+fz_drop_tint_table_imp(fz_context *ctx, fz_storable *table_)
+{
+	fz_tint_table *table = (fz_tint_table *)table_;
+	fz_free(ctx, table->lookup);
+	fz_drop_hash_table(ctx, table->hash);
+	fz_free(ctx, table);
+}
+
+static int
+fz_make_hash_tint_table_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_tint_table_key *key = (fz_tint_table_key *)key_;
+	hash->u.pi.ptr = key->cs;
+	hash->u.pi.i = 0;
+	return 1;
+}
+
+static void *
+fz_keep_tint_table_key(fz_context *ctx, void *key_)
+{
+	fz_tint_table_key *key = (fz_tint_table_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_tint_table_key(fz_context *ctx, void *key_)
+{
+	fz_tint_table_key *key = (fz_tint_table_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_colorspace_store_key(ctx, key->cs);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_tint_table_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_tint_table_key *k0 = (fz_tint_table_key *)k0_;
+	fz_tint_table_key *k1 = (fz_tint_table_key *)k1_;
+	return k0->cs == k1->cs;
+}
+
+static void
+fz_format_tint_table_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	fz_tint_table_key *key = (fz_tint_table_key *)key_;
+	fz_snprintf(s, n, "(tint table %s)", key->cs->name);
+}
+
+static int
+fz_needs_reap_tint_table_key(fz_context *ctx, void *key_)
+{
+	fz_tint_table_key *key = (fz_tint_table_key *)key_;
+	return key->cs->key_storable.store_key_refs == key->cs->key_storable.storable.refs;
+}
+
+static const fz_store_type fz_tint_table_store_type =
+{
+	fz_make_hash_tint_table_key,
+	fz_keep_tint_table_key,
+	fz_drop_tint_table_key,
+	fz_cmp_tint_table_key,
+	fz_format_tint_table_key,
+	fz_needs_reap_tint_table_key
+};
+
+static fz_tint_table *
+fz_find_tint_table(fz_context *ctx, fz_colorspace *cs)
+{
+	fz_tint_table_key key;
+	key.refs = 1;
+	key.cs = cs;
+	return fz_find_item(ctx, fz_drop_tint_table_imp, &key, &fz_tint_table_store_type);
+}
+
+/* Takes ownership of lookup and hash. */
+static fz_tint_table *
+fz_store_tint_table(fz_context *ctx, fz_colorspace *cs, unsigned char *lookup, fz_hash_table *hash, size_t size)
+{
+	fz_tint_table *table, *old_table;
+	fz_tint_table_key *key = NULL;
+
+	fz_var(key);
+	fz_var(table);
+
+	fz_try(ctx)
+		table = fz_malloc_struct(ctx, fz_tint_table);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, lookup);
+		fz_drop_hash_table(ctx, hash);
+		fz_rethrow(ctx);
+	}
+	FZ_INIT_STORABLE(table, 1, fz_drop_tint_table_imp);
+	table->lookup = lookup;
+	table->hash = hash;
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, fz_tint_table_key);
+		key->refs = 1;
+		key->cs = fz_keep_colorspace_store_key(ctx, cs);
+		old_table = fz_store_item(ctx, key, table, size + sizeof *table, &fz_tint_table_store_type);
+		if (old_table)
+		{
+			/* Found one while adding! Perhaps from another thread? */
+			fz_drop_storable(ctx, &table->storable);
+			table = old_table;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			fz_drop_tint_table_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_storable(ctx, &table->storable);
+		fz_rethrow(ctx);
+	}
+
+	return table;
+}
+
+static void
+convert_separation_pixmap_with_table(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst)
+{
+	fz_colorspace *ss = src->colorspace;
+	fz_tint_table *table = fz_find_tint_table(ctx, ss);
+	int bn = ss->u.separation.base->n;
+	const unsigned char *s = src->samples;
+	unsigned char *d = dst->samples;
+	int s_line_inc = src->stride - src->w * src->n;
+	int d_line_inc = dst->stride - dst->w * dst->n;
+	const unsigned char *lookup;
+	int x, y, i, k;
+
+	if (!table)
+	{
+		float src_v[1];
+		float base_v[FZ_MAX_COLORS];
+		unsigned char *lut = fz_malloc(ctx, 256 * bn);
+		fz_try(ctx)
+		{
+			for (i = 0; i < 256; i++)
+			{
+				src_v[0] = i / 255.0f;
+				ss->u.separation.eval(ctx, ss->u.separation.tint, src_v, 1, base_v, bn);
+				for (k = 0; k < bn; k++)
+					lut[i * bn + k] = base_v[k] * 255.0f;
+			}
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, lut);
+			fz_rethrow(ctx);
+		}
+		table = fz_store_tint_table(ctx, ss, lut, NULL, 256 * bn);
+	}
+
+	lookup = table->lookup;
+	for (y = 0; y < src->h; y++)
+	{
+		for (x = 0; x < src->w; x++)
+		{
+			memcpy(d, lookup + *s++ * bn, bn);
+			d += bn;
+			if (src->alpha)
+				*d++ = *s++;
+		}
+		s += s_line_inc;
+		d += d_line_inc;
+	}
+
+	fz_drop_storable(ctx, &table->storable);
+}
+
+static void
+convert_separation_pixmap_with_hash(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst)
+{
+	fz_colorspace *ss = src->colorspace;
+	fz_tint_table *table = fz_find_tint_table(ctx, ss);
+	fz_hash_table *hash = NULL;
+	int count = 0;
+	int sn = ss->n;
+	int bn = ss->u.separation.base->n;
+	float src_v[FZ_MAX_COLORS];
+	float base_v[FZ_MAX_COLORS];
+	const unsigned char *s = src->samples;
+	const unsigned char *sold = NULL;
+	unsigned char *d = dst->samples;
+	unsigned char *dold = NULL;
+	unsigned char *color;
+	int s_line_inc = src->stride - src->w * src->n;
+	int d_line_inc = dst->stride - dst->w * dst->n;
+	int x, y, k;
+
+	fz_var(hash);
+	fz_var(table);
+	fz_var(count);
+
+	fz_try(ctx)
+	{
+		hash = fz_new_hash_table(ctx, 509, sn, -1, fz_free);
+
+		for (y = 0; y < src->h; y++)
+		{
+			for (x = 0; x < src->w; x++)
+			{
+				if (sold && memcmp(sold, s, sn) == 0)
+					memcpy(d, dold, bn);
+				else
+				{
+					color = table ? fz_hash_find(ctx, table->hash, s) : NULL;
+					if (!color)
+						color = fz_hash_find(ctx, hash, s);
+					if (color)
+						memcpy(d, color, bn);
+					else
+					{
+						for (k = 0; k < sn; k++)
+							src_v[k] = s[k] / 255.0f;
+						ss->u.separation.eval(ctx, ss->u.separation.tint, src_v, sn, base_v, bn);
+						for (k = 0; k < bn; k++)
+							d[k] = base_v[k] * 255.0f;
+						if (count < MAX_TINT_HASH_ENTRIES)
+						{
+							color = fz_malloc(ctx, bn);
+							memcpy(color, d, bn);
+							fz_try(ctx)
+								fz_hash_insert(ctx, hash, s, color);
+							fz_catch(ctx)
+							{
+								fz_free(ctx, color);
+								fz_rethrow(ctx);
+							}
+							count++;
+						}
+					}
+					sold = s;
+					dold = d;
+				}
+				s += sn;
+				d += bn;
+				if (src->alpha)
+					*d++ = *s++;
+			}
+			s += s_line_inc;
+			d += d_line_inc;
+		}
+
+		if (!table && count > 0)
+		{
+			fz_hash_table *published = hash;
+			hash = NULL;
+			table = fz_store_tint_table(ctx, ss, NULL, published, (size_t)count * (sn + bn + sizeof(void *)));
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_hash_table(ctx, hash);
+		if (table)
+			fz_drop_storable(ctx, &table->storable);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 /*
  * Convert pixmap from DeviceN/Separation to base colorspace.
  */
@@ -1753,12 +2053,6 @@ fz_convert_separation_pixmap_to_base(fz_context *ctx, const fz_pixmap *src)
 {
 	fz_pixmap *dst;
 	fz_colorspace *ss, *base;
-	const unsigned char *s;
-	unsigned char *d;
-	int y, x, k, sn, bn, a;
-	float src_v[FZ_MAX_COLORS];
-	float base_v[FZ_MAX_COLORS];
-	int s_line_inc, d_line_inc;
 
 	ss = src->colorspace;
 
@@ -1772,47 +2066,10 @@ fz_convert_separation_pixmap_to_base(fz_context *ctx, const fz_pixmap *src)
 	fz_clear_pixmap(ctx, dst);
 	fz_try(ctx)
 	{
-		s = src->samples;
-		d = dst->samples;
-		s_line_inc = src->stride - src->w * src->n;
-		d_line_inc = dst->stride - dst->w * dst->n;
-		sn = ss->n;
-		bn = base->n;
-
-		if (src->alpha)
-		{
-			for (y = 0; y < src->h; y++)
-			{
-				for (x = 0; x < src->w; x++)
-				{
-					for (k = 0; k < sn; ++k)
-						src_v[k] = *s++ / 255.0f;
-					a = *s++;
-					ss->u.separation.eval(ctx, ss->u.separation.tint, src_v, sn, base_v, bn);
-					for (k = 0; k < bn; ++k)
-						*d++ = base_v[k] * 255.0f;
-					*d++ = a;
-				}
-				s += s_line_inc;
-				d += d_line_inc;
-			}
-		}
+		if (ss->n == 1)
+			convert_separation_pixmap_with_table(ctx, src, dst);
 		else
-		{
-			for (y = 0; y < src->h; y++)
-			{
-				for (x = 0; x < src->w; x++)
-				{
-					for (k = 0; k < sn; ++k)
-						src_v[k] = *s++ / 255.0f;
-					ss->u.separation.eval(ctx, ss->u.separation.tint, src_v, sn, base_v, bn);
-					for (k = 0; k < bn; ++k)
-						*d++ = base_v[k] * 255.0f;
-				}
-				s += s_line_inc;
-				d += d_line_inc;
-			}
-		}
+			convert_separation_pixmap_with_hash(ctx, src, dst);
 
 		if (src->flags & FZ_PIXMAP_FLAG_INTERPOLATE)
 			dst->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
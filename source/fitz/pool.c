@@ -11,13 +11,14 @@ typedef struct fz_pool_node_s fz_pool_node;
 struct fz_pool_s
 {
 	size_t size;
-	fz_pool_node *head, *tail;
+	fz_pool_node *head, *tail, *first;
 	char *pos, *end;
 };
 
 struct fz_pool_node_s
 {
 	fz_pool_node *next;
+	size_t size;
 	char mem[1];
 };
 
@@ -30,7 +31,8 @@ fz_pool *fz_new_pool(fz_context *ctx)
 	fz_try(ctx)
 	{
 		node = Memento_label(fz_calloc(ctx, offsetof(fz_pool_node, mem) + POOL_SIZE, 1), "fz_pool_block");
-		pool->head = pool->tail = node;
+		node->size = POOL_SIZE;
+		pool->head = pool->tail = pool->first = node;
 		pool->pos = node->mem;
 		pool->end = node->mem + POOL_SIZE;
 	}
@@ -49,6 +51,7 @@ static void *fz_pool_alloc_oversize(fz_context *ctx, fz_pool *pool, size_t size)
 
 	/* link in memory at the head of the list */
 	node = Memento_label(fz_calloc(ctx, offsetof(fz_pool_node, mem) + size, 1), "fz_pool_oversize");
+	node->size = size;
 	node->next = pool->head;
 	pool->head = node;
 	pool->size += offsetof(fz_pool_node, mem) + size;
@@ -68,11 +71,20 @@ void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size)
 
 	if (pool->pos + size > pool->end)
 	{
-		fz_pool_node *node = Memento_label(fz_calloc(ctx, offsetof(fz_pool_node, mem) + POOL_SIZE, 1), "fz_pool_block");
-		pool->tail = pool->tail->next = node;
+		/* reuse blocks kept by fz_reset_pool before allocating new ones */
+		fz_pool_node *node = pool->tail->next;
+		if (node)
+			memset(node->mem, 0, POOL_SIZE);
+		else
+		{
+			node = Memento_label(fz_calloc(ctx, offsetof(fz_pool_node, mem) + POOL_SIZE, 1), "fz_pool_block");
+			node->size = POOL_SIZE;
+			pool->tail->next = node;
+			pool->size += offsetof(fz_pool_node, mem) + POOL_SIZE;
+		}
+		pool->tail = node;
 		pool->pos = node->mem;
 		pool->end = node->mem + POOL_SIZE;
-		pool->size += offsetof(fz_pool_node, mem) + POOL_SIZE;
 	}
 	ptr = pool->pos;
 	pool->pos += size;
@@ -87,6 +99,32 @@ char *fz_pool_strdup(fz_context *ctx, fz_pool *pool, const char *s)
 	return p;
 }
 
+/*
+	Forget everything allocated from the pool, so that its memory can be
+	handed out again. Blocks of the default size are kept for reuse
+	rather than freed; allocations that were too large to share a block
+	are freed.
+*/
+void fz_reset_pool(fz_context *ctx, fz_pool *pool)
+{
+	while (pool->head != pool->first)
+	{
+		fz_pool_node *next = pool->head->next;
+		pool->size -= offsetof(fz_pool_node, mem) + pool->head->size;
+		fz_free(ctx, pool->head);
+		pool->head = next;
+	}
+
+	if (pool->tail == pool->first)
+		memset(pool->first->mem, 0, pool->pos - pool->first->mem);
+	else
+		memset(pool->first->mem, 0, POOL_SIZE);
+
+	pool->tail = pool->first;
+	pool->pos = pool->first->mem;
+	pool->end = pool->first->mem + POOL_SIZE;
+}
+
 size_t fz_pool_size(fz_context *ctx, fz_pool *pool)
 {
 	return pool ? pool->size : 0;
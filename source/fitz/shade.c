@@ -1100,7 +1100,19 @@ fz_bound_mesh(fz_context *ctx, fz_shade *shade)
 fz_shade *
 fz_keep_shade(fz_context *ctx, fz_shade *shade)
 {
-	return fz_keep_storable(ctx, &shade->storable);
+	return fz_keep_key_storable(ctx, &shade->key_storable);
+}
+
+fz_shade *
+fz_keep_shade_store_key(fz_context *ctx, fz_shade *shade)
+{
+	return fz_keep_key_storable_key(ctx, &shade->key_storable);
+}
+
+void
+fz_drop_shade_store_key(fz_context *ctx, fz_shade *shade)
+{
+	fz_drop_key_storable_key(ctx, &shade->key_storable);
 }
 
 /*
@@ -1124,7 +1136,7 @@ fz_drop_shade_imp(fz_context *ctx, fz_storable *shade_)
 void
 fz_drop_shade(fz_context *ctx, fz_shade *shade)
 {
-	fz_drop_storable(ctx, &shade->storable);
+	fz_drop_key_storable(ctx, &shade->key_storable);
 }
 
 /*
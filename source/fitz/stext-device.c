@@ -77,6 +77,12 @@ struct fz_stext_device_s
 	int flags;
 	int color;
 	const fz_text *lasttext;
+	fz_stext_block_fn *block_fn;
+	void *block_arg;
+	fz_stext_page stream_page;
+	fz_stext_line *open_line;
+	fz_stext_char *line_chars;
+	int line_len, line_cap;
 };
 
 const char *fz_stext_options_usage =
@@ -129,10 +135,146 @@ fz_drop_stext_page(fz_context *ctx, fz_stext_page *page)
 	}
 }
 
+static void
+fz_stext_finish_block(fz_context *ctx, fz_stext_block *block)
+{
+	fz_stext_line *line;
+	fz_stext_char *ch;
+
+	if (block->type != FZ_STEXT_BLOCK_TEXT)
+		return;
+
+	for (line = block->u.t.first_line; line; line = line->next)
+	{
+		for (ch = line->first_char; ch; ch = ch->next)
+		{
+			fz_rect ch_box = fz_rect_from_quad(ch->quad);
+			if (ch == line->first_char)
+				line->bbox = ch_box;
+			else
+				line->bbox = fz_union_rect(line->bbox, ch_box);
+		}
+		block->bbox = fz_union_rect(block->bbox, line->bbox);
+	}
+}
+
+/* Pass the finished blocks of a streaming device on, and recycle their memory. */
+static void
+fz_stext_flush_blocks(fz_context *ctx, fz_stext_device *dev)
+{
+	fz_stext_page *page = dev->page;
+	fz_stext_block *block = page->first_block;
+
+	fz_try(ctx)
+	{
+		for (; block; block = block->next)
+		{
+			fz_stext_finish_block(ctx, block);
+			dev->block_fn(ctx, dev->block_arg, block);
+		}
+	}
+	fz_always(ctx)
+	{
+		for (block = page->first_block; block; block = block->next)
+			if (block->type == FZ_STEXT_BLOCK_IMAGE)
+				fz_drop_image(ctx, block->u.i.image);
+		page->first_block = page->last_block = NULL;
+		fz_reset_pool(ctx, page->pool);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+link_line_chars(fz_stext_line *line, fz_stext_char *chars, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		chars[i].next = i + 1 < n ? &chars[i + 1] : NULL;
+	line->first_char = n > 0 ? chars : NULL;
+	line->last_char = n > 0 ? &chars[n - 1] : NULL;
+	line->len = 0;
+	line->text = NULL;
+	line->center = NULL;
+}
+
+/*
+	The chars of the line being built are gathered in a buffer of the
+	device, and copied into the page as one array once the line is
+	complete, so the chars of every line lie next to each other. The
+	codepoints and quad middles of the chars are copied out into side
+	tables at the same time.
+*/
+static void
+fz_stext_flush_line(fz_context *ctx, fz_stext_device *dev)
+{
+	fz_stext_line *line = dev->open_line;
+	fz_stext_char *chars = NULL;
+	int *text = NULL;
+	fz_point *center = NULL;
+	int i, n = dev->line_len;
+
+	if (!line)
+		return;
+	if (n > 0)
+	{
+		chars = fz_pool_alloc(ctx, dev->page->pool, n * sizeof *chars);
+		text = fz_pool_alloc(ctx, dev->page->pool, n * sizeof *text);
+		center = fz_pool_alloc(ctx, dev->page->pool, n * sizeof *center);
+		memcpy(chars, dev->line_chars, n * sizeof *chars);
+		for (i = 0; i < n; i++)
+		{
+			fz_quad q = chars[i].quad;
+			text[i] = chars[i].c;
+			center[i].x = (q.ul.x + q.ur.x + q.ll.x + q.lr.x) / 4;
+			center[i].y = (q.ul.y + q.ur.y + q.ll.y + q.lr.y) / 4;
+		}
+	}
+	link_line_chars(line, chars, n);
+	line->len = n;
+	line->text = text;
+	line->center = center;
+	dev->open_line = NULL;
+	dev->line_len = 0;
+}
+
+static void
+fz_stext_open_line(fz_context *ctx, fz_stext_device *dev, fz_stext_line *line)
+{
+	fz_stext_char *ch;
+	int n = 0;
+
+	fz_stext_flush_line(ctx, dev);
+
+	/* A line left over from an earlier device is moved back into the buffer. */
+	for (ch = line->first_char; ch; ch = ch->next)
+		++n;
+	if (n > dev->line_cap)
+	{
+		dev->line_chars = fz_realloc_array(ctx, dev->line_chars, n, fz_stext_char);
+		dev->line_cap = n;
+	}
+	n = 0;
+	for (ch = line->first_char; ch; ch = ch->next)
+		dev->line_chars[n++] = *ch;
+	link_line_chars(line, dev->line_chars, n);
+	dev->line_len = n;
+	dev->open_line = line;
+}
+
 static fz_stext_block *
-add_block_to_page(fz_context *ctx, fz_stext_page *page)
+add_block_to_page(fz_context *ctx, fz_stext_device *dev)
 {
-	fz_stext_block *block = fz_pool_alloc(ctx, page->pool, sizeof *page->first_block);
+	fz_stext_page *page = dev->page;
+	fz_stext_block *block;
+
+	fz_stext_flush_line(ctx, dev);
+
+	/* Nothing more is ever added to a block once another one is started. */
+	if (dev->block_fn && page->last_block)
+		fz_stext_flush_blocks(ctx, dev);
+
+	block = fz_pool_alloc(ctx, page->pool, sizeof *page->first_block);
 	block->prev = page->last_block;
 	if (!page->first_block)
 		page->first_block = page->last_block = block;
@@ -145,17 +287,17 @@ add_block_to_page(fz_context *ctx, fz_stext_page *page)
 }
 
 static fz_stext_block *
-add_text_block_to_page(fz_context *ctx, fz_stext_page *page)
+add_text_block_to_page(fz_context *ctx, fz_stext_device *dev)
 {
-	fz_stext_block *block = add_block_to_page(ctx, page);
+	fz_stext_block *block = add_block_to_page(ctx, dev);
 	block->type = FZ_STEXT_BLOCK_TEXT;
 	return block;
 }
 
 static fz_stext_block *
-add_image_block_to_page(fz_context *ctx, fz_stext_page *page, fz_matrix ctm, fz_image *image)
+add_image_block_to_page(fz_context *ctx, fz_stext_device *dev, fz_matrix ctm, fz_image *image)
 {
-	fz_stext_block *block = add_block_to_page(ctx, page);
+	fz_stext_block *block = add_block_to_page(ctx, dev);
 	block->type = FZ_STEXT_BLOCK_IMAGE;
 	block->u.i.transform = ctm;
 	block->u.i.image = fz_keep_image(ctx, image);
@@ -164,9 +306,13 @@ add_image_block_to_page(fz_context *ctx, fz_stext_page *page, fz_matrix ctm, fz_
 }
 
 static fz_stext_line *
-add_line_to_block(fz_context *ctx, fz_stext_page *page, fz_stext_block *block, const fz_point *dir, int wmode)
+add_line_to_block(fz_context *ctx, fz_stext_device *dev, fz_stext_block *block, const fz_point *dir, int wmode)
 {
-	fz_stext_line *line = fz_pool_alloc(ctx, page->pool, sizeof *block->u.t.first_line);
+	fz_stext_line *line;
+
+	fz_stext_flush_line(ctx, dev);
+
+	line = fz_pool_alloc(ctx, dev->page->pool, sizeof *block->u.t.first_line);
 	line->prev = block->u.t.last_line;
 	if (!block->u.t.first_line)
 		block->u.t.first_line = block->u.t.last_line = line;
@@ -183,11 +329,23 @@ add_line_to_block(fz_context *ctx, fz_stext_page *page, fz_stext_block *block, c
 }
 
 static fz_stext_char *
-add_char_to_line(fz_context *ctx, fz_stext_page *page, fz_stext_line *line, fz_matrix trm, fz_font *font, float size, int c, fz_point *p, fz_point *q, int color)
+add_char_to_line(fz_context *ctx, fz_stext_device *dev, fz_stext_line *line, fz_matrix trm, fz_font *font, float size, int c, fz_point *p, fz_point *q, int color)
 {
-	fz_stext_char *ch = fz_pool_alloc(ctx, page->pool, sizeof *line->first_char);
+	fz_stext_char *ch;
 	fz_point a, d;
 
+	if (dev->open_line != line)
+		fz_stext_open_line(ctx, dev, line);
+	if (dev->line_len == dev->line_cap)
+	{
+		int cap = dev->line_cap ? dev->line_cap * 2 : 64;
+		dev->line_chars = fz_realloc_array(ctx, dev->line_chars, cap, fz_stext_char);
+		dev->line_cap = cap;
+		link_line_chars(line, dev->line_chars, dev->line_len);
+	}
+	ch = &dev->line_chars[dev->line_len++];
+	memset(ch, 0, sizeof *ch);
+
 	if (!line->first_char)
 		line->first_char = line->last_char = ch;
 	else
@@ -341,7 +499,7 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 	if (cur_line && glyph < 0)
 	{
 		/* Don't advance pen or break lines for no-glyph characters in a cluster */
-		add_char_to_line(ctx, page, cur_line, trm, font, size, c, &dev->pen, &dev->pen, dev->color);
+		add_char_to_line(ctx, dev, cur_line, trm, font, size, c, &dev->pen, &dev->pen, dev->color);
 		dev->lastchar = c;
 		return;
 	}
@@ -434,22 +592,22 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 	/* Start a new block (but only at the beginning of a text object) */
 	if (new_para || !cur_block)
 	{
-		cur_block = add_text_block_to_page(ctx, page);
+		cur_block = add_text_block_to_page(ctx, dev);
 		cur_line = cur_block->u.t.last_line;
 	}
 
 	/* Start a new line */
 	if (new_line || !cur_line)
 	{
-		cur_line = add_line_to_block(ctx, page, cur_block, &ndir, wmode);
+		cur_line = add_line_to_block(ctx, dev, cur_block, &ndir, wmode);
 		dev->start = p;
 	}
 
 	/* Add synthetic space */
 	if (add_space && !(dev->flags & FZ_STEXT_INHIBIT_SPACES))
-		add_char_to_line(ctx, page, cur_line, trm, font, size, ' ', &dev->pen, &p, dev->color);
+		add_char_to_line(ctx, dev, cur_line, trm, font, size, ' ', &dev->pen, &p, dev->color);
 
-	add_char_to_line(ctx, page, cur_line, trm, font, size, c, &p, &q, dev->color);
+	add_char_to_line(ctx, dev, cur_line, trm, font, size, c, &p, &q, dev->color);
 	dev->lastchar = c;
 	dev->pen = q;
 
@@ -659,7 +817,7 @@ fz_stext_fill_image(fz_context *ctx, fz_device *dev, fz_image *img, fz_matrix ct
 	if (alpha < 0.5f)
 		return;
 
-	add_image_block_to_page(ctx, tdev->page, ctm, img);
+	add_image_block_to_page(ctx, tdev, ctm, img);
 }
 
 static void
@@ -726,27 +884,18 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_stext_page *page = tdev->page;
 	fz_stext_block *block;
-	fz_stext_line *line;
-	fz_stext_char *ch;
 
-	for (block = page->first_block; block; block = block->next)
+	fz_stext_flush_line(ctx, tdev);
+
+	if (tdev->block_fn)
 	{
-		if (block->type != FZ_STEXT_BLOCK_TEXT)
-			continue;
-		for (line = block->u.t.first_line; line; line = line->next)
-		{
-			for (ch = line->first_char; ch; ch = ch->next)
-			{
-				fz_rect ch_box = fz_rect_from_quad(ch->quad);
-				if (ch == line->first_char)
-					line->bbox = ch_box;
-				else
-					line->bbox = fz_union_rect(line->bbox, ch_box);
-			}
-			block->bbox = fz_union_rect(block->bbox, line->bbox);
-		}
+		fz_stext_flush_blocks(ctx, tdev);
+		return;
 	}
 
+	for (block = page->first_block; block; block = block->next)
+		fz_stext_finish_block(ctx, block);
+
 	/* TODO: smart sorting of blocks and lines in reading order */
 	/* TODO: unicode NFC normalization */
 }
@@ -756,6 +905,23 @@ fz_stext_drop_device(fz_context *ctx, fz_device *dev)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_drop_text(ctx, tdev->lasttext);
+	if (tdev->open_line && !tdev->block_fn)
+	{
+		/* Keep the last line of a device that was never closed. */
+		fz_try(ctx)
+			fz_stext_flush_line(ctx, tdev);
+		fz_catch(ctx)
+			link_line_chars(tdev->open_line, NULL, 0);
+	}
+	fz_free(ctx, tdev->line_chars);
+	if (tdev->block_fn)
+	{
+		fz_stext_block *block;
+		for (block = tdev->stream_page.first_block; block; block = block->next)
+			if (block->type == FZ_STEXT_BLOCK_IMAGE)
+				fz_drop_image(ctx, block->u.i.image);
+		fz_drop_pool(ctx, tdev->stream_page.pool);
+	}
 }
 
 /*
@@ -828,3 +994,40 @@ fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options
 
 	return (fz_device*)dev;
 }
+
+/*
+	Create a device to extract the text on a page one block at a time.
+
+	Instead of collecting the whole page, each block is passed to fn as
+	soon as it is complete (which is when the next block is started, or
+	the device is closed), after which its memory is reused for the
+	blocks that follow. This keeps memory use bounded by the size of the
+	largest block, rather than the whole page, and avoids allocating for
+	every character.
+
+	The blocks passed to fn are only valid for the duration of the call.
+
+	options: Options to configure the stext device.
+*/
+fz_device *
+fz_new_stext_stream_device(fz_context *ctx, const fz_stext_options *opts, fz_stext_block_fn *fn, void *arg)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	fz_stext_device *dev = NULL;
+
+	fz_try(ctx)
+		dev = (fz_stext_device*)fz_new_stext_device(ctx, NULL, opts);
+	fz_catch(ctx)
+	{
+		fz_drop_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	dev->stream_page.pool = pool;
+	dev->stream_page.mediabox = fz_empty_rect;
+	dev->page = &dev->stream_page;
+	dev->block_fn = fn;
+	dev->block_arg = arg;
+
+	return (fz_device*)dev;
+}
@@ -145,6 +145,24 @@ fz_print_stext_block_as_html(fz_context *ctx, fz_output *out, fz_stext_block *bl
 	}
 }
 
+static void
+fz_print_stext_page_begin_as_html(fz_context *ctx, fz_output *out, fz_rect mediabox, int id)
+{
+	int w = mediabox.x1 - mediabox.x0;
+	int h = mediabox.y1 - mediabox.y0;
+
+	fz_write_printf(ctx, out, "<div id=\"page%d\" style=\"position:relative;width:%dpt;height:%dpt;background-color:white\">\n", id, w, h);
+}
+
+static void
+fz_print_stext_any_block_as_html(fz_context *ctx, fz_output *out, fz_stext_block *block)
+{
+	if (block->type == FZ_STEXT_BLOCK_IMAGE)
+		fz_print_stext_image_as_html(ctx, out, block);
+	else if (block->type == FZ_STEXT_BLOCK_TEXT)
+		fz_print_stext_block_as_html(ctx, out, block);
+}
+
 /*
 	Output a page to a file in HTML (visual) format.
 */
@@ -153,18 +171,10 @@ fz_print_stext_page_as_html(fz_context *ctx, fz_output *out, fz_stext_page *page
 {
 	fz_stext_block *block;
 
-	int w = page->mediabox.x1 - page->mediabox.x0;
-	int h = page->mediabox.y1 - page->mediabox.y0;
-
-	fz_write_printf(ctx, out, "<div id=\"page%d\" style=\"position:relative;width:%dpt;height:%dpt;background-color:white\">\n", id, w, h);
+	fz_print_stext_page_begin_as_html(ctx, out, page->mediabox, id);
 
 	for (block = page->first_block; block; block = block->next)
-	{
-		if (block->type == FZ_STEXT_BLOCK_IMAGE)
-			fz_print_stext_image_as_html(ctx, out, block);
-		else if (block->type == FZ_STEXT_BLOCK_TEXT)
-			fz_print_stext_block_as_html(ctx, out, block);
-	}
+		fz_print_stext_any_block_as_html(ctx, out, block);
 
 	fz_write_string(ctx, out, "</div>\n");
 }
@@ -326,6 +336,21 @@ static void fz_print_stext_block_as_xhtml(fz_context *ctx, fz_output *out, fz_st
 	fz_write_printf(ctx, out, "</%s>\n", tag);
 }
 
+static void
+fz_print_stext_page_begin_as_xhtml(fz_context *ctx, fz_output *out, int id)
+{
+	fz_write_printf(ctx, out, "<div id=\"page%d\">\n", id);
+}
+
+static void
+fz_print_stext_any_block_as_xhtml(fz_context *ctx, fz_output *out, fz_stext_block *block)
+{
+	if (block->type == FZ_STEXT_BLOCK_IMAGE)
+		fz_print_stext_image_as_xhtml(ctx, out, block);
+	else if (block->type == FZ_STEXT_BLOCK_TEXT)
+		fz_print_stext_block_as_xhtml(ctx, out, block);
+}
+
 /*
 	Output a page to a file in XHTML (semantic) format.
 */
@@ -334,15 +359,10 @@ fz_print_stext_page_as_xhtml(fz_context *ctx, fz_output *out, fz_stext_page *pag
 {
 	fz_stext_block *block;
 
-	fz_write_printf(ctx, out, "<div id=\"page%d\">\n", id);
+	fz_print_stext_page_begin_as_xhtml(ctx, out, id);
 
 	for (block = page->first_block; block; block = block->next)
-	{
-		if (block->type == FZ_STEXT_BLOCK_IMAGE)
-			fz_print_stext_image_as_xhtml(ctx, out, block);
-		else if (block->type == FZ_STEXT_BLOCK_TEXT)
-			fz_print_stext_block_as_xhtml(ctx, out, block);
-	}
+		fz_print_stext_any_block_as_xhtml(ctx, out, block);
 
 	fz_write_string(ctx, out, "</div>\n");
 }
@@ -372,121 +392,137 @@ fz_print_stext_trailer_as_xhtml(fz_context *ctx, fz_output *out)
 
 /* Detailed XML dump of the entire structured text data */
 
-/*
-	Output a page to a file in XML format.
-*/
-void
-fz_print_stext_page_as_xml(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
+static void
+fz_print_stext_page_begin_as_xml(fz_context *ctx, fz_output *out, fz_rect mediabox, int id)
+{
+	fz_write_printf(ctx, out, "<page id=\"page%d\" width=\"%g\" height=\"%g\">\n", id,
+		mediabox.x1 - mediabox.x0,
+		mediabox.y1 - mediabox.y0);
+}
+
+static void
+fz_print_stext_block_as_xml(fz_context *ctx, fz_output *out, fz_stext_block *block)
 {
-	fz_stext_block *block;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 
-	fz_write_printf(ctx, out, "<page id=\"page%d\" width=\"%g\" height=\"%g\">\n", id,
-		page->mediabox.x1 - page->mediabox.x0,
-		page->mediabox.y1 - page->mediabox.y0);
-
-	for (block = page->first_block; block; block = block->next)
+	switch (block->type)
 	{
-		switch (block->type)
+	case FZ_STEXT_BLOCK_TEXT:
+		fz_write_printf(ctx, out, "<block bbox=\"%g %g %g %g\">\n",
+				block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-		case FZ_STEXT_BLOCK_TEXT:
-			fz_write_printf(ctx, out, "<block bbox=\"%g %g %g %g\">\n",
-					block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
-			for (line = block->u.t.first_line; line; line = line->next)
-			{
-				fz_font *font = NULL;
-				float size = 0;
-				const char *name = NULL;
+			fz_font *font = NULL;
+			float size = 0;
+			const char *name = NULL;
 
-				fz_write_printf(ctx, out, "<line bbox=\"%g %g %g %g\" wmode=\"%d\" dir=\"%g %g\">\n",
-						line->bbox.x0, line->bbox.y0, line->bbox.x1, line->bbox.y1,
-						line->wmode,
-						line->dir.x, line->dir.y);
+			fz_write_printf(ctx, out, "<line bbox=\"%g %g %g %g\" wmode=\"%d\" dir=\"%g %g\">\n",
+					line->bbox.x0, line->bbox.y0, line->bbox.x1, line->bbox.y1,
+					line->wmode,
+					line->dir.x, line->dir.y);
 
-				for (ch = line->first_char; ch; ch = ch->next)
+			for (ch = line->first_char; ch; ch = ch->next)
+			{
+				if (ch->font != font || ch->size != size)
 				{
-					if (ch->font != font || ch->size != size)
-					{
-						if (font)
-							fz_write_string(ctx, out, "</font>\n");
-						font = ch->font;
-						size = ch->size;
-						name = font_full_name(ctx, font);
-						fz_write_printf(ctx, out, "<font name=\"%s\" size=\"%g\">\n", name, size);
-					}
-					fz_write_printf(ctx, out, "<char quad=\"%g %g %g %g %g %g %g %g\" x=\"%g\" y=\"%g\" color=\"#%06x\" c=\"",
-							ch->quad.ul.x, ch->quad.ul.y,
-							ch->quad.ur.x, ch->quad.ur.y,
-							ch->quad.ll.x, ch->quad.ll.y,
-							ch->quad.lr.x, ch->quad.lr.y,
-							ch->origin.x, ch->origin.y,
-							ch->color);
-					switch (ch->c)
-					{
-					case '<': fz_write_string(ctx, out, "&lt;"); break;
-					case '>': fz_write_string(ctx, out, "&gt;"); break;
-					case '&': fz_write_string(ctx, out, "&amp;"); break;
-					case '"': fz_write_string(ctx, out, "&quot;"); break;
-					case '\'': fz_write_string(ctx, out, "&apos;"); break;
-					default:
-						   if (ch->c >= 32 && ch->c <= 127)
-							   fz_write_printf(ctx, out, "%c", ch->c);
-						   else
-							   fz_write_printf(ctx, out, "&#x%x;", ch->c);
-						   break;
-					}
-					fz_write_string(ctx, out, "\"/>\n");
+					if (font)
+						fz_write_string(ctx, out, "</font>\n");
+					font = ch->font;
+					size = ch->size;
+					name = font_full_name(ctx, font);
+					fz_write_printf(ctx, out, "<font name=\"%s\" size=\"%g\">\n", name, size);
 				}
-
-				if (font)
-					fz_write_string(ctx, out, "</font>\n");
-
-				fz_write_string(ctx, out, "</line>\n");
+				fz_write_printf(ctx, out, "<char quad=\"%g %g %g %g %g %g %g %g\" x=\"%g\" y=\"%g\" color=\"#%06x\" c=\"",
+						ch->quad.ul.x, ch->quad.ul.y,
+						ch->quad.ur.x, ch->quad.ur.y,
+						ch->quad.ll.x, ch->quad.ll.y,
+						ch->quad.lr.x, ch->quad.lr.y,
+						ch->origin.x, ch->origin.y,
+						ch->color);
+				switch (ch->c)
+				{
+				case '<': fz_write_string(ctx, out, "&lt;"); break;
+				case '>': fz_write_string(ctx, out, "&gt;"); break;
+				case '&': fz_write_string(ctx, out, "&amp;"); break;
+				case '"': fz_write_string(ctx, out, "&quot;"); break;
+				case '\'': fz_write_string(ctx, out, "&apos;"); break;
+				default:
+					   if (ch->c >= 32 && ch->c <= 127)
+						   fz_write_printf(ctx, out, "%c", ch->c);
+					   else
+						   fz_write_printf(ctx, out, "&#x%x;", ch->c);
+					   break;
+				}
+				fz_write_string(ctx, out, "\"/>\n");
 			}
-			fz_write_string(ctx, out, "</block>\n");
-			break;
 
-		case FZ_STEXT_BLOCK_IMAGE:
-			fz_write_printf(ctx, out, "<image bbox=\"%g %g %g %g\" />\n",
-					block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
-			break;
+			if (font)
+				fz_write_string(ctx, out, "</font>\n");
+
+			fz_write_string(ctx, out, "</line>\n");
 		}
+		fz_write_string(ctx, out, "</block>\n");
+		break;
+
+	case FZ_STEXT_BLOCK_IMAGE:
+		fz_write_printf(ctx, out, "<image bbox=\"%g %g %g %g\" />\n",
+				block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
+		break;
 	}
-	fz_write_string(ctx, out, "</page>\n");
 }
 
-/* Plain text */
-
 /*
-	Output a page to a file in UTF-8 format.
+	Output a page to a file in XML format.
 */
 void
-fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page *page)
+fz_print_stext_page_as_xml(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
 {
 	fz_stext_block *block;
+
+	fz_print_stext_page_begin_as_xml(ctx, out, page->mediabox, id);
+
+	for (block = page->first_block; block; block = block->next)
+		fz_print_stext_block_as_xml(ctx, out, block);
+
+	fz_write_string(ctx, out, "</page>\n");
+}
+
+/* Plain text */
+
+static void
+fz_print_stext_block_as_text(fz_context *ctx, fz_output *out, fz_stext_block *block)
+{
 	fz_stext_line *line;
-	fz_stext_char *ch;
 	char utf[10];
-	int i, n;
+	int i, k, n;
 
-	for (block = page->first_block; block; block = block->next)
+	if (block->type != FZ_STEXT_BLOCK_TEXT)
+		return;
+
+	for (line = block->u.t.first_line; line; line = line->next)
 	{
-		if (block->type == FZ_STEXT_BLOCK_TEXT)
+		for (k = 0; k < line->len; k++)
 		{
-			for (line = block->u.t.first_line; line; line = line->next)
-			{
-				for (ch = line->first_char; ch; ch = ch->next)
-				{
-					n = fz_runetochar(utf, ch->c);
-					for (i = 0; i < n; i++)
-						fz_write_byte(ctx, out, utf[i]);
-				}
-				fz_write_string(ctx, out, "\n");
-			}
-			fz_write_string(ctx, out, "\n");
+			n = fz_runetochar(utf, line->text[k]);
+			for (i = 0; i < n; i++)
+				fz_write_byte(ctx, out, utf[i]);
 		}
+		fz_write_string(ctx, out, "\n");
 	}
+	fz_write_string(ctx, out, "\n");
+}
+
+/*
+	Output a page to a file in UTF-8 format.
+*/
+void
+fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page *page)
+{
+	fz_stext_block *block;
+
+	for (block = page->first_block; block; block = block->next)
+		fz_print_stext_block_as_text(ctx, out, block);
 }
 
 /* Text output writer */
@@ -506,25 +542,55 @@ struct fz_text_writer_s
 	int format;
 	int number;
 	fz_stext_options opts;
-	fz_stext_page *page;
 	fz_output *out;
 };
 
+static void
+text_write_block(fz_context *ctx, void *arg, fz_stext_block *block)
+{
+	fz_text_writer *wri = arg;
+
+	switch (wri->format)
+	{
+	default:
+	case FZ_FORMAT_TEXT:
+		fz_print_stext_block_as_text(ctx, wri->out, block);
+		break;
+	case FZ_FORMAT_HTML:
+		fz_print_stext_any_block_as_html(ctx, wri->out, block);
+		break;
+	case FZ_FORMAT_XHTML:
+		fz_print_stext_any_block_as_xhtml(ctx, wri->out, block);
+		break;
+	case FZ_FORMAT_STEXT:
+		fz_print_stext_block_as_xml(ctx, wri->out, block);
+		break;
+	}
+}
+
+/* Blocks are written out as soon as the device has finished them, so
+ * the whole page is never held in memory. */
 static fz_device *
 text_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
 {
 	fz_text_writer *wri = (fz_text_writer*)wri_;
 
-	if (wri->page)
+	wri->number++;
+
+	switch (wri->format)
 	{
-		fz_drop_stext_page(ctx, wri->page);
-		wri->page = NULL;
+	case FZ_FORMAT_HTML:
+		fz_print_stext_page_begin_as_html(ctx, wri->out, mediabox, wri->number);
+		break;
+	case FZ_FORMAT_XHTML:
+		fz_print_stext_page_begin_as_xhtml(ctx, wri->out, wri->number);
+		break;
+	case FZ_FORMAT_STEXT:
+		fz_print_stext_page_begin_as_xml(ctx, wri->out, mediabox, wri->number);
+		break;
 	}
 
-	wri->number++;
-
-	wri->page = fz_new_stext_page(ctx, mediabox);
-	return fz_new_stext_device(ctx, wri->page, &wri->opts);
+	return fz_new_stext_stream_device(ctx, &wri->opts, text_write_block, wri);
 }
 
 static void
@@ -537,27 +603,17 @@ text_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 		fz_close_device(ctx, dev);
 		switch (wri->format)
 		{
-		default:
-		case FZ_FORMAT_TEXT:
-			fz_print_stext_page_as_text(ctx, wri->out, wri->page);
-			break;
 		case FZ_FORMAT_HTML:
-			fz_print_stext_page_as_html(ctx, wri->out, wri->page, wri->number);
-			break;
 		case FZ_FORMAT_XHTML:
-			fz_print_stext_page_as_xhtml(ctx, wri->out, wri->page, wri->number);
+			fz_write_string(ctx, wri->out, "</div>\n");
 			break;
 		case FZ_FORMAT_STEXT:
-			fz_print_stext_page_as_xml(ctx, wri->out, wri->page, wri->number);
+			fz_write_string(ctx, wri->out, "</page>\n");
 			break;
 		}
 	}
 	fz_always(ctx)
-	{
 		fz_drop_device(ctx, dev);
-		fz_drop_stext_page(ctx, wri->page);
-		wri->page = NULL;
-	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 }
@@ -585,7 +641,6 @@ static void
 text_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_text_writer *wri = (fz_text_writer*)wri_;
-	fz_drop_stext_page(ctx, wri->page);
 	fz_drop_output(ctx, wri->out);
 }
 
@@ -25,18 +25,9 @@ static float vdist(fz_point *dir, fz_point *a, fz_point *b)
 	return fz_abs(dx * dir->y + dy * dir->x);
 }
 
-static int line_length(fz_stext_line *line)
-{
-	fz_stext_char *ch;
-	int n = 0;
-	for (ch = line->first_char; ch; ch = ch->next)
-		++n;
-	return n;
-}
-
 static int find_closest_in_line(fz_stext_line *line, int idx, fz_point p)
 {
-	fz_stext_char *ch;
+	int i;
 	float closest_dist = 1e30f;
 	int closest_idx = idx;
 
@@ -45,20 +36,20 @@ static int find_closest_in_line(fz_stext_line *line, int idx, fz_point p)
 		if (p.y < line->bbox.y0)
 			return idx;
 		if (p.y > line->bbox.y1)
-			return idx + line_length(line);
+			return idx + line->len;
 	}
 	else
 	{
 		if (p.x < line->bbox.x0)
-			return idx + line_length(line);
+			return idx + line->len;
 		if (p.x > line->bbox.x1)
 			return idx;
 	}
 
-	for (ch = line->first_char; ch; ch = ch->next)
+	for (i = 0; i < line->len; i++)
 	{
-		float mid_x = (ch->quad.ul.x + ch->quad.ur.x + ch->quad.ll.x + ch->quad.lr.x) / 4;
-		float mid_y = (ch->quad.ul.y + ch->quad.ur.y + ch->quad.ll.y + ch->quad.lr.y) / 4;
+		float mid_x = line->center[i].x;
+		float mid_y = line->center[i].y;
 		float this_dist = dist2(p.x - mid_x, p.y - mid_y);
 		if (this_dist < closest_dist)
 		{
@@ -122,7 +113,7 @@ static int find_closest_in_page(fz_stext_page *page, fz_point p)
 				closest_line = line;
 				closest_idx = idx;
 			}
-			idx += line_length(line);
+			idx += line->len;
 		}
 	}
 
@@ -143,8 +134,7 @@ fz_enumerate_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_poin
 {
 	fz_stext_block *block;
 	fz_stext_line *line;
-	fz_stext_char *ch;
-	int idx, start, end;
+	int i, idx, start, end;
 	int inside;
 
 	start = find_closest_in_page(page, a);
@@ -164,13 +154,19 @@ fz_enumerate_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_poin
 			continue;
 		for (line = block->u.t.first_line; line; line = line->next)
 		{
-			for (ch = line->first_char; ch; ch = ch->next)
+			/* Skip whole lines up to the start. */
+			if (!inside && idx + line->len <= start)
+			{
+				idx += line->len;
+				continue;
+			}
+			for (i = 0; i < line->len; i++)
 			{
 				if (!inside)
 					if (idx == start)
 						inside = 1;
 				if (inside)
-					cb->on_char(ctx, cb->arg, line, ch);
+					cb->on_char(ctx, cb->arg, line, &line->first_char[i]);
 				if (++idx == end)
 					return;
 			}
@@ -254,6 +250,7 @@ struct highlight
 	int len, cap;
 	fz_quad *box;
 	float hfuzz, vfuzz;
+	int *marks, mark;
 };
 
 static void on_highlight_char(fz_context *ctx, void *arg, fz_stext_line *line, fz_stext_char *ch)
@@ -262,7 +259,7 @@ static void on_highlight_char(fz_context *ctx, void *arg, fz_stext_line *line, f
 	float vfuzz = ch->size * hits->vfuzz;
 	float hfuzz = ch->size * hits->hfuzz;
 
-	if (hits->len > 0)
+	if (hits->len > 0 && (!hits->marks || hits->marks[hits->len-1] == hits->mark))
 	{
 		fz_quad *end = &hits->box[hits->len-1];
 		if (hdist(&line->dir, &end->lr, &ch->quad.ll) < hfuzz
@@ -277,7 +274,11 @@ static void on_highlight_char(fz_context *ctx, void *arg, fz_stext_line *line, f
 	}
 
 	if (hits->len < hits->cap)
+	{
+		if (hits->marks)
+			hits->marks[hits->len] = hits->mark;
 		hits->box[hits->len++] = ch->quad;
+	}
 }
 
 static void on_highlight_line(fz_context *ctx, void *arg, fz_stext_line *line)
@@ -298,6 +299,8 @@ fz_highlight_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_poin
 	hits.box = quads;
 	hits.hfuzz = 0.5f; /* merge large gaps */
 	hits.vfuzz = 0.1f;
+	hits.marks = NULL;
+	hits.mark = 0;
 
 	cb.on_char = on_highlight_char;
 	cb.on_line = on_highlight_line;
@@ -358,144 +361,491 @@ fz_copy_selection(fz_context *ctx, fz_stext_page *page, fz_point a, fz_point b,
 	return (char*)s;
 }
 
+
 /* String search */
 
+/*
+	Text is searched as a stream of symbols: every character is case
+	folded, and each run of white space (including the line and block
+	breaks) is collapsed into a single ' '. The needles are reduced the
+	same way and compiled into an Aho-Corasick automaton, so that any
+	number of needles are found in one linear pass over the page.
+*/
+
+/* Simple case folding for Latin, Greek, Cyrillic, Armenian and Georgian. */
+static const struct { unsigned short lo, hi; short delta; unsigned char alt; } fold_table[] = {
+	{ 0x00C0, 0x00D6, 32, 0 }, { 0x00D8, 0x00DE, 32, 0 },
+	{ 0x0100, 0x012F, 1, 1 }, { 0x0130, 0x0130, -199, 0 },
+	{ 0x0132, 0x0137, 1, 1 }, { 0x0139, 0x0148, 1, 1 },
+	{ 0x014A, 0x0177, 1, 1 }, { 0x0178, 0x0178, -121, 0 },
+	{ 0x0179, 0x017E, 1, 1 }, { 0x017F, 0x017F, -268, 0 },
+	{ 0x01CD, 0x01DC, 1, 1 }, { 0x01DE, 0x01EF, 1, 1 },
+	{ 0x01F8, 0x021F, 1, 1 }, { 0x0222, 0x0233, 1, 1 },
+	{ 0x0386, 0x0386, 38, 0 }, { 0x0388, 0x038A, 37, 0 },
+	{ 0x038C, 0x038C, 64, 0 }, { 0x038E, 0x038F, 63, 0 },
+	{ 0x0391, 0x03A1, 32, 0 }, { 0x03A3, 0x03AB, 32, 0 },
+	{ 0x03C2, 0x03C2, 1, 0 }, { 0x03D8, 0x03EF, 1, 1 },
+	{ 0x0400, 0x040F, 80, 0 }, { 0x0410, 0x042F, 32, 0 },
+	{ 0x0460, 0x0481, 1, 1 }, { 0x048A, 0x04BF, 1, 1 },
+	{ 0x04C0, 0x04C0, 15, 0 }, { 0x04C1, 0x04CE, 1, 1 },
+	{ 0x04D0, 0x052F, 1, 1 }, { 0x0531, 0x0556, 48, 0 },
+	{ 0x10A0, 0x10C5, 7264, 0 }, { 0x1E00, 0x1E95, 1, 1 },
+	{ 0x1E9E, 0x1E9E, -7615, 0 }, { 0x1EA0, 0x1EFF, 1, 1 },
+	{ 0x1F08, 0x1F0F, -8, 0 }, { 0x1F18, 0x1F1D, -8, 0 },
+	{ 0x1F28, 0x1F2F, -8, 0 }, { 0x1F38, 0x1F3F, -8, 0 },
+	{ 0x1F48, 0x1F4D, -8, 0 }, { 0x1F68, 0x1F6F, -8, 0 },
+	{ 0x2160, 0x216F, 16, 0 }, { 0x24B6, 0x24CF, 26, 0 },
+	{ 0xFF21, 0xFF3A, 32, 0 },
+};
+
+static int fold_case(int c)
+{
+	int l = 0;
+	int r = nelem(fold_table) - 1;
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		if (c < fold_table[m].lo)
+			r = m - 1;
+		else if (c > fold_table[m].hi)
+			l = m + 1;
+		else if (fold_table[m].alt && ((c - fold_table[m].lo) & 1))
+			return c;
+		else
+			return c + fold_table[m].delta;
+	}
+	return c;
+}
+
 static inline int canon(int c)
 {
-	/* TODO: proper unicode case folding */
 	/* TODO: character equivalence (a matches ä, etc) */
-	if (c == 0xA0 || c == 0x2028 || c == 0x2029)
-		return ' ';
-	if (c == '\r' || c == '\n' || c == '\t')
+	if (c < 128)
+	{
+		if (c >= 'A' && c <= 'Z')
+			return c - 'A' + 'a';
+		if (c == '\r' || c == '\n' || c == '\t' || c == '\v' || c == '\f')
+			return ' ';
+		return c;
+	}
+	if (c == 0xA0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200A) ||
+		c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000)
 		return ' ';
-	if (c >= 'A' && c <= 'Z')
-		return c - 'A' + 'a';
-	return c;
+	return fold_case(c);
 }
 
-static inline int chartocanon(int *c, const char *s)
+struct search_sym
 {
-	int n = fz_chartorune(c, s);
-	*c = canon(*c);
-	return n;
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int start, end;
+};
+
+struct fz_stext_search_s
+{
+	fz_pool *pool;
+	int needle_count;
+	int *needle_len;
+
+	/* Automaton; node 0 is the root. The edges out of node i are
+	 * edge_sym/edge_to[edge_start[i] .. edge_start[i+1]), sorted by symbol. */
+	int node_count;
+	int *edge_start, *edge_sym, *edge_to;
+	int *fail, *out, *dict;
+	int root[128];
+
+	/* Size of the ring of recent symbols each pass keeps; a power
+	 * of two no smaller than the longest needle. */
+	int ring_mask;
+};
+
+static int find_trie_child(int *child, int *sibling, int *sym, int s, int c)
+{
+	for (s = child[s]; s; s = sibling[s])
+		if (sym[s] == c)
+			return s;
+	return 0;
 }
 
-static const char *match_string(const char *h, const char *n)
+static int find_edge(fz_stext_search *search, int s, int c)
 {
-	int hc, nc;
-	const char *e = h;
-	h += chartocanon(&hc, h);
-	n += chartocanon(&nc, n);
-	while (hc == nc)
+	int l = search->edge_start[s];
+	int r = search->edge_start[s+1] - 1;
+	while (l <= r)
 	{
-		e = h;
-		if (hc == ' ')
-			do
-				h += chartocanon(&hc, h);
-			while (hc == ' ');
+		int m = (l + r) >> 1;
+		if (c < search->edge_sym[m])
+			r = m - 1;
+		else if (c > search->edge_sym[m])
+			l = m + 1;
 		else
-			h += chartocanon(&hc, h);
-		if (nc == ' ')
-			do
-				n += chartocanon(&nc, n);
-			while (nc == ' ');
-		else
-			n += chartocanon(&nc, n);
+			return search->edge_to[m];
 	}
-	return nc == 0 ? e : NULL;
+	return 0;
 }
 
-static const char *find_string(const char *s, const char *needle, const char **endp)
+static void
+build_stext_search(fz_context *ctx, fz_stext_search *search, const char **needles, int *sym, int *child, int *sibling, int *queue)
 {
-	const char *end;
-	while (*s)
+	int i, k, c, s, t, n, head, tail, prev, len, max_len, ring_size;
+	const char *p;
+
+	/* Build the trie. */
+	search->out[0] = -1;
+	n = 1;
+	max_len = 1;
+	for (k = 0; k < search->needle_count; ++k)
+	{
+		s = 0;
+		len = 0;
+		prev = 0;
+		for (p = needles[k]; *p; prev = c)
+		{
+			p += fz_chartorune(&c, p);
+			c = canon(c);
+			if (c == ' ' && prev == ' ')
+				continue;
+			t = find_trie_child(child, sibling, sym, s, c);
+			if (!t)
+			{
+				t = n++;
+				sym[t] = c;
+				search->out[t] = -1;
+				sibling[t] = child[s];
+				child[s] = t;
+			}
+			s = t;
+			++len;
+		}
+		search->needle_len[k] = len;
+		if (len > 0 && search->out[s] < 0)
+			search->out[s] = k;
+		if (len > max_len)
+			max_len = len;
+	}
+	search->node_count = n;
+
+	/* Compute failure and dictionary suffix links in breadth first order. */
+	head = tail = 0;
+	for (t = child[0]; t; t = sibling[t])
+		queue[tail++] = t;
+	while (head < tail)
+	{
+		s = queue[head++];
+		for (t = child[s]; t; t = sibling[t])
+		{
+			int f = search->fail[s];
+			while (f && !find_trie_child(child, sibling, sym, f, sym[t]))
+				f = search->fail[f];
+			search->fail[t] = find_trie_child(child, sibling, sym, f, sym[t]);
+			f = search->fail[t];
+			search->dict[t] = search->out[f] >= 0 ? f : search->dict[f];
+			queue[tail++] = t;
+		}
+	}
+
+	/* Flatten the edges into sorted arrays. */
+	k = 0;
+	for (s = 0; s < n; ++s)
 	{
-		end = match_string(s, needle);
-		if (end)
-			return *endp = end, s;
-		++s;
+		search->edge_start[s] = k;
+		for (t = child[s]; t; t = sibling[t])
+		{
+			for (i = k; i > search->edge_start[s] && search->edge_sym[i-1] > sym[t]; --i)
+			{
+				search->edge_sym[i] = search->edge_sym[i-1];
+				search->edge_to[i] = search->edge_to[i-1];
+			}
+			search->edge_sym[i] = sym[t];
+			search->edge_to[i] = t;
+			++k;
+		}
 	}
-	return *endp = NULL, NULL;
+	search->edge_start[n] = k;
+
+	for (c = 0; c < 128; ++c)
+		search->root[c] = find_edge(search, 0, c);
+
+	for (ring_size = 1; ring_size < max_len; ring_size <<= 1)
+		;
+	search->ring_mask = ring_size - 1;
 }
 
 /*
-	Search for occurrence of 'needle' in text page.
+	Compile a set of needles for searching structured text pages.
 
-	Return the number of hits and store hit quads in the passed in array.
+	Matching ignores case, and any run of white space or line breaks
+	in a needle matches any run of white space or line breaks in the
+	text. Empty needles never match, and needles that are the same
+	after folding are reported as the first of them.
 
-	NOTE: This is an experimental interface and subject to change without notice.
+	The compiled search can be used for any number of pages. It is
+	not changed by searching, so it may be run on several pages at
+	once from different threads.
+*/
+fz_stext_search *
+fz_new_stext_search(fz_context *ctx, const char **needles, int count)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	fz_stext_search *search = NULL;
+	int *sym = NULL, *child = NULL, *sibling = NULL, *queue = NULL;
+	size_t k, n = 1;
+
+	fz_var(sym);
+	fz_var(child);
+	fz_var(sibling);
+	fz_var(queue);
+
+	fz_try(ctx)
+	{
+		for (k = 0; k < (size_t)count; ++k)
+			n += strlen(needles[k]);
+
+		search = fz_pool_alloc(ctx, pool, sizeof *search);
+		search->pool = pool;
+		search->needle_count = count;
+		search->needle_len = fz_pool_alloc(ctx, pool, count * sizeof(int));
+		search->edge_start = fz_pool_alloc(ctx, pool, (n + 1) * sizeof(int));
+		search->edge_sym = fz_pool_alloc(ctx, pool, n * sizeof(int));
+		search->edge_to = fz_pool_alloc(ctx, pool, n * sizeof(int));
+		search->fail = fz_pool_alloc(ctx, pool, n * sizeof(int));
+		search->out = fz_pool_alloc(ctx, pool, n * sizeof(int));
+		search->dict = fz_pool_alloc(ctx, pool, n * sizeof(int));
+
+		sym = fz_malloc_array(ctx, n, int);
+		child = fz_calloc(ctx, n, sizeof(int));
+		sibling = fz_malloc_array(ctx, n, int);
+		queue = fz_malloc_array(ctx, n, int);
+
+		build_stext_search(ctx, search, needles, sym, child, sibling, queue);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, sym);
+		fz_free(ctx, child);
+		fz_free(ctx, sibling);
+		fz_free(ctx, queue);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	return search;
+}
+
+void
+fz_drop_stext_search(fz_context *ctx, fz_stext_search *search)
+{
+	if (search)
+		fz_drop_pool(ctx, search->pool);
+}
+
+struct search_state
+{
+	fz_stext_search *search;
+	struct highlight *hits;
+	int state, pos, idx, space;
+
+	/* The last symbol of the previous hit for each needle, and the
+	 * position of the most recent symbols. */
+	int *last_end;
+	struct search_sym *ring;
+};
+
+static void
+search_hit(fz_context *ctx, struct search_state *st, int k)
+{
+	fz_stext_search *search = st->search;
+	int first = st->pos - search->needle_len[k] + 1;
+	struct search_sym *a, *b;
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int n;
+
+	/* Hits of the same needle do not overlap. */
+	if (first <= st->last_end[k])
+		return;
+	st->last_end[k] = st->pos;
+
+	a = &st->ring[first & search->ring_mask];
+	b = &st->ring[st->pos & search->ring_mask];
+	block = a->block;
+	line = a->line;
+	ch = a->ch;
+
+	st->hits->mark = k;
+	for (n = b->end - a->start; n > 0; --n)
+	{
+		while (!ch)
+		{
+			line = line->next;
+			while (!line)
+			{
+				block = block->next;
+				if (block->type == FZ_STEXT_BLOCK_TEXT)
+					line = block->u.t.first_line;
+			}
+			ch = line->first_char;
+		}
+		on_highlight_char(ctx, st->hits, line, ch);
+		ch = ch->next;
+	}
+}
+
+/* Feed one character, or a line break if ch is NULL, to the automaton. */
+static inline void
+search_char(fz_context *ctx, struct search_state *st, int c, fz_stext_block *block, fz_stext_line *line, fz_stext_char *ch)
+{
+	fz_stext_search *search = st->search;
+	struct search_sym *sym;
+	int s, t;
+
+	/* The position of a run of white space is that of its first
+	 * character; for a run that starts with a line break, that is the
+	 * first character that follows it. */
+	if (c == ' ' && st->space)
+	{
+		if (ch)
+		{
+			sym = &st->ring[st->pos & search->ring_mask];
+			if (!sym->ch)
+			{
+				sym->block = block;
+				sym->line = line;
+				sym->ch = ch;
+			}
+			st->idx++;
+		}
+		return;
+	}
+
+	if (ch && st->pos >= 0)
+	{
+		sym = &st->ring[st->pos & search->ring_mask];
+		if (!sym->ch)
+		{
+			sym->block = block;
+			sym->line = line;
+			sym->ch = ch;
+		}
+	}
+
+	s = st->state;
+	for (;;)
+	{
+		if (s == 0)
+		{
+			s = c < 128 ? search->root[c] : find_edge(search, 0, c);
+			break;
+		}
+		t = find_edge(search, s, c);
+		if (t)
+		{
+			s = t;
+			break;
+		}
+		s = search->fail[s];
+	}
+	st->state = s;
+	st->space = (c == ' ');
+
+	sym = &st->ring[++st->pos & search->ring_mask];
+	sym->block = block;
+	sym->line = line;
+	sym->ch = ch;
+	sym->start = st->idx;
+	if (ch)
+		st->idx++;
+	sym->end = st->idx;
+
+	for (t = search->out[s] >= 0 ? s : search->dict[s]; t; t = search->dict[t])
+		search_hit(ctx, st, search->out[t]);
+}
+
+/*
+	Search for all occurrences of a compiled set of needles in a text
+	page, in a single pass.
+
+	Return the number of quads and store the hit quads in the passed in
+	array. Adjacent characters are merged into one quad.
+
+	marks: If not NULL, an array of max_quads entries that receives the
+	index of the needle each quad belongs to. Quads of different needles
+	are never merged.
 */
 int
-fz_search_stext_page(fz_context *ctx, fz_stext_page *page, const char *needle, fz_quad *quads, int max_quads)
+fz_run_stext_search(fz_context *ctx, fz_stext_search *search, fz_stext_page *page, fz_quad *quads, int *marks, int max_quads)
 {
 	struct highlight hits;
+	struct search_state st;
 	fz_stext_block *block;
 	fz_stext_line *line;
-	fz_stext_char *ch;
-	fz_buffer *buffer;
-	const char *haystack, *begin, *end;
-	int c, inside;
+	int i, k;
 
-	if (strlen(needle) == 0)
-		return 0;
+	/* Per pass state lives here rather than in the search, so that the
+	 * compiled search can be shared between threads. */
+	st.ring = fz_malloc(ctx, (search->ring_mask + 1) * sizeof *st.ring + search->needle_count * sizeof(int));
+	st.last_end = (int *)(st.ring + search->ring_mask + 1);
 
 	hits.len = 0;
 	hits.cap = max_quads;
 	hits.box = quads;
 	hits.hfuzz = 0.2f; /* merge kerns but not large gaps */
 	hits.vfuzz = 0.1f;
+	hits.marks = marks;
+	hits.mark = 0;
 
-	buffer = fz_new_buffer_from_stext_page(ctx, page);
-	fz_try(ctx)
-	{
-		haystack = fz_string_from_buffer(ctx, buffer);
-		begin = find_string(haystack, needle, &end);
-		if (!begin)
-			goto no_more_matches;
+	st.search = search;
+	st.hits = &hits;
+	st.state = 0;
+	st.pos = -1;
+	st.idx = 0;
+	st.space = 0;
+
+	for (k = 0; k < search->needle_count; ++k)
+		st.last_end[k] = -1;
 
-		inside = 0;
-		for (block = page->first_block; block; block = block->next)
+	for (block = page->first_block; block; block = block->next)
+	{
+		if (block->type != FZ_STEXT_BLOCK_TEXT)
+			continue;
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-			if (block->type != FZ_STEXT_BLOCK_TEXT)
-				continue;
-			for (line = block->u.t.first_line; line; line = line->next)
-			{
-				for (ch = line->first_char; ch; ch = ch->next)
-				{
-try_new_match:
-					if (!inside)
-					{
-						if (haystack >= begin)
-							inside = 1;
-					}
-					if (inside)
-					{
-						if (haystack < end)
-							on_highlight_char(ctx, &hits, line, ch);
-						else
-						{
-							inside = 0;
-							begin = find_string(haystack, needle, &end);
-							if (!begin)
-								goto no_more_matches;
-							else
-								goto try_new_match;
-						}
-					}
-					haystack += fz_chartorune(&c, haystack);
-				}
-				assert(*haystack == '\n');
-				++haystack;
-			}
-			assert(*haystack == '\n');
-			++haystack;
+			for (i = 0; i < line->len; i++)
+				search_char(ctx, &st, canon(line->text[i]), block, line, &line->first_char[i]);
+			search_char(ctx, &st, ' ', block, line, NULL);
 		}
-no_more_matches:;
+		search_char(ctx, &st, ' ', block, NULL, NULL);
 	}
-	fz_always(ctx)
-		fz_drop_buffer(ctx, buffer);
-	fz_catch(ctx)
-		fz_rethrow(ctx);
+
+	fz_free(ctx, st.ring);
 
 	return hits.len;
 }
+
+/*
+	Search for occurrence of 'needle' in text page.
+
+	Return the number of hits and store hit quads in the passed in array.
+
+	NOTE: This is an experimental interface and subject to change without notice.
+*/
+int
+fz_search_stext_page(fz_context *ctx, fz_stext_page *page, const char *needle, fz_quad *quads, int max_quads)
+{
+	fz_stext_search *search;
+	int n;
+
+	if (strlen(needle) == 0)
+		return 0;
+
+	search = fz_new_stext_search(ctx, &needle, 1);
+	n = fz_run_stext_search(ctx, search, page, quads, NULL, max_quads);
+	fz_drop_stext_search(ctx, search);
+
+	return n;
+}
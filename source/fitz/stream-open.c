@@ -271,6 +271,17 @@ fz_open_buffer(fz_context *ctx, fz_buffer *buf)
 	return stm;
 }
 
+/*
+	Returns non-zero if stm is a memory stream (as opened by
+	fz_open_buffer or fz_open_memory), in which case everything
+	left to read lies between stm->rp and stm->wp.
+*/
+int
+fz_is_memory_stream(fz_stream *stm)
+{
+	return stm->next == next_buffer;
+}
+
 /*
 	Open a block of memory as a stream.
 
@@ -10,6 +10,7 @@ typedef struct tile_s tile;
 typedef struct font_s font;
 typedef struct glyph_s glyph;
 typedef struct image_s image;
+typedef struct reuse_s reuse;
 
 struct tile_s
 {
@@ -24,6 +25,7 @@ struct glyph_s
 {
 	float x_off;
 	float y_off;
+	int id, gid; /* the symbol to use, font_<id>_<gid> */
 };
 
 struct font_s
@@ -40,12 +42,19 @@ struct image_s
 	fz_image *image;
 };
 
+struct reuse_s
+{
+	int count;
+	int id, gid;
+};
+
 struct svg_device_s
 {
 	fz_device super;
 
 	int text_as_text;
 	int reuse_images;
+	int reuse_paths;
 
 	fz_output *out;
 	fz_output *out_store;
@@ -70,6 +79,11 @@ struct svg_device_s
 	int max_images;
 	image *images;
 
+	fz_hash_table *reuse;
+	fz_pool *reuse_pool;
+	int reuse_count;
+	unsigned char *seen;
+
 	int layers;
 };
 
@@ -158,6 +172,165 @@ svg_dev_path(fz_context *ctx, svg_device *sdev, const fz_path *path)
 	fz_write_printf(ctx, sdev->out, "\"");
 }
 
+/* Repeated paths, glyph outlines and images are spotted by their MD5
+ * digest; paths by their coordinates, so that repeats need not be formatted
+ * at all, and images by their encoded data (only when sharing paths, as it
+ * means encoding each image before it can be written). The number of digests we
+ * remember is capped, so memory use stays bounded however much content a
+ * page has. To keep the cost down on pages where nothing repeats, a path
+ * is only digested once a cheap hash of it has been seen before. Paths with
+ * fewer segments than MIN_REUSE_PATH are not worth sharing. */
+enum { MAX_REUSE = 65536, MIN_REUSE_PATH = 3, SEEN_BITS = 1 << 19 };
+
+typedef struct
+{
+	fz_md5 *md5;
+	unsigned int hash;
+	int n;
+} svg_path_digest;
+
+static void
+digest_path_data(svg_path_digest *d, const float *v, int n)
+{
+	unsigned int h = d->hash;
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		union { float f; unsigned int u; } x;
+		x.f = v[i];
+		h = (h ^ x.u) * 16777619;
+	}
+	d->hash = h;
+	if (d->md5)
+		fz_md5_update(d->md5, (const unsigned char *)v, n * sizeof *v);
+}
+
+static void
+digest_path_moveto(fz_context *ctx, void *arg, float x, float y)
+{
+	float v[3] = { 'M', x, y };
+	digest_path_data(arg, v, 3);
+	((svg_path_digest *)arg)->n++;
+}
+
+static void
+digest_path_lineto(fz_context *ctx, void *arg, float x, float y)
+{
+	float v[3] = { 'L', x, y };
+	digest_path_data(arg, v, 3);
+	((svg_path_digest *)arg)->n++;
+}
+
+static void
+digest_path_curveto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	float v[7] = { 'C', x1, y1, x2, y2, x3, y3 };
+	digest_path_data(arg, v, 7);
+	((svg_path_digest *)arg)->n++;
+}
+
+static void
+digest_path_close(fz_context *ctx, void *arg)
+{
+	float v[1] = { 'Z' };
+	digest_path_data(arg, v, 1);
+}
+
+static const fz_path_walker digest_path_walker =
+{
+	digest_path_moveto,
+	digest_path_lineto,
+	digest_path_curveto,
+	digest_path_close
+};
+
+/* Hash the path, and compute its MD5 digest if digest is not NULL.
+ * Returns the number of segments in the path. */
+static int
+svg_dev_digest_path(fz_context *ctx, int kind, const fz_path *path, unsigned int *hash, unsigned char digest[16])
+{
+	svg_path_digest d;
+	fz_md5 md5;
+
+	d.md5 = NULL;
+	d.hash = 2166136261u ^ kind;
+	d.n = 0;
+	if (digest)
+	{
+		d.md5 = &md5;
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, (unsigned char *)&kind, sizeof kind);
+	}
+	fz_walk_path(ctx, path, &digest_path_walker, &d);
+	if (digest)
+		fz_md5_final(&md5, digest);
+	if (hash)
+		*hash = d.hash;
+	return d.n;
+}
+
+static reuse *
+svg_dev_find_reuse(fz_context *ctx, svg_device *sdev, unsigned char digest[16])
+{
+	reuse *r;
+
+	if (sdev->reuse == NULL)
+	{
+		sdev->reuse_pool = fz_new_pool(ctx);
+		sdev->reuse = fz_new_hash_table(ctx, 4096, 16, -1, NULL);
+	}
+	r = fz_hash_find(ctx, sdev->reuse, digest);
+	if (r || sdev->reuse_count >= MAX_REUSE)
+		return r;
+
+	r = fz_pool_alloc(ctx, sdev->reuse_pool, sizeof *r);
+	r->id = -1;
+	fz_hash_insert(ctx, sdev->reuse, digest, r);
+	sdev->reuse_count++;
+	return r;
+}
+
+/* Return the id of a shared definition to <use> in place of the path, or -1
+ * if the path is to be sent inline. A path is sent inline the first two
+ * times it is seen, and defined when it is seen again. */
+static int
+svg_dev_reuse_path(fz_context *ctx, svg_device *sdev, const fz_path *path)
+{
+	unsigned char digest[16];
+	unsigned int hash;
+	fz_output *out;
+	reuse *r;
+
+	if (!sdev->reuse_paths)
+		return -1;
+
+	if (svg_dev_digest_path(ctx, 'P', path, &hash, NULL) < MIN_REUSE_PATH)
+		return -1;
+	if (sdev->seen == NULL)
+		sdev->seen = fz_calloc(ctx, SEEN_BITS / 8, 1);
+	hash &= SEEN_BITS - 1;
+	if ((sdev->seen[hash >> 3] & (1 << (hash & 7))) == 0)
+	{
+		sdev->seen[hash >> 3] |= 1 << (hash & 7);
+		return -1;
+	}
+
+	svg_dev_digest_path(ctx, 'P', path, NULL, digest);
+	r = svg_dev_find_reuse(ctx, sdev, digest);
+	if (r == NULL || r->count++ == 0)
+		return -1;
+	if (r->id < 0)
+	{
+		r->id = sdev->id++;
+		out = start_def(ctx, sdev);
+		fz_write_printf(ctx, out, "<defs>\n<path id=\"path%d\"", r->id);
+		svg_dev_path(ctx, sdev, path);
+		fz_write_printf(ctx, out, "/>\n</defs>\n");
+		end_def(ctx, sdev);
+	}
+	return r->id;
+}
+
 static void
 svg_dev_ctm(fz_context *ctx, svg_device *sdev, fz_matrix ctm)
 {
@@ -472,10 +645,9 @@ svg_dev_text_span_as_paths_defs(fz_context *ctx, fz_device *dev, fz_text_span *s
 		if (fnt->sentlist[gid].x_off == FLT_MIN)
 		{
 			/* Need to send this one */
-			fz_rect rect;
-			fz_path *path;
-			out = start_def(ctx, sdev);
-			fz_write_printf(ctx, out, "<symbol id=\"font_%x_%x\">\n", fnt->id, gid);
+			fz_rect rect = fz_empty_rect;
+			fz_path *path = NULL;
+			reuse *r = NULL;
 			if (fz_font_ft_face(ctx, span->font))
 			{
 				path = fz_outline_glyph(ctx, span->font, gid, fz_identity);
@@ -485,15 +657,47 @@ svg_dev_text_span_as_paths_defs(fz_context *ctx, fz_device *dev, fz_text_span *s
 					shift.e = -rect.x0;
 					shift.f = -rect.y0;
 					fz_transform_path(ctx, path, shift);
+					/* Subset fonts often repeat the same outlines. */
+					if (sdev->reuse_paths)
+					{
+						unsigned char digest[16];
+						fz_try(ctx)
+						{
+							svg_dev_digest_path(ctx, 'G', path, NULL, digest);
+							r = svg_dev_find_reuse(ctx, sdev, digest);
+						}
+						fz_catch(ctx)
+						{
+							fz_drop_path(ctx, path);
+							fz_rethrow(ctx);
+						}
+					}
+				}
+			}
+			if (r && r->id >= 0)
+			{
+				/* Same outline, but this glyph keeps its own offset. */
+				fz_drop_path(ctx, path);
+				fnt->sentlist[gid].x_off = rect.x0;
+				fnt->sentlist[gid].y_off = rect.y0;
+				fnt->sentlist[gid].id = r->id;
+				fnt->sentlist[gid].gid = r->gid;
+				continue;
+			}
+			out = start_def(ctx, sdev);
+			fz_write_printf(ctx, out, "<symbol id=\"font_%x_%x\">\n", fnt->id, gid);
+			if (path)
+			{
+				fz_try(ctx)
+				{
 					fz_write_printf(ctx, out, "<path");
 					svg_dev_path(ctx, sdev, path);
 					fz_write_printf(ctx, out, "/>\n");
-					fz_drop_path(ctx, path);
-				}
-				else
-				{
-					rect = fz_empty_rect;
 				}
+				fz_always(ctx)
+					fz_drop_path(ctx, path);
+				fz_catch(ctx)
+					fz_rethrow(ctx);
 			}
 			else if (fz_font_t3_procs(ctx, span->font))
 			{
@@ -506,6 +710,13 @@ svg_dev_text_span_as_paths_defs(fz_context *ctx, fz_device *dev, fz_text_span *s
 			out = end_def(ctx, sdev);
 			fnt->sentlist[gid].x_off = rect.x0;
 			fnt->sentlist[gid].y_off = rect.y0;
+			fnt->sentlist[gid].id = fnt->id;
+			fnt->sentlist[gid].gid = gid;
+			if (r)
+			{
+				r->id = fnt->id;
+				r->gid = gid;
+			}
 		}
 	}
 	return fnt;
@@ -542,7 +753,7 @@ svg_dev_text_span_as_paths_fill(fz_context *ctx, fz_device *dev, const fz_text_s
 		trm.f = it->y;
 		mtx = fz_concat(shift, fz_concat(trm, ctm));
 
-		fz_write_printf(ctx, out, "<use xlink:href=\"#font_%x_%x\"", fnt->id, gid);
+		fz_write_printf(ctx, out, "<use xlink:href=\"#font_%x_%x\"", fnt->sentlist[gid].id, fnt->sentlist[gid].gid);
 		svg_dev_ctm(ctx, sdev, mtx);
 		svg_dev_fill_color(ctx, sdev, colorspace, color, alpha, color_params);
 		fz_write_printf(ctx, out, "/>\n");
@@ -581,7 +792,7 @@ svg_dev_text_span_as_paths_stroke(fz_context *ctx, fz_device *dev, const fz_text
 		trm.f = it->y;
 		mtx = fz_concat(shift, fz_concat(trm, ctm));
 
-		fz_write_printf(ctx, out, "<use xlink:href=\"#font_%x_%x\"", fnt->id, gid);
+		fz_write_printf(ctx, out, "<use xlink:href=\"#font_%x_%x\"", fnt->sentlist[gid].id, fnt->sentlist[gid].gid);
 		svg_dev_stroke_state(ctx, sdev, stroke, mtx);
 		svg_dev_ctm(ctx, sdev, mtx);
 		svg_dev_stroke_color(ctx, sdev, colorspace, color, alpha, color_params);
@@ -596,11 +807,16 @@ svg_dev_fill_path(fz_context *ctx, fz_device *dev, const fz_path *path, int even
 	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
 {
 	svg_device *sdev = (svg_device*)dev;
+	int id = svg_dev_reuse_path(ctx, sdev, path);
 	fz_output *out = sdev->out;
 
-	fz_write_printf(ctx, out, "<path");
+	if (id >= 0)
+		fz_write_printf(ctx, out, "<use xlink:href=\"#path%d\"", id);
+	else
+		fz_write_printf(ctx, out, "<path");
 	svg_dev_ctm(ctx, sdev, ctm);
-	svg_dev_path(ctx, sdev, path);
+	if (id < 0)
+		svg_dev_path(ctx, sdev, path);
 	svg_dev_fill_color(ctx, sdev, colorspace, color, alpha, color_params);
 	if (even_odd)
 		fz_write_printf(ctx, out, " fill-rule=\"evenodd\"");
@@ -612,13 +828,18 @@ svg_dev_stroke_path(fz_context *ctx, fz_device *dev, const fz_path *path, const
 	fz_colorspace *colorspace, const float *color, float alpha, fz_color_params color_params)
 {
 	svg_device *sdev = (svg_device*)dev;
+	int id = svg_dev_reuse_path(ctx, sdev, path);
 	fz_output *out = sdev->out;
 
-	fz_write_printf(ctx, out, "<path");
+	if (id >= 0)
+		fz_write_printf(ctx, out, "<use xlink:href=\"#path%d\"", id);
+	else
+		fz_write_printf(ctx, out, "<path");
 	svg_dev_ctm(ctx, sdev, ctm);
 	svg_dev_stroke_state(ctx, sdev, stroke, fz_identity);
 	svg_dev_stroke_color(ctx, sdev, colorspace, color, alpha, color_params);
-	svg_dev_path(ctx, sdev, path);
+	if (id < 0)
+		svg_dev_path(ctx, sdev, path);
 	fz_write_printf(ctx, out, "/>\n");
 }
 
@@ -824,15 +1045,60 @@ svg_dev_ignore_text(fz_context *ctx, fz_device *dev, const fz_text *text, fz_mat
 	}
 }
 
+/* Encode an image as a data URI, and look up the digest of the result
+ * to find an earlier image with the same data. */
+static fz_buffer *
+svg_dev_digest_image(fz_context *ctx, svg_device *sdev, fz_image *img, reuse **rp)
+{
+	unsigned char digest[16];
+	int head[3];
+	fz_md5 md5;
+	fz_buffer *buf;
+	fz_output *out = NULL;
+
+	fz_var(out);
+
+	buf = fz_new_buffer(ctx, 1024);
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_buffer(ctx, buf);
+		fz_write_image_as_data_uri(ctx, out, img);
+		fz_close_output(ctx, out);
+
+		head[0] = 'I';
+		head[1] = img->w;
+		head[2] = img->h;
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, (unsigned char *)head, sizeof head);
+		fz_md5_update(&md5, buf->data, buf->len);
+		fz_md5_final(&md5, digest);
+		*rp = svg_dev_find_reuse(ctx, sdev, digest);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
 /* We spot repeated images, and send them just once using
  * symbols. Unfortunately, for pathological files, such
  * as the example in Bug695988, this can cause viewers to
  * have conniptions. We therefore have an option that is
- * made to avoid this (reuse-images=no). */
+ * made to avoid this (reuse-images=no).
+ * When sharing paths as well, distinct image objects with
+ * the same data (such as a logo embedded once per form)
+ * are spotted by the digest of their encoded data. */
 static void
 svg_send_image(fz_context *ctx, svg_device *sdev, fz_image *img, fz_color_params color_params)
 {
 	fz_output *out = sdev->out;
+	fz_buffer *buf = NULL;
+	reuse *r = NULL;
 	int i;
 	int id;
 
@@ -858,16 +1124,36 @@ svg_send_image(fz_context *ctx, svg_device *sdev, fz_image *img, fz_color_params
 			sdev->max_images = new_max;
 		}
 
-		id = sdev->id++;
-		out = start_def(ctx, sdev);
-		fz_write_printf(ctx, out, "<symbol id=\"im%d\" viewBox=\"0 0 %d %d\">\n", id, img->w, img->h);
+		if (sdev->reuse_paths)
+			buf = svg_dev_digest_image(ctx, sdev, img, &r);
 
-		fz_write_printf(ctx, out, "<image width=\"%d\" height=\"%d\" xlink:href=\"", img->w, img->h);
-		fz_write_image_as_data_uri(ctx, out, img);
-		fz_write_printf(ctx, out, "\"/>\n");
+		fz_try(ctx)
+		{
+			if (r && r->id >= 0)
+				id = r->id;
+			else
+			{
+				id = sdev->id++;
+				out = start_def(ctx, sdev);
+				fz_write_printf(ctx, out, "<symbol id=\"im%d\" viewBox=\"0 0 %d %d\">\n", id, img->w, img->h);
 
-		fz_write_printf(ctx, out, "</symbol>\n");
-		out = end_def(ctx, sdev);
+				fz_write_printf(ctx, out, "<image width=\"%d\" height=\"%d\" xlink:href=\"", img->w, img->h);
+				if (buf)
+					fz_write_data(ctx, out, buf->data, buf->len);
+				else
+					fz_write_image_as_data_uri(ctx, out, img);
+				fz_write_printf(ctx, out, "\"/>\n");
+
+				fz_write_printf(ctx, out, "</symbol>\n");
+				out = end_def(ctx, sdev);
+				if (r)
+					r->id = id;
+			}
+		}
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
 
 		sdev->images[sdev->num_images].id = id;
 		sdev->images[sdev->num_images].image = fz_keep_image(ctx, img);
@@ -1271,6 +1557,9 @@ svg_dev_drop_device(fz_context *ctx, fz_device *dev)
 		fz_drop_image(ctx, sdev->images[i].image);
 	}
 	fz_free(ctx, sdev->images);
+	fz_drop_hash_table(ctx, sdev->reuse);
+	fz_drop_pool(ctx, sdev->reuse_pool);
+	fz_free(ctx, sdev->seen);
 }
 
 /*
@@ -1285,11 +1574,16 @@ svg_dev_drop_device(fz_context *ctx, fz_device *dev)
 		FZ_SVG_TEXT_AS_TEXT: As <text> elements with possible layout errors and mismatching fonts.
 		FZ_SVG_TEXT_AS_PATH: As <path> elements with exact visual appearance.
 
-	reuse_images: Share image resources using <symbol> definitions.
+	reuse: Which resources to share using definitions, a combination of:
+		FZ_SVG_REUSE_IMAGES: Send each image once as a <symbol>.
+		FZ_SVG_REUSE_PATHS: Send repeated paths and glyph outlines once
+		as <defs>/<symbol> definitions that are drawn with <use>. With
+		FZ_SVG_REUSE_IMAGES as well, different images with the same
+		data are also sent once.
 
 	id: ID parameter to keep generated IDs unique across SVG files.
 */
-fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse_images, int *id)
+fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse, int *id)
 {
 	svg_device *dev = fz_new_derived_device(ctx, svg_device);
 
@@ -1331,7 +1625,8 @@ fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page
 	dev->id = id ? *id : 0;
 	dev->layers = 0;
 	dev->text_as_text = (text_format == FZ_SVG_TEXT_AS_TEXT);
-	dev->reuse_images = reuse_images;
+	dev->reuse_images = !!(reuse & FZ_SVG_REUSE_IMAGES);
+	dev->reuse_paths = !!(reuse & FZ_SVG_REUSE_PATHS);
 
 	fz_write_printf(ctx, out, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n");
 	fz_write_printf(ctx, out, "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n");
@@ -1344,7 +1639,7 @@ fz_device *fz_new_svg_device_with_id(fz_context *ctx, fz_output *out, float page
 	return (fz_device*)dev;
 }
 
-fz_device *fz_new_svg_device(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse_images)
+fz_device *fz_new_svg_device(fz_context *ctx, fz_output *out, float page_width, float page_height, int text_format, int reuse)
 {
-	return fz_new_svg_device_with_id(ctx, out, page_width, page_height, text_format, reuse_images, NULL);
+	return fz_new_svg_device_with_id(ctx, out, page_width, page_height, text_format, reuse, NULL);
 }
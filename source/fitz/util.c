@@ -393,8 +393,8 @@ fz_new_buffer_from_stext_page(fz_context *ctx, fz_stext_page *page)
 {
 	fz_stext_block *block;
 	fz_stext_line *line;
-	fz_stext_char *ch;
 	fz_buffer *buf;
+	int i;
 
 	buf = fz_new_buffer(ctx, 256);
 	fz_try(ctx)
@@ -405,8 +405,8 @@ fz_new_buffer_from_stext_page(fz_context *ctx, fz_stext_page *page)
 			{
 				for (line = block->u.t.first_line; line; line = line->next)
 				{
-					for (ch = line->first_char; ch; ch = ch->next)
-						fz_append_rune(ctx, buf, ch->c);
+					for (i = 0; i < line->len; i++)
+						fz_append_rune(ctx, buf, line->text[i]);
 					fz_append_byte(ctx, buf, '\n');
 				}
 				fz_append_byte(ctx, buf, '\n');
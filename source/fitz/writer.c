@@ -97,27 +97,27 @@ fz_document_writer *fz_new_document_writer_of_size(fz_context *ctx, size_t size,
 
 fz_document_writer *fz_new_png_pixmap_writer(fz_context *ctx, const char *path, const char *options)
 {
-	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.png", 0, fz_save_pixmap_as_png);
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.png", 0, fz_save_pixmap_as_png, fz_new_png_band_writer);
 }
 
 fz_document_writer *fz_new_pam_pixmap_writer(fz_context *ctx, const char *path, const char *options)
 {
-	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.pam", 0, fz_save_pixmap_as_pam);
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.pam", 0, fz_save_pixmap_as_pam, fz_new_pam_band_writer);
 }
 
 fz_document_writer *fz_new_pnm_pixmap_writer(fz_context *ctx, const char *path, const char *options)
 {
-	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.pnm", 0, fz_save_pixmap_as_pnm);
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.pnm", 0, fz_save_pixmap_as_pnm, fz_new_pnm_band_writer);
 }
 
 fz_document_writer *fz_new_pgm_pixmap_writer(fz_context *ctx, const char *path, const char *options)
 {
-	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.pgm", 1, fz_save_pixmap_as_pnm);
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.pgm", 1, fz_save_pixmap_as_pnm, fz_new_pnm_band_writer);
 }
 
 fz_document_writer *fz_new_ppm_pixmap_writer(fz_context *ctx, const char *path, const char *options)
 {
-	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.ppm", 3, fz_save_pixmap_as_pnm);
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.ppm", 3, fz_save_pixmap_as_pnm, fz_new_pnm_band_writer);
 }
 
 fz_document_writer *fz_new_pbm_pixmap_writer(fz_context *ctx, const char *path, const char *options)
@@ -130,6 +130,11 @@ fz_document_writer *fz_new_pkm_pixmap_writer(fz_context *ctx, const char *path,
 	return fz_new_pixmap_writer(ctx, path, options, "out-%04d.pkm", 4, fz_save_pixmap_as_pkm);
 }
 
+fz_document_writer *fz_new_psd_pixmap_writer(fz_context *ctx, const char *path, const char *options)
+{
+	return fz_new_banded_pixmap_writer(ctx, path, options, "out-%04d.psd", 0, fz_save_pixmap_as_psd, fz_new_psd_band_writer);
+}
+
 /*
 	Create a new fz_document_writer, for a
 	file of the given type.
@@ -137,7 +142,7 @@ fz_document_writer *fz_new_pkm_pixmap_writer(fz_context *ctx, const char *path,
 	path: The document name to write (or NULL for default)
 
 	format: Which format to write (currently cbz, html, pdf, pam, pbm,
-	pgm, pkm, png, ppm, pnm, svg, text, xhtml)
+	pgm, pkm, png, ppm, pnm, psd, svg, text, xhtml)
 
 	options: NULL, or pointer to comma separated string to control
 	file generation.
@@ -176,6 +181,8 @@ fz_new_document_writer(fz_context *ctx, const char *path, const char *format, co
 		return fz_new_pbm_pixmap_writer(ctx, path, options);
 	if (!fz_strcasecmp(format, "pkm"))
 		return fz_new_pkm_pixmap_writer(ctx, path, options);
+	if (!fz_strcasecmp(format, "psd"))
+		return fz_new_psd_pixmap_writer(ctx, path, options);
 
 	if (!fz_strcasecmp(format, "pcl"))
 		return fz_new_pcl_writer(ctx, path, options);
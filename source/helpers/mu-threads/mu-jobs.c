@@ -0,0 +1,196 @@
+#include "mupdf/helpers/mu-jobs.h"
+#include "mupdf/helpers/mu-threads.h"
+
+#ifdef DISABLE_MUTHREADS
+
+mu_job_pool *mu_new_job_pool(fz_context *ctx, int threads)
+{
+	return NULL;
+}
+
+void mu_drop_job_pool(fz_context *ctx, mu_job_pool *pool)
+{
+}
+
+#else
+
+typedef struct mu_job_worker_s mu_job_worker;
+
+struct mu_job_worker_s
+{
+	mu_job_pool *pool;
+	fz_context *ctx;
+	int quit;
+	mu_semaphore start;
+	mu_semaphore stop;
+	mu_thread thread;
+};
+
+struct mu_job_pool_s
+{
+	int count;
+	mu_job_worker *workers;
+
+	/* Protects busy and next. */
+	mu_mutex mutex;
+	int busy;
+
+	/* The batch being run. */
+	fz_job_fn *fn;
+	void **jobs;
+	int njobs;
+	int next;
+};
+
+/* Run jobs from the current batch until there are none left. */
+static void
+run_batch(mu_job_pool *pool, fz_context *ctx)
+{
+	int i;
+
+	for (;;)
+	{
+		mu_lock_mutex(&pool->mutex);
+		i = pool->next++;
+		mu_unlock_mutex(&pool->mutex);
+		if (i >= pool->njobs)
+			break;
+		pool->fn(ctx, pool->jobs[i]);
+	}
+}
+
+static void
+worker_thread(void *arg)
+{
+	mu_job_worker *me = arg;
+
+	for (;;)
+	{
+		mu_wait_semaphore(&me->start);
+		if (me->quit)
+			break;
+		run_batch(me->pool, me->ctx);
+		mu_trigger_semaphore(&me->stop);
+	}
+}
+
+static void
+run_jobs(void *arg, fz_context *ctx, int count, fz_job_fn *fn, void **jobs)
+{
+	mu_job_pool *pool = arg;
+	int i, busy;
+
+	mu_lock_mutex(&pool->mutex);
+	busy = pool->busy;
+	pool->busy = 1;
+	mu_unlock_mutex(&pool->mutex);
+
+	/* Another batch (possibly the one that issued these jobs) owns
+	 * the workers, so run this one ourselves. */
+	if (busy)
+	{
+		for (i = 0; i < count; i++)
+			fn(ctx, jobs[i]);
+		return;
+	}
+
+	pool->fn = fn;
+	pool->jobs = jobs;
+	pool->njobs = count;
+	pool->next = 0;
+
+	for (i = 0; i < pool->count; i++)
+		mu_trigger_semaphore(&pool->workers[i].start);
+	run_batch(pool, ctx);
+	for (i = 0; i < pool->count; i++)
+		mu_wait_semaphore(&pool->workers[i].stop);
+
+	mu_lock_mutex(&pool->mutex);
+	pool->busy = 0;
+	mu_unlock_mutex(&pool->mutex);
+}
+
+static void
+free_job_pool(fz_context *ctx, mu_job_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->count; i++)
+	{
+		mu_job_worker *w = &pool->workers[i];
+		w->quit = 1;
+		mu_trigger_semaphore(&w->start);
+		mu_destroy_thread(&w->thread);
+		mu_destroy_semaphore(&w->start);
+		mu_destroy_semaphore(&w->stop);
+		fz_drop_context(w->ctx);
+	}
+	mu_destroy_mutex(&pool->mutex);
+	fz_free(ctx, pool->workers);
+	fz_free(ctx, pool);
+}
+
+mu_job_pool *mu_new_job_pool(fz_context *ctx, int threads)
+{
+	mu_job_pool *pool;
+	int i, fail = 0;
+
+	if (threads < 2)
+		return NULL;
+
+	pool = fz_malloc_struct(ctx, mu_job_pool);
+	fz_try(ctx)
+		pool->workers = fz_calloc(ctx, threads - 1, sizeof *pool->workers);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	if (mu_create_mutex(&pool->mutex))
+	{
+		fz_free(ctx, pool->workers);
+		fz_free(ctx, pool);
+		return NULL;
+	}
+
+	/* Workers are added one at a time, so that free_job_pool only
+	 * ever sees fully started ones. */
+	for (i = 0; i < threads - 1 && !fail; i++)
+	{
+		mu_job_worker *w = &pool->workers[i];
+		w->pool = pool;
+		w->ctx = fz_clone_context(ctx);
+		fail = (w->ctx == NULL);
+		fail = fail || mu_create_semaphore(&w->start);
+		fail = fail || mu_create_semaphore(&w->stop);
+		fail = fail || mu_create_thread(&w->thread, worker_thread, w);
+		if (fail)
+		{
+			mu_destroy_semaphore(&w->start);
+			mu_destroy_semaphore(&w->stop);
+			fz_drop_context(w->ctx);
+		}
+		else
+			pool->count++;
+	}
+
+	if (fail)
+	{
+		free_job_pool(ctx, pool);
+		return NULL;
+	}
+
+	fz_set_job_runner(ctx, run_jobs, pool, threads);
+	return pool;
+}
+
+void mu_drop_job_pool(fz_context *ctx, mu_job_pool *pool)
+{
+	if (!pool)
+		return;
+	fz_set_job_runner(ctx, NULL, NULL, 1);
+	free_job_pool(ctx, pool);
+}
+
+#endif
@@ -15,6 +15,8 @@ enum
 };
 
 typedef struct psobj_s psobj;
+typedef struct psc_inst_s psc_inst;
+typedef union psc_value_s psc_value;
 
 enum
 {
@@ -62,6 +64,14 @@ struct pdf_function_s
 		struct {
 			psobj *code;
 			int cap;
+			psc_inst *prog;		/* compiled code */
+			psc_value *init;	/* initial register contents */
+			int len;
+			int nregs;		/* zero if not compiled */
+			int out[MAX_N];		/* output registers */
+			int out_int[MAX_N];
+			float *lut;		/* sampled table, or NULL */
+			int lut_size;
 		} p;
 	} u;
 };
@@ -832,6 +842,840 @@ parse_code(fz_context *ctx, pdf_function *func, fz_stream *stream, int *codeptr,
 	}
 }
 
+/*
+ * Compiled calculator functions
+ *
+ * The code array is translated into register based instructions with
+ * all operand types resolved at load time. Stack shuffling operators
+ * turn into register renaming, operators on constant operands are
+ * folded, and 'if'/'ifelse' on a constant condition keep only the
+ * branch that is taken. Anything whose effect depends on the error
+ * recovery in ps_run (stack underflow, type mismatches, operands that
+ * are only known when evaluating) makes compilation give up, and the
+ * function is interpreted as before.
+ */
+
+#define PSC_MAX_REGS 512
+
+enum
+{
+	PSC_ABS_I, PSC_ABS_R, PSC_ADD_I, PSC_ADD_R, PSC_AND, PSC_ATAN,
+	PSC_BITSHIFT, PSC_CEILING, PSC_COS, PSC_CVI, PSC_CVR, PSC_DIV,
+	PSC_EQ_I, PSC_EQ_R, PSC_EXP, PSC_FLOOR, PSC_GE_I, PSC_GE_R,
+	PSC_GT_I, PSC_GT_R, PSC_IDIV, PSC_LE_I, PSC_LE_R, PSC_LN, PSC_LOG,
+	PSC_LT_I, PSC_LT_R, PSC_MOD, PSC_MUL_I, PSC_MUL_R, PSC_NE_I,
+	PSC_NE_R, PSC_NEG_I, PSC_NEG_R, PSC_NOT_B, PSC_NOT_I, PSC_OR,
+	PSC_ROUND, PSC_SIN, PSC_SQRT, PSC_SUB_I, PSC_SUB_R, PSC_TRUNCATE,
+	PSC_XOR, PSC_MOV, PSC_JZ, PSC_JMP
+};
+
+union psc_value_s
+{
+	int i;					/* integer and boolean */
+	float f;				/* real */
+};
+
+struct psc_inst_s
+{
+	int op;
+	int dst;				/* result register, or jump target */
+	int a, b;				/* operand registers */
+};
+
+typedef struct
+{
+	int type;
+	int reg;
+} psc_slot;
+
+typedef struct
+{
+	psc_slot slot[100];
+	int sp;
+} psc_stack;
+
+typedef struct
+{
+	psobj *code;
+	psc_inst *prog;
+	int len, cap;
+	psc_value init[PSC_MAX_REGS];
+	unsigned char is_const[PSC_MAX_REGS];
+	int nregs;
+} psc_compiler;
+
+/* Same as the conversion in ps_push_real. */
+static inline float psc_real(float x)
+{
+	if (isnan(x))
+		return 1.0f;
+	return fz_clamp(x, -FLT_MAX, FLT_MAX);
+}
+
+static inline void
+psc_exec(int op, psc_value *d, psc_value a, psc_value b)
+{
+	float r;
+
+	switch (op)
+	{
+	case PSC_ABS_I: d->i = fz_absi(a.i); break;
+	case PSC_ABS_R: d->f = psc_real(fz_abs(a.f)); break;
+	case PSC_ADD_I: d->i = a.i + b.i; break;
+	case PSC_ADD_R: d->f = psc_real(a.f + b.f); break;
+	case PSC_AND: d->i = a.i & b.i; break;
+	case PSC_ATAN:
+		r = atan2f(a.f, b.f) * FZ_RADIAN;
+		if (r < 0)
+			r += 360;
+		d->f = psc_real(r);
+		break;
+	case PSC_BITSHIFT:
+		if (b.i > 0 && b.i < 8 * (int)sizeof (b.i))
+			d->i = a.i << b.i;
+		else if (b.i < 0 && b.i > -8 * (int)sizeof (b.i))
+			d->i = (int)((unsigned int)a.i >> -b.i);
+		else
+			d->i = a.i;
+		break;
+	case PSC_CEILING: d->f = psc_real(ceilf(a.f)); break;
+	case PSC_COS: d->f = psc_real(cosf(a.f/FZ_RADIAN)); break;
+	case PSC_CVI: d->i = a.f; break;
+	case PSC_CVR: d->f = psc_real(a.i); break;
+	case PSC_DIV:
+		if (fabsf(b.f) >= FLT_EPSILON)
+			d->f = psc_real(a.f / b.f);
+		else
+			d->f = DIV_BY_ZERO(a.f, b.f, -FLT_MAX, FLT_MAX);
+		break;
+	case PSC_EQ_I: d->i = a.i == b.i; break;
+	case PSC_EQ_R: d->i = a.f == b.f; break;
+	case PSC_EXP: d->f = psc_real(powf(a.f, b.f)); break;
+	case PSC_FLOOR: d->f = psc_real(floorf(a.f)); break;
+	case PSC_GE_I: d->i = a.i >= b.i; break;
+	case PSC_GE_R: d->i = a.f >= b.f; break;
+	case PSC_GT_I: d->i = a.i > b.i; break;
+	case PSC_GT_R: d->i = a.f > b.f; break;
+	case PSC_IDIV:
+		if (b.i != 0)
+			d->i = a.i / b.i;
+		else
+			d->i = DIV_BY_ZERO(a.i, b.i, INT_MIN, INT_MAX);
+		break;
+	case PSC_LE_I: d->i = a.i <= b.i; break;
+	case PSC_LE_R: d->i = a.f <= b.f; break;
+	case PSC_LN:
+		/* Bug 692941 - logf as separate statement */
+		r = logf(a.f);
+		d->f = psc_real(r);
+		break;
+	case PSC_LOG: d->f = psc_real(log10f(a.f)); break;
+	case PSC_LT_I: d->i = a.i < b.i; break;
+	case PSC_LT_R: d->i = a.f < b.f; break;
+	case PSC_MOD:
+		if (b.i != 0)
+			d->i = a.i % b.i;
+		else
+			d->i = DIV_BY_ZERO(a.i, b.i, INT_MIN, INT_MAX);
+		break;
+	case PSC_MUL_I: d->i = a.i * b.i; break;
+	case PSC_MUL_R: d->f = psc_real(a.f * b.f); break;
+	case PSC_NE_I: d->i = a.i != b.i; break;
+	case PSC_NE_R: d->i = a.f != b.f; break;
+	case PSC_NEG_I: d->i = -a.i; break;
+	case PSC_NEG_R: d->f = psc_real(-a.f); break;
+	case PSC_NOT_B: d->i = !a.i; break;
+	case PSC_NOT_I: d->i = ~a.i; break;
+	case PSC_OR: d->i = a.i | b.i; break;
+	case PSC_ROUND: d->f = psc_real((a.f >= 0) ? floorf(a.f + 0.5f) : ceilf(a.f - 0.5f)); break;
+	case PSC_SIN: d->f = psc_real(sinf(a.f/FZ_RADIAN)); break;
+	case PSC_SQRT: d->f = psc_real(sqrtf(a.f)); break;
+	case PSC_SUB_I: d->i = a.i - b.i; break;
+	case PSC_SUB_R: d->f = psc_real(a.f - b.f); break;
+	case PSC_TRUNCATE: d->f = psc_real((a.f >= 0) ? floorf(a.f) : ceilf(a.f)); break;
+	case PSC_XOR: d->i = a.i ^ b.i; break;
+	case PSC_MOV: *d = a; break;
+	}
+}
+
+static int
+psc_emit(fz_context *ctx, psc_compiler *c, int op, int dst, int a, int b)
+{
+	if (c->len == c->cap)
+	{
+		int new_cap = c->cap + 64;
+		c->prog = fz_realloc_array(ctx, c->prog, new_cap, psc_inst);
+		c->cap = new_cap;
+	}
+	c->prog[c->len].op = op;
+	c->prog[c->len].dst = dst;
+	c->prog[c->len].a = a;
+	c->prog[c->len].b = b;
+	return c->len++;
+}
+
+static int
+psc_new_reg(psc_compiler *c)
+{
+	if (c->nregs == PSC_MAX_REGS)
+		return -1;
+	return c->nregs++;
+}
+
+static int
+psc_push(psc_stack *st, int type, int reg)
+{
+	if (reg < 0 || st->sp + 1 >= (int)nelem(st->slot))
+		return 0;
+	st->slot[st->sp].type = type;
+	st->slot[st->sp].reg = reg;
+	st->sp++;
+	return 1;
+}
+
+static int
+psc_push_const(psc_compiler *c, psc_stack *st, int type, psc_value v)
+{
+	int reg = psc_new_reg(c);
+	if (reg < 0)
+		return 0;
+	c->init[reg] = v;
+	c->is_const[reg] = 1;
+	return psc_push(st, type, reg);
+}
+
+static int
+psc_pop(psc_stack *st, psc_slot *x)
+{
+	if (st->sp == 0)
+		return 0;
+	*x = st->slot[--st->sp];
+	return 1;
+}
+
+/* Fold the operation if the operands are constant, otherwise emit it. */
+static int
+psc_op(fz_context *ctx, psc_compiler *c, psc_stack *st, int op, int type, int a, int b)
+{
+	psc_value v;
+	int d;
+
+	if (a < 0 || b < 0)
+		return 0;
+	if (c->is_const[a] && c->is_const[b])
+	{
+		psc_exec(op, &v, c->init[a], c->init[b]);
+		return psc_push_const(c, st, type, v);
+	}
+	d = psc_new_reg(c);
+	if (d < 0)
+		return 0;
+	psc_emit(ctx, c, op, d, a, b);
+	return psc_push(st, type, d);
+}
+
+/* Registers holding the operand as ps_pop_real and ps_pop_int would return it. */
+static int
+psc_as_real(fz_context *ctx, psc_compiler *c, psc_slot x)
+{
+	psc_stack tmp;
+	if (x.type == PS_REAL)
+		return x.reg;
+	if (x.type != PS_INT)
+		return -1;
+	tmp.sp = 0;
+	if (!psc_op(ctx, c, &tmp, PSC_CVR, PS_REAL, x.reg, x.reg))
+		return -1;
+	return tmp.slot[0].reg;
+}
+
+static int
+psc_as_int(fz_context *ctx, psc_compiler *c, psc_slot x)
+{
+	psc_stack tmp;
+	if (x.type == PS_INT)
+		return x.reg;
+	if (x.type != PS_REAL)
+		return -1;
+	tmp.sp = 0;
+	if (!psc_op(ctx, c, &tmp, PSC_CVI, PS_INT, x.reg, x.reg))
+		return -1;
+	return tmp.slot[0].reg;
+}
+
+static int
+psc_const_int(fz_context *ctx, psc_compiler *c, psc_slot x, int *v)
+{
+	int reg = psc_as_int(ctx, c, x);
+	if (reg < 0 || !c->is_const[reg])
+		return 0;
+	*v = c->init[reg].i;
+	return 1;
+}
+
+static int
+psc_unary_real(fz_context *ctx, psc_compiler *c, psc_stack *st, int op)
+{
+	psc_slot x;
+	int a;
+	if (!psc_pop(st, &x))
+		return 0;
+	a = psc_as_real(ctx, c, x);
+	return psc_op(ctx, c, st, op, PS_REAL, a, a);
+}
+
+static int
+psc_binary_real(fz_context *ctx, psc_compiler *c, psc_stack *st, int op)
+{
+	psc_slot x, y;
+	if (!psc_pop(st, &y) || !psc_pop(st, &x))
+		return 0;
+	return psc_op(ctx, c, st, op, PS_REAL, psc_as_real(ctx, c, x), psc_as_real(ctx, c, y));
+}
+
+static int
+psc_binary_int(fz_context *ctx, psc_compiler *c, psc_stack *st, int op)
+{
+	psc_slot x, y;
+	if (!psc_pop(st, &y) || !psc_pop(st, &x))
+		return 0;
+	return psc_op(ctx, c, st, op, PS_INT, psc_as_int(ctx, c, x), psc_as_int(ctx, c, y));
+}
+
+/* Integer result for two integers, real result otherwise. */
+static int
+psc_arith(fz_context *ctx, psc_compiler *c, psc_stack *st, int op_i, int op_r)
+{
+	psc_slot x, y;
+	if (!psc_pop(st, &y) || !psc_pop(st, &x))
+		return 0;
+	if (x.type == PS_INT && y.type == PS_INT)
+		return psc_op(ctx, c, st, op_i, PS_INT, x.reg, y.reg);
+	return psc_op(ctx, c, st, op_r, PS_REAL, psc_as_real(ctx, c, x), psc_as_real(ctx, c, y));
+}
+
+static int
+psc_compare(fz_context *ctx, psc_compiler *c, psc_stack *st, int op_i, int op_r, int allow_bool)
+{
+	psc_slot x, y;
+	if (!psc_pop(st, &y) || !psc_pop(st, &x))
+		return 0;
+	if ((x.type == PS_INT && y.type == PS_INT) || (allow_bool && x.type == PS_BOOL && y.type == PS_BOOL))
+		return psc_op(ctx, c, st, op_i, PS_BOOL, x.reg, y.reg);
+	return psc_op(ctx, c, st, op_r, PS_BOOL, psc_as_real(ctx, c, x), psc_as_real(ctx, c, y));
+}
+
+/* Boolean result for two booleans, integer result otherwise. */
+static int
+psc_logic(fz_context *ctx, psc_compiler *c, psc_stack *st, int op)
+{
+	psc_slot x, y;
+	if (!psc_pop(st, &y) || !psc_pop(st, &x))
+		return 0;
+	if (x.type == PS_BOOL && y.type == PS_BOOL)
+		return psc_op(ctx, c, st, op, PS_BOOL, x.reg, y.reg);
+	return psc_op(ctx, c, st, op, PS_INT, psc_as_int(ctx, c, x), psc_as_int(ctx, c, y));
+}
+
+static void
+psc_roll(psc_stack *st, int n, int j)
+{
+	psc_slot tmp;
+	int i;
+
+	if (n < 0 || n > st->sp || j == 0 || n == 0)
+		return;
+
+	if (j >= 0)
+	{
+		j %= n;
+	}
+	else
+	{
+		j = -j % n;
+		if (j != 0)
+			j = n - j;
+	}
+
+	for (i = 0; i < j; i++)
+	{
+		tmp = st->slot[st->sp - 1];
+		memmove(st->slot + st->sp - n + 1, st->slot + st->sp - n, (n - 1) * sizeof(psc_slot));
+		st->slot[st->sp - n] = tmp;
+	}
+}
+
+static int psc_compile_block(fz_context *ctx, psc_compiler *c, psc_stack *st, int pc);
+
+static int
+psc_compile_branches(fz_context *ctx, psc_compiler *c, psc_stack *st, int cond, int then_pc, int else_pc)
+{
+	psc_stack a = *st;
+	psc_stack b = *st;
+	int merge[nelem(st->slot)];
+	int jz, jmp_a, jmp_end, i;
+
+	if (c->is_const[cond])
+	{
+		if (c->init[cond].i)
+			return psc_compile_block(ctx, c, st, then_pc);
+		if (else_pc >= 0)
+			return psc_compile_block(ctx, c, st, else_pc);
+		return 1;
+	}
+
+	jz = psc_emit(ctx, c, PSC_JZ, 0, cond, cond);
+	if (!psc_compile_block(ctx, c, &a, then_pc))
+		return 0;
+	jmp_a = psc_emit(ctx, c, PSC_JMP, 0, 0, 0);
+	c->prog[jz].dst = c->len;
+	if (else_pc >= 0 && !psc_compile_block(ctx, c, &b, else_pc))
+		return 0;
+
+	/* Both branches must leave the same shape of stack behind. */
+	if (a.sp != b.sp)
+		return 0;
+	for (i = 0; i < a.sp; i++)
+	{
+		if (a.slot[i].type != b.slot[i].type)
+			return 0;
+		merge[i] = -1;
+		if (a.slot[i].reg != b.slot[i].reg)
+		{
+			merge[i] = psc_new_reg(c);
+			if (merge[i] < 0)
+				return 0;
+			psc_emit(ctx, c, PSC_MOV, merge[i], b.slot[i].reg, b.slot[i].reg);
+		}
+	}
+	jmp_end = psc_emit(ctx, c, PSC_JMP, 0, 0, 0);
+	c->prog[jmp_a].dst = c->len;
+	for (i = 0; i < a.sp; i++)
+	{
+		if (merge[i] >= 0)
+		{
+			psc_emit(ctx, c, PSC_MOV, merge[i], a.slot[i].reg, a.slot[i].reg);
+			a.slot[i].reg = merge[i];
+		}
+	}
+	c->prog[jmp_end].dst = c->len;
+
+	*st = a;
+	return 1;
+}
+
+static int
+psc_compile_block(fz_context *ctx, psc_compiler *c, psc_stack *st, int pc)
+{
+	psc_value v;
+	psc_slot x, y;
+	int n, j, ok;
+
+	while (1)
+	{
+		psobj *obj = &c->code[pc++];
+
+		if (obj->type == PS_INT)
+		{
+			v.i = obj->u.i;
+			if (!psc_push_const(c, st, PS_INT, v))
+				return 0;
+			continue;
+		}
+		if (obj->type == PS_REAL)
+		{
+			v.f = psc_real(obj->u.f);
+			if (!psc_push_const(c, st, PS_REAL, v))
+				return 0;
+			continue;
+		}
+		if (obj->type != PS_OPERATOR)
+			return 0;
+
+		switch (obj->u.op)
+		{
+		case PS_OP_ABS:
+			if (!psc_pop(st, &x))
+				return 0;
+			if (x.type == PS_INT)
+				ok = psc_op(ctx, c, st, PSC_ABS_I, PS_INT, x.reg, x.reg);
+			else
+				ok = psc_op(ctx, c, st, PSC_ABS_R, PS_REAL, psc_as_real(ctx, c, x), x.reg);
+			break;
+
+		case PS_OP_NEG:
+			if (!psc_pop(st, &x))
+				return 0;
+			if (x.type == PS_INT)
+				ok = psc_op(ctx, c, st, PSC_NEG_I, PS_INT, x.reg, x.reg);
+			else
+				ok = psc_op(ctx, c, st, PSC_NEG_R, PS_REAL, psc_as_real(ctx, c, x), x.reg);
+			break;
+
+		case PS_OP_NOT:
+			if (!psc_pop(st, &x))
+				return 0;
+			if (x.type == PS_BOOL)
+				ok = psc_op(ctx, c, st, PSC_NOT_B, PS_BOOL, x.reg, x.reg);
+			else
+				ok = psc_op(ctx, c, st, PSC_NOT_I, PS_INT, psc_as_int(ctx, c, x), x.reg);
+			break;
+
+		case PS_OP_ROUND:
+		case PS_OP_TRUNCATE:
+			if (!psc_pop(st, &x))
+				return 0;
+			if (x.type == PS_INT)
+				ok = psc_push(st, PS_INT, x.reg);
+			else
+				ok = psc_op(ctx, c, st, obj->u.op == PS_OP_ROUND ? PSC_ROUND : PSC_TRUNCATE, PS_REAL, psc_as_real(ctx, c, x), x.reg);
+			break;
+
+		case PS_OP_CVI:
+			ok = psc_pop(st, &x) && psc_push(st, PS_INT, psc_as_int(ctx, c, x));
+			break;
+		case PS_OP_CVR:
+			ok = psc_pop(st, &x) && psc_push(st, PS_REAL, psc_as_real(ctx, c, x));
+			break;
+
+		case PS_OP_ADD: ok = psc_arith(ctx, c, st, PSC_ADD_I, PSC_ADD_R); break;
+		case PS_OP_SUB: ok = psc_arith(ctx, c, st, PSC_SUB_I, PSC_SUB_R); break;
+		case PS_OP_MUL: ok = psc_arith(ctx, c, st, PSC_MUL_I, PSC_MUL_R); break;
+
+		case PS_OP_EQ: ok = psc_compare(ctx, c, st, PSC_EQ_I, PSC_EQ_R, 1); break;
+		case PS_OP_NE: ok = psc_compare(ctx, c, st, PSC_NE_I, PSC_NE_R, 1); break;
+		case PS_OP_GE: ok = psc_compare(ctx, c, st, PSC_GE_I, PSC_GE_R, 0); break;
+		case PS_OP_GT: ok = psc_compare(ctx, c, st, PSC_GT_I, PSC_GT_R, 0); break;
+		case PS_OP_LE: ok = psc_compare(ctx, c, st, PSC_LE_I, PSC_LE_R, 0); break;
+		case PS_OP_LT: ok = psc_compare(ctx, c, st, PSC_LT_I, PSC_LT_R, 0); break;
+
+		case PS_OP_AND:
+			if (!psc_pop(st, &y) || !psc_pop(st, &x))
+				return 0;
+			if (x.type == PS_INT && y.type == PS_INT)
+				ok = psc_op(ctx, c, st, PSC_AND, PS_INT, x.reg, y.reg);
+			else if (x.type == PS_BOOL && y.type == PS_BOOL)
+				ok = psc_op(ctx, c, st, PSC_AND, PS_BOOL, x.reg, y.reg);
+			else
+				ok = 0;
+			break;
+		case PS_OP_OR: ok = psc_logic(ctx, c, st, PSC_OR); break;
+		case PS_OP_XOR: ok = psc_logic(ctx, c, st, PSC_XOR); break;
+
+		case PS_OP_ATAN: ok = psc_binary_real(ctx, c, st, PSC_ATAN); break;
+		case PS_OP_DIV: ok = psc_binary_real(ctx, c, st, PSC_DIV); break;
+		case PS_OP_EXP: ok = psc_binary_real(ctx, c, st, PSC_EXP); break;
+		case PS_OP_BITSHIFT: ok = psc_binary_int(ctx, c, st, PSC_BITSHIFT); break;
+		case PS_OP_IDIV: ok = psc_binary_int(ctx, c, st, PSC_IDIV); break;
+		case PS_OP_MOD: ok = psc_binary_int(ctx, c, st, PSC_MOD); break;
+
+		case PS_OP_CEILING: ok = psc_unary_real(ctx, c, st, PSC_CEILING); break;
+		case PS_OP_COS: ok = psc_unary_real(ctx, c, st, PSC_COS); break;
+		case PS_OP_FLOOR: ok = psc_unary_real(ctx, c, st, PSC_FLOOR); break;
+		case PS_OP_LN: ok = psc_unary_real(ctx, c, st, PSC_LN); break;
+		case PS_OP_LOG: ok = psc_unary_real(ctx, c, st, PSC_LOG); break;
+		case PS_OP_SIN: ok = psc_unary_real(ctx, c, st, PSC_SIN); break;
+		case PS_OP_SQRT: ok = psc_unary_real(ctx, c, st, PSC_SQRT); break;
+
+		case PS_OP_TRUE:
+		case PS_OP_FALSE:
+			v.i = (obj->u.op == PS_OP_TRUE);
+			ok = psc_push_const(c, st, PS_BOOL, v);
+			break;
+
+		/* Stack operators mirror ps_copy, ps_index and ps_roll. */
+		case PS_OP_DUP:
+		case PS_OP_COPY:
+			n = 1;
+			if (obj->u.op == PS_OP_COPY && (!psc_pop(st, &x) || !psc_const_int(ctx, c, x, &n)))
+				return 0;
+			if (n >= 0 && n <= st->sp && st->sp + n < (int)nelem(st->slot))
+			{
+				memcpy(st->slot + st->sp, st->slot + st->sp - n, n * sizeof(psc_slot));
+				st->sp += n;
+			}
+			ok = 1;
+			break;
+
+		case PS_OP_INDEX:
+			if (!psc_pop(st, &x) || !psc_const_int(ctx, c, x, &n) || n < 0)
+				return 0;
+			if (st->sp + 1 < (int)nelem(st->slot) && n + 1 <= st->sp)
+			{
+				st->slot[st->sp] = st->slot[st->sp - n - 1];
+				st->sp++;
+			}
+			ok = 1;
+			break;
+
+		case PS_OP_EXCH:
+		case PS_OP_ROLL:
+			n = 2;
+			j = 1;
+			if (obj->u.op == PS_OP_ROLL)
+			{
+				if (!psc_pop(st, &y) || !psc_const_int(ctx, c, y, &j))
+					return 0;
+				if (!psc_pop(st, &x) || !psc_const_int(ctx, c, x, &n))
+					return 0;
+			}
+			psc_roll(st, n, j);
+			ok = 1;
+			break;
+
+		case PS_OP_POP:
+			if (st->sp > 0)
+				st->sp--;
+			ok = 1;
+			break;
+
+		case PS_OP_IF:
+			if (!psc_pop(st, &x) || x.type != PS_BOOL)
+				return 0;
+			ok = psc_compile_branches(ctx, c, st, x.reg, c->code[pc + 1].u.block, -1);
+			pc = c->code[pc + 2].u.block;
+			break;
+
+		case PS_OP_IFELSE:
+			if (!psc_pop(st, &x) || x.type != PS_BOOL)
+				return 0;
+			ok = psc_compile_branches(ctx, c, st, x.reg, c->code[pc + 1].u.block, c->code[pc + 0].u.block);
+			pc = c->code[pc + 2].u.block;
+			break;
+
+		case PS_OP_RETURN:
+			return 1;
+
+		default:
+			return 0;
+		}
+
+		if (!ok)
+			return 0;
+	}
+}
+
+static void
+compile_postscript_func(fz_context *ctx, pdf_function *func)
+{
+	psc_compiler *c;
+	psc_stack st;
+	int i;
+
+	c = fz_malloc_struct(ctx, psc_compiler);
+	c->code = func->u.p.code;
+
+	fz_try(ctx)
+	{
+		st.sp = 0;
+		for (i = 0; i < func->m; i++)
+		{
+			c->nregs++;
+			psc_push(&st, PS_REAL, i);
+		}
+
+		if (psc_compile_block(ctx, c, &st, 0) && st.sp >= func->n)
+		{
+			for (i = 0; i < func->n; i++)
+			{
+				psc_slot *x = &st.slot[st.sp - func->n + i];
+				if (x->type == PS_BOOL)
+					break;
+				func->u.p.out[i] = x->reg;
+				func->u.p.out_int[i] = (x->type == PS_INT);
+			}
+			if (i == func->n)
+			{
+				func->u.p.init = fz_malloc_array(ctx, c->nregs, psc_value);
+				memcpy(func->u.p.init, c->init, c->nregs * sizeof(psc_value));
+				func->u.p.nregs = c->nregs;
+				func->u.p.prog = c->prog;
+				func->u.p.len = c->len;
+				c->prog = NULL;
+				func->size += c->nregs * sizeof(psc_value) + c->cap * sizeof(psc_inst);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, c->prog);
+		fz_free(ctx, c);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+run_compiled_postscript_func(pdf_function *func, const float *in, float *out)
+{
+	psc_value reg[PSC_MAX_REGS];
+	const psc_inst *prog = func->u.p.prog;
+	int len = func->u.p.len;
+	int pc = 0;
+	float x;
+	int i;
+
+	memcpy(reg, func->u.p.init, func->u.p.nregs * sizeof(psc_value));
+	for (i = 0; i < func->m; i++)
+		reg[i].f = psc_real(fz_clamp(in[i], func->domain[i][0], func->domain[i][1]));
+
+	while (pc < len)
+	{
+		const psc_inst *inst = &prog[pc++];
+		if (inst->op == PSC_JZ)
+		{
+			if (!reg[inst->a].i)
+				pc = inst->dst;
+		}
+		else if (inst->op == PSC_JMP)
+			pc = inst->dst;
+		else
+			psc_exec(inst->op, &reg[inst->dst], reg[inst->a], reg[inst->b]);
+	}
+
+	for (i = 0; i < func->n; i++)
+	{
+		int r = func->u.p.out[i];
+		x = func->u.p.out_int[i] ? reg[r].i : reg[r].f;
+		out[i] = fz_clamp(x, func->range[i][0], func->range[i][1]);
+	}
+}
+
+/*
+ * Expensive functions of one or two inputs are sampled into a table
+ * when they are loaded, and evaluated by linear or bilinear
+ * interpolation from then on. The one input table has a grid step
+ * that puts every 8-bit input value on a sample point.
+ *
+ * Interpolation is only close to the function where it is smooth, so
+ * the table is checked against the function in the middle of every
+ * cell, and dropped if any output is off by more than a quarter of an
+ * 8-bit step. That rules out thresholds, branches, min/max and other
+ * functions with steps or sharp corners between the grid points.
+ */
+
+enum { PSC_LUT_1 = 4 * 255 + 1, PSC_LUT_2 = 255 / 3 + 1 };
+
+static void eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float *out);
+static void eval_sampled_postscript_func(pdf_function *func, const float *in, float *out);
+
+static int
+check_sampled_postscript_func(fz_context *ctx, pdf_function *func, float *lut, int size)
+{
+	float in[2], want[MAX_N], got[MAX_N];
+	int i, j, k, ok = 1;
+
+	for (j = 0; ok && j < (func->m == 2 ? size - 1 : 1); j++)
+	{
+		in[1] = lerp(j + 0.5f, 0, size - 1, func->domain[1][0], func->domain[1][1]);
+		for (i = 0; ok && i < size - 1; i++)
+		{
+			in[0] = lerp(i + 0.5f, 0, size - 1, func->domain[0][0], func->domain[0][1]);
+			func->u.p.lut = NULL;
+			eval_postscript_func(ctx, func, in, want);
+			func->u.p.lut = lut;
+			eval_sampled_postscript_func(func, in, got);
+			for (k = 0; k < func->n; k++)
+				if (fabsf(got[k] - want[k]) > fabsf(func->range[k][1] - func->range[k][0]) / 1024)
+					ok = 0;
+		}
+	}
+	func->u.p.lut = NULL;
+	return ok;
+}
+
+static void
+sample_postscript_func(fz_context *ctx, pdf_function *func, int ninterp)
+{
+	float in[2], *lut;
+	int cost, size, count, i, j;
+
+	/* Rough cost in compiled instructions; interpreting is several times slower. */
+	cost = func->u.p.nregs ? func->u.p.len : ninterp * 4;
+
+	if (func->m == 1 && cost > 4 * func->n)
+		size = PSC_LUT_1, count = size;
+	else if (func->m == 2 && cost > 16 * func->n)
+		size = PSC_LUT_2, count = size * size;
+	else
+		return;
+
+	lut = fz_malloc_array(ctx, count * func->n, float);
+	fz_try(ctx)
+	{
+		for (j = 0; j < (func->m == 2 ? size : 1); j++)
+		{
+			in[1] = lerp(j, 0, size - 1, func->domain[1][0], func->domain[1][1]);
+			for (i = 0; i < size; i++)
+			{
+				in[0] = lerp(i, 0, size - 1, func->domain[0][0], func->domain[0][1]);
+				eval_postscript_func(ctx, func, in, lut + (j * size + i) * func->n);
+			}
+		}
+		func->u.p.lut_size = size;
+		if (!check_sampled_postscript_func(ctx, func, lut, size))
+		{
+			fz_free(ctx, lut);
+			lut = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		func->u.p.lut = NULL;
+		fz_free(ctx, lut);
+		fz_rethrow(ctx);
+	}
+
+	if (!lut)
+		return;
+	func->u.p.lut = lut;
+	func->u.p.lut_size = size;
+	func->size += count * func->n * sizeof(float);
+}
+
+static inline int
+lut_coord(pdf_function *func, const float *in, int i, float *frac)
+{
+	int size = func->u.p.lut_size;
+	float x = psc_real(fz_clamp(in[i], func->domain[i][0], func->domain[i][1]));
+	float t = fz_clamp(lerp(x, func->domain[i][0], func->domain[i][1], 0, size - 1), 0, size - 1);
+	int k = (int)t;
+	if (k > size - 2)
+		k = size - 2;
+	*frac = t - k;
+	return k;
+}
+
+static void
+eval_sampled_postscript_func(pdf_function *func, const float *in, float *out)
+{
+	const float *lut = func->u.p.lut;
+	int n = func->n;
+	float fx, fy;
+	int x, y, i;
+
+	x = lut_coord(func, in, 0, &fx);
+	if (func->m == 1)
+	{
+		const float *a = lut + x * n;
+		for (i = 0; i < n; i++)
+			out[i] = a[i] + (a[i + n] - a[i]) * fx;
+	}
+	else
+	{
+		int stride = func->u.p.lut_size * n;
+		const float *a;
+		y = lut_coord(func, in, 1, &fy);
+		a = lut + y * stride + x * n;
+		for (i = 0; i < n; i++)
+		{
+			float ab = a[i] + (a[i + n] - a[i]) * fx;
+			float cd = a[i + stride] + (a[i + stride + n] - a[i + stride]) * fx;
+			out[i] = ab + (cd - ab) * fy;
+		}
+	}
+}
+
 static void
 load_postscript_func(fz_context *ctx, pdf_function *func, pdf_obj *dict)
 {
@@ -859,6 +1703,9 @@ load_postscript_func(fz_context *ctx, pdf_function *func, pdf_obj *dict)
 
 		codeptr = 0;
 		parse_code(ctx, func, stream, &codeptr, &buf);
+
+		compile_postscript_func(ctx, func);
+		sample_postscript_func(ctx, func, codeptr);
 	}
 	fz_always(ctx)
 	{
@@ -880,6 +1727,17 @@ eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float
 	float x;
 	int i;
 
+	if (func->u.p.lut)
+	{
+		eval_sampled_postscript_func(func, in, out);
+		return;
+	}
+	if (func->u.p.nregs)
+	{
+		run_compiled_postscript_func(func, in, out);
+		return;
+	}
+
 	ps_init_stack(&st);
 
 	for (i = 0; i < func->m; i++)
@@ -1363,6 +2221,9 @@ pdf_drop_function_imp(fz_context *ctx, fz_storable *func_)
 		break;
 	case POSTSCRIPT:
 		fz_free(ctx, func->u.p.code);
+		fz_free(ctx, func->u.p.prog);
+		fz_free(ctx, func->u.p.init);
+		fz_free(ctx, func->u.p.lut);
 		break;
 	}
 	fz_free(ctx, func);
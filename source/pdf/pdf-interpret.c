@@ -53,6 +53,7 @@ pdf_clear_stack(fz_context *ctx, pdf_csi *csi)
 
 	pdf_drop_obj(ctx, csi->obj);
 	csi->obj = NULL;
+	csi->resource = NULL;
 
 	csi->name[0] = 0;
 	csi->string_len = 0;
@@ -79,6 +80,426 @@ pdf_try_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *fon
 	return desc;
 }
 
+/* Maximum number of operators recorded for a single content stream */
+#define MAX_RECORDED_OPS (1 << 20)
+
+/*
+	A recording holds the operators of a content stream after lexing,
+	so that the stream can be processed again without opening,
+	decompressing and tokenising it. Numeric operands are stored in a
+	shared float pool; the less common names, strings, objects and
+	inline images go in a separate argument table. Named resources
+	looked up by the operators are kept as well, and reused as long as
+	the stream is processed with the same resource dictionary and the
+	document has not been edited since.
+
+	Form XObjects and tiling patterns are recorded the second time they
+	are used; the first use only leaves a marker in the store. Page
+	contents are recorded right away, but only if the document has the
+	content cache enabled.
+
+	The recording remembers the stream sources it was made from so that
+	it is not used after any of them has been updated. Contents that
+	could not be recorded leave a failed entry behind, so that they
+	are not recorded again on every use.
+*/
+
+typedef struct
+{
+	int key;
+	int top;
+	int stack;
+	int arg;
+} pdf_recorded_op;
+
+typedef struct
+{
+	int name;
+	int string;
+	int string_len;
+	pdf_obj *obj;
+	pdf_obj *res;
+	fz_image *image;
+} pdf_recorded_arg;
+
+typedef struct
+{
+	int num;
+	fz_buffer *stm_buf;
+	int64_t stm_ofs;
+} pdf_recorded_source;
+
+struct pdf_recording_s
+{
+	fz_storable storable;
+	pdf_document *doc;
+	int nsrc;
+	pdf_recorded_source *src;
+	pdf_obj *rdb;
+	int edit_count;
+	int marker;
+	int failed;
+	int len, cap;
+	pdf_recorded_op *ops;
+	int alen, acap;
+	pdf_recorded_arg *args;
+	int flen, fcap;
+	float *floats;
+	int tlen, tcap;
+	char *text;
+	int image_count;
+	size_t image_size;
+};
+
+void
+pdf_enable_content_cache(fz_context *ctx, pdf_document *doc, int enable)
+{
+	doc->cache_contents = enable;
+}
+
+/* Throw away the recorded operators, keeping only the sources. */
+static void
+pdf_clear_recording(fz_context *ctx, pdf_recording *rec)
+{
+	int i;
+
+	for (i = 0; i < rec->alen; i++)
+	{
+		pdf_drop_obj(ctx, rec->args[i].obj);
+		pdf_drop_obj(ctx, rec->args[i].res);
+		fz_drop_image(ctx, rec->args[i].image);
+	}
+	pdf_drop_obj(ctx, rec->rdb);
+	fz_free(ctx, rec->ops);
+	fz_free(ctx, rec->args);
+	fz_free(ctx, rec->floats);
+	fz_free(ctx, rec->text);
+	rec->rdb = NULL;
+	rec->ops = NULL;
+	rec->args = NULL;
+	rec->floats = NULL;
+	rec->text = NULL;
+	rec->len = rec->cap = 0;
+	rec->alen = rec->acap = 0;
+	rec->flen = rec->fcap = 0;
+	rec->tlen = rec->tcap = 0;
+	rec->image_count = 0;
+	rec->image_size = 0;
+}
+
+static void
+pdf_drop_recording_imp(fz_context *ctx, fz_storable *rec_)
+{
+	pdf_recording *rec = (pdf_recording *)rec_;
+	int i;
+
+	pdf_clear_recording(ctx, rec);
+	for (i = 0; i < rec->nsrc; i++)
+		fz_drop_buffer(ctx, rec->src[i].stm_buf);
+	fz_free(ctx, rec->src);
+	fz_free(ctx, rec);
+}
+
+static void
+pdf_drop_recording(fz_context *ctx, pdf_recording *rec)
+{
+	if (rec)
+		fz_drop_storable(ctx, &rec->storable);
+}
+
+static size_t
+pdf_recording_size(pdf_recording *rec)
+{
+	return sizeof(*rec) +
+		rec->nsrc * sizeof(*rec->src) +
+		rec->cap * sizeof(*rec->ops) +
+		rec->acap * sizeof(*rec->args) +
+		rec->fcap * sizeof(*rec->floats) +
+		rec->tcap +
+		rec->image_size;
+}
+
+/*
+	Find the object to store a recording of the contents under, or NULL
+	if the contents should not be recorded. Contents arrays are stored
+	under the array itself, whether it is an indirect object or not.
+*/
+static pdf_obj *
+pdf_recording_key(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	pdf_obj *type;
+
+	if (pdf_is_array(ctx, stmobj))
+	{
+		if (!doc->cache_contents || pdf_array_len(ctx, stmobj) == 0)
+			return NULL;
+		return stmobj;
+	}
+
+	if (!pdf_is_indirect(ctx, stmobj) || !pdf_is_stream(ctx, stmobj))
+		return NULL;
+	if (doc->cache_contents)
+		return stmobj;
+	type = pdf_dict_get(ctx, stmobj, PDF_NAME(Subtype));
+	if (pdf_name_eq(ctx, type, PDF_NAME(Form)))
+		return stmobj;
+	type = pdf_dict_get(ctx, stmobj, PDF_NAME(Type));
+	if (pdf_name_eq(ctx, type, PDF_NAME(Pattern)))
+		return stmobj;
+	return NULL;
+}
+
+static pdf_xref_entry *
+pdf_recording_entry(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
+{
+	int num;
+
+	if (!pdf_is_indirect(ctx, obj))
+		return NULL;
+	num = pdf_to_num(ctx, obj);
+	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
+		return NULL;
+	return pdf_get_xref_entry(ctx, doc, num);
+}
+
+static int
+pdf_recording_is_current(fz_context *ctx, pdf_document *doc, pdf_recording *rec, pdf_obj *stmobj)
+{
+	int i, n = pdf_is_array(ctx, stmobj) ? pdf_array_len(ctx, stmobj) : 1;
+
+	/* Direct contents arrays of different documents can have the same key. */
+	if (rec->doc != doc || n != rec->nsrc)
+		return 0;
+	for (i = 0; i < n; i++)
+	{
+		pdf_obj *obj = pdf_is_array(ctx, stmobj) ? pdf_array_get(ctx, stmobj, i) : stmobj;
+		pdf_xref_entry *x = pdf_recording_entry(ctx, doc, obj);
+		if (!x)
+		{
+			if (rec->src[i].num != 0)
+				return 0;
+		}
+		else if (pdf_to_num(ctx, obj) != rec->src[i].num ||
+			x->stm_buf != rec->src[i].stm_buf || x->stm_ofs != rec->src[i].stm_ofs)
+			return 0;
+	}
+	return 1;
+}
+
+/* Start a new recording of the contents, or a marker if marker is set. */
+static pdf_recording *
+pdf_new_recording(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj, int marker)
+{
+	int i, n = pdf_is_array(ctx, stmobj) ? pdf_array_len(ctx, stmobj) : 1;
+	pdf_recording *rec;
+
+	rec = fz_malloc_struct(ctx, pdf_recording);
+	FZ_INIT_STORABLE(rec, 1, pdf_drop_recording_imp);
+	rec->doc = doc;
+	rec->edit_count = doc->edit_count;
+	rec->marker = marker;
+	fz_try(ctx)
+	{
+		rec->src = fz_malloc_array(ctx, n, pdf_recorded_source);
+		for (i = 0; i < n; i++)
+		{
+			pdf_obj *obj = pdf_is_array(ctx, stmobj) ? pdf_array_get(ctx, stmobj, i) : stmobj;
+			pdf_xref_entry *x = pdf_recording_entry(ctx, doc, obj);
+			if (x)
+			{
+				rec->src[i].num = pdf_to_num(ctx, obj);
+				rec->src[i].stm_buf = fz_keep_buffer(ctx, x->stm_buf);
+				rec->src[i].stm_ofs = x->stm_ofs;
+			}
+			else
+			{
+				/* Not a stream in this document; don't record what we get for it. */
+				rec->src[i].num = 0;
+				rec->src[i].stm_buf = NULL;
+				rec->src[i].stm_ofs = 0;
+				rec->failed = 1;
+			}
+			rec->nsrc++;
+		}
+		rec->rdb = pdf_keep_obj(ctx, rdb);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_recording(ctx, rec);
+		fz_rethrow(ctx);
+	}
+	return rec;
+}
+
+/* Look for a recording or marker that is still valid for the contents. */
+static pdf_recording *
+pdf_find_recording(fz_context *ctx, pdf_document *doc, pdf_obj *key, pdf_obj *stmobj)
+{
+	pdf_recording *rec;
+
+	rec = pdf_find_item(ctx, pdf_drop_recording_imp, key);
+	if (rec && !pdf_recording_is_current(ctx, doc, rec, stmobj))
+	{
+		pdf_remove_item(ctx, pdf_drop_recording_imp, key);
+		pdf_drop_recording(ctx, rec);
+		rec = NULL;
+	}
+	return rec;
+}
+
+static void
+pdf_store_recording(fz_context *ctx, pdf_obj *key, pdf_recording *rec)
+{
+	pdf_recording *existing;
+
+	/* Keep only the sources of a failed recording, to remember not to try again. */
+	if (rec->failed)
+	{
+		pdf_clear_recording(ctx, rec);
+		rec->marker = 0;
+	}
+	else if (rec->len == 0 && !rec->marker)
+		return;
+
+	/* Replace a marker, but keep a recording someone else made while we were busy. */
+	existing = pdf_find_item(ctx, pdf_drop_recording_imp, key);
+	if (existing)
+	{
+		int marker = existing->marker;
+		pdf_drop_recording(ctx, existing);
+		if (!marker || rec->marker)
+			return;
+		pdf_remove_item(ctx, pdf_drop_recording_imp, key);
+	}
+
+	pdf_store_item(ctx, key, rec, pdf_recording_size(rec));
+}
+
+static void
+pdf_grow_recording(fz_context *ctx, pdf_recording *rec, int nargs, int nfloats, int ntext)
+{
+	if (rec->len == rec->cap)
+	{
+		int cap = rec->cap ? rec->cap * 2 : 64;
+		rec->ops = fz_realloc_array(ctx, rec->ops, cap, pdf_recorded_op);
+		rec->cap = cap;
+	}
+	if (rec->alen + nargs > rec->acap)
+	{
+		int cap = rec->acap ? rec->acap * 2 : 16;
+		rec->args = fz_realloc_array(ctx, rec->args, cap, pdf_recorded_arg);
+		rec->acap = cap;
+	}
+	if (rec->flen + nfloats > rec->fcap)
+	{
+		int cap = rec->fcap ? rec->fcap * 2 : 256;
+		while (cap < rec->flen + nfloats)
+			cap *= 2;
+		rec->floats = fz_realloc_array(ctx, rec->floats, cap, float);
+		rec->fcap = cap;
+	}
+	if (rec->tlen + ntext > rec->tcap)
+	{
+		int cap = rec->tcap ? rec->tcap * 2 : 256;
+		while (cap < rec->tlen + ntext)
+			cap *= 2;
+		rec->text = fz_realloc_array(ctx, rec->text, cap, char);
+		rec->tcap = cap;
+	}
+}
+
+/*
+	Append the operator with the operands currently on the stack to the
+	recording. Failing to record is not an error; the recording is just
+	abandoned.
+*/
+static void
+pdf_record_op(fz_context *ctx, pdf_csi *csi, int key, fz_image *image, const char *name)
+{
+	pdf_recording *rec = csi->recording;
+	pdf_recorded_op *op;
+	pdf_recorded_arg *arg;
+	int name_len, ntext, nargs;
+
+	if (rec->failed)
+		return;
+	if (rec->len == MAX_RECORDED_OPS)
+	{
+		rec->failed = 1;
+		return;
+	}
+
+	name_len = name[0] ? (int)strlen(name) + 1 : 0;
+	ntext = name_len + (int)csi->string_len;
+	nargs = (ntext || csi->obj || image) ? 1 : 0;
+	if (rec->len == rec->cap || rec->alen + nargs > rec->acap || rec->flen + csi->top > rec->fcap || rec->tlen + ntext > rec->tcap)
+	{
+		fz_try(ctx)
+			pdf_grow_recording(ctx, rec, nargs, csi->top, ntext);
+		fz_catch(ctx)
+		{
+			rec->failed = 1;
+			return;
+		}
+	}
+
+	op = &rec->ops[rec->len++];
+	op->key = key;
+	op->top = csi->top;
+	op->stack = rec->flen;
+	memcpy(rec->floats + rec->flen, csi->stack, csi->top * sizeof(float));
+	rec->flen += csi->top;
+	op->arg = -1;
+	if (!nargs)
+		return;
+
+	op->arg = rec->alen;
+	arg = &rec->args[rec->alen++];
+	arg->name = -1;
+	if (name_len)
+	{
+		arg->name = rec->tlen;
+		memcpy(rec->text + rec->tlen, name, name_len);
+		rec->tlen += name_len;
+	}
+	arg->string = rec->tlen;
+	arg->string_len = (int)csi->string_len;
+	memcpy(rec->text + rec->tlen, csi->string, csi->string_len);
+	rec->tlen += (int)csi->string_len;
+	arg->obj = pdf_keep_obj(ctx, csi->obj);
+	arg->res = NULL;
+	arg->image = fz_keep_image(ctx, image);
+	if (image)
+	{
+		rec->image_count++;
+		rec->image_size += fz_image_size(ctx, image);
+	}
+}
+
+/*
+	Look up the resource named by the current operator. Replays with
+	the same resource dictionary get the resource that was found when
+	the operator was recorded.
+*/
+static pdf_obj *
+pdf_lookup_resource(fz_context *ctx, pdf_csi *csi, pdf_obj *type)
+{
+	pdf_recording *rec = csi->recording;
+	pdf_obj *res;
+
+	if (csi->resource)
+		return csi->resource;
+
+	res = pdf_dict_gets(ctx, pdf_dict_get(ctx, csi->rdb, type), csi->name);
+	if (rec && !rec->failed && rec->len > 0 && rec->ops[rec->len-1].arg >= 0)
+	{
+		pdf_recorded_arg *arg = &rec->args[rec->ops[rec->len-1].arg];
+		if (!arg->res)
+			arg->res = pdf_keep_obj(ctx, res);
+	}
+	return res;
+}
+
 static fz_image *
 parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm, char *csname, int cslen)
 {
@@ -309,10 +730,9 @@ pdf_process_extgstate(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_ob
 static void
 pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 {
-	pdf_obj *xres, *xobj, *subtype;
+	pdf_obj *xobj, *subtype;
 
-	xres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(XObject));
-	xobj = pdf_dict_gets(ctx, xres, csi->name);
+	xobj = pdf_lookup_resource(ctx, csi, PDF_NAME(XObject));
 	if (!xobj)
 		fz_throw(ctx, FZ_ERROR_MINOR, "cannot find XObject resource '%s'", csi->name);
 	subtype = pdf_dict_get(ctx, xobj, PDF_NAME(Subtype));
@@ -379,9 +799,8 @@ pdf_process_CS(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 			cs = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
 		else
 		{
-			pdf_obj *csres, *csobj;
-			csres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ColorSpace));
-			csobj = pdf_dict_gets(ctx, csres, csi->name);
+			pdf_obj *csobj;
+			csobj = pdf_lookup_resource(ctx, csi, PDF_NAME(ColorSpace));
 			if (!csobj)
 				fz_throw(ctx, FZ_ERROR_MINOR, "cannot find ColorSpace resource '%s'", csi->name);
 			cs = pdf_load_colorspace(ctx, csobj);
@@ -406,10 +825,9 @@ pdf_process_SC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, int stroke)
 {
 	if (csi->name[0])
 	{
-		pdf_obj *patres, *patobj, *type;
+		pdf_obj *patobj, *type;
 
-		patres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Pattern));
-		patobj = pdf_dict_gets(ctx, patres, csi->name);
+		patobj = pdf_lookup_resource(ctx, csi, PDF_NAME(Pattern));
 		if (!patobj)
 			fz_throw(ctx, FZ_ERROR_MINOR, "cannot find Pattern resource '%s'", csi->name);
 
@@ -551,11 +969,9 @@ pdf_process_end(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 #define B(a,b) (a | b << 8)
 #define C(a,b,c) (a | b << 8 | c << 16)
 
-static void
-pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, char *word)
+static int
+pdf_keyword_key(const char *word)
 {
-	float *s = csi->stack;
-	char csname[40];
 	int key;
 
 	key = word[0];
@@ -570,6 +986,15 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 		}
 	}
 
+	return key;
+}
+
+static void
+pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm, int key, const char *word)
+{
+	float *s = csi->stack;
+	char csname[40];
+
 	switch (key)
 	{
 	default:
@@ -588,9 +1013,8 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 
 	case B('g','s'):
 		{
-			pdf_obj *gsres, *gsobj;
-			gsres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(ExtGState));
-			gsobj = pdf_dict_gets(ctx, gsres, csi->name);
+			pdf_obj *gsobj;
+			gsobj = pdf_lookup_resource(ctx, csi, PDF_NAME(ExtGState));
 			if (!gsobj)
 				fz_throw(ctx, FZ_ERROR_MINOR, "cannot find ExtGState resource '%s'", csi->name);
 			if (proc->op_gs_begin)
@@ -646,10 +1070,9 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	case B('T','f'):
 		if (proc->op_Tf)
 		{
-			pdf_obj *fontres, *fontobj;
+			pdf_obj *fontobj;
 			pdf_font_desc *font;
-			fontres = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Font));
-			fontobj = pdf_dict_gets(ctx, fontres, csi->name);
+			fontobj = pdf_lookup_resource(ctx, csi, PDF_NAME(Font));
 			if (pdf_is_dict(ctx, fontobj))
 				font = pdf_try_load_font(ctx, csi->doc, csi->rdb, fontobj, csi->cookie);
 			else
@@ -724,6 +1147,8 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 			fz_image *img = parse_inline_image(ctx, csi, stm, csname, sizeof csname);
 			fz_try(ctx)
 			{
+				if (csi->recording)
+					pdf_record_op(ctx, csi, key, img, csname);
 				if (proc->op_BI)
 					proc->op_BI(ctx, proc, img, csname[0] ? csname : NULL);
 			}
@@ -737,10 +1162,9 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	case B('s','h'):
 		if (proc->op_sh)
 		{
-			pdf_obj *shaderes, *shadeobj;
+			pdf_obj *shadeobj;
 			fz_shade *shade;
-			shaderes = pdf_dict_get(ctx, csi->rdb, PDF_NAME(Shading));
-			shadeobj = pdf_dict_gets(ctx, shaderes, csi->name);
+			shadeobj = pdf_lookup_resource(ctx, csi, PDF_NAME(Shading));
 			if (!shadeobj)
 				fz_throw(ctx, FZ_ERROR_MINOR, "cannot find Shading resource '%s'", csi->name);
 			shade = pdf_load_shading(ctx, csi->doc, shadeobj);
@@ -768,6 +1192,72 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	}
 }
 
+/*
+	Deal with an error caught while processing a content stream.
+	Rethrows errors that must abort processing, and returns non-zero
+	if the rest of the content stream should be ignored.
+*/
+static int
+pdf_process_error(fz_context *ctx, pdf_csi *csi, int *syntax_errors)
+{
+	fz_cookie *cookie = csi->cookie;
+	int caught = fz_caught(ctx);
+	int stop = 0;
+
+	if (cookie)
+	{
+		if (caught == FZ_ERROR_TRYLATER)
+		{
+			cookie->incomplete++;
+			stop = 1;
+		}
+		else if (caught == FZ_ERROR_ABORT)
+		{
+			fz_rethrow(ctx);
+		}
+		else if (caught == FZ_ERROR_MINOR)
+		{
+			cookie->errors++;
+		}
+		else if (caught == FZ_ERROR_SYNTAX)
+		{
+			cookie->errors++;
+			if (++*syntax_errors >= MAX_SYNTAX_ERRORS)
+			{
+				fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+				stop = 1;
+			}
+		}
+		else
+		{
+			fz_rethrow(ctx);
+		}
+	}
+	else
+	{
+		if (caught == FZ_ERROR_TRYLATER)
+			stop = 1;
+		else if (caught == FZ_ERROR_ABORT)
+			fz_rethrow(ctx);
+		else if (caught == FZ_ERROR_MINOR)
+			/* ignore minor errors */ ;
+		else if (caught == FZ_ERROR_SYNTAX)
+		{
+			if (++*syntax_errors >= MAX_SYNTAX_ERRORS)
+			{
+				fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+				stop = 1;
+			}
+		}
+		else
+		{
+			fz_rethrow(ctx);
+		}
+	}
+
+	return stop;
+}
+
 static void
 pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream *stm)
 {
@@ -778,6 +1268,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 	pdf_token tok = PDF_TOK_ERROR;
 	int in_text_array = 0;
 	int syntax_errors = 0;
+	int key;
 
 	/* make sure we have a clean slate if we come here from flush_text */
 	pdf_clear_stack(ctx, csi);
@@ -839,7 +1330,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 								{
 									csi->stack[0] = pdf_to_real(ctx, o);
 									pdf_array_delete(ctx, csi->obj, n-1);
-									pdf_process_keyword(ctx, proc, csi, stm, buf->scratch);
+									pdf_process_keyword(ctx, proc, csi, stm, pdf_keyword_key(buf->scratch), buf->scratch);
 								}
 							}
 						}
@@ -928,7 +1419,11 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					break;
 
 				case PDF_TOK_KEYWORD:
-					pdf_process_keyword(ctx, proc, csi, stm, buf->scratch);
+					key = pdf_keyword_key(buf->scratch);
+					/* inline images are recorded once they have been parsed */
+					if (csi->recording && key != B('B','I'))
+						pdf_record_op(ctx, csi, key, NULL, csi->name);
+					pdf_process_keyword(ctx, proc, csi, stm, key, buf->scratch);
 					pdf_clear_stack(ctx, csi);
 					break;
 
@@ -944,63 +1439,115 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 		}
 		fz_catch(ctx)
 		{
-			int caught = fz_caught(ctx);
-			if (cookie)
-			{
-				if (caught == FZ_ERROR_TRYLATER)
-				{
-					cookie->incomplete++;
-					tok = PDF_TOK_EOF;
-				}
-				else if (caught == FZ_ERROR_ABORT)
-				{
-					fz_rethrow(ctx);
-				}
-				else if (caught == FZ_ERROR_MINOR)
-				{
-					cookie->errors++;
-				}
-				else if (caught == FZ_ERROR_SYNTAX)
-				{
-					cookie->errors++;
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
-					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
-					}
-				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
-			}
-			else
+			/* Errors from the lexer would not be reproduced by a replay. */
+			if (csi->recording && fz_caught(ctx) != FZ_ERROR_MINOR)
+				csi->recording->failed = 1;
+
+			if (pdf_process_error(ctx, csi, &syntax_errors))
+				tok = PDF_TOK_EOF;
+
+			/* If we do catch an error, then reset ourselves to a base lexing state */
+			in_text_array = 0;
+		}
+	}
+	while (tok != PDF_TOK_EOF);
+}
+
+static void
+pdf_replay_op(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_recording *rec, pdf_recorded_op *op)
+{
+	pdf_recorded_arg *arg = op->arg >= 0 ? &rec->args[op->arg] : NULL;
+	const char *name = "";
+
+	memcpy(csi->stack, rec->floats + op->stack, op->top * sizeof(float));
+	csi->top = op->top;
+	if (arg)
+	{
+		if (arg->name >= 0)
+			name = rec->text + arg->name;
+		fz_strlcpy(csi->name, name, sizeof csi->name);
+		memcpy(csi->string, rec->text + arg->string, arg->string_len);
+		csi->string_len = arg->string_len;
+		csi->obj = pdf_keep_obj(ctx, arg->obj);
+		if (csi->rdb == rec->rdb && csi->doc->edit_count == rec->edit_count)
+			csi->resource = arg->res;
+	}
+
+	if (op->key == B('B','I'))
+	{
+		if (proc->op_BI)
+			proc->op_BI(ctx, proc, arg->image, name[0] ? name : NULL);
+	}
+	else
+	{
+		/* Unknown keywords are only recorded inside BX/EX, where they are ignored. */
+		pdf_process_keyword(ctx, proc, csi, NULL, op->key, "");
+	}
+}
+
+/*
+	Inline images are parsed with the resources of the recording, so
+	a recording that has any is only replayed with those resources,
+	and only if nothing has been edited since.
+*/
+static int
+pdf_can_replay_recording(pdf_csi *csi, pdf_recording *rec)
+{
+	if (rec->marker || rec->failed)
+		return 0;
+	if (rec->image_count == 0)
+		return 1;
+	return csi->rdb == rec->rdb && csi->doc->edit_count == rec->edit_count;
+}
+
+/* Process a recorded content stream, with the same error handling as pdf_process_stream. */
+static void
+pdf_process_recording(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_recording *rec)
+{
+	fz_cookie *cookie = csi->cookie;
+	int syntax_errors = 0;
+	int i = 0;
+
+	pdf_clear_stack(ctx, csi);
+
+	fz_var(i);
+
+	if (cookie)
+	{
+		cookie->progress_max = -1;
+		cookie->progress = 0;
+	}
+
+	while (i < rec->len)
+	{
+		fz_try(ctx)
+		{
+			while (i < rec->len)
 			{
-				if (caught == FZ_ERROR_TRYLATER)
-					tok = PDF_TOK_EOF;
-				else if (caught == FZ_ERROR_ABORT)
-					fz_rethrow(ctx);
-				else if (caught == FZ_ERROR_MINOR)
-					/* ignore minor errors */ ;
-				else if (caught == FZ_ERROR_SYNTAX)
+				if (cookie)
 				{
-					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
+					if (cookie->abort)
 					{
-						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
-						tok = PDF_TOK_EOF;
+						i = rec->len;
+						break;
 					}
+					cookie->progress++;
 				}
-				else
-				{
-					fz_rethrow(ctx);
-				}
-			}
 
-			/* If we do catch an error, then reset ourselves to a base lexing state */
-			in_text_array = 0;
+				pdf_replay_op(ctx, proc, csi, rec, &rec->ops[i++]);
+				pdf_clear_stack(ctx, csi);
+			}
+		}
+		fz_always(ctx)
+		{
+			pdf_clear_stack(ctx, csi);
+		}
+		fz_catch(ctx)
+		{
+			if (pdf_process_error(ctx, csi, &syntax_errors))
+				i = rec->len;
 		}
 	}
-	while (tok != PDF_TOK_EOF);
 }
 
 /* Functions to actually process annotations, glyphs and general stream objects */
@@ -1010,11 +1557,14 @@ pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pd
 	pdf_csi csi;
 	pdf_lexbuf buf;
 	fz_stream *stm = NULL;
+	pdf_recording *rec = NULL;
+	pdf_obj *key = NULL;
 
 	if (!stmobj)
 		return;
 
 	fz_var(stm);
+	fz_var(rec);
 
 	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
 	pdf_init_csi(ctx, &csi, doc, rdb, &buf, cookie);
@@ -1022,8 +1572,30 @@ pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pd
 	fz_try(ctx)
 	{
 		fz_defer_reap_start(ctx);
-		stm = pdf_open_contents_stream(ctx, doc, stmobj);
-		pdf_process_stream(ctx, proc, &csi, stm);
+		key = pdf_recording_key(ctx, doc, stmobj);
+		if (key)
+			rec = pdf_find_recording(ctx, doc, key, stmobj);
+		if (rec && pdf_can_replay_recording(&csi, rec))
+			pdf_process_recording(ctx, proc, &csi, rec);
+		else
+		{
+			if (key && (!rec || rec->marker))
+			{
+				/* Leave a marker on first use, unless caching all contents. */
+				int marker = !rec && !doc->cache_contents;
+				csi.recording = pdf_new_recording(ctx, doc, rdb, stmobj, marker);
+				if (marker)
+				{
+					pdf_store_recording(ctx, key, csi.recording);
+					pdf_drop_recording(ctx, csi.recording);
+					csi.recording = NULL;
+				}
+			}
+			stm = pdf_open_contents_stream(ctx, doc, stmobj);
+			pdf_process_stream(ctx, proc, &csi, stm);
+			if (csi.recording && !(cookie && cookie->abort))
+				pdf_store_recording(ctx, key, csi.recording);
+		}
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
@@ -1032,6 +1604,8 @@ pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pd
 		fz_drop_stream(ctx, stm);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
+		pdf_drop_recording(ctx, rec);
+		pdf_drop_recording(ctx, csi.recording);
 	}
 	fz_catch(ctx)
 	{
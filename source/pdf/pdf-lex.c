@@ -41,10 +41,79 @@ static inline int lex_byte(fz_context *ctx, fz_stream *stm)
 		fz_write_printf(ctx, fz_stdout(ctx), "<%02x>", c);
 	return c;
 }
+/* every byte must go through lex_byte to be dumped */
+#define lex_avail(S) 0
 #else
 #define lex_byte(C,S) fz_read_byte(C,S)
+#define lex_avail(S) ((S)->wp - (S)->rp)
 #endif
 
+/*
+	Character classes for the block scanning fast paths, which work
+	directly on the bytes available in the stream buffer and leave
+	anything unusual (and anything crossing the end of the buffer) to
+	the byte at a time code below.
+*/
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_NAME = 4, /* copied verbatim into names and keywords */
+	LEX_STRING = 8, /* copied verbatim into literal strings */
+	LEX_HEX = 16
+};
+
+#define W LEX_WHITE
+#define D LEX_DELIM
+#define N LEX_NAME
+#define S LEX_STRING
+#define H LEX_HEX
+static const unsigned char lex_class[256] =
+{
+	W|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, W|S, W|S, N|S, W|S, W|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	W|S, N|S, N|S, S, N|S, D|S, N|S, N|S,
+	D, D, N|S, N|S, N|S, N|S, N|S, D|S,
+	N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H,
+	N|S|H, N|S|H, N|S, N|S, D|S, N|S, D|S, N|S,
+	N|S, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, D|S, N, D|S, N|S, N|S,
+	N|S, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S|H, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, D|S, N|S, D|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+	N|S, N|S, N|S, N|S, N|S, N|S, N|S, N|S,
+};
+#undef W
+#undef D
+#undef N
+#undef S
+#undef H
+
+static const double lex_pow10[10] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
 static inline int iswhite(int ch)
 {
 	return
@@ -72,7 +141,16 @@ static inline int unhex(int ch)
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *p = f->rp;
+	unsigned char *end = p + lex_avail(f);
 	int c;
+
+	while (p < end && (lex_class[*p] & LEX_WHITE))
+		p++;
+	f->rp = p;
+	if (p < end)
+		return;
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -83,7 +161,19 @@ lex_white(fz_context *ctx, fz_stream *f)
 static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *p = f->rp;
+	unsigned char *end = p + lex_avail(f);
 	int c;
+
+	while (p < end && *p != '\012' && *p != '\015')
+		p++;
+	if (p < end)
+	{
+		f->rp = p + 1;
+		return;
+	}
+	f->rp = p;
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -162,6 +252,80 @@ static int fast_atoi(char *s)
 	return neg ? -i : i;
 }
 
+/*
+	Lex the common number formats (an optional minus sign, at most nine
+	digits and an optional decimal point, followed by a delimiter within
+	the stream buffer) without going through the string conversion.
+	The result is exactly what the slow path would produce: at most nine
+	digits and a power of ten both fit a double exactly, so the division
+	is correctly rounded, as is fz_strtof for such numbers.
+	Returns PDF_TOK_ERROR if the slow path must be used.
+*/
+static int
+lex_number_fast(fz_stream *f, pdf_lexbuf *buf, int c)
+{
+	unsigned char *start = f->rp;
+	unsigned char *end = start + lex_avail(f);
+	unsigned char *p = start;
+	unsigned int m = 0;
+	int neg = 0, dot = 0;
+	int ndigits = 0, nint = 0, nfrac = 0;
+	size_t len;
+
+	if (c == '-')
+		neg = 1;
+	else if (c == '.')
+		dot = 1;
+	else if (c >= '0' && c <= '9')
+	{
+		m = c - '0';
+		ndigits = nint = 1;
+	}
+	else
+		return PDF_TOK_ERROR;
+
+	while (p < end)
+	{
+		c = *p;
+		if (c >= '0' && c <= '9')
+		{
+			if (++ndigits > 9)
+				return PDF_TOK_ERROR;
+			m = m * 10 + (c - '0');
+			if (dot)
+				nfrac++;
+			else
+				nint++;
+		}
+		else if (c == '.' && !dot)
+			dot = 1;
+		else
+			break;
+		p++;
+	}
+
+	/* the number must be followed by a delimiter we can see */
+	if (p == end || !(lex_class[*p] & (LEX_WHITE | LEX_DELIM)) || ndigits == 0)
+		return PDF_TOK_ERROR;
+	/* the slow path uses acrobat_compatible_atof for long integer parts */
+	if (dot && neg + nint >= 10)
+		return PDF_TOK_ERROR;
+
+	len = p - start + 1;
+	memcpy(buf->scratch, start - 1, len);
+	buf->scratch[len] = 0;
+	f->rp = p;
+
+	if (dot)
+	{
+		float v = (float)(m / lex_pow10[nfrac]);
+		buf->f = neg ? -v : v;
+		return PDF_TOK_REAL;
+	}
+	buf->i = neg ? -(int)m : (int)m;
+	return PDF_TOK_INT;
+}
+
 static int
 lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -170,6 +334,11 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 	char *isreal = (c == '.' ? s : NULL);
 	int neg = (c == '-');
 	int isbad = 0;
+	int tok;
+
+	tok = lex_number_fast(f, buf, c);
+	if (tok != PDF_TOK_ERROR)
+		return tok;
 
 	*s++ = c;
 
@@ -238,8 +407,22 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 {
 	char *s = lb->scratch;
 	char *e = s + fz_minz(127, lb->size);
+	unsigned char *p = f->rp;
+	unsigned char *end = p + fz_minz(lex_avail(f), e - s);
 	int c;
 
+	/* Names without escapes that end within the stream buffer. */
+	while (p < end && (lex_class[*p] & LEX_NAME))
+		p++;
+	if (p < end && (lex_class[*p] & (LEX_WHITE | LEX_DELIM)))
+	{
+		lb->len = p - f->rp;
+		memcpy(s, f->rp, lb->len);
+		s[lb->len] = 0;
+		f->rp = p;
+		return;
+	}
+
 	while (1)
 	{
 		if (s == e)
@@ -318,6 +501,7 @@ lex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 {
 	char *s = lb->scratch;
 	char *e = s + lb->size;
+	unsigned char *p, *end;
 	int bal = 1;
 	int oct;
 	int c;
@@ -329,6 +513,16 @@ lex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+
+		/* Copy runs of ordinary characters straight from the stream buffer. */
+		p = f->rp;
+		end = p + fz_minz(lex_avail(f), e - s);
+		while (p < end && (lex_class[*p] & LEX_STRING))
+			*s++ = *p++;
+		f->rp = p;
+		if (s == e)
+			continue;
+
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
@@ -416,6 +610,7 @@ lex_hex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 {
 	char *s = lb->scratch;
 	char *e = s + lb->size;
+	unsigned char *p, *end;
 	int a = 0, x = 0;
 	int c;
 
@@ -426,6 +621,22 @@ lex_hex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+
+		/* Decode runs of hex digit pairs straight from the stream buffer. */
+		if (!x)
+		{
+			p = f->rp;
+			end = p + fz_minz(lex_avail(f) / 2, e - s) * 2;
+			while (p < end && (lex_class[p[0]] & lex_class[p[1]] & LEX_HEX))
+			{
+				*s++ = (unhex(p[0]) << 4) + unhex(p[1]);
+				p += 2;
+			}
+			f->rp = p;
+			if (s == e)
+				continue;
+		}
+
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
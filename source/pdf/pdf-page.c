@@ -1094,6 +1094,34 @@ pdf_update_default_colorspaces(fz_context *ctx, fz_default_colorspaces *old_cs,
 
 	number: page number, where 0 is the first page of the document.
 */
+/*
+	The /O entry of a linearization dictionary is only a hint (and
+	some writers get it wrong), so check that the object really is
+	the first leaf of the page tree before trusting it. Walking up
+	the Parent chain only touches objects that the first page needs
+	anyway.
+*/
+static int
+pdf_is_first_page_obj(fz_context *ctx, pdf_document *doc, pdf_obj *page)
+{
+	pdf_obj *pages = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Pages");
+	pdf_obj *node = page;
+	int depth = 0;
+
+	if (!pdf_name_eq(ctx, pdf_dict_get(ctx, page, PDF_NAME(Type)), PDF_NAME(Page)))
+		return 0;
+	while (node && depth++ < 100)
+	{
+		pdf_obj *parent = pdf_dict_get(ctx, node, PDF_NAME(Parent));
+		if (!parent)
+			return node != page && pdf_to_num(ctx, node) == pdf_to_num(ctx, pages);
+		if (pdf_to_num(ctx, pdf_array_get(ctx, pdf_dict_get(ctx, parent, PDF_NAME(Kids)), 0)) != pdf_to_num(ctx, node))
+			return 0;
+		node = parent;
+	}
+	return 0;
+}
+
 pdf_page *
 pdf_load_page(fz_context *ctx, pdf_document *doc, int number)
 {
@@ -1107,6 +1135,8 @@ pdf_load_page(fz_context *ctx, pdf_document *doc, int number)
 		if (pageobj == NULL)
 			fz_throw(ctx, FZ_ERROR_TRYLATER, "page %d not available yet", number);
 	}
+	else if (doc->deferred_xref_ofs && number == 0 && pdf_is_first_page_obj(ctx, doc, doc->linear_page_refs[0]))
+		pageobj = doc->linear_page_refs[0];
 	else
 		pageobj = pdf_lookup_page_obj(ctx, doc, number);
 
@@ -331,6 +331,7 @@ pdf_repair_xref(fz_context *ctx, pdf_document *doc)
 	doc->repair_attempted = 1;
 
 	doc->dirty = 1;
+	doc->edit_count++;
 
 	pdf_forget_xref(ctx, doc);
 
@@ -325,6 +325,46 @@ pdf_open_raw_filter(fz_context *ctx, fz_stream *file_stm, pdf_document *doc, pdf
 	return null_stm;
 }
 
+/*
+ * The flate filter decodes much faster when it is given all of the
+ * compressed data at once, so read flate streams of moderate size
+ * into memory before decoding them.
+ */
+#define MAX_BUFFERED_FLATE (16 << 20)
+
+static fz_stream *
+pdf_buffer_flate_filter(fz_context *ctx, fz_stream *rstm, pdf_document *doc, pdf_obj *stmobj, int num, pdf_obj *filters)
+{
+	pdf_obj *first = pdf_is_array(ctx, filters) ? pdf_array_get(ctx, filters, 0) : filters;
+	int len = pdf_dict_get_int(ctx, stmobj, PDF_NAME(Length));
+	fz_buffer *buf;
+	fz_stream *stm;
+
+	if (!pdf_name_eq(ctx, first, PDF_NAME(FlateDecode)) && !pdf_name_eq(ctx, first, PDF_NAME(Fl)))
+		return rstm;
+	if (len <= 0 || len > MAX_BUFFERED_FLATE)
+		return rstm;
+	if (num > 0 && num < pdf_xref_len(ctx, doc) && pdf_get_xref_entry(ctx, doc, num)->stm_buf)
+		return rstm;
+
+	fz_try(ctx)
+	{
+		buf = fz_read_all(ctx, rstm, len + 1);
+		fz_try(ctx)
+			stm = fz_open_buffer(ctx, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, rstm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return stm;
+}
+
 /*
  * Construct a filter to decode a stream, constraining
  * to stream length and decrypting.
@@ -338,6 +378,8 @@ pdf_open_filter(fz_context *ctx, pdf_document *doc, fz_stream *file_stm, pdf_obj
 	fz_stream *rstm, *fstm;
 
 	rstm = pdf_open_raw_filter(ctx, file_stm, doc, stmobj, num, &orig_num, &orig_gen, offset);
+	if (!imparams)
+		rstm = pdf_buffer_flate_filter(ctx, rstm, doc, stmobj, num, filters);
 	fz_try(ctx)
 	{
 		if (pdf_is_name(ctx, filters))
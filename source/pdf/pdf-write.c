@@ -14,12 +14,17 @@
 
 #define SIG_EXTRAS_SIZE (1024)
 
+/* Limits on the streams deflated in parallel ahead of the write cursor. */
+#define DEFLATE_AHEAD_BUDGET (64 << 20)
+#define DEFLATE_AHEAD_PER_THREAD 4
+
 #define SLASH_BYTE_RANGE ("/ByteRange")
 #define SLASH_CONTENTS ("/Contents")
 #define SLASH_FILTER ("/Filter")
 
 
 typedef struct pdf_write_state_s pdf_write_state;
+typedef struct stream_job_s stream_job;
 
 /*
 	As part of linearization, we need to keep a list of what objects are used
@@ -105,6 +110,15 @@ struct pdf_write_state_s
 	char upwd_utf8[128];
 	int permissions;
 	pdf_crypt *crypt;
+
+	/* Streams deflated ahead of the write cursor (see deflate_ahead) */
+	int ahead_from;
+	int ahead_to;
+	int ahead_cap;
+	int ahead_len;
+	int ahead_pos;
+	stream_job *ahead;
+	void **ahead_args;
 };
 
 /*
@@ -668,103 +682,266 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pd
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Scan for and remove duplicate objects.
+ *
+ * Every object is reduced to an MD5 digest of a canonical serialisation
+ * and looked up in a table of the digests of the objects preceding it,
+ * so the scan is linear in the number of objects. Candidates are always
+ * confirmed with pdf_objcmp (and a comparison of the raw stream data)
+ * before being merged, so digest collisions can never merge objects that
+ * differ.
+ *
+ * Stream data is only digested once a second stream with an identical
+ * dictionary turns up, so files without duplicate streams never need to
+ * load their streams here.
  */
 
+static void digest_obj_imp(fz_context *ctx, fz_md5 *state, pdf_obj *obj)
+{
+	unsigned char tag;
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+	{
+		int ref[2];
+		ref[0] = pdf_to_num(ctx, obj);
+		ref[1] = pdf_to_gen(ctx, obj);
+		tag = 'R';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)ref, sizeof ref);
+	}
+	else if (pdf_is_null(ctx, obj))
+	{
+		tag = 'n';
+		fz_md5_update(state, &tag, 1);
+	}
+	else if (pdf_is_bool(ctx, obj))
+	{
+		tag = pdf_to_bool(ctx, obj) ? 't' : 'f';
+		fz_md5_update(state, &tag, 1);
+	}
+	else if (pdf_is_int(ctx, obj))
+	{
+		int64_t i64 = pdf_to_int64(ctx, obj);
+		tag = 'i';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)&i64, sizeof i64);
+	}
+	else if (pdf_is_real(ctx, obj))
+	{
+		/* pdf_objcmp considers 0 and -0 equal, so they must digest the same. */
+		float f = pdf_to_real(ctx, obj);
+		if (f == 0)
+			f = 0;
+		tag = 'r';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)&f, sizeof f);
+	}
+	else if (pdf_is_name(ctx, obj))
+	{
+		const char *s = pdf_to_name(ctx, obj);
+		tag = '/';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (const unsigned char *)s, strlen(s) + 1);
+	}
+	else if (pdf_is_string(ctx, obj))
+	{
+		size_t len = pdf_to_str_len(ctx, obj);
+		tag = '(';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)&len, sizeof len);
+		fz_md5_update(state, (unsigned char *)pdf_to_str_buf(ctx, obj), len);
+	}
+	else if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		tag = '[';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)&n, sizeof n);
+		for (i = 0; i < n; i++)
+			digest_obj_imp(ctx, state, pdf_array_get(ctx, obj, i));
+	}
+	else if (pdf_is_dict(ctx, obj))
+	{
+		/* pdf_objcmp compares dictionary entries in order, so we do too. */
+		n = pdf_dict_len(ctx, obj);
+		tag = '<';
+		fz_md5_update(state, &tag, 1);
+		fz_md5_update(state, (unsigned char *)&n, sizeof n);
+		for (i = 0; i < n; i++)
+		{
+			digest_obj_imp(ctx, state, pdf_dict_get_key(ctx, obj, i));
+			digest_obj_imp(ctx, state, pdf_dict_get_val(ctx, obj, i));
+		}
+	}
+}
+
+static void digest_obj(fz_context *ctx, pdf_obj *obj, int is_stream, unsigned char digest[16])
+{
+	fz_md5 state;
+	unsigned char tag = is_stream ? 'S' : 'O';
+	fz_md5_init(&state);
+	fz_md5_update(&state, &tag, 1);
+	digest_obj_imp(ctx, &state, obj);
+	fz_md5_final(&state, digest);
+}
+
+/* Combine the digest of a stream dictionary with a digest of its raw data. */
+static void digest_stream_data(fz_context *ctx, pdf_document *doc, int num, const unsigned char dict_digest[16], unsigned char digest[16])
+{
+	fz_buffer *buf = pdf_load_raw_stream_number(ctx, doc, num);
+	unsigned char *data;
+	size_t len;
+	fz_md5 state;
+
+	len = fz_buffer_storage(ctx, buf, &data);
+	fz_md5_init(&state);
+	fz_md5_update(&state, dict_digest, 16);
+	fz_md5_update(&state, data, len);
+	fz_md5_final(&state, digest);
+	fz_drop_buffer(ctx, buf);
+}
+
+static int streams_are_equal(fz_context *ctx, pdf_document *doc, int a, int b)
+{
+	fz_buffer *sa = NULL;
+	fz_buffer *sb = NULL;
+	unsigned char *dataa, *datab;
+	size_t lena, lenb;
+	int equal = 0;
+
+	fz_var(sa);
+	fz_var(sb);
+
+	fz_try(ctx)
+	{
+		sa = pdf_load_raw_stream_number(ctx, doc, a);
+		sb = pdf_load_raw_stream_number(ctx, doc, b);
+		lena = fz_buffer_storage(ctx, sa, &dataa);
+		lenb = fz_buffer_storage(ctx, sb, &datab);
+		equal = (lena == lenb && memcmp(dataa, datab, lena) == 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return equal;
+}
+
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
 {
-	int num, other, max_num;
+	fz_hash_table *objs = NULL;
+	fz_hash_table *stream_dicts = NULL;
+	int num, other, first, max_num;
 	int xref_len = pdf_xref_len(ctx, doc);
 
-	for (num = 1; num < xref_len; num++)
+	fz_var(objs);
+	fz_var(stream_dicts);
+
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		/* Maps object digests to the lowest numbered object with that digest. */
+		objs = fz_new_hash_table(ctx, 4096, 16, -1, NULL);
+
+		/* Maps stream dictionary digests to the first stream seen with that
+		 * dictionary. The number is negated once the data of that first
+		 * stream has been digested and entered into objs. */
+		stream_dicts = fz_new_hash_table(ctx, 1024, 16, -1, NULL);
+
+		for (num = 1; num < xref_len; num++)
 		{
+			unsigned char dict_digest[16];
+			unsigned char digest[16];
 			pdf_obj *a, *b;
-			int newnum, streama = 0, streamb = 0, differ = 0;
+			int is_stream;
 
-			if (num == other || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
 
 			/* TODO: resolve indirect references to see if we can omit them */
 
 			/*
-			 * Comparing stream objects data contents would take too long.
-			 *
 			 * pdf_obj_num_is_stream calls pdf_cache_object and ensures
 			 * that the xref table has the objects loaded.
 			 */
 			fz_try(ctx)
 			{
-				streama = pdf_obj_num_is_stream(ctx, doc, num);
-				streamb = pdf_obj_num_is_stream(ctx, doc, other);
-				differ = streama || streamb;
-				if (streama && streamb && opts->do_garbage >= 4)
-					differ = 0;
+				is_stream = pdf_obj_num_is_stream(ctx, doc, num);
+				a = pdf_get_xref_entry(ctx, doc, num)->obj;
+				if (!is_stream)
+				{
+					digest_obj(ctx, a, 0, digest);
+					other = (int)(intptr_t)fz_hash_find(ctx, objs, digest);
+				}
+				else
+				{
+					digest_obj(ctx, a, 1, dict_digest);
+					first = (int)(intptr_t)fz_hash_find(ctx, stream_dicts, dict_digest);
+					if (first == 0)
+					{
+						/* No other stream has this dictionary, so this one
+						 * can't be a duplicate. Leave its data alone until
+						 * another stream with the same dictionary shows up. */
+						fz_hash_insert(ctx, stream_dicts, dict_digest, (void *)(intptr_t)num);
+						other = -1;
+					}
+					else
+					{
+						if (first > 0)
+						{
+							unsigned char first_digest[16];
+							digest_stream_data(ctx, doc, first, dict_digest, first_digest);
+							if (!fz_hash_find(ctx, objs, first_digest))
+								fz_hash_insert(ctx, objs, first_digest, (void *)(intptr_t)first);
+							fz_hash_remove(ctx, stream_dicts, dict_digest);
+							fz_hash_insert(ctx, stream_dicts, dict_digest, (void *)(intptr_t)-first);
+						}
+						digest_stream_data(ctx, doc, num, dict_digest, digest);
+						other = (int)(intptr_t)fz_hash_find(ctx, objs, digest);
+					}
+				}
 			}
 			fz_catch(ctx)
 			{
 				/* Assume different */
-				differ = 1;
+				other = -1;
 			}
-			if (differ)
+			if (other < 0)
 				continue;
 
-			a = pdf_get_xref_entry(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry(ctx, doc, other)->obj;
+			if (other == 0)
+			{
+				fz_hash_insert(ctx, objs, digest, (void *)(intptr_t)num);
+				continue;
+			}
 
+			/* Make sure this isn't just a digest collision. */
+			b = pdf_get_xref_entry(ctx, doc, other)->obj;
 			if (pdf_objcmp(ctx, a, b))
 				continue;
-
-			if (streama && streamb)
-			{
-				/* Check to see if streams match too. */
-				fz_buffer *sa = NULL;
-				fz_buffer *sb = NULL;
-
-				fz_var(sa);
-				fz_var(sb);
-
-				differ = 1;
-				fz_try(ctx)
-				{
-					unsigned char *dataa, *datab;
-					size_t lena, lenb;
-					sa = pdf_load_raw_stream_number(ctx, doc, num);
-					sb = pdf_load_raw_stream_number(ctx, doc, other);
-					lena = fz_buffer_storage(ctx, sa, &dataa);
-					lenb = fz_buffer_storage(ctx, sb, &datab);
-					if (lena == lenb && memcmp(dataa, datab, lena) == 0)
-						differ = 0;
-				}
-				fz_always(ctx)
-				{
-					fz_drop_buffer(ctx, sa);
-					fz_drop_buffer(ctx, sb);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow(ctx);
-				}
-				if (differ)
-					continue;
-			}
+			if (is_stream && !streams_are_equal(ctx, doc, num, other))
+				continue;
 
 			/* Keep the lowest numbered object */
-			newnum = fz_mini(num, other);
 			max_num = fz_maxi(num, other);
 			if (max_num >= opts->list_len)
 				expand_lists(ctx, opts, max_num);
-			opts->renumber_map[num] = newnum;
-			opts->renumber_map[other] = newnum;
-			opts->rev_renumber_map[newnum] = num; /* Either will do */
-			opts->use_list[fz_maxi(num, other)] = 0;
-
-			/* One duplicate was found, do not look for another */
-			break;
+			opts->renumber_map[num] = other;
+			opts->rev_renumber_map[other] = num; /* Either will do */
+			opts->use_list[num] = 0;
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_drop_hash_table(ctx, objs);
+		fz_drop_hash_table(ctx, stream_dicts);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 /*
@@ -1747,111 +1924,93 @@ static void write_data(fz_context *ctx, void *arg, const unsigned char *data, si
 	fz_write_data(ctx, (fz_output *)arg, data, len);
 }
 
-static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+/*
+ * Streams are written in three steps: the data is loaded and the
+ * dictionary adjusted (prepare_stream), the data is deflated if
+ * required (deflate_stream), and the result is written out
+ * (write_stream). Only the middle step is free of any document
+ * access, so when the context has a job runner we deflate a window
+ * of streams ahead of the write cursor in parallel (deflate_ahead).
+ */
+
+struct stream_job_s
 {
-	fz_buffer *tmp_unhex = NULL, *tmp_flate = NULL, *tmp_hex = NULL, *buf = NULL;
-	pdf_obj *obj = NULL;
-	size_t len;
-	unsigned char *data;
+	int num;
+	int do_deflate;
+	pdf_obj *obj;
+	fz_buffer *buf;
+	fz_buffer *flate;
+};
 
-	fz_var(buf);
-	fz_var(tmp_flate);
-	fz_var(tmp_hex);
-	fz_var(obj);
+static void drop_stream_job(fz_context *ctx, stream_job *job)
+{
+	pdf_drop_obj(ctx, job->obj);
+	fz_drop_buffer(ctx, job->buf);
+	fz_drop_buffer(ctx, job->flate);
+	memset(job, 0, sizeof *job);
+}
 
-	fz_try(ctx)
-	{
-		buf = pdf_load_raw_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
+static void prepare_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj_orig, int num, int do_deflate, int do_expand, stream_job *job)
+{
+	fz_buffer *tmp_unhex;
+	unsigned char *data;
+	size_t len;
 
-		len = fz_buffer_storage(ctx, buf, &data);
+	job->num = num;
+	job->obj = pdf_copy_dict(ctx, obj_orig);
 
-		if (do_deflate && striphexfilter(ctx, doc, obj))
+	if (do_expand)
+	{
+		job->buf = pdf_load_stream_number(ctx, doc, num);
+		pdf_dict_del(ctx, job->obj, PDF_NAME(Filter));
+		pdf_dict_del(ctx, job->obj, PDF_NAME(DecodeParms));
+		job->do_deflate = do_deflate;
+	}
+	else
+	{
+		job->buf = pdf_load_raw_stream_number(ctx, doc, num);
+		if (do_deflate && striphexfilter(ctx, doc, job->obj))
 		{
+			len = fz_buffer_storage(ctx, job->buf, &data);
 			tmp_unhex = unhexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_unhex, &data);
-		}
-
-		if (do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter)))
-		{
-			size_t clen;
-			unsigned char *cdata;
-			tmp_flate = deflatebuf(ctx, data, len);
-			clen = fz_buffer_storage(ctx, tmp_flate, &cdata);
-			if (clen < len)
-			{
-				len = clen;
-				data = cdata;
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
-			}
+			fz_drop_buffer(ctx, job->buf);
+			job->buf = tmp_unhex;
 		}
+		job->do_deflate = do_deflate && !pdf_dict_get(ctx, job->obj, PDF_NAME(Filter));
+	}
+}
 
-		if (opts->do_ascii && isbinarystream(ctx, data, len))
-		{
-			tmp_hex = hexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_hex, &data);
-			addhexfilter(ctx, doc, obj);
-		}
-
-		fz_write_printf(ctx, opts->out, "%d %d obj\n", num, gen);
-
-		if (unenc)
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), len);
-			pdf_print_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			fz_write_data(ctx, opts->out, data, len);
-		}
-		else
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
-			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
-		}
+static void deflate_stream(fz_context *ctx, stream_job *job)
+{
+	unsigned char *data;
+	size_t len;
 
-		fz_write_string(ctx, opts->out, "\nendstream\nendobj\n\n");
-	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, tmp_unhex);
-		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_flate);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
-	}
-	fz_catch(ctx)
+	if (job->do_deflate)
 	{
-		fz_rethrow(ctx);
+		len = fz_buffer_storage(ctx, job->buf, &data);
+		job->flate = deflatebuf(ctx, data, len);
 	}
 }
 
-static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+static void write_stream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, stream_job *job, int gen, int unenc)
 {
-	fz_buffer *buf = NULL, *tmp_flate = NULL, *tmp_hex = NULL;
-	pdf_obj *obj = NULL;
+	fz_buffer *tmp_hex = NULL;
+	pdf_obj *obj = job->obj;
+	int num = job->num;
 	size_t len;
 	unsigned char *data;
 
-	fz_var(buf);
-	fz_var(tmp_flate);
 	fz_var(tmp_hex);
-	fz_var(obj);
 
 	fz_try(ctx)
 	{
-		buf = pdf_load_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
-		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
-		pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
+		len = fz_buffer_storage(ctx, job->buf, &data);
 
-		len = fz_buffer_storage(ctx, buf, &data);
-		if (do_deflate)
+		if (job->flate)
 		{
-			unsigned char *cdata;
 			size_t clen;
-			tmp_flate = deflatebuf(ctx, data, len);
-			clen = fz_buffer_storage(ctx, tmp_flate, &cdata);
+			unsigned char *cdata;
+			clen = fz_buffer_storage(ctx, job->flate, &cdata);
 			if (clen < len)
 			{
 				len = clen;
@@ -1878,7 +2037,7 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 		}
 		else
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, (int)len));
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
 			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
 			fz_write_string(ctx, opts->out, "\nstream\n");
 			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
@@ -1889,9 +2048,6 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 	fz_always(ctx)
 	{
 		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_flate);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
 	{
@@ -1989,16 +2145,157 @@ static int is_xml_metadata(fz_context *ctx, pdf_obj *obj)
 	return 0;
 }
 
+static void get_stream_mode(fz_context *ctx, pdf_write_state *opts, pdf_obj *obj, int *do_deflate, int *do_expand)
+{
+	*do_deflate = opts->do_compress;
+	*do_expand = opts->do_expand;
+	if (opts->do_compress_images && is_image_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (opts->do_compress_fonts && is_font_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (is_xml_metadata(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (is_jpx_stream(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+}
+
+/* Would writing this stream deflate its data? (see prepare_stream) */
+static int stream_will_deflate(fz_context *ctx, pdf_obj *obj, int do_deflate, int do_expand)
+{
+	pdf_obj *f;
+	int n;
+
+	if (!do_deflate || do_expand)
+		return do_deflate;
+
+	f = pdf_dict_get(ctx, obj, PDF_NAME(Filter));
+	if (pdf_is_array(ctx, f))
+	{
+		n = pdf_array_len(ctx, f);
+		if (n > 0 && pdf_array_get(ctx, f, 0) == PDF_NAME(ASCIIHexDecode))
+			n--;
+		return n == 0;
+	}
+	return f == NULL || f == PDF_NAME(ASCIIHexDecode);
+}
+
+static void drop_deflated_ahead(fz_context *ctx, pdf_write_state *opts)
+{
+	int i;
+
+	for (i = 0; i < opts->ahead_len; i++)
+		drop_stream_job(ctx, &opts->ahead[i]);
+	opts->ahead_len = 0;
+	opts->ahead_pos = 0;
+	opts->ahead_from = 0;
+	opts->ahead_to = 0;
+}
+
+static void deflate_stream_job(fz_context *ctx, void *job)
+{
+	deflate_stream(ctx, job);
+}
+
+/*
+ * Load the streams between object number num and end that will need
+ * deflating when written, and deflate them as a batch of jobs. We stop
+ * once we hold DEFLATE_AHEAD_BUDGET bytes of stream data, or have
+ * DEFLATE_AHEAD_PER_THREAD streams for each thread.
+ *
+ * The checks mirror the ones dowriteobject and writeobject make to
+ * decide how to write each object.
+ */
+static void deflate_ahead(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int end)
+{
+	int threads = fz_job_threads(ctx);
+	size_t budget = 0;
+	pdf_obj *obj = NULL;
+	int do_deflate, do_expand;
+
+	if (threads < 2 || (num >= opts->ahead_from && num < opts->ahead_to))
+		return;
+
+	drop_deflated_ahead(ctx, opts);
+
+	if (opts->ahead == NULL)
+	{
+		opts->ahead_cap = threads * DEFLATE_AHEAD_PER_THREAD;
+		opts->ahead = fz_calloc(ctx, opts->ahead_cap, sizeof *opts->ahead);
+		opts->ahead_args = fz_calloc(ctx, opts->ahead_cap, sizeof *opts->ahead_args);
+	}
+
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		opts->ahead_from = num;
+		for (; num < end && opts->ahead_len < opts->ahead_cap && budget < DEFLATE_AHEAD_BUDGET; num++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, num);
+			pdf_obj *type;
+
+			if (opts->do_garbage && !opts->use_list[num])
+				continue;
+			if (entry->type != 'n' && entry->type != 'o')
+				continue;
+			if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+				continue;
+			if (!pdf_obj_num_is_stream(ctx, doc, num))
+				continue;
+
+			obj = pdf_load_object(ctx, doc, num);
+			type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
+			if (type != PDF_NAME(ObjStm) && type != PDF_NAME(XRef))
+			{
+				get_stream_mode(ctx, opts, obj, &do_deflate, &do_expand);
+				if (stream_will_deflate(ctx, obj, do_deflate, do_expand))
+				{
+					stream_job *job = &opts->ahead[opts->ahead_len++];
+					prepare_stream(ctx, doc, obj, num, do_deflate, do_expand, job);
+					opts->ahead_args[opts->ahead_len-1] = job;
+					budget += fz_buffer_storage(ctx, job->buf, NULL);
+				}
+			}
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+		}
+		opts->ahead_to = num;
+
+		fz_run_jobs(ctx, opts->ahead_len, deflate_stream_job, opts->ahead_args);
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, obj);
+	fz_catch(ctx)
+	{
+		drop_deflated_ahead(ctx, opts);
+		fz_rethrow(ctx);
+	}
+}
+
+/* Take the stream for object num out of the deflated ahead window, if it is there. */
+static int take_deflated_ahead(fz_context *ctx, pdf_write_state *opts, int num, stream_job *job)
+{
+	while (opts->ahead_pos < opts->ahead_len && opts->ahead[opts->ahead_pos].num < num)
+		drop_stream_job(ctx, &opts->ahead[opts->ahead_pos++]);
+	if (opts->ahead_pos < opts->ahead_len && opts->ahead[opts->ahead_pos].num == num)
+	{
+		*job = opts->ahead[opts->ahead_pos];
+		memset(&opts->ahead[opts->ahead_pos++], 0, sizeof *job);
+		return 1;
+	}
+	return 0;
+}
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int gen, int skip_xrefs, int unenc)
 {
 	pdf_obj *obj = NULL;
-	fz_buffer *buf = NULL;
+	stream_job job = { 0 };
 	int do_deflate = 0;
 	int do_expand = 0;
 	int skip = 0;
 
 	fz_var(obj);
-	fz_var(buf);
+	fz_var(job);
 
 	if (opts->do_encrypt == PDF_ENCRYPT_NONE)
 		unenc = 1;
@@ -2027,21 +2324,13 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		{
 			if (pdf_obj_num_is_stream(ctx, doc, num))
 			{
-				do_deflate = opts->do_compress;
-				do_expand = opts->do_expand;
-				if (opts->do_compress_images && is_image_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (opts->do_compress_fonts && is_font_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (is_xml_metadata(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-				if (is_jpx_stream(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-
-				if (do_expand)
-					expandstream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
-				else
-					copystream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
+				if (!take_deflated_ahead(ctx, opts, num, &job))
+				{
+					get_stream_mode(ctx, opts, obj, &do_deflate, &do_expand);
+					prepare_stream(ctx, doc, obj, num, do_deflate, do_expand, &job);
+					deflate_stream(ctx, &job);
+				}
+				write_stream(ctx, doc, opts, &job, gen, unenc);
 			}
 			else
 			{
@@ -2053,7 +2342,7 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 	}
 	fz_always(ctx)
 	{
-		fz_drop_buffer(ctx, buf);
+		drop_stream_job(ctx, &job);
 		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
@@ -2349,6 +2638,14 @@ dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num
 		opts->use_list[num] = 0;
 }
 
+static void
+writeheader(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
+{
+	int version = pdf_version(ctx, doc);
+	fz_write_printf(ctx, opts->out, "%%PDF-%d.%d\n", version / 10, version % 10);
+	fz_write_string(ctx, opts->out, "%\xC2\xB5\xC2\xB6\n\n");
+}
+
 static void
 writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass)
 {
@@ -2356,11 +2653,7 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	int xref_len = pdf_xref_len(ctx, doc);
 
 	if (!opts->do_incremental)
-	{
-		int version = pdf_version(ctx, doc);
-		fz_write_printf(ctx, opts->out, "%%PDF-%d.%d\n", version / 10, version % 10);
-		fz_write_string(ctx, opts->out, "%\xC2\xB5\xC2\xB6\n\n");
-	}
+		writeheader(ctx, doc, opts);
 
 	dowriteobject(ctx, doc, opts, opts->start, pass);
 
@@ -2375,7 +2668,10 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	}
 
 	for (num = opts->start+1; num < xref_len; num++)
+	{
+		deflate_ahead(ctx, doc, opts, num, xref_len);
 		dowriteobject(ctx, doc, opts, num, pass);
+	}
 	if (opts->do_linear && pass == 1)
 	{
 		int64_t offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
@@ -2385,8 +2681,10 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	{
 		if (pass == 1)
 			opts->ofs_list[num] += opts->hintstream_len;
+		deflate_ahead(ctx, doc, opts, num, opts->start);
 		dowriteobject(ctx, doc, opts, num, pass);
 	}
+	drop_deflated_ahead(ctx, opts);
 }
 
 static int
@@ -2961,6 +3259,9 @@ static void finalise_write_state(fz_context *ctx, pdf_write_state *opts)
 	pdf_drop_obj(ctx, opts->hints_s);
 	pdf_drop_obj(ctx, opts->hints_length);
 	page_objects_list_destroy(ctx, opts->page_object_lists);
+	drop_deflated_ahead(ctx, opts);
+	fz_free(ctx, opts->ahead);
+	fz_free(ctx, opts->ahead_args);
 }
 
 const pdf_write_options pdf_default_write_options = {
@@ -2976,6 +3277,7 @@ const pdf_write_options pdf_default_write_options = {
 	0, /* do_clean */
 	0, /* do_sanitize */
 	0, /* do_appearance */
+	0, /* do_stream */
 	0, /* do_encrypt */
 	~0, /* permissions */
 	"", /* opwd_utf8[128] */
@@ -2995,6 +3297,7 @@ const char *fz_pdf_write_options_usage =
 	"\tsanitize: sanitize graphics commands in content streams\n"
 	"\tgarbage: garbage collect unused objects\n"
 	"\tincremental: write changes as incremental update\n"
+	"\tstream: write pages out as they are completed (merge and create only)\n"
 	"\tcontinue-on-error: continue saving the document even if there is an error\n"
 	"\tor garbage=compact: ... and compact cross reference table\n"
 	"\tor garbage=deduplicate: ... and remove duplicate objects\n"
@@ -3043,6 +3346,8 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_sanitize = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "incremental", &val))
 		opts->do_incremental = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "stream", &val))
+		opts->do_stream = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "decrypt", &val))
 		opts->do_encrypt = fz_option_eq(val, "yes") ? PDF_ENCRYPT_NONE : PDF_ENCRYPT_KEEP;
 	if (fz_has_option(ctx, args, "encrypt", &val))
@@ -3216,6 +3521,39 @@ create_encryption_dictionary(fz_context *ctx, pdf_document *doc, pdf_crypt *cryp
 	}
 }
 
+static void
+prepare_encryption(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
+{
+	pdf_obj *id, *id1;
+
+	/* Update second half of ID array if it exists. */
+	id = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(ID));
+	if (id)
+		change_identity(ctx, doc, id);
+
+	/* Remove encryption dictionary if saving without encryption. */
+	if (opts->do_encrypt == PDF_ENCRYPT_NONE)
+	{
+		pdf_dict_del(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt));
+	}
+
+	/* Keep encryption dictionary if saving with old encryption. */
+	else if (opts->do_encrypt == PDF_ENCRYPT_KEEP)
+	{
+		opts->crypt = doc->crypt;
+	}
+
+	/* Create encryption dictionary if saving with new encryption. */
+	else
+	{
+		if (!id)
+			id = new_identity(ctx, doc);
+		id1 = pdf_array_get(ctx, id, 0);
+		opts->crypt = pdf_new_encrypt(ctx, opts->opwd_utf8, opts->upwd_utf8, id1, opts->permissions, opts->do_encrypt);
+		create_encryption_dictionary(ctx, doc, opts->crypt);
+	}
+}
+
 static void
 ensure_initial_incremental_contents(fz_context *ctx, fz_stream *in, fz_output *out)
 {
@@ -3272,13 +3610,30 @@ ensure_initial_incremental_contents(fz_context *ctx, fz_stream *in, fz_output *o
 		fz_rethrow(ctx);
 }
 
+/* Construct linked list of free object slots */
+static void
+link_free_objects(pdf_write_state *opts, int xref_len)
+{
+	int num, lastfree = 0;
+
+	for (num = 0; num < xref_len; num++)
+	{
+		if (!opts->use_list[num])
+		{
+			opts->gen_list[num]++;
+			opts->ofs_list[lastfree] = num;
+			lastfree = num;
+		}
+	}
+}
+
 static void
 do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_write_options *in_opts)
 {
-	int lastfree;
 	int num;
 	int xref_len;
-	pdf_obj *id, *id1;
+
+	pdf_load_deferred_xref(ctx, doc);
 
 	if (in_opts->do_incremental)
 	{
@@ -3300,39 +3655,16 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 	fz_try(ctx)
 	{
 		initialise_write_state(ctx, doc, in_opts, opts);
+		prepare_encryption(ctx, doc, opts);
 
-		/* Update second half of ID array if it exists. */
-		id = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(ID));
-		if (id)
-			change_identity(ctx, doc, id);
-
-		/* Remove encryption dictionary if saving without encryption. */
-		if (opts->do_encrypt == PDF_ENCRYPT_NONE)
-		{
-			pdf_dict_del(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt));
-		}
-
-		/* Keep encryption dictionary if saving with old encryption. */
-		else if (opts->do_encrypt == PDF_ENCRYPT_KEEP)
-		{
-			opts->crypt = doc->crypt;
-		}
-
-		/* Create encryption dictionary if saving with new encryption. */
-		else
-		{
-			if (!id)
-				id = new_identity(ctx, doc);
-			id1 = pdf_array_get(ctx, id, 0);
-			opts->crypt = pdf_new_encrypt(ctx, opts->opwd_utf8, opts->upwd_utf8, id1, opts->permissions, opts->do_encrypt);
-			create_encryption_dictionary(ctx, doc, opts->crypt);
-		}
-
-		/* Make sure any objects hidden in compressed streams have been loaded */
+		/* Renumbering moves objects around in the xref, so make sure any
+		 * objects hidden in compressed streams have been loaded first.
+		 * Otherwise they are loaded one at a time as they are written. */
 		if (!opts->do_incremental)
 		{
 			pdf_ensure_solid_xref(ctx, doc, xref_len);
-			preloadobjstms(ctx, doc);
+			if (opts->do_garbage >= 2 || opts->do_linear)
+				preloadobjstms(ctx, doc);
 			xref_len = pdf_xref_len(ctx, doc); /* May have changed due to repair */
 			expand_lists(ctx, opts, xref_len);
 		}
@@ -3426,17 +3758,7 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 			dump_object_details(ctx, doc, opts);
 #endif
 
-			/* Construct linked list of free object slots */
-			lastfree = 0;
-			for (num = 0; num < xref_len; num++)
-			{
-				if (!opts->use_list[num])
-				{
-					opts->gen_list[num]++;
-					opts->ofs_list[lastfree] = num;
-					lastfree = num;
-				}
-			}
+			link_free_objects(opts, xref_len);
 
 			if (opts->do_linear && opts->page_count > 0)
 			{
@@ -3620,6 +3942,185 @@ void pdf_save_document(fz_context *ctx, pdf_document *doc, const char *filename,
 	}
 }
 
+struct pdf_streaming_save_s
+{
+	pdf_document *doc;
+	pdf_write_state opts;
+	int held;
+	int next;
+};
+
+/*
+	Begin writing a document to an output progressively.
+
+	Objects that already exist in the document (such as the catalog
+	and the page tree root) are held back and written by
+	pdf_close_streaming_save, so they may be changed until then.
+	Every object created afterwards is written out and evicted from
+	memory by the next call to pdf_flush_streaming_save, so it must
+	be complete by that time. Loading or resolving an evicted object
+	afterwards throws an error.
+
+	This allows large documents to be assembled (for example by
+	merging many files) in bounded memory. Garbage collection,
+	linearization, content stream cleaning and incremental saving
+	all need the whole document at once, and are not supported.
+*/
+pdf_streaming_save *
+pdf_new_streaming_save(fz_context *ctx, pdf_document *doc, fz_output *out, pdf_write_options *in_opts)
+{
+	pdf_write_options opts_defaults = pdf_default_write_options;
+	pdf_streaming_save *save;
+
+	if (!in_opts)
+		in_opts = &opts_defaults;
+
+	if (in_opts->do_incremental)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't do incremental writes when streaming");
+	if (in_opts->do_garbage)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't garbage collect when streaming");
+	if (in_opts->do_linear)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't linearize when streaming");
+	if (in_opts->do_clean || in_opts->do_sanitize)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't clean content streams when streaming");
+	if (pdf_has_unsaved_sigs(ctx, doc))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't stream a document that has unsaved sigs");
+
+	save = fz_malloc_struct(ctx, pdf_streaming_save);
+	fz_try(ctx)
+	{
+		initialise_write_state(ctx, doc, in_opts, &save->opts);
+		save->opts.out = out;
+		prepare_encryption(ctx, doc, &save->opts);
+		save->opts.crypt_object_number = pdf_to_num(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt)));
+		writeheader(ctx, doc, &save->opts);
+		save->doc = pdf_keep_document(ctx, doc);
+		save->held = save->next = pdf_xref_len(ctx, doc);
+		doc->evicted_from = doc->evicted_to = save->held;
+	}
+	fz_catch(ctx)
+	{
+		finalise_write_state(ctx, &save->opts);
+		if (save->opts.crypt != doc->crypt)
+			pdf_drop_crypt(ctx, save->opts.crypt);
+		fz_free(ctx, save);
+		fz_rethrow(ctx);
+	}
+
+	return save;
+}
+
+static void
+evict_object(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_xref_entry *x = pdf_get_xref_entry(ctx, doc, num);
+
+	if (x->type == 'n')
+	{
+		pdf_drop_obj(ctx, x->obj);
+		x->obj = NULL;
+		fz_drop_buffer(ctx, x->stm_buf);
+		x->stm_buf = NULL;
+	}
+	doc->evicted_to = num + 1;
+}
+
+static void
+write_streaming_objects(fz_context *ctx, pdf_streaming_save *save, int from, int to, int evict)
+{
+	pdf_write_state *opts = &save->opts;
+	int num;
+
+	expand_lists(ctx, opts, pdf_xref_len(ctx, save->doc));
+
+	fz_try(ctx)
+	{
+		for (num = from; num < to; num++)
+		{
+			opts->use_list[num] = 1;
+			deflate_ahead(ctx, save->doc, opts, num, to);
+			dowriteobject(ctx, save->doc, opts, num, 0);
+			if (evict)
+				evict_object(ctx, save->doc, num);
+		}
+	}
+	fz_always(ctx)
+		drop_deflated_ahead(ctx, opts);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/*
+	Write out and evict every object created since the
+	previous flush.
+*/
+void
+pdf_flush_streaming_save(fz_context *ctx, pdf_streaming_save *save)
+{
+	int xref_len = pdf_xref_len(ctx, save->doc);
+
+	write_streaming_objects(ctx, save, save->next, xref_len, 1);
+	save->next = xref_len;
+}
+
+/*
+	Append a page previously created by pdf_add_page to the root
+	of the page tree, then write out and evict it along with every
+	other object created since the previous flush.
+
+	Only the root of the page tree is changed, so the pages already
+	written out are never looked at again.
+*/
+void
+pdf_add_streaming_page(fz_context *ctx, pdf_streaming_save *save, pdf_obj *page_ref)
+{
+	pdf_obj *pages = pdf_dict_getp(ctx, pdf_trailer(ctx, save->doc), "Root/Pages");
+	pdf_obj *kids = pdf_dict_get(ctx, pages, PDF_NAME(Kids));
+
+	if (!kids)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "malformed page tree");
+
+	pdf_array_push(ctx, kids, page_ref);
+	pdf_dict_put(ctx, page_ref, PDF_NAME(Parent), pages);
+	pdf_dict_put_int(ctx, pages, PDF_NAME(Count), pdf_array_len(ctx, kids));
+
+	pdf_flush_streaming_save(ctx, save);
+}
+
+/*
+	Write out any remaining objects followed by the xref
+	and trailer. The output is not closed.
+*/
+void
+pdf_close_streaming_save(fz_context *ctx, pdf_streaming_save *save)
+{
+	pdf_write_state *opts = &save->opts;
+	int xref_len;
+
+	pdf_flush_streaming_save(ctx, save);
+	write_streaming_objects(ctx, save, 0, save->held, 0);
+
+	xref_len = pdf_xref_len(ctx, save->doc);
+	link_free_objects(opts, xref_len);
+
+	opts->first_xref_offset = fz_tell_output(ctx, opts->out);
+	writexref(ctx, save->doc, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
+
+	save->doc->dirty = 0;
+}
+
+void
+pdf_drop_streaming_save(fz_context *ctx, pdf_streaming_save *save)
+{
+	if (!save)
+		return;
+	finalise_write_state(ctx, &save->opts);
+	if (save->opts.crypt != save->doc->crypt)
+		pdf_drop_crypt(ctx, save->opts.crypt);
+	pdf_drop_document(ctx, save->doc);
+	fz_free(ctx, save);
+}
+
 char *
 pdf_format_write_options(fz_context *ctx, char *buffer, size_t buffer_len, const pdf_write_options *opts)
 {
@@ -3647,6 +4148,8 @@ pdf_format_write_options(fz_context *ctx, char *buffer, size_t buffer_len, const
 		ADD_OPT("sanitize=yes");
 	if (opts->do_incremental)
 		ADD_OPT("incremental=yes");
+	if (opts->do_stream)
+		ADD_OPT("stream=yes");
 	if (opts->do_encrypt == PDF_ENCRYPT_NONE)
 		ADD_OPT("decrypt=yes");
 	else if (opts->do_encrypt == PDF_ENCRYPT_KEEP)
@@ -3734,6 +4237,7 @@ struct pdf_writer_s
 	pdf_document *pdf;
 	pdf_write_options opts;
 	fz_output *out;
+	pdf_streaming_save *save;
 
 	fz_rect mediabox;
 	pdf_obj *resources;
@@ -3760,7 +4264,10 @@ pdf_writer_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
 	{
 		fz_close_device(ctx, dev);
 		obj = pdf_add_page(ctx, wri->pdf, wri->mediabox, 0, wri->resources, wri->contents);
-		pdf_insert_page(ctx, wri->pdf, -1, obj);
+		if (wri->save)
+			pdf_add_streaming_page(ctx, wri->save, obj);
+		else
+			pdf_insert_page(ctx, wri->pdf, -1, obj);
 	}
 	fz_always(ctx)
 	{
@@ -3779,7 +4286,10 @@ static void
 pdf_writer_close_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	pdf_writer *wri = (pdf_writer*)wri_;
-	pdf_write_document(ctx, wri->pdf, wri->out, &wri->opts);
+	if (wri->save)
+		pdf_close_streaming_save(ctx, wri->save);
+	else
+		pdf_write_document(ctx, wri->pdf, wri->out, &wri->opts);
 	fz_close_output(ctx, wri->out);
 }
 
@@ -3789,6 +4299,7 @@ pdf_writer_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 	pdf_writer *wri = (pdf_writer*)wri_;
 	fz_drop_buffer(ctx, wri->contents);
 	pdf_drop_obj(ctx, wri->resources);
+	pdf_drop_streaming_save(ctx, wri->save);
 	pdf_drop_document(ctx, wri->pdf);
 	fz_drop_output(ctx, wri->out);
 }
@@ -3803,6 +4314,9 @@ fz_new_pdf_writer_with_output(fz_context *ctx, fz_output *out, const char *optio
 		pdf_parse_write_options(ctx, &wri->opts, options);
 		wri->out = out;
 		wri->pdf = pdf_create_document(ctx);
+
+		if (wri->opts.do_stream)
+			wri->save = pdf_new_streaming_save(ctx, wri->pdf, wri->out, &wri->opts);
 	}
 	fz_catch(ctx)
 	{
@@ -329,6 +329,9 @@ pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 */
 static void ensure_incremental_xref(fz_context *ctx, pdf_document *doc)
 {
+	/* Changes must go on top of the complete table */
+	pdf_load_deferred_xref(ctx, doc);
+
 	/* If there are as yet no incremental sections, or if the most recent
 	 * one has been used to sign a signature field, then we need a new one.
 	 * After a signing, any further document changes require a new increment */
@@ -453,6 +456,8 @@ int pdf_xref_obj_is_unsaved_signature(pdf_document *doc, pdf_obj *obj)
  * that covers the entire range. */
 void pdf_ensure_solid_xref(fz_context *ctx, pdf_document *doc, int num)
 {
+	pdf_load_deferred_xref(ctx, doc);
+
 	if (doc->num_xref_sections == 0)
 		pdf_populate_next_xref_level(ctx, doc);
 
@@ -1242,16 +1247,12 @@ pdf_prime_xref_index(fz_context *ctx, pdf_document *doc)
  */
 
 static void
-pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
+pdf_check_xref(fz_context *ctx, pdf_document *doc)
 {
 	int i;
 	int xref_len;
 	pdf_xref_entry *entry;
 
-	pdf_read_start_xref(ctx, doc);
-
-	pdf_read_xref_sections(ctx, doc, doc->startxref, buf, 1);
-
 	if (pdf_xref_len(ctx, doc) == 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "found xref was empty");
 
@@ -1295,6 +1296,16 @@ pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 	}
 }
 
+static void
+pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
+{
+	pdf_read_start_xref(ctx, doc);
+
+	pdf_read_xref_sections(ctx, doc, doc->startxref, buf, 1);
+
+	pdf_check_xref(ctx, doc);
+}
+
 static void
 pdf_check_linear(fz_context *ctx, pdf_document *doc)
 {
@@ -1381,13 +1392,117 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 	}
 }
 
+/*
+	Read only the first page cross reference section of a local
+	linearized file, and remember where the main section is so that
+	it can be read later by pdf_load_deferred_xref. Falls back to
+	normal loading if the file does not look suitable.
+*/
+static void
+pdf_load_first_page_xref(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *dict = NULL;
+	pdf_xref_entry *entry;
+	int num, gen;
+	int64_t stmofs, pos, main_ofs;
+
+	fz_var(dict);
+
+	pos = fz_tell(ctx, doc->file);
+	fz_seek(ctx, doc->file, 0, SEEK_END);
+	doc->file_size = fz_tell(ctx, doc->file);
+	fz_seek(ctx, doc->file, pos, SEEK_SET);
+
+	fz_try(ctx)
+	{
+		dict = pdf_parse_ind_obj(ctx, doc, doc->file, &doc->lexbuf.base, &num, &gen, &stmofs, NULL);
+		if (!pdf_is_dict(ctx, dict) || pdf_dict_get_int(ctx, dict, PDF_NAME(Linearized)) != 1)
+			break;
+		doc->has_linearization_object = 1;
+		if (pdf_dict_get_int(ctx, dict, PDF_NAME(L)) != doc->file_size)
+			break;
+		if (pdf_dict_get_int(ctx, dict, PDF_NAME(N)) <= 0)
+			break;
+
+		pdf_read_xref_sections(ctx, doc, fz_tell(ctx, doc->file), &doc->lexbuf.base, 0);
+		main_ofs = pdf_dict_get_int(ctx, pdf_trailer(ctx, doc), PDF_NAME(Prev));
+		if (main_ofs <= 0 || main_ofs >= doc->file_size || !pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root)))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "unexpected first page xref trailer");
+
+		pdf_prime_xref_index(ctx, doc);
+		entry = pdf_get_xref_entry(ctx, doc, 0);
+		entry->type = 'f';
+		entry->gen = 65535;
+		entry->num = 0;
+
+		doc->linear_page_count = pdf_dict_get_int(ctx, dict, PDF_NAME(N));
+		doc->linear_page_refs = fz_realloc_array(ctx, doc->linear_page_refs, doc->linear_page_count, pdf_obj *);
+		memset(doc->linear_page_refs, 0, doc->linear_page_count * sizeof(pdf_obj*));
+		doc->linear_page1_obj_num = pdf_dict_get_int(ctx, dict, PDF_NAME(O));
+		doc->linear_page_refs[0] = pdf_new_indirect(ctx, doc, doc->linear_page1_obj_num, 0);
+		doc->deferred_xref_ofs = main_ofs;
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, dict);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		/* Drop back to normal reading */
+		pdf_drop_xref_sections(ctx, doc);
+		if (doc->xref_index)
+			memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
+		doc->linear_page_count = 0;
+		doc->deferred_xref_ofs = 0;
+	}
+}
+
+/*
+	Finish loading the cross reference table of a document
+	opened with pdf_open_document_lazily. This happens
+	automatically as soon as an object that is not described by
+	the first page section is needed, but clients may call this
+	when idle (for example once the first page has been shown)
+	to avoid a pause later on. Does nothing if the whole table
+	has already been loaded.
+*/
+void
+pdf_load_deferred_xref(fz_context *ctx, pdf_document *doc)
+{
+	int64_t ofs = doc->deferred_xref_ofs;
+	int64_t pos;
+
+	if (ofs == 0)
+		return;
+	doc->deferred_xref_ofs = 0;
+
+	pos = fz_tell(ctx, doc->file);
+	fz_try(ctx)
+	{
+		pdf_read_start_xref(ctx, doc);
+		pdf_read_xref_sections(ctx, doc, ofs, &doc->lexbuf.base, 1);
+		pdf_check_xref(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "trying to repair broken xref");
+		pdf_drop_xref_sections(ctx, doc);
+		if (doc->xref_index)
+			memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
+		pdf_repair_xref(ctx, doc);
+		pdf_prime_xref_index(ctx, doc);
+		pdf_repair_obj_stms(ctx, doc);
+	}
+	fz_seek(ctx, doc->file, pos, SEEK_SET);
+}
+
 /*
  * Initialize and load xref tables.
  * If password is not null, try to decrypt.
  */
 
 static void
-pdf_init_document(fz_context *ctx, pdf_document *doc)
+pdf_init_document(fz_context *ctx, pdf_document *doc, int lazy)
 {
 	pdf_obj *encrypt, *id;
 	pdf_obj *dict = NULL;
@@ -1417,6 +1532,10 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		 * mode. */
 		if (doc->file_reading_linearly)
 			pdf_load_linear(ctx, doc);
+		else if (lazy)
+			/* Read just enough to show the first page of a local
+			 * linearized file. */
+			pdf_load_first_page_xref(ctx, doc);
 		else
 			/* Even if we're not in progressive mode, check to see
 			 * if the file claims to be linearized. This is important
@@ -1426,7 +1545,7 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* If we aren't in progressive mode (or the linear load failed
 		 * and has set us back to non-progressive mode), load normally.
 		 */
-		if (!doc->file_reading_linearly)
+		if (!doc->file_reading_linearly && !doc->deferred_xref_ofs)
 			pdf_load_xref(ctx, doc, &doc->lexbuf.base);
 	}
 	fz_catch(ctx)
@@ -1623,27 +1742,61 @@ pdf_keep_document(fz_context *ctx, pdf_document *doc)
 
 /*
  * compressed object streams
+ *
+ * The decoded contents and offset table of an object stream are kept
+ * in the store, so that objects can be parsed one at a time as they
+ * are needed rather than all at once.
  */
 
-static pdf_xref_entry *
-pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, int target)
+typedef struct
+{
+	fz_storable storable;
+	size_t size;
+	int count;
+	int64_t first;
+	int *num;
+	int64_t *ofs;
+	fz_buffer *data;
+} pdf_obj_stm_index;
+
+static void
+pdf_drop_obj_stm_index_imp(fz_context *ctx, fz_storable *index_)
 {
+	pdf_obj_stm_index *index = (pdf_obj_stm_index *)index_;
+
+	fz_drop_buffer(ctx, index->data);
+	fz_free(ctx, index->num);
+	fz_free(ctx, index->ofs);
+	fz_free(ctx, index);
+}
+
+static void
+pdf_drop_obj_stm_index(fz_context *ctx, pdf_obj_stm_index *index)
+{
+	fz_drop_storable(ctx, &index->storable);
+}
+
+static pdf_obj_stm_index *
+pdf_load_obj_stm_index(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf)
+{
+	pdf_obj_stm_index *index = NULL;
 	fz_stream *stm = NULL;
 	pdf_obj *objstm = NULL;
-	int *numbuf = NULL;
-	int64_t *ofsbuf = NULL;
-
-	pdf_obj *obj;
+	pdf_obj *ref;
 	int64_t first;
 	int count;
 	int i;
 	pdf_token tok;
-	pdf_xref_entry *ret_entry = NULL;
 	int xref_len;
-	int found;
 
-	fz_var(numbuf);
-	fz_var(ofsbuf);
+	ref = pdf_new_indirect(ctx, doc, num, 0);
+	if ((index = pdf_find_item(ctx, pdf_drop_obj_stm_index_imp, ref)) != NULL)
+	{
+		pdf_drop_obj(ctx, ref);
+		return index;
+	}
+
+	fz_var(index);
 	fz_var(objstm);
 	fz_var(stm);
 
@@ -1657,6 +1810,7 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	fz_catch(ctx)
 	{
 		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj(ctx, ref);
 		fz_rethrow(ctx);
 	}
 
@@ -1674,86 +1828,106 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 				|| first + count - 1 > PDF_MAX_OBJECT_NUMBER)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "object stream object numbers are out of range");
 
-		numbuf = fz_calloc(ctx, count, sizeof(*numbuf));
-		ofsbuf = fz_calloc(ctx, count, sizeof(*ofsbuf));
+		index = fz_malloc_struct(ctx, pdf_obj_stm_index);
+		FZ_INIT_STORABLE(index, 1, pdf_drop_obj_stm_index_imp);
+		index->count = count;
+		index->first = first;
+		index->num = fz_calloc(ctx, count, sizeof(*index->num));
+		index->ofs = fz_calloc(ctx, count, sizeof(*index->ofs));
+		index->data = pdf_load_stream_number(ctx, doc, num);
 
 		xref_len = pdf_xref_len(ctx, doc);
 
-		found = 0;
-
-		stm = pdf_open_stream_number(ctx, doc, num);
+		stm = fz_open_buffer(ctx, index->data);
 		for (i = 0; i < count; i++)
 		{
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d 0 R)", num);
-			numbuf[found] = buf->i;
+			index->num[i] = buf->i;
 
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d 0 R)", num);
-			ofsbuf[found] = buf->i;
+			index->ofs[i] = buf->i;
 
-			if (numbuf[found] <= 0 || numbuf[found] >= xref_len)
+			if (index->num[i] <= 0 || index->num[i] >= xref_len)
+			{
 				fz_warn(ctx, "object stream object out of range, skipping");
-			else
-				found++;
+				index->num[i] = 0;
+			}
 		}
 
-		for (i = 0; i < found; i++)
-		{
-			pdf_xref_entry *entry;
+		index->size = sizeof(*index) + count * (sizeof(*index->num) + sizeof(*index->ofs)) + fz_buffer_storage(ctx, index->data, NULL);
+		pdf_store_item(ctx, ref, index, index->size);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		pdf_unmark_obj(ctx, objstm);
+		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj(ctx, ref);
+	}
+	fz_catch(ctx)
+	{
+		if (index)
+			pdf_drop_obj_stm_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+	return index;
+}
 
-			fz_seek(ctx, stm, first + ofsbuf[i], SEEK_SET);
+/*
+	Parse a single object out of an object stream, using the
+	index hint from the xref entry if it is correct and
+	searching the offset table otherwise.
+*/
+static pdf_xref_entry *
+pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, int target)
+{
+	pdf_obj_stm_index *index;
+	pdf_xref_entry *entry;
+	fz_stream *stm = NULL;
+	int i;
 
-			obj = pdf_parse_stm_obj(ctx, doc, stm, buf);
+	index = pdf_load_obj_stm_index(ctx, doc, num, buf);
 
-			entry = pdf_get_xref_entry(ctx, doc, numbuf[i]);
+	fz_var(stm);
 
-			pdf_set_obj_parent(ctx, obj, numbuf[i]);
+	fz_try(ctx)
+	{
+		entry = pdf_get_xref_entry(ctx, doc, target);
+		if (entry->type != 'o' || entry->ofs != num)
+			entry = NULL;
+		else if (!entry->obj)
+		{
+			i = entry->gen;
+			if (i >= index->count || index->num[i] != target)
+				for (i = 0; i < index->count; i++)
+					if (index->num[i] == target)
+						break;
 
-			if (entry->type == 'o' && entry->ofs == num)
+			if (i < index->count)
 			{
-				/* If we already have an entry for this object,
-				 * we'd like to drop it and use the new one -
-				 * but this means that anyone currently holding
-				 * a pointer to the old one will be left with a
-				 * stale pointer. Instead, we drop the new one
-				 * and trust that the old one is correct. */
-				if (entry->obj)
-				{
-					if (pdf_objcmp(ctx, entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
-					pdf_drop_obj(ctx, obj);
-				}
-				else
-				{
-					entry->obj = obj;
-					fz_drop_buffer(ctx, entry->stm_buf);
-					entry->stm_buf = NULL;
-				}
-				if (numbuf[i] == target)
-					ret_entry = entry;
-			}
-			else
-			{
-				pdf_drop_obj(ctx, obj);
+				stm = fz_open_buffer(ctx, index->data);
+				fz_seek(ctx, stm, index->first + index->ofs[i], SEEK_SET);
+				entry->obj = pdf_parse_stm_obj(ctx, doc, stm, buf);
+				pdf_set_obj_parent(ctx, entry->obj, target);
+				fz_drop_buffer(ctx, entry->stm_buf);
+				entry->stm_buf = NULL;
 			}
 		}
 	}
 	fz_always(ctx)
 	{
 		fz_drop_stream(ctx, stm);
-		fz_free(ctx, ofsbuf);
-		fz_free(ctx, numbuf);
-		pdf_unmark_obj(ctx, objstm);
-		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj_stm_index(ctx, index);
 	}
 	fz_catch(ctx)
 	{
 		fz_rethrow(ctx);
 	}
-	return ret_entry;
+	return entry;
 }
 
 /*
@@ -2018,8 +2192,13 @@ pdf_cache_object(fz_context *ctx, pdf_document *doc, int num)
 
 	fz_var(try_repair);
 
+	if (num >= pdf_xref_len(ctx, doc) && doc->deferred_xref_ofs)
+		pdf_load_deferred_xref(ctx, doc);
+
 	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "object out of range (%d 0 R); xref size %d", num, pdf_xref_len(ctx, doc));
+	if (num >= doc->evicted_from && num < doc->evicted_to)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "object (%d 0 R) has already been written out", num);
 
 object_updated:
 	try_repair = 0;
@@ -2094,6 +2273,11 @@ object_updated:
 				fz_throw(ctx, FZ_ERROR_GENERIC, "object (%d 0 R) was not found in its object stream", num);
 		}
 	}
+	else if (doc->deferred_xref_ofs)
+	{
+		pdf_load_deferred_xref(ctx, doc);
+		goto object_updated;
+	}
 	else if (doc->hint_obj_offsets && read_hinted_object(ctx, doc, num))
 	{
 		goto object_updated;
@@ -2134,6 +2318,9 @@ pdf_resolve_indirect(fz_context *ctx, pdf_obj *ref)
 			fz_warn(ctx, "invalid indirect reference (%d 0 R)", num);
 			return NULL;
 		}
+		/* Objects evicted by a streaming save can not be brought back. */
+		if (num >= doc->evicted_from && num < doc->evicted_to)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "object (%d 0 R) has already been written out", num);
 
 		fz_try(ctx)
 			entry = pdf_cache_object(ctx, doc, num);
@@ -2213,6 +2400,7 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 	}
 
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
+	doc->edit_count++;
 
 	fz_drop_buffer(ctx, x->stm_buf);
 	pdf_drop_obj(ctx, x->obj);
@@ -2247,6 +2435,7 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 	}
 
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
+	doc->edit_count++;
 
 	pdf_drop_obj(ctx, x->obj);
 
@@ -2383,7 +2572,7 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	pdf_document *doc = pdf_new_document(ctx, file);
 	fz_try(ctx)
 	{
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, 0);
 	}
 	fz_catch(ctx)
 	{
@@ -2424,7 +2613,48 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	{
 		file = fz_open_file(ctx, filename);
 		doc = pdf_new_document(ctx, file);
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, file);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_document(ctx, &doc->super);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+/*
+	Open a PDF document, reading as little as possible before
+	the first page can be shown.
+
+	For a linearized file that has not been updated since it was
+	linearized, only the first page cross reference section is
+	read. The rest of the table is read by pdf_load_deferred_xref,
+	which is called automatically when an object outside the first
+	page section is needed. Other files are opened as by
+	pdf_open_document.
+
+	Code that walks the cross reference table directly should call
+	pdf_load_deferred_xref first.
+*/
+pdf_document *
+pdf_open_document_lazily(fz_context *ctx, const char *filename)
+{
+	fz_stream *file = NULL;
+	pdf_document *doc = NULL;
+
+	fz_var(file);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		file = fz_open_file(ctx, filename);
+		doc = pdf_new_document(ctx, file);
+		pdf_init_document(ctx, doc, 1);
 	}
 	fz_always(ctx)
 	{
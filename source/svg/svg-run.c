@@ -1019,10 +1019,6 @@ svg_parse_common(fz_context *ctx, svg_document *doc, fz_xml *node, svg_state *st
 		else
 			stroke->linewidth = svg_parse_length(stroke_width_att, state->viewbox_size, state->fontsize);
 	}
-	else
-	{
-		stroke->linewidth = 1;
-	}
 
 	if (stroke_linecap_att)
 	{
@@ -1033,10 +1029,6 @@ svg_parse_common(fz_context *ctx, svg_document *doc, fz_xml *node, svg_state *st
 		if (!strcmp(stroke_linecap_att, "square"))
 			stroke->start_cap = FZ_LINECAP_SQUARE;
 	}
-	else
-	{
-		stroke->start_cap = FZ_LINECAP_BUTT;
-	}
 
 	stroke->dash_cap = stroke->start_cap;
 	stroke->end_cap = stroke->start_cap;
@@ -1050,10 +1042,6 @@ svg_parse_common(fz_context *ctx, svg_document *doc, fz_xml *node, svg_state *st
 		if (!strcmp(stroke_linejoin_att, "bevel"))
 			stroke->linejoin = FZ_LINEJOIN_BEVEL;
 	}
-	else
-	{
-		stroke->linejoin = FZ_LINEJOIN_MITER;
-	}
 
 	if (stroke_miterlimit_att)
 	{
@@ -1062,10 +1050,6 @@ svg_parse_common(fz_context *ctx, svg_document *doc, fz_xml *node, svg_state *st
 		else
 			stroke->miterlimit = svg_parse_length(stroke_miterlimit_att, state->viewbox_size, state->fontsize);
 	}
-	else
-	{
-		stroke->miterlimit = 4.0f;
-	}
 }
 
 static void
@@ -1365,6 +1349,7 @@ svg_run_document(fz_context *ctx, svg_document *doc, fz_xml *root, fz_device *de
 	/* Initial graphics state */
 	state.transform = ctm;
 	state.stroke = fz_default_stroke_state;
+	state.stroke.miterlimit = 4;
 	state.use_depth = 0;
 
 	state.viewport_w = DEF_WIDTH;
@@ -10,6 +10,7 @@
 
 #ifndef DISABLE_MUTHREADS
 #include "mupdf/helpers/mu-threads.h"
+#include "mupdf/helpers/mu-jobs.h"
 #endif
 
 #include <string.h>
@@ -269,6 +270,9 @@ static char *filename;
 static int files = 0;
 static int num_workers = 0;
 static worker_t *workers;
+#ifndef DISABLE_MUTHREADS
+static mu_job_pool *job_pool = NULL;
+#endif
 static fz_band_writer *bander = NULL;
 
 static const char *layer_config = NULL;
@@ -290,6 +294,52 @@ static struct {
 	fz_separations *seps;
 } bgprint;
 
+#ifndef DISABLE_MUTHREADS
+/* Stop interpreting further ahead once this much display list memory
+ * is waiting to be rendered. */
+#define MAX_QUEUED_LIST_SIZE (128 << 20)
+
+typedef struct interp_worker_t {
+	fz_context *ctx;
+	mu_thread thread;
+	mu_semaphore start;
+	mu_semaphore stop;
+	mu_semaphore wake;
+	int waiting;
+} interp_worker_t;
+
+typedef struct interp_slot_t {
+	mu_semaphore ready;
+	int pagenum;
+	int interptime;
+	fz_display_list *list;
+	fz_separations *seps;
+	const char *features;
+	size_t size;
+	int failed;
+	char message[256];
+} interp_slot_t;
+
+/* Interpretation threads (-j) each produce display lists for the
+ * pages of a batch into a ring of slots, which the main thread
+ * outputs in page order. */
+static struct {
+	int threads;
+	const char *password;
+	interp_worker_t *workers;
+	interp_slot_t *slots;
+	int nslots;
+	mu_mutex mutex;
+	size_t queued;
+	int *pages;
+	int count;
+	int next;
+	int consumed;
+	int abort;
+	int quit;
+} interp;
+#endif
+
 static struct {
 	int count, total;
 	int min, max;
@@ -326,7 +376,7 @@ static void usage(void)
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
 		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ps, psd and png output only)\n"
 #ifndef DISABLE_MUTHREADS
-		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t-T -\tnumber of threads to use for rendering\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -350,8 +400,10 @@ static void usage(void)
 		"\t-L\tlow memory mode (avoid caching, clear objects after each page)\n"
 #ifndef DISABLE_MUTHREADS
 		"\t-P\tparallel interpretation/rendering\n"
+		"\t-j -\tnumber of threads to use for interpretation (implies -P)\n"
 #else
 		"\t-P\tparallel interpretation/rendering (disabled in this non-threading build)\n"
+		"\t-j -\tnumber of threads to use for interpretation (disabled in this non-threading build)\n"
 #endif
 		"\t-N\tdisable ICC workflow (\"N\"o color management)\n"
 		"\t-O -\tControl spot/overprint rendering\n"
@@ -673,7 +725,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				out = fz_new_output_with_path(ctx, buf, 0);
 			}
 
-			dev = fz_new_svg_device(ctx, out, tbounds.x1-tbounds.x0, tbounds.y1-tbounds.y0, FZ_SVG_TEXT_AS_PATH, 1);
+			dev = fz_new_svg_device(ctx, out, tbounds.x1-tbounds.x0, tbounds.y1-tbounds.y0, FZ_SVG_TEXT_AS_PATH, FZ_SVG_REUSE_IMAGES);
 			if (lowmemory)
 				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
 			if (list)
@@ -786,6 +838,13 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				tbounds.y1 = tbounds.y0 + band_height + 2;
 				DEBUG_THREADS(("Using %d Bands\n", bands));
 			}
+			else if (list)
+			{
+				/* Without banding the rendering itself happens on one
+				 * thread, but the images can still be decoded on all
+				 * of them. */
+				fz_predecode_display_list_images(ctx, list, ctm, ibounds);
+			}
 
 			if (num_workers > 0)
 			{
@@ -1006,110 +1065,109 @@ static void bgprint_flush(void)
 	bgprint.started = 0;
 }
 
-static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
+static fz_separations *pageseps(fz_context *ctx, fz_page *page)
 {
-	fz_page *page;
-	fz_display_list *list = NULL;
-	fz_device *dev = NULL;
-	int start;
-	fz_cookie cookie = { 0 };
-	fz_separations *seps = NULL;
-	const char *features = "";
+	fz_separations *seps;
 
-	fz_var(list);
-	fz_var(dev);
-	fz_var(seps);
+	if (spots == SPOTS_NONE)
+		return NULL;
 
-	start = (showtime ? gettime() : 0);
+	seps = fz_page_separations(ctx, page);
+	if (seps)
+	{
+		int i, n = fz_count_separations(ctx, seps);
+		if (spots == SPOTS_FULL)
+			for (i = 0; i < n; i++)
+				fz_set_separation_behavior(ctx, seps, i, FZ_SEPARATION_SPOT);
+		else
+			for (i = 0; i < n; i++)
+				fz_set_separation_behavior(ctx, seps, i, FZ_SEPARATION_COMPOSITE);
+	}
+	else if (fz_page_uses_overprint(ctx, page))
+	{
+		/* This page uses overprint, so we need an empty
+		 * sep object to force the overprint simulation on. */
+		seps = fz_new_separations(ctx, 0);
+	}
+	else if (oi && fz_colorspace_n(ctx, oi) != fz_colorspace_n(ctx, colorspace))
+	{
+		/* We have an output intent, and it's incompatible
+		 * with the colorspace our device needs. Force the
+		 * overprint simulation on, because this ensures that
+		 * we 'simulate' the output intent too. */
+		seps = fz_new_separations(ctx, 0);
+	}
+	return seps;
+}
 
-	page = fz_load_page(ctx, doc, pagenum - 1);
+static fz_display_list *listpage(fz_context *ctx, fz_page *page, fz_cookie *cookie)
+{
+	fz_display_list *list;
+	fz_device *dev = NULL;
 
-	if (spots != SPOTS_NONE)
+	fz_var(dev);
+
+	list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+	fz_try(ctx)
 	{
-		fz_try(ctx)
-		{
-			seps = fz_page_separations(ctx, page);
-			if (seps)
-			{
-				int i, n = fz_count_separations(ctx, seps);
-				if (spots == SPOTS_FULL)
-					for (i = 0; i < n; i++)
-						fz_set_separation_behavior(ctx, seps, i, FZ_SEPARATION_SPOT);
-				else
-					for (i = 0; i < n; i++)
-						fz_set_separation_behavior(ctx, seps, i, FZ_SEPARATION_COMPOSITE);
-			}
-			else if (fz_page_uses_overprint(ctx, page))
-			{
-				/* This page uses overprint, so we need an empty
-				 * sep object to force the overprint simulation on. */
-				seps = fz_new_separations(ctx, 0);
-			}
-			else if (oi && fz_colorspace_n(ctx, oi) != fz_colorspace_n(ctx, colorspace))
-			{
-				/* We have an output intent, and it's incompatible
-				 * with the colorspace our device needs. Force the
-				 * overprint simulation on, because this ensures that
-				 * we 'simulate' the output intent too. */
-				seps = fz_new_separations(ctx, 0);
-			}
-		}
-		fz_catch(ctx)
-		{
-			fz_drop_page(ctx, page);
-			fz_rethrow(ctx);
-		}
+		dev = fz_new_list_device(ctx, list);
+		if (lowmemory)
+			fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+		fz_run_page(ctx, page, dev, fz_identity, cookie);
+		fz_close_device(ctx, dev);
 	}
-
-	if (uselist)
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
 	{
-		fz_try(ctx)
-		{
-			list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
-			dev = fz_new_list_device(ctx, list);
-			if (lowmemory)
-				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
-			fz_run_page(ctx, page, dev, fz_identity, &cookie);
-			fz_close_device(ctx, dev);
-		}
-		fz_always(ctx)
-		{
-			fz_drop_device(ctx, dev);
-			dev = NULL;
-		}
-		fz_catch(ctx)
-		{
-			fz_drop_display_list(ctx, list);
-			fz_drop_separations(ctx, seps);
-			fz_drop_page(ctx, page);
-			fz_rethrow(ctx);
-		}
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
 
-		if (bgprint.active && showtime)
-		{
-			int end = gettime();
-			start = end - start;
-		}
+static const char *pagefeatures(fz_context *ctx, fz_page *page, fz_display_list *list, fz_cookie *cookie)
+{
+	fz_device *dev;
+	int iscolor;
+
+	dev = fz_new_test_device(ctx, &iscolor, 0.02f, 0, NULL);
+	if (lowmemory)
+		fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+	fz_try(ctx)
+	{
+		if (list)
+			fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+		else
+			fz_run_page(ctx, page, dev, fz_identity, cookie);
+		fz_close_device(ctx, dev);
 	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return iscolor ? " color" : " grayscale";
+}
 
-	if (showfeatures)
+/* Hand an interpreted page over to the output: the page, list and seps
+ * are consumed. With bgprint active, start is the interpretation time. */
+static void outputpage(fz_context *ctx, fz_page *page, fz_display_list *list, fz_separations *seps, int pagenum, int start, const char *features, fz_cookie *cookie)
+{
+	if (output_file_per_page)
 	{
-		int iscolor;
-		dev = fz_new_test_device(ctx, &iscolor, 0.02f, 0, NULL);
-		if (lowmemory)
-			fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+		char text_buffer[512];
+
+		bgprint_flush();
 		fz_try(ctx)
 		{
-			if (list)
-				fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
-			else
-				fz_run_page(ctx, page, dev, fz_identity, &cookie);
-			fz_close_device(ctx, dev);
-		}
-		fz_always(ctx)
-		{
-			fz_drop_device(ctx, dev);
-			dev = NULL;
+			if (out)
+			{
+				fz_close_output(ctx, out);
+				fz_drop_output(ctx, out);
+				out = NULL;
+			}
+			fz_format_output_path(ctx, text_buffer, sizeof text_buffer, output, pagenum);
+			out = fz_new_output_with_path(ctx, text_buffer, 0);
 		}
 		fz_catch(ctx)
 		{
@@ -1118,21 +1176,6 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			fz_drop_page(ctx, page);
 			fz_rethrow(ctx);
 		}
-		features = iscolor ? " color" : " grayscale";
-	}
-
-	if (output_file_per_page)
-	{
-		char text_buffer[512];
-
-		bgprint_flush();
-		if (out)
-		{
-			fz_close_output(ctx, out);
-			fz_drop_output(ctx, out);
-		}
-		fz_format_output_path(ctx, text_buffer, sizeof text_buffer, output, pagenum);
-		out = fz_new_output_with_path(ctx, text_buffer, 0);
 	}
 
 	if (bgprint.active)
@@ -1162,14 +1205,351 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 	{
 		if (!quiet || showfeatures || showtime || showmd5)
 			fprintf(stderr, "page %s %d%s", filename, pagenum, features);
-		dodrawpage(ctx, page, list, pagenum, &cookie, start, 0, filename, 0, seps);
+		dodrawpage(ctx, page, list, pagenum, cookie, start, 0, filename, 0, seps);
 	}
 }
 
+static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
+{
+	fz_page *page;
+	fz_display_list *list = NULL;
+	int start;
+	fz_cookie cookie = { 0 };
+	fz_separations *seps = NULL;
+	const char *features = "";
+
+	fz_var(list);
+	fz_var(seps);
+	fz_var(start);
+	fz_var(features);
+
+	start = (showtime ? gettime() : 0);
+
+	page = fz_load_page(ctx, doc, pagenum - 1);
+
+	fz_try(ctx)
+	{
+		seps = pageseps(ctx, page);
+
+		if (uselist)
+		{
+			list = listpage(ctx, page, &cookie);
+
+			if (bgprint.active && showtime)
+			{
+				int end = gettime();
+				start = end - start;
+			}
+		}
+
+		if (showfeatures)
+			features = pagefeatures(ctx, page, list, &cookie);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_drop_separations(ctx, seps);
+		fz_drop_page(ctx, page);
+		fz_rethrow(ctx);
+	}
+
+	outputpage(ctx, page, list, seps, pagenum, start, features, &cookie);
+}
+
+#ifndef DISABLE_MUTHREADS
+static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc, int verbose);
+
+/* Open another instance of the current document for an interpretation
+ * thread; documents cannot be shared between threads. */
+static fz_document *interp_open_document(fz_context *ctx)
+{
+	fz_document *doc = fz_open_document(ctx, filename);
+
+	fz_try(ctx)
+	{
+		if (fz_needs_password(ctx, doc))
+		{
+			if (!fz_authenticate_password(ctx, doc, interp.password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+		}
+
+		fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+
+		if (layer_config)
+			apply_layer_config(ctx, doc, layer_config, 0);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+/* Claim the next page to interpret, waiting while the queue is full
+ * (either in pages or in display list memory). Returns -1 when there
+ * is nothing left to do. */
+static int interp_claim(interp_worker_t *me)
+{
+	int k;
+
+	mu_lock_mutex(&interp.mutex);
+	while (!interp.abort && interp.next < interp.count &&
+		(interp.next - interp.consumed >= interp.nslots || interp.queued > MAX_QUEUED_LIST_SIZE))
+	{
+		me->waiting = 1;
+		mu_unlock_mutex(&interp.mutex);
+		mu_wait_semaphore(&me->wake);
+		mu_lock_mutex(&interp.mutex);
+	}
+	if (interp.abort || interp.next >= interp.count)
+		k = -1;
+	else
+		k = interp.next++;
+	mu_unlock_mutex(&interp.mutex);
+
+	return k;
+}
+
+static void interp_page(fz_context *ctx, fz_document *doc, int k)
+{
+	interp_slot_t *slot = &interp.slots[k % interp.nslots];
+	fz_cookie cookie = { 0 };
+	fz_page *page = NULL;
+	int start;
+
+	fz_var(page);
+
+	start = (showtime ? gettime() : 0);
+
+	slot->pagenum = interp.pages[k];
+	slot->list = NULL;
+	slot->seps = NULL;
+	slot->features = "";
+	slot->failed = 0;
+
+	fz_try(ctx)
+	{
+		if (!doc)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open document: %s", filename);
+		page = fz_load_page(ctx, doc, slot->pagenum - 1);
+		slot->seps = pageseps(ctx, page);
+		slot->list = listpage(ctx, page, &cookie);
+		if (showfeatures)
+			slot->features = pagefeatures(ctx, NULL, slot->list, &cookie);
+	}
+	fz_always(ctx)
+		fz_drop_page(ctx, page);
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, slot->list);
+		fz_drop_separations(ctx, slot->seps);
+		slot->list = NULL;
+		slot->seps = NULL;
+		slot->failed = 1;
+		fz_strlcpy(slot->message, fz_caught_message(ctx), sizeof slot->message);
+	}
+
+	slot->interptime = (showtime ? gettime() - start : 0);
+	slot->size = fz_display_list_size(ctx, slot->list);
+
+	mu_lock_mutex(&interp.mutex);
+	interp.queued += slot->size;
+	mu_unlock_mutex(&interp.mutex);
+
+	DEBUG_THREADS(("Interp page %d ready\n", slot->pagenum));
+	mu_trigger_semaphore(&slot->ready);
+}
+
+static void interp_worker(void *arg)
+{
+	interp_worker_t *me = (interp_worker_t *)arg;
+	fz_context *ctx = me->ctx;
+	fz_document *doc = NULL;
+	int k;
+
+	fz_var(doc);
+
+	for (;;)
+	{
+		DEBUG_THREADS(("Interp worker waiting\n"));
+		mu_wait_semaphore(&me->start);
+		if (interp.quit)
+			break;
+
+		/* Pages claimed with a missing document are reported as
+		 * errors, so that the consumer never waits forever. */
+		fz_try(ctx)
+			doc = interp_open_document(ctx);
+		fz_catch(ctx)
+			doc = NULL;
+
+		while ((k = interp_claim(me)) >= 0)
+			interp_page(ctx, doc, k);
+
+		fz_drop_document(ctx, doc);
+		doc = NULL;
+		mu_trigger_semaphore(&me->stop);
+	}
+	mu_trigger_semaphore(&me->stop);
+}
+
+/* Wake the threads waiting for queue space; called with the
+ * mutex held. Each thread has its own semaphore, as a semaphore
+ * may not have more than one trigger outstanding. */
+static void interp_wake(void)
+{
+	int i;
+
+	for (i = 0; i < interp.threads; i++)
+	{
+		if (interp.workers[i].waiting)
+		{
+			interp.workers[i].waiting = 0;
+			mu_trigger_semaphore(&interp.workers[i].wake);
+		}
+	}
+}
+
+/* Output the k'th page of the current batch once it has been
+ * interpreted, freeing its queue slot for the next page. */
+static void drawqueued(fz_context *ctx, int k)
+{
+	interp_slot_t *slot = &interp.slots[k % interp.nslots];
+	fz_display_list *list;
+	fz_separations *seps;
+	fz_cookie cookie = { 0 };
+	const char *features;
+	char message[sizeof slot->message];
+	int pagenum, interptime, failed;
+
+	mu_wait_semaphore(&slot->ready);
+
+	list = slot->list;
+	seps = slot->seps;
+	features = slot->features;
+	pagenum = slot->pagenum;
+	interptime = slot->interptime;
+	failed = slot->failed;
+	if (failed)
+		fz_strlcpy(message, slot->message, sizeof message);
+
+	mu_lock_mutex(&interp.mutex);
+	interp.queued -= slot->size;
+	interp.consumed++;
+	interp_wake();
+	mu_unlock_mutex(&interp.mutex);
+
+	fz_try(ctx)
+	{
+		if (failed)
+		{
+			bgprint_flush();
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", message);
+		}
+		outputpage(ctx, NULL, list, seps, pagenum, interptime, features, &cookie);
+	}
+	fz_catch(ctx)
+	{
+		if (ignore_errors)
+			fz_warn(ctx, "ignoring error on page %d in '%s'", pagenum, filename);
+		else
+			fz_rethrow(ctx);
+	}
+}
+
+/* Stop the interpretation threads after the current batch, and drop
+ * anything they interpreted that has not been output. */
+static void interp_finish(fz_context *ctx)
+{
+	int i, k;
+
+	mu_lock_mutex(&interp.mutex);
+	interp.abort = 1;
+	interp_wake();
+	mu_unlock_mutex(&interp.mutex);
+
+	for (i = 0; i < interp.threads; i++)
+		mu_wait_semaphore(&interp.workers[i].stop);
+
+	for (k = interp.consumed; k < interp.next; k++)
+	{
+		interp_slot_t *slot = &interp.slots[k % interp.nslots];
+		mu_wait_semaphore(&slot->ready);
+		fz_drop_display_list(ctx, slot->list);
+		fz_drop_separations(ctx, slot->seps);
+		slot->list = NULL;
+		slot->seps = NULL;
+	}
+}
+
+/* Interpret the pages in range on the interpretation threads, several
+ * pages ahead, and output them here in order. */
+static void interprange(fz_context *ctx, fz_document *doc, const char *range)
+{
+	int page, spage, epage, pagecount;
+	const char *r;
+	int *pages;
+	int i, k, count = 0;
+
+	pagecount = fz_count_pages(ctx, doc);
+
+	r = range;
+	while ((r = fz_parse_page_range(ctx, r, &spage, &epage, pagecount)))
+		count += (spage < epage ? epage - spage : spage - epage) + 1;
+	if (count == 0)
+		return;
+
+	pages = fz_malloc_array(ctx, count, int);
+	k = 0;
+	r = range;
+	while ((r = fz_parse_page_range(ctx, r, &spage, &epage, pagecount)))
+	{
+		if (spage < epage)
+			for (page = spage; page <= epage; page++)
+				pages[k++] = page;
+		else
+			for (page = spage; page >= epage; page--)
+				pages[k++] = page;
+	}
+
+	interp.pages = pages;
+	interp.count = count;
+	interp.next = 0;
+	interp.consumed = 0;
+	interp.queued = 0;
+	interp.abort = 0;
+	for (i = 0; i < interp.threads; i++)
+		mu_trigger_semaphore(&interp.workers[i].start);
+
+	fz_try(ctx)
+	{
+		for (k = 0; k < count; k++)
+			drawqueued(ctx, k);
+	}
+	fz_always(ctx)
+	{
+		interp_finish(ctx);
+		fz_free(ctx, pages);
+		interp.pages = NULL;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+#endif
+
 static void drawrange(fz_context *ctx, fz_document *doc, const char *range)
 {
 	int page, spage, epage, pagecount;
 
+#ifndef DISABLE_MUTHREADS
+	if (interp.threads > 0)
+	{
+		interprange(ctx, doc, range);
+		return;
+	}
+#endif
+
 	pagecount = fz_count_pages(ctx, doc);
 
 	while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
@@ -1295,18 +1675,21 @@ trace_realloc(void *arg, void *p_, size_t size)
 static void worker_thread(void *arg)
 {
 	worker_t *me = (worker_t *)arg;
+	int band;
 
 	do
 	{
 		DEBUG_THREADS(("Worker %d waiting\n", me->num));
 		mu_wait_semaphore(&me->start);
-		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, me->band));
-		if (me->band >= 0)
-			drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, me->band * band_height, me->pix, &me->bit);
-		DEBUG_THREADS(("Worker %d completed band %d\n", me->num, me->band));
+		/* me->band may be changed as soon as we trigger stop. */
+		band = me->band;
+		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, band));
+		if (band >= 0)
+			drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
+		DEBUG_THREADS(("Worker %d completed band %d\n", me->num, band));
 		mu_trigger_semaphore(&me->stop);
 	}
-	while (me->band >= 0);
+	while (band >= 0);
 }
 
 static void bgprint_worker(void *arg)
@@ -1342,7 +1725,7 @@ static inline int iswhite(int ch)
 		ch == '\014' || ch == '\015' || ch == '\040';
 }
 
-static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc)
+static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc, int verbose)
 {
 #if FZ_ENABLE_PDF
 	pdf_document *pdoc = pdf_specifics(ctx, doc);
@@ -1352,7 +1735,8 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 
 	if (!pdoc)
 	{
-		fz_warn(ctx, "Only PDF files have layers");
+		if (verbose)
+			fz_warn(ctx, "Only PDF files have layers");
 		return;
 	}
 
@@ -1361,7 +1745,12 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 
 	if (*lc == 0 || *lc == 'l')
 	{
-		int num_configs = pdf_count_layer_configs(ctx, pdoc);
+		int num_configs;
+
+		if (!verbose)
+			return;
+
+		num_configs = pdf_count_layer_configs(ctx, pdoc);
 
 		fprintf(stderr, "Layer configs:\n");
 		for (config = 0; config < num_configs; config++)
@@ -1380,7 +1769,8 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 	/* Read the config number */
 	if (*lc < '0' || *lc > '9')
 	{
-		fprintf(stderr, "cannot find number expected for -y\n");
+		if (verbose)
+			fprintf(stderr, "cannot find number expected for -y\n");
 		return;
 	}
 	config = fz_atoi(lc);
@@ -1402,13 +1792,17 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 			lc++;
 		if (*lc < '0' || *lc > '9')
 		{
-			fprintf(stderr, "Expected a number for UI item to toggle\n");
+			if (verbose)
+				fprintf(stderr, "Expected a number for UI item to toggle\n");
 			return;
 		}
 		item = fz_atoi(lc);
 		pdf_toggle_layer_config_ui(ctx, pdoc, item);
 	}
 
+	if (!verbose)
+		return;
+
 	/* Now list the final state of the config */
 	fprintf(stderr, "Layer Config %d:\n", config);
 	pdf_layer_config_info(ctx, pdoc, config, &info);
@@ -1458,7 +1852,7 @@ int mudraw_main(int argc, char **argv)
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:U:XLvPl:y:NO:")) != -1)
+	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:U:XLvPj:l:y:NO:")) != -1)
 	{
 		switch (c)
 		{
@@ -1533,6 +1927,16 @@ int mudraw_main(int argc, char **argv)
 #else
 			fprintf(stderr, "Threads not enabled in this build\n");
 			break;
+#endif
+		case 'j':
+#ifndef DISABLE_MUTHREADS
+			interp.threads = atoi(fz_optarg);
+			if (interp.threads > 0)
+				bgprint.active = 1;
+			break;
+#else
+			fprintf(stderr, "Threads not enabled in this build\n");
+			break;
 #endif
 		case 'y': layer_config = fz_optarg; break;
 
@@ -1550,11 +1954,6 @@ int mudraw_main(int argc, char **argv)
 			fprintf(stderr, "cannot use multiple threads without using display list\n");
 			exit(1);
 		}
-
-		if (band_height == 0)
-		{
-			fprintf(stderr, "Using multiple threads without banding is pointless\n");
-		}
 	}
 
 	if (bgprint.active)
@@ -1632,6 +2031,38 @@ int mudraw_main(int argc, char **argv)
 				fprintf(stderr, "worker startup failed\n");
 				exit(1);
 			}
+
+			/* Let the library split work such as image decoding
+			 * over the same number of threads. */
+			job_pool = mu_new_job_pool(ctx, num_workers);
+		}
+
+		if (interp.threads > 0)
+		{
+			int i;
+			int fail = 0;
+			interp.password = password;
+			interp.nslots = interp.threads * 2;
+			interp.workers = fz_calloc(ctx, interp.threads, sizeof(*interp.workers));
+			interp.slots = fz_calloc(ctx, interp.nslots, sizeof(*interp.slots));
+			fail |= mu_create_mutex(&interp.mutex);
+			for (i = 0; i < interp.nslots; i++)
+				fail |= mu_create_semaphore(&interp.slots[i].ready);
+			for (i = 0; i < interp.threads; i++)
+			{
+				interp.workers[i].ctx = fz_clone_context(ctx);
+				/* Errors are reported when the page is output. */
+				fz_set_error_callback(interp.workers[i].ctx, NULL, NULL);
+				fail |= mu_create_semaphore(&interp.workers[i].start);
+				fail |= mu_create_semaphore(&interp.workers[i].stop);
+				fail |= mu_create_semaphore(&interp.workers[i].wake);
+				fail |= mu_create_thread(&interp.workers[i].thread, interp_worker, &interp.workers[i]);
+			}
+			if (fail)
+			{
+				fprintf(stderr, "interpretation thread startup failed\n");
+				exit(1);
+			}
 		}
 #endif /* DISABLE_MUTHREADS */
 
@@ -1908,7 +2339,7 @@ int mudraw_main(int argc, char **argv)
 					fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
 
 					if (layer_config)
-						apply_layer_config(ctx, doc, layer_config);
+						apply_layer_config(ctx, doc, layer_config, 1);
 
 					if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
 						drawrange(ctx, doc, "1-N");
@@ -1991,6 +2422,8 @@ int mudraw_main(int argc, char **argv)
 		}
 
 #ifndef DISABLE_MUTHREADS
+		mu_drop_job_pool(ctx, job_pool);
+
 		if (num_workers > 0)
 		{
 			int i;
@@ -2007,6 +2440,27 @@ int mudraw_main(int argc, char **argv)
 			fz_free(ctx, workers);
 		}
 
+		if (interp.threads > 0)
+		{
+			int i;
+			interp.quit = 1;
+			for (i = 0; i < interp.threads; i++)
+			{
+				mu_trigger_semaphore(&interp.workers[i].start);
+				mu_wait_semaphore(&interp.workers[i].stop);
+				mu_destroy_semaphore(&interp.workers[i].start);
+				mu_destroy_semaphore(&interp.workers[i].stop);
+				mu_destroy_semaphore(&interp.workers[i].wake);
+				mu_destroy_thread(&interp.workers[i].thread);
+				fz_drop_context(interp.workers[i].ctx);
+			}
+			for (i = 0; i < interp.nslots; i++)
+				mu_destroy_semaphore(&interp.slots[i].ready);
+			mu_destroy_mutex(&interp.mutex);
+			fz_free(ctx, interp.workers);
+			fz_free(ctx, interp.slots);
+		}
+
 		if (bgprint.active)
 		{
 			bgprint.pagenum = -1;
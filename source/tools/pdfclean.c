@@ -11,6 +11,8 @@
 
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "mupdf/helpers/mu-threads.h"
+#include "mupdf/helpers/mu-jobs.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -23,8 +25,7 @@ static void usage(void)
 		"\t-p -\tpassword\n"
 		"\t-g\tgarbage collect unused objects\n"
 		"\t-gg\tin addition to -g compact xref table\n"
-		"\t-ggg\tin addition to -gg merge duplicate objects\n"
-		"\t-gggg\tin addition to -ggg check streams for duplication\n"
+		"\t-ggg\tin addition to -gg merge duplicate objects and streams\n"
 		"\t-l\tlinearize PDF\n"
 		"\t-D\tsave file without encryption\n"
 		"\t-E -\tsave file with new encryption (rc4-40, rc4-128, aes-128, or aes-256)\n"
@@ -34,6 +35,11 @@ static void usage(void)
 		"\t-a\tascii hex encode binary streams\n"
 		"\t-d\tdecompress streams\n"
 		"\t-z\tdeflate uncompressed streams\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-T -\tnumber of threads to use for deflating streams\n"
+#else
+		"\t-T -\tnumber of threads to use for deflating streams (disabled in this non-threading build)\n"
+#endif
 		"\t-f\tcompress font streams\n"
 		"\t-i\tcompress image streams\n"
 		"\t-c\tclean content streams\n"
@@ -45,6 +51,56 @@ static void usage(void)
 	exit(1);
 }
 
+/*
+	Deflating streams can be spread over several threads, in which
+	case we need locks for the contexts cloned for the worker threads.
+*/
+#ifndef DISABLE_MUTHREADS
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void pdfclean_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void pdfclean_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context pdfclean_locks =
+{
+	NULL, pdfclean_lock, pdfclean_unlock
+};
+
+static void fin_pdfclean_locks(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+}
+
+static fz_locks_context *init_pdfclean_locks(void)
+{
+	int i;
+	int failed = 0;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		failed |= mu_create_mutex(&mutexes[i]);
+
+	if (failed)
+	{
+		fin_pdfclean_locks();
+		return NULL;
+	}
+
+	return &pdfclean_locks;
+}
+
+#endif
+
 static int encrypt_method_from_string(const char *name)
 {
 	if (!strcmp(name, "rc4-40")) return PDF_ENCRYPT_RC4_40;
@@ -62,9 +118,12 @@ int pdfclean_main(int argc, char **argv)
 	int c;
 	pdf_write_options opts = pdf_default_write_options;
 	int errors = 0;
+	int num_threads = 0;
+	fz_locks_context *locks = NULL;
+	mu_job_pool *pool = NULL;
 	fz_context *ctx;
 
-	while ((c = fz_getopt(argc, argv, "adfgilp:sczDAE:O:U:P:")) != -1)
+	while ((c = fz_getopt(argc, argv, "adfgilp:sczDAE:O:U:P:T:")) != -1)
 	{
 		switch (c)
 		{
@@ -87,6 +146,12 @@ int pdfclean_main(int argc, char **argv)
 		case 'O': fz_strlcpy(opts.opwd_utf8, fz_optarg, sizeof opts.opwd_utf8); break;
 		case 'U': fz_strlcpy(opts.upwd_utf8, fz_optarg, sizeof opts.upwd_utf8); break;
 
+#ifndef DISABLE_MUTHREADS
+		case 'T': num_threads = fz_atoi(fz_optarg); break;
+#else
+		case 'T': fprintf(stderr, "threads are disabled in this build\n"); break;
+#endif
+
 		default: usage(); break;
 		}
 	}
@@ -105,7 +170,19 @@ int pdfclean_main(int argc, char **argv)
 		outfile = argv[fz_optind++];
 	}
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+#ifndef DISABLE_MUTHREADS
+	if (num_threads > 1)
+	{
+		locks = init_pdfclean_locks();
+		if (locks == NULL)
+		{
+			fprintf(stderr, "mutex initialisation failed\n");
+			exit(1);
+		}
+	}
+#endif
+
+	ctx = fz_new_context(NULL, locks, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
@@ -114,13 +191,25 @@ int pdfclean_main(int argc, char **argv)
 
 	fz_try(ctx)
 	{
+		if (num_threads > 1)
+		{
+			pool = mu_new_job_pool(ctx, num_threads);
+			if (!pool)
+				fz_warn(ctx, "cannot start worker threads");
+		}
 		pdf_clean_file(ctx, infile, outfile, password, &opts, &argv[fz_optind], argc - fz_optind);
 	}
 	fz_catch(ctx)
 	{
 		errors++;
 	}
+	mu_drop_job_pool(ctx, pool);
 	fz_drop_context(ctx);
 
+#ifndef DISABLE_MUTHREADS
+	if (locks)
+		fin_pdfclean_locks();
+#endif
+
 	return errors != 0;
 }
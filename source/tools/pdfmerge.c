@@ -26,6 +26,7 @@ static void usage(void)
 static fz_context *ctx = NULL;
 static pdf_document *doc_des = NULL;
 static pdf_document *doc_src = NULL;
+static pdf_streaming_save *save = NULL;
 
 static void page_merge(int page_from, int page_to, pdf_graft_map *graft_map)
 {
@@ -72,7 +73,10 @@ static void page_merge(int page_from, int page_to, pdf_graft_map *graft_map)
 		ref = pdf_add_object(ctx, doc_des, page_dict);
 
 		/* Insert it into the page tree. */
-		pdf_insert_page(ctx, doc_des, page_to - 1, ref);
+		if (save)
+			pdf_add_streaming_page(ctx, save, ref);
+		else
+			pdf_insert_page(ctx, doc_des, page_to - 1, ref);
 	}
 	fz_always(ctx)
 	{
@@ -118,9 +122,12 @@ static void merge_range(const char *range)
 int pdfmerge_main(int argc, char **argv)
 {
 	pdf_write_options opts = pdf_default_write_options;
+	fz_output *out = NULL;
+	char *temp = NULL;
 	char *output = "out.pdf";
 	char *flags = "";
 	char *input;
+	int failed = 0;
 	int c;
 
 	while ((c = fz_getopt(argc, argv, "o:O:")) != -1)
@@ -157,14 +164,39 @@ int pdfmerge_main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* Write pages out as they are merged into a temporary file, which
+	 * replaces the output only once every input has been merged. */
+	if (opts.do_stream)
+	{
+		fz_try(ctx)
+		{
+			temp = fz_asprintf(ctx, "%s.tmp", output);
+			out = fz_new_output_with_path(ctx, temp, 0);
+			save = pdf_new_streaming_save(ctx, doc_des, out, &opts);
+		}
+		fz_catch(ctx)
+		{
+			fprintf(stderr, "error: Cannot create output file: '%s'.\n", output);
+			fz_drop_output(ctx, out);
+			if (out)
+				remove(temp);
+			fz_free(ctx, temp);
+			pdf_drop_document(ctx, doc_des);
+			fz_flush_warnings(ctx);
+			fz_drop_context(ctx);
+			exit(1);
+		}
+	}
+
 	/* Step through the source files */
 	while (fz_optind < argc)
 	{
 		input = argv[fz_optind++];
-		doc_src = pdf_open_document(ctx, input);
+		doc_src = NULL;
 
 		fz_try(ctx)
 		{
+			doc_src = pdf_open_document(ctx, input);
 			if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
 				merge_range("1-N");
 			else
@@ -173,19 +205,45 @@ int pdfmerge_main(int argc, char **argv)
 		fz_always(ctx)
 			pdf_drop_document(ctx, doc_src);
 		fz_catch(ctx)
+		{
 			fprintf(stderr, "error: Cannot merge document '%s'.\n", input);
+			failed = 1;
+			if (save)
+				break;
+		}
 	}
 
-	if (fz_optind == argc)
+	if (!save || !failed)
 	{
 		fz_try(ctx)
-			pdf_save_document(ctx, doc_des, output, &opts);
+		{
+			if (save)
+			{
+				pdf_close_streaming_save(ctx, save);
+				fz_close_output(ctx, out);
+				remove(output);
+				if (rename(temp, output) < 0)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot rename '%s'", temp);
+				fz_free(ctx, temp);
+				temp = NULL;
+			}
+			else
+				pdf_save_document(ctx, doc_des, output, &opts);
+		}
 		fz_catch(ctx)
+		{
 			fprintf(stderr, "error: Cannot save output file: '%s'.\n", output);
+			failed = 1;
+		}
 	}
 
+	pdf_drop_streaming_save(ctx, save);
+	fz_drop_output(ctx, out);
+	if (temp)
+		remove(temp);
+	fz_free(ctx, temp);
 	pdf_drop_document(ctx, doc_des);
 	fz_flush_warnings(ctx);
 	fz_drop_context(ctx);
-	return 0;
+	return failed;
 }
@@ -220,7 +220,7 @@ xps_draw_one_radial_gradient(fz_context *ctx, xps_document *doc, fz_matrix ctm,
 	fz_shade *shade;
 
 	shade = fz_malloc_struct(ctx, fz_shade);
-	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+	FZ_INIT_KEY_STORABLE(shade, 1, fz_drop_shade_imp);
 	shade->colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
 	shade->bbox = fz_infinite_rect;
 	shade->matrix = fz_identity;
@@ -262,7 +262,7 @@ xps_draw_one_linear_gradient(fz_context *ctx, xps_document *doc, fz_matrix ctm,
 	fz_shade *shade;
 
 	shade = fz_malloc_struct(ctx, fz_shade);
-	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+	FZ_INIT_KEY_STORABLE(shade, 1, fz_drop_shade_imp);
 	shade->colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
 	shade->bbox = fz_infinite_rect;
 	shade->matrix = fz_identity;